@@ -82,6 +82,7 @@
 #import <Sparkle/Sparkle.h>
 #import <WebKit/WebKit.h>
 #import "NSDate_BDSKExtensions.h"
+#import "BDSKFiler.h"
 
 #define WEB_URL @"http://bibdesk.sourceforge.net/"
 #define WIKI_URL @"http://sourceforge.net/apps/mediawiki/bibdesk/"
@@ -318,6 +319,9 @@ static void fixLegacyTableColumnIdentifiers()
     [fileManager copyFileFromSharedSupportToApplicationSupport:@"previewtemplate.tex" overwrite:NO];
     [fileManager copyFileFromSharedSupportToApplicationSupport:@"template.txt" overwrite:NO];   
     [fileManager copyFileFromSharedSupportToApplicationSupport:@"Bookmarks.plist" overwrite:NO];   
+    
+    // put back files from an AutoFile that did not finish
+    [BDSKFiler recoverInterruptedMoves];
 
     NSString *scriptsPath = [[fileManager applicationSupportDirectory] stringByAppendingPathComponent:@"Scripts"];
     if ([fileManager fileExistsAtPath:scriptsPath] == NO)
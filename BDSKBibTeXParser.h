@@ -42,6 +42,11 @@
 
 @protocol BDSKOwner;
 
+typedef struct _BDSKNameRange {
+    uint32_t location;
+    uint32_t length;
+} BDSKNameRange;
+
 @interface BDSKBibTeXParser : NSObject {
 }
 
@@ -125,6 +130,25 @@
 */
 + (NSArray *)authorsFromBibtexString:(NSString *)aString withPublication:(BibItem *)pub forField:(NSString *)field;
 
+/*!
+    @method     nameRangesFromBibtexString:
+    @abstract   Finds the names in a BibTeX author string without creating BibAuthor objects
+    @discussion Returns a compact array of BDSKNameRange structs into aString, one for each name separated by "and" outside braces.
+    @param      aString The author string
+    @result     Data containing the name ranges, or nil when the braces are unbalanced.
+*/
++ (NSData *)nameRangesFromBibtexString:(NSString *)aString;
+
+/*!
+    @method     authorsFromBibtexString:nameRanges:withPublication:forField:
+    @abstract   Creates BibAuthor objects for names previously found by nameRangesFromBibtexString:
+    @discussion (comprehensive description)
+    @param      aString The author string
+    @param      nameRanges The ranges returned by nameRangesFromBibtexString: for aString
+    @result     An array of BibAuthor objects.
+*/
++ (NSArray *)authorsFromBibtexString:(NSString *)aString nameRanges:(NSData *)nameRanges withPublication:(BibItem *)pub forField:(NSString *)field;
+
 + (NSDictionary *)nameComponents:(NSString *)aName forPublication:(BibItem *)pub;
 
 @end
@@ -61,6 +61,7 @@
 #import "NSData_BDSKExtensions.h"
 #import "CFString_BDSKExtensions.h"
 #import "NSDictionary_BDSKExtensions.h"
+#import "BDSKTypeManager.h"
 
 static NSLock *parserLock = nil;
 
@@ -92,6 +93,11 @@ static BOOL addValuesFromEntryToDictionary(AST *entry, NSMutableDictionary *dict
 
 static void handleError(bt_error *err);
 
+// per-parse tables of interned field names and entry types, only accessed while holding the parserLock
+static void beginNameTables(void);
+static void endNameTables(void);
+static NSString *copyInternedName(const char *cstring, NSInteger line, NSString *filePath, NSStringEncoding parserEncoding, BOOL isEntryType);
+
 
 @implementation BDSKBibTeXParser
 
@@ -210,6 +216,8 @@ static NSString *stringWithoutComments(NSString *string) {
     bt_set_stringopts(BTE_MACRODEF, BTO_MINIMAL);
     // Passing BTO_COLLAPSE causes problems.  The comments on bt_postprocess_value indicate that BibTeX-style collapsing must take place /after/ pasting, but we do this with BDSKComplexString instead of BTO_PASTE.  See bug #1803091 for an example, although that case could be avoided by having bt_postprocess_string consider a single space " " as collapsed instead of deleting it.
     bt_set_stringopts(BTE_REGULAR, BTO_MINIMAL);
+    
+    beginNameTables();
 	
     NSMutableArray *returnArray = [NSMutableArray array];
     NSUInteger inputDataLength = [inData length];
@@ -259,6 +267,7 @@ static NSString *stringWithoutComments(NSString *string) {
     } // while (scanning through file) 
 
     // execute this regardless, so the parser isn't left in an inconsistent state
+    endNameTables();
     bt_cleanup();
     fclose(infile);
 	
@@ -574,6 +583,80 @@ __BDCreateArrayOfNamesByCheckingBraceDepth(CFArrayRef names)
 	return authors;
 }
 
+static inline Boolean isAndSeparatorAtIndex(CFStringInlineBuffer *inlineBuffer, CFIndex idx, CFIndex length)
+{
+    if (idx + 5 > length)
+        return FALSE;
+    return CFStringGetCharacterFromInlineBuffer(inlineBuffer, idx) == ' ' &&
+           (CFStringGetCharacterFromInlineBuffer(inlineBuffer, idx + 1) | 0x20) == 'a' &&
+           (CFStringGetCharacterFromInlineBuffer(inlineBuffer, idx + 2) | 0x20) == 'n' &&
+           (CFStringGetCharacterFromInlineBuffer(inlineBuffer, idx + 3) | 0x20) == 'd' &&
+           CFStringGetCharacterFromInlineBuffer(inlineBuffer, idx + 4) == ' ';
+}
+
+// single pass equivalent of splitting on " and " followed by __BDCreateArrayOfNamesByCheckingBraceDepth, only recording the ranges of the names
++ (NSData *)nameRangesFromBibtexString:(NSString *)aString{
+    
+    NSMutableData *data = [NSMutableData data];
+    
+    if ([NSString isEmptyString:aString])
+        return data;
+    
+    CFIndex idx = 0, start = 0, length = CFStringGetLength((CFStringRef)aString), braceDepth = 0;
+    CFStringInlineBuffer inlineBuffer;
+    CFStringInitInlineBuffer((CFStringRef)aString, &inlineBuffer, CFRangeMake(0, length));
+    BDSKNameRange range;
+    UniChar ch;
+    
+    while (idx < length) {
+        ch = CFStringGetCharacterFromInlineBuffer(&inlineBuffer, idx);
+        if (ch == '{') {
+            braceDepth++;
+        } else if (ch == '}') {
+            braceDepth--;
+        } else if (braceDepth == 0 && isAndSeparatorAtIndex(&inlineBuffer, idx, length)) {
+            range.location = (uint32_t)start;
+            range.length = (uint32_t)(idx - start);
+            [data appendBytes:&range length:sizeof(BDSKNameRange)];
+            idx += 5;
+            start = idx;
+            continue;
+        }
+        idx++;
+    }
+    
+    // returning nil will signify our error condition
+    if (braceDepth != 0)
+        return nil;
+    
+    if (start < length) {
+        range.location = (uint32_t)start;
+        range.length = (uint32_t)(length - start);
+        [data appendBytes:&range length:sizeof(BDSKNameRange)];
+    }
+    
+    return data;
+}
+
++ (NSArray *)authorsFromBibtexString:(NSString *)aString nameRanges:(NSData *)nameRanges withPublication:(BibItem *)pub forField:(NSString *)field{
+    
+    NSUInteger i, iMax = [nameRanges length] / sizeof(BDSKNameRange);
+	NSMutableArray *authors = [NSMutableArray arrayWithCapacity:iMax];
+    const BDSKNameRange *ranges = (const BDSKNameRange *)[nameRanges bytes];
+    CFAllocatorRef allocator = CFAllocatorGetDefault();
+    CFStringRef name;
+    BibAuthor *anAuthor;
+    
+    for (i = 0; i < iMax; i++) {
+        name = CFStringCreateWithSubstring(allocator, (CFStringRef)aString, CFRangeMake(ranges[i].location, ranges[i].length));
+        anAuthor = [[BibAuthor alloc] initWithName:(NSString *)name publication:pub forField:field];
+        [authors addObject:anAuthor];
+        [anAuthor release];
+        CFRelease(name);
+    }
+    return authors;
+}
+
 // creates an NSString from the given bt_name and bt_namepart, which were parsed with the given encoding; returns nil if no such name component exists
 static NSString *createNameStringForComponent(CFAllocatorRef alloc, bt_name *theName, bt_namepart thePart, CFStringEncoding encoding)
 {
@@ -1041,10 +1124,8 @@ static BOOL addValuesFromEntryToDictionary(AST *entry, NSMutableDictionary *dict
     
     while ((field = bt_next_field (entry, field, &fieldname)))
     {
-        // Get fieldname as a capitalized NSString
-        tmpStr = copyCheckedString(fieldname, field->line, filePath, parserEncoding);
-        fieldName = [tmpStr fieldName];
-        [tmpStr release];
+        // Get fieldname as a capitalized NSString, shared by all entries in this parse
+        fieldName = [copyInternedName(fieldname, field->line, filePath, parserEncoding, NO) autorelease];
         
         fieldValue = nil;
         
@@ -1104,9 +1185,7 @@ static BOOL addItemToDictionaryOrSetDocumentInfo(AST *entry, NSMutableArray *ret
         hadProblems = YES;
     
     // get the entry type as a string
-    NSString *tmpStr = copyCheckedString(bt_entry_type(entry), entry->line, filePath, parserEncoding);
-    NSString *entryType = [tmpStr entryType];
-    [tmpStr release];
+    NSString *entryType = [copyInternedName(bt_entry_type(entry), entry->line, filePath, parserEncoding, YES) autorelease];
     
     if ([entryType isEqualToString:@"bibdesk_info"]) {
         if(outDocumentInfo)
@@ -1182,3 +1261,89 @@ void handleError (bt_error *err)
                             line:err->line ?: -1
                        isWarning:err->class <= BTERR_USAGEWARN];
 }
+
+#pragma mark Name tables
+
+// Field names and entry types repeat for every entry, so we keep a per-parse table from the raw C string to the interned NSString. Only the names are interned, the field values are owned by the items, so they are created normally. The table keys are copied into blocks that are freed in one go when the parse ends, so we don't need to malloc and free each key separately.
+
+#define KEY_BLOCK_SIZE 4096
+
+typedef struct _BDSKNameKeyBlock {
+    struct _BDSKNameKeyBlock *next;
+    size_t used;
+    size_t size;
+    char bytes[1];
+} BDSKNameKeyBlock;
+
+static BDSKNameKeyBlock *nameKeyBlocks = NULL;
+static CFMutableDictionaryRef parsedFieldNames = NULL;
+static CFMutableDictionaryRef parsedEntryTypes = NULL;
+
+static char *copyNameKey(const char *cstring)
+{
+    size_t length = strlen(cstring) + 1;
+    if (nameKeyBlocks == NULL || nameKeyBlocks->size - nameKeyBlocks->used < length) {
+        size_t size = MAX(length, (size_t)KEY_BLOCK_SIZE);
+        BDSKNameKeyBlock *block = (BDSKNameKeyBlock *)malloc(sizeof(BDSKNameKeyBlock) + size);
+        block->next = nameKeyBlocks;
+        block->used = 0;
+        block->size = size;
+        nameKeyBlocks = block;
+    }
+    char *copy = nameKeyBlocks->bytes + nameKeyBlocks->used;
+    memcpy(copy, cstring, length);
+    nameKeyBlocks->used += length;
+    return copy;
+}
+
+static Boolean cStringEqual(const void *value1, const void *value2) { return 0 == strcmp((const char *)value1, (const char *)value2); }
+
+static CFHashCode cStringHash(const void *value)
+{
+    // FNV-1a, the names are short
+    const unsigned char *ptr = (const unsigned char *)value;
+    CFHashCode hash = 2166136261U;
+    while (*ptr)
+        hash = (hash ^ *ptr++) * 16777619U;
+    return hash;
+}
+
+static void beginNameTables(void)
+{
+    BDSKASSERT(parsedFieldNames == NULL && parsedEntryTypes == NULL);
+    // the keys are owned by the key blocks, so no retain/release callbacks
+    const CFDictionaryKeyCallBacks keyCallBacks = { 0, NULL, NULL, NULL, cStringEqual, cStringHash };
+    parsedFieldNames = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &keyCallBacks, &kCFTypeDictionaryValueCallBacks);
+    parsedEntryTypes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &keyCallBacks, &kCFTypeDictionaryValueCallBacks);
+}
+
+static void endNameTables(void)
+{
+    BDSKCFDESTROY(parsedFieldNames);
+    BDSKCFDESTROY(parsedEntryTypes);
+    while (nameKeyBlocks) {
+        BDSKNameKeyBlock *next = nameKeyBlocks->next;
+        free(nameKeyBlocks);
+        nameKeyBlocks = next;
+    }
+}
+
+static NSString *copyInternedName(const char *cstring, NSInteger line, NSString *filePath, NSStringEncoding parserEncoding, BOOL isEntryType)
+{
+    if (cstring == NULL)
+        return nil;
+    
+    CFMutableDictionaryRef table = isEntryType ? parsedEntryTypes : parsedFieldNames;
+    NSString *name = table ? (NSString *)CFDictionaryGetValue(table, cstring) : nil;
+    
+    if (name == nil) {
+        // encoding failures are not cached, so they are reported for every occurrence
+        NSString *tmpStr = copyCheckedString(cstring, line, filePath, parserEncoding);
+        name = isEntryType ? [tmpStr entryType] : [BDSKTypeManager internedFieldName:[tmpStr fieldName]];
+        [tmpStr release];
+        if (name && table)
+            CFDictionarySetValue(table, copyNameKey(cstring), name);
+    }
+    
+    return [name retain];
+}
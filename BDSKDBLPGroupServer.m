@@ -37,6 +37,7 @@
  */
 #import "BDSKDBLPGroupServer.h"
 #import "BDSKDBLPWebServices.h"
+#import "BDSKSearchGroupCache.h"
 #import "BDSKServerInfo.h"
 #import "BibItem.h"
 #import "BibAuthor.h"
@@ -45,6 +46,9 @@
 #import "NSError_BDSKExtensions.h"
 #import "NSString_BDSKExtensions.h"
 
+#define BIBTEX_KEY @"bibtex"
+#define ABSTRACTS_KEY @"abstracts"
+
 // private protocols for inter-thread messaging
 @protocol BDSKDBLPGroupServerMainThread <BDSKAsyncDOServerMainThread>
 - (void)addPublicationsFromBibTeXString:(bycopy NSString *)btString abstracts:(bycopy NSDictionary *)abstracts;
@@ -126,7 +130,7 @@
 
 - (void)retrieveWithSearchTerm:(NSString *)aSearchTerm
 {
-    if ([[self class] canConnect]) {
+    if ([[self class] canConnect] || [[BDSKSearchGroupCache sharedCache] hasResultsForServerInfo:[self serverInfo] searchTerm:aSearchTerm startIndex:0]) {
         OSAtomicCompareAndSwap32Barrier(1, 0, &flags.failedDownload);
         
         // stop the current service (if any); -cancel is thread safe, and so is calling it multiple times
@@ -273,7 +277,17 @@ static void fixEEURL(BibItem *pub)
     NSString *btString = nil;
     NSMutableDictionary *abstracts = nil;
     
-    if (NO == [NSString isEmptyString:searchTerm]){
+    // DBLP returns all results at once, so we cache them as a single page; use an expired page when we cannot connect
+    NSDictionary *cachedResults = nil;
+    if (NO == [NSString isEmptyString:searchTerm])
+        cachedResults = [[BDSKSearchGroupCache sharedCache] resultsForServerInfo:[self serverInfo] searchTerm:searchTerm startIndex:0 count:NULL availableResults:NULL allowExpired:NO == [[self class] canConnect]];
+    
+    if ([cachedResults isKindOfClass:[NSDictionary class]]) {
+        
+        btString = [cachedResults objectForKey:BIBTEX_KEY];
+        abstracts = [cachedResults objectForKey:ABSTRACTS_KEY];
+        
+    } else if (NO == [NSString isEmptyString:searchTerm]){
         
         NSArray *dblpKeys = [[self resultsWithSearchTerm:searchTerm database:database] valueForKeyPath:@"dblp_key"];
         int32_t dblpKeysCount = [dblpKeys count];
@@ -301,6 +315,18 @@ static void fixEEURL(BibItem *pub)
         }
         
         btString = (flags.isRetrieving == 0) ? @"" : [[btEntries allObjects] componentsJoinedByString:@"\n"];
+        
+        // don't cache a cancelled search; abstracts can be NSNull, which is not a property list
+        if ([btEntries count] && [btString isEqualToString:@""] == NO) {
+            NSMutableDictionary *cachedAbstracts = [NSMutableDictionary dictionary];
+            for (NSString *aKey in abstracts) {
+                id value = [abstracts objectForKey:aKey];
+                if ([value isKindOfClass:[NSString class]])
+                    [cachedAbstracts setObject:value forKey:aKey];
+            }
+            cachedResults = [NSDictionary dictionaryWithObjectsAndKeys:btString, BIBTEX_KEY, cachedAbstracts, ABSTRACTS_KEY, nil];
+            [[BDSKSearchGroupCache sharedCache] setResults:cachedResults count:dblpKeysCount availableResults:dblpKeysCount forServerInfo:[self serverInfo] searchTerm:searchTerm startIndex:0];
+        }
     }
     
     // this will create the array if it doesn't exist
@@ -0,0 +1,71 @@
+//
+//  BDSKDirectoryWatcher.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Cocoa/Cocoa.h>
+#import <CoreServices/CoreServices.h>
+
+extern NSString *BDSKDirectoryWatcherDirectoriesDidChangeNotification;
+extern NSString *BDSKDirectoryWatcherDirectoriesKey;
+
+// Watches directories using FSEvents and keeps a generation for each directory, so cached information about files in a directory can be checked without touching the file system.
+// Changes are posted as a notification with the changed directories. Should only be used from the main thread.
+@interface BDSKDirectoryWatcher : NSObject {
+    FSEventStreamRef streamRef;
+    FSEventStreamEventId lastEventId;
+    NSMutableDictionary *generations;
+    NSCountedSet *watchCounts;
+    NSUInteger generation;
+    BOOL needsRestart;
+}
+
++ (id)sharedWatcher;
+
+// the current generation, to be compared with the generation of a directory later on
+- (NSUInteger)generation;
+
+// starts watching the directory, returns the real path of the directory, which should be used for the generation and in the notifications
+// watches are counted, every watch should be balanced by an unwatch of the returned path
+- (NSString *)watchDirectory:(NSString *)path;
+
+// stops watching the directory when this balances the last watch, the path should be the real path returned by watchDirectory:
+- (void)unwatchDirectory:(NSString *)path;
+
+// returns YES when the directory is not watched, or a change was seen after the given generation
+- (BOOL)directory:(NSString *)path hasChangedSinceGeneration:(NSUInteger)aGeneration;
+
+@end
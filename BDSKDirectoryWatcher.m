@@ -0,0 +1,261 @@
+//
+//  BDSKDirectoryWatcher.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKDirectoryWatcher.h"
+#include <sys/param.h>
+#include <stdlib.h>
+
+NSString *BDSKDirectoryWatcherDirectoriesDidChangeNotification = @"BDSKDirectoryWatcherDirectoriesDidChangeNotification";
+NSString *BDSKDirectoryWatcherDirectoriesKey = @"directories";
+
+#define LATENCY         0.5
+#define RESTART_DELAY   0.5
+
+@interface BDSKDirectoryWatcher (Private)
+- (void)stopStream;
+- (void)restartStream;
+- (void)noteChangedDirectories:(NSSet *)changedDirectories;
+- (void)handleEventsWithPaths:(const char * const *)eventPaths flags:(const FSEventStreamEventFlags *)eventFlags count:(size_t)numEvents lastEventId:(FSEventStreamEventId)eventId;
+@end
+
+@implementation BDSKDirectoryWatcher
+
++ (id)sharedWatcher {
+    static BDSKDirectoryWatcher *sharedWatcher = nil;
+    if (sharedWatcher == nil)
+        sharedWatcher = [[self alloc] init];
+    return sharedWatcher;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        streamRef = NULL;
+        lastEventId = FSEventsGetCurrentEventId();
+        generations = [[NSMutableDictionary alloc] init];
+        watchCounts = [[NSCountedSet alloc] init];
+        generation = 0;
+        needsRestart = NO;
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(handleApplicationWillTerminateNotification:) name:NSApplicationWillTerminateNotification object:NSApp];
+        NSNotificationCenter *wsnc = [[NSWorkspace sharedWorkspace] notificationCenter];
+        [wsnc addObserver:self selector:@selector(handleVolumeDidMountOrUnmountNotification:) name:NSWorkspaceDidMountNotification object:nil];
+        [wsnc addObserver:self selector:@selector(handleVolumeDidMountOrUnmountNotification:) name:NSWorkspaceDidUnmountNotification object:nil];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [[[NSWorkspace sharedWorkspace] notificationCenter] removeObserver:self];
+    [self stopStream];
+    BDSKDESTROY(generations);
+    BDSKDESTROY(watchCounts);
+    [super dealloc];
+}
+
+- (void)handleApplicationWillTerminateNotification:(NSNotification *)notification {
+    [self stopStream];
+}
+
+// FSEvents does not report a volume that is mounted or unmounted, and a directory on a volume that was not mounted may not have existed when we started watching it
+- (void)handleVolumeDidMountOrUnmountNotification:(NSNotification *)notification {
+    NSString *volumePath = [[notification userInfo] objectForKey:@"NSDevicePath"];
+    if (volumePath == nil || [generations count] == 0)
+        return;
+    
+    NSString *prefix = [volumePath hasSuffix:@"/"] ? volumePath : [volumePath stringByAppendingString:@"/"];
+    NSMutableSet *changedDirectories = [NSMutableSet set];
+    for (NSString *directory in generations) {
+        if ([directory isEqualToString:volumePath] || [directory hasPrefix:prefix])
+            [changedDirectories addObject:directory];
+    }
+    
+    if ([changedDirectories count]) {
+        [self noteChangedDirectories:changedDirectories];
+        if (needsRestart == NO) {
+            needsRestart = YES;
+            [self performSelector:@selector(restartStream) withObject:nil afterDelay:RESTART_DELAY];
+        }
+    }
+}
+
+- (NSUInteger)generation {
+    return generation;
+}
+
+// FSEvents reports real paths, e.g. /private/var rather than /var and with the case on disk
+static NSString *realPathForDirectory(NSString *path) {
+    char realPath[PATH_MAX];
+    if (realpath([path fileSystemRepresentation], realPath) == NULL)
+        return path;
+    return [[NSFileManager defaultManager] stringWithFileSystemRepresentation:realPath length:strlen(realPath)];
+}
+
+- (NSString *)watchDirectory:(NSString *)path {
+    BDSKASSERT([NSThread isMainThread]);
+    if (path == nil)
+        return nil;
+    path = realPathForDirectory(path);
+    [watchCounts addObject:path];
+    if ([generations objectForKey:path] == nil) {
+        // events that happened before we watch the directory are replayed when the stream restarts, as it starts from the last event we've seen
+        [generations setObject:[NSNumber numberWithUnsignedInteger:generation] forKey:path];
+        if (needsRestart == NO) {
+            needsRestart = YES;
+            [self performSelector:@selector(restartStream) withObject:nil afterDelay:RESTART_DELAY];
+        }
+    }
+    return path;
+}
+
+- (void)unwatchDirectory:(NSString *)path {
+    // files may be deallocated on other threads
+    if ([NSThread isMainThread] == NO) {
+        [self performSelectorOnMainThread:_cmd withObject:path waitUntilDone:NO];
+        return;
+    }
+    if (path == nil || [watchCounts countForObject:path] == 0)
+        return;
+    [watchCounts removeObject:path];
+    if ([watchCounts countForObject:path] == 0) {
+        [generations removeObjectForKey:path];
+        if (needsRestart == NO) {
+            needsRestart = YES;
+            [self performSelector:@selector(restartStream) withObject:nil afterDelay:RESTART_DELAY];
+        }
+    }
+}
+
+- (BOOL)directory:(NSString *)path hasChangedSinceGeneration:(NSUInteger)aGeneration {
+    NSNumber *number = path ? [generations objectForKey:path] : nil;
+    return number == nil || [number unsignedIntegerValue] > aGeneration;
+}
+
+@end
+
+@implementation BDSKDirectoryWatcher (Private)
+
+static void fsevents_callback(FSEventStreamRef streamRef, void *clientCallBackInfo, size_t numEvents, const char *const eventPaths[], const FSEventStreamEventFlags *eventFlags, const FSEventStreamEventId *eventIds) {
+    if (numEvents > 0)
+        [(BDSKDirectoryWatcher *)clientCallBackInfo handleEventsWithPaths:eventPaths flags:eventFlags count:numEvents lastEventId:eventIds[numEvents - 1]];
+}
+
+- (void)stopStream {
+    if (streamRef) {
+        FSEventStreamStop(streamRef);
+        FSEventStreamInvalidate(streamRef);
+        FSEventStreamRelease(streamRef);
+        streamRef = NULL;
+    }
+}
+
+- (void)restartStream {
+    needsRestart = NO;
+    [self stopStream];
+    
+    if ([generations count] == 0)
+        return;
+    
+    FSEventStreamContext context = {0, (void *)self, NULL, NULL, NULL};
+    streamRef = FSEventStreamCreate(kCFAllocatorDefault,
+                                    (FSEventStreamCallback)&fsevents_callback, // callback
+                                    &context, // context
+                                    (CFArrayRef)[generations allKeys], // pathsToWatch
+                                    lastEventId, // sinceWhen
+                                    LATENCY, // latency
+                                    kFSEventStreamCreateFlagWatchRoot); // flags, we need to know when a parent folder is moved or renamed
+    if (streamRef) {
+        FSEventStreamScheduleWithRunLoop(streamRef, CFRunLoopGetMain(), kCFRunLoopDefaultMode);
+        FSEventStreamStart(streamRef);
+    }
+}
+
+- (void)handleEventsWithPaths:(const char * const *)eventPaths flags:(const FSEventStreamEventFlags *)eventFlags count:(size_t)numEvents lastEventId:(FSEventStreamEventId)eventId {
+    NSMutableSet *changedDirectories = [NSMutableSet set];
+    size_t i;
+    
+    for (i = 0; i < numEvents; i++) {
+        FSEventStreamEventFlags flags = eventFlags[i];
+        
+        if ((flags & kFSEventStreamEventFlagHistoryDone))
+            continue;
+        
+        if ((flags & (kFSEventStreamEventFlagUserDropped | kFSEventStreamEventFlagKernelDropped))) {
+            // we don't know what changed
+            [changedDirectories addObjectsFromArray:[generations allKeys]];
+            break;
+        }
+        
+        NSString *path = [[NSFileManager defaultManager] stringWithFileSystemRepresentation:eventPaths[i] length:strlen(eventPaths[i])];
+        if ([path length] > 1 && [path hasSuffix:@"/"])
+            path = [path substringToIndex:[path length] - 1];
+        
+        if ((flags & kFSEventStreamEventFlagRootChanged)) {
+            // the watched directory or one of its parents was moved, renamed or deleted, the path is the watched directory
+            // the stream should find the directory again when it reappears at its path
+            if ([generations objectForKey:path])
+                [changedDirectories addObject:path];
+            if (needsRestart == NO) {
+                needsRestart = YES;
+                [self performSelector:@selector(restartStream) withObject:nil afterDelay:RESTART_DELAY];
+            }
+        } else if ((flags & kFSEventStreamEventFlagMustScanSubDirs)) {
+            NSString *prefix = [path hasSuffix:@"/"] ? path : [path stringByAppendingString:@"/"];
+            for (NSString *directory in generations) {
+                if ([directory isEqualToString:path] || [directory hasPrefix:prefix])
+                    [changedDirectories addObject:directory];
+            }
+        } else if ([generations objectForKey:path]) {
+            [changedDirectories addObject:path];
+        }
+    }
+    
+    lastEventId = eventId;
+    
+    if ([changedDirectories count])
+        [self noteChangedDirectories:changedDirectories];
+}
+
+- (void)noteChangedDirectories:(NSSet *)changedDirectories {
+    NSNumber *number = [NSNumber numberWithUnsignedInteger:++generation];
+    for (NSString *directory in changedDirectories)
+        [generations setObject:number forKey:directory];
+    [[NSNotificationCenter defaultCenter] postNotificationName:BDSKDirectoryWatcherDirectoriesDidChangeNotification object:self userInfo:[NSDictionary dictionaryWithObjectsAndKeys:[changedDirectories allObjects], BDSKDirectoryWatcherDirectoriesKey, nil]];
+}
+
+@end
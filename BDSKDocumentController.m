@@ -52,6 +52,7 @@
 #import "BDSKTask.h"
 #import "BDSKOpenAccessoryViewController.h"
 #import "NSURL_BDSKExtensions.h"
+#import "BDSKSpotlightCachePack.h"
 
 enum {
     BDSKOpenDefault,
@@ -280,6 +281,22 @@ enum {
             NSBeep();
         }
         
+    } else if ([theUTI isEqualToUTI:@"net.sourceforge.bibdesk.bdskcachepack"]) {
+        
+        // a packed cache has all items of a document, so we just open the document
+        BDSKSpotlightCachePack *pack = [[[BDSKSpotlightCachePack alloc] initWithContentsOfFile:[absoluteURL path]] autorelease];
+        NSDictionary *dictionary = [pack documentInfo];
+        BDAlias *fileAlias = [BDAlias aliasWithData:[dictionary valueForKey:@"FileAlias"]];
+        NSString *fullPath = [fileAlias fullPath] ?: [dictionary valueForKey:@"net_sourceforge_bibdesk_owningfilepath"];
+        
+        if (fullPath == nil) {
+            if(outError != nil) 
+                *outError = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileNoSuchFileError userInfo:[NSDictionary dictionaryWithObjectsAndKeys:NSLocalizedString(@"Unable to find the file associated with this item.", @"Error description"), NSLocalizedDescriptionKey, nil]];
+            return nil;
+        }
+        
+        document = [super openDocumentWithContentsOfURL:[NSURL fileURLWithPath:fullPath] display:displayDocument error:outError];
+        
     } else if ([theUTI isEqualToUTI:@"net.sourceforge.bibdesk.bdsksearch"]) {
         
         NSDictionary *dictionary = [NSDictionary dictionaryWithContentsOfURL:absoluteURL];
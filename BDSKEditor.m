@@ -2529,7 +2529,7 @@ static inline BOOL validRanges(NSArray *ranges, NSUInteger max) {
 
 static NSString *queryStringWithCiteKey(NSString *citekey)
 {
-    return [NSString stringWithFormat:@"(net_sourceforge_bibdesk_citekey = '%@'cd) && ((kMDItemContentType != *) || (kMDItemContentType != com.apple.mail.emlx))", citekey];
+    return [NSString stringWithFormat:@"((net_sourceforge_bibdesk_citekey = '%@'cd) || (net_sourceforge_bibdesk_citekeys = '%@'cd)) && ((kMDItemContentType != *) || (kMDItemContentType != com.apple.mail.emlx))", citekey, citekey];
 }
 
 - (BOOL)citationFormatter:(BDSKCitationFormatter *)formatter isValidKey:(NSString *)key {
@@ -50,6 +50,18 @@
     NSString *queryKey;   // searchTerm as returned by PubMed
     NSString *filePath;
     NSURLDownload *URLDownload;
+    NSUInteger receivedLength;
+    NSUInteger parsedLength;
+    NSUInteger nextParseLength;
+    NSURLDownload *prefetchDownload;
+    NSString *prefetchFilePath;
+    NSMutableArray *prefetchedPages;
+    NSInteger prefetchingResults;
+    NSInteger prefetchStartIndex;
+    NSInteger fetchStartIndex;
+    NSInteger fetchingResults;
+    BOOL isWaitingForPrefetch;
+    BOOL isOffline;
     BOOL failedDownload;
     BOOL isRetrieving;
     BOOL needsReset;
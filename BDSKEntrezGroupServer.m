@@ -39,6 +39,13 @@
 // max number of results from NCBI is 100, except on evenings and weekends
 #define MAX_RESULTS 50
 
+#define DATA_KEY  @"data"
+#define COUNT_KEY @"count"
+#define START_KEY @"start"
+
+// how much more of a page we download before we try to parse the articles we have so far
+#define STREAM_PARSE_INTERVAL 32768
+
 /* Based on public domain sample code written by Oleg Khovayko, available at
  http://www.ncbi.nlm.nih.gov/entrez/query/static/eutils_example.pl
  
@@ -59,6 +66,16 @@
 #import "NSError_BDSKExtensions.h"
 #import "NSFileManager_BDSKExtensions.h"
 #import "BDSKPubMedXMLParser.h"
+#import "BDSKSearchGroupCache.h"
+
+@interface BDSKEntrezGroupServer (BDSKPrivate)
+- (void)startSearch;
+- (BOOL)addPublicationsFromData:(NSData *)data location:(NSUInteger)location;
+- (void)cancelPrefetch;
+- (void)prefetch;
+- (void)prefetchDidFinish;
+- (void)prefetchDidFail;
+@end
 
 @implementation BDSKEntrezGroupServer
 
@@ -96,6 +113,15 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
         availableResults = 0;
         filePath = nil;
         URLDownload = nil;
+        prefetchDownload = nil;
+        prefetchFilePath = nil;
+        prefetchedPages = [[NSMutableArray alloc] init];
+        prefetchingResults = 0;
+        prefetchStartIndex = 0;
+        fetchStartIndex = 0;
+        fetchingResults = 0;
+        isWaitingForPrefetch = NO;
+        isOffline = NO;
         downloadState = BDSKIdleState;
         errorMessage = nil;
     }
@@ -105,11 +131,14 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
 - (void)dealloc
 {
     group = nil;
+    // a prefetch may still be running when the group goes away, and its temporary file would be left behind
+    [self cancelPrefetch];
     BDSKDESTROY(filePath);
     BDSKDESTROY(serverInfo);
     BDSKDESTROY(webEnv);
     BDSKDESTROY(queryKey);
     BDSKDESTROY(errorMessage);
+    BDSKDESTROY(prefetchedPages);
     [super dealloc];
 }
 
@@ -121,12 +150,15 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
 {
     if ([self isRetrieving])
         [self terminate];
+    else
+        [self cancelPrefetch];
     availableResults = 0;
     fetchedResults = 0;
 }
 
 - (void)terminate;
 {
+    [self cancelPrefetch];
     [URLDownload cancel];
     BDSKDESTROY(URLDownload);
     downloadState = BDSKIdleState;
@@ -137,9 +169,12 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
 }
 
 - (void)retrieveWithSearchTerm:(NSString *)aSearchTerm {
-    if ([[self class] canConnect]) {
+    BOOL isNewSearch = [[self searchTerm] isEqualToString:aSearchTerm] == NO || needsReset;
+    // we can still show results we got before when we're offline
+    isOffline = [[self class] canConnect] == NO;
+    if (isOffline == NO || [[BDSKSearchGroupCache sharedCache] resultsForServerInfo:[self serverInfo] searchTerm:aSearchTerm startIndex:isNewSearch ? 0 : [self numberOfFetchedResults] count:NULL availableResults:NULL allowExpired:YES]) {
         isRetrieving = YES;
-        if ([[self searchTerm] isEqualToString:aSearchTerm] == NO || needsReset) {
+        if (isNewSearch) {
             [self setSearchTerm:aSearchTerm];
             [self resetSearch];
         } else if ([self isRetrieving] == NO) {
@@ -219,30 +254,80 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
 
 - (void)resetSearch;
 {
+    [self cancelPrefetch];
     [self setWebEnv:nil];
     [self setQueryKey:nil];
     [self reset];
     
     if(NO == [NSString isEmptyString:[self searchTerm]]){
-        // get the initial XML document with our search parameters in it
-        NSString *esearch = [[[self class] baseURLString] stringByAppendingFormat:@"/esearch.fcgi?db=%@&retmax=1&usehistory=y&term=%@&tool=bibdesk", [[self serverInfo] database], [[self searchTerm] stringByAddingPercentEscapesIncludingReserved]];
-        NSURL *initialURL = [NSURL URLWithString:esearch]; 
-        BDSKPRECONDITION(initialURL);
-        
-        downloadState = BDSKEsearchState;
-        [self startDownloadFromURL:initialURL];
+        NSInteger cachedAvailableResults = 0;
         needsReset = NO;
+        if ([[BDSKSearchGroupCache sharedCache] resultsForServerInfo:[self serverInfo] searchTerm:[self searchTerm] startIndex:0 count:NULL availableResults:&cachedAvailableResults allowExpired:isOffline]) {
+            // we searched for this before, we only need to search the server again when we need results that are not cached
+            availableResults = cachedAvailableResults;
+            [self fetch];
+        } else {
+            [self startSearch];
+        }
     }
 }
 
+- (void)startSearch;
+{
+    // get the initial XML document with our search parameters in it
+    NSString *esearch = [[[self class] baseURLString] stringByAppendingFormat:@"/esearch.fcgi?db=%@&retmax=1&usehistory=y&term=%@&tool=bibdesk", [[self serverInfo] database], [[self searchTerm] stringByAddingPercentEscapesIncludingReserved]];
+    NSURL *initialURL = [NSURL URLWithString:esearch]; 
+    BDSKPRECONDITION(initialURL);
+    
+    downloadState = BDSKEsearchState;
+    [self startDownloadFromURL:initialURL];
+}
+
 - (void)fetch;
 {
-    if ([self webEnv] == nil || [self queryKey] == nil || [self numberOfAvailableResults] <= [self numberOfFetchedResults]) {
+    if ([self numberOfAvailableResults] <= [self numberOfFetchedResults]) {
         [group addPublications:[NSArray array]];
         return;
     }
     
     BDSKPRECONDITION(downloadState == BDSKIdleState);
+    
+    if ([prefetchedPages count] > 0) {
+        // we already have the next page
+        NSDictionary *page = [[prefetchedPages objectAtIndex:0] retain];
+        [prefetchedPages removeObjectAtIndex:0];
+        fetchedResults += [[page objectForKey:COUNT_KEY] integerValue];
+        [self prefetch];
+        if ([self addPublicationsFromData:[page objectForKey:DATA_KEY] location:0])
+            [[BDSKSearchGroupCache sharedCache] setResults:[page objectForKey:DATA_KEY] count:[[page objectForKey:COUNT_KEY] integerValue] availableResults:[self numberOfAvailableResults] forServerInfo:[self serverInfo] searchTerm:[self searchTerm] startIndex:[[page objectForKey:START_KEY] integerValue]];
+        [page release];
+        return;
+    } else if (prefetchDownload) {
+        // the next page is on its way, we'll use it when it arrives
+        isWaitingForPrefetch = YES;
+        downloadState = BDSKEfetchState;
+        return;
+    }
+    
+    NSInteger cachedCount = 0, cachedAvailableResults = 0;
+    NSData *cachedData = [[BDSKSearchGroupCache sharedCache] resultsForServerInfo:[self serverInfo] searchTerm:[self searchTerm] startIndex:[self numberOfFetchedResults] count:&cachedCount availableResults:&cachedAvailableResults allowExpired:isOffline];
+    if (cachedData && cachedCount > 0) {
+        fetchedResults += cachedCount;
+        availableResults = cachedAvailableResults;
+        [self addPublicationsFromData:cachedData location:0];
+        return;
+    }
+    
+    if ([self webEnv] == nil || [self queryKey] == nil) {
+        if (isOffline || [NSString isEmptyString:[self searchTerm]]) {
+            [group addPublications:[NSArray array]];
+        } else {
+            // the earlier results came from the cache, so we first need to search the server, which fetches when it's done
+            [self startSearch];
+        }
+        return;
+    }
+    
     NSInteger numResults = MIN([self numberOfAvailableResults] - [self numberOfFetchedResults], MAX_RESULTS);
     
     // need to escape queryKey, but the rest should be valid for a URL
@@ -250,6 +335,8 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
     NSURL *theURL = [NSURL URLWithString:efetch];
     BDSKPOSTCONDITION(theURL);
     
+    fetchStartIndex = fetchedResults;
+    fetchingResults = numResults;
     fetchedResults += numResults;
     
     downloadState = BDSKEfetchState;
@@ -265,20 +352,56 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
     if (URLDownload)
         [URLDownload cancel];
     [URLDownload release];
+    receivedLength = 0;
+    parsedLength = 0;
+    nextParseLength = STREAM_PARSE_INTERVAL;
     URLDownload = [[WebDownload alloc] initWithRequest:request delegate:self];
     [URLDownload setDestination:[[NSFileManager defaultManager] temporaryFileWithBasename:nil] allowOverwrite:NO];
 }
 
 - (void)download:(NSURLDownload *)download didCreateDestination:(NSString *)path
 {
-    [filePath autorelease];
-    filePath = [path copy];
+    if (download == prefetchDownload) {
+        [prefetchFilePath autorelease];
+        prefetchFilePath = [path copy];
+    } else {
+        [filePath autorelease];
+        filePath = [path copy];
+    }
+}
+
+- (void)download:(NSURLDownload *)download didReceiveDataOfLength:(NSUInteger)length
+{
+    if (download != URLDownload || downloadState != BDSKEfetchState || filePath == nil)
+        return;
+    
+    receivedLength += length;
+    if (receivedLength < nextParseLength)
+        return;
+    nextParseLength = receivedLength + STREAM_PARSE_INTERVAL;
+    
+    // add the complete articles we have so far, so they show up while the rest of the page is downloading
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForReadingAtPath:filePath];
+    [fileHandle seekToFileOffset:parsedLength];
+    NSData *data = [fileHandle readDataToEndOfFile];
+    [fileHandle closeFile];
+    
+    NSUInteger location = 0;
+    NSArray *pubs = [BDSKPubMedXMLParser itemsFromPartialData:data location:&location error:NULL];
+    if ([pubs count]) {
+        parsedLength += location;
+        [group addPublications:pubs];
+    }
 }
 
 - (void)downloadDidFinish:(NSURLDownload *)download
 {
+    if (download == prefetchDownload) {
+        [self prefetchDidFinish];
+        return;
+    }
+    
     failedDownload = NO;
-    NSError *presentableError;
     
     if (URLDownload) {
         BDSKDESTROY(URLDownload);
@@ -322,19 +445,12 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
         }
         case BDSKEfetchState:
         {
-            // specifically requested the XML type, so go straight to the correct parser
-            NSArray *pubs = [BDSKPubMedXMLParser itemsFromData:[NSData dataWithContentsOfMappedFile:[downloadURL path]] error:&presentableError];
-            
-            // set before addPublications:
-            downloadState = BDSKIdleState;
-            
-            if (nil == pubs) {
-                failedDownload = YES;
-                [self setErrorMessage:[presentableError localizedDescription]];
-            }
-            else {
-                [group addPublications:pubs];
-            }
+            NSData *data = [NSData dataWithContentsOfMappedFile:[downloadURL path]];
+            // download the next page while we parse this one
+            [self prefetch];
+            // only parse what we did not already add while downloading
+            if ([self addPublicationsFromData:data location:parsedLength])
+                [[BDSKSearchGroupCache sharedCache] setResults:data count:fetchingResults availableResults:[self numberOfAvailableResults] forServerInfo:[self serverInfo] searchTerm:[self searchTerm] startIndex:fetchStartIndex];
             break;
         }
         case BDSKIdleState:
@@ -353,6 +469,11 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
 
 - (void)download:(NSURLDownload *)download didFailWithError:(NSError *)error
 {
+    if (download == prefetchDownload) {
+        [self prefetchDidFail];
+        return;
+    }
+    
     downloadState = BDSKIdleState;
     failedDownload = YES;
     [self setErrorMessage:[error localizedDescription]];
@@ -370,4 +491,107 @@ enum { BDSKIdleState, BDSKEsearchState, BDSKEfetchState };
     [group addPublications:nil];
 }
 
+#pragma mark Prefetching
+
+// returns NO when the data could not be parsed; a non-zero location is the part of the data we already parsed
+- (BOOL)addPublicationsFromData:(NSData *)data location:(NSUInteger)location;
+{
+    NSError *presentableError = nil;
+    NSArray *pubs;
+    // specifically requested the XML type, so go straight to the correct parser
+    if (location > 0)
+        pubs = [BDSKPubMedXMLParser itemsFromPartialData:data location:&location error:&presentableError];
+    else
+        pubs = [BDSKPubMedXMLParser itemsFromData:data error:&presentableError];
+    
+    // set before addPublications:
+    downloadState = BDSKIdleState;
+    
+    if (nil == pubs) {
+        failedDownload = YES;
+        [self setErrorMessage:[presentableError localizedDescription]];
+        return NO;
+    }
+    else {
+        [group addPublications:pubs];
+        return YES;
+    }
+}
+
+- (void)cancelPrefetch;
+{
+    [prefetchDownload cancel];
+    BDSKDESTROY(prefetchDownload);
+    if (prefetchFilePath) {
+        [[NSFileManager defaultManager] removeItemAtPath:prefetchFilePath error:NULL];
+        BDSKDESTROY(prefetchFilePath);
+    }
+    [prefetchedPages removeAllObjects];
+    prefetchingResults = 0;
+    isWaitingForPrefetch = NO;
+}
+
+// downloads the page after the ones we have, so the next fetch does not have to wait for the server
+- (void)prefetch;
+{
+    NSInteger depth = BDSKSearchGroupPrefetchDepth();
+    NSInteger start = [self numberOfFetchedResults];
+    for (NSDictionary *page in prefetchedPages)
+        start += [[page objectForKey:COUNT_KEY] integerValue];
+    NSInteger numResults = MIN([self numberOfAvailableResults] - start, MAX_RESULTS);
+    
+    if (prefetchDownload || numResults <= 0 || (NSInteger)[prefetchedPages count] >= depth || [self webEnv] == nil || [self queryKey] == nil)
+        return;
+    
+    NSString *efetch = [[[self class] baseURLString] stringByAppendingFormat:@"/efetch.fcgi?rettype=abstract&retmode=xml&retstart=%ld&retmax=%ld&db=%@&query_key=%@&WebEnv=%@&tool=bibdesk", (long)start, (long)numResults, [[self serverInfo] database], [[self queryKey] stringByAddingPercentEscapesIncludingReserved], [self webEnv]];
+    NSURL *theURL = [NSURL URLWithString:efetch];
+    BDSKPOSTCONDITION(theURL);
+    
+    prefetchStartIndex = start;
+    prefetchingResults = numResults;
+    prefetchDownload = [[WebDownload alloc] initWithRequest:[NSURLRequest requestWithURL:theURL] delegate:self];
+    [prefetchDownload setDestination:[[NSFileManager defaultManager] temporaryFileWithBasename:nil] allowOverwrite:NO];
+}
+
+- (void)prefetchDidFinish;
+{
+    NSData *data = prefetchFilePath ? [NSData dataWithContentsOfFile:prefetchFilePath] : nil;
+    
+    BDSKDESTROY(prefetchDownload);
+    if (prefetchFilePath) {
+        [[NSFileManager defaultManager] removeItemAtPath:prefetchFilePath error:NULL];
+        BDSKDESTROY(prefetchFilePath);
+    }
+    
+    if ([data length] > 0)
+        [prefetchedPages addObject:[NSDictionary dictionaryWithObjectsAndKeys:data, DATA_KEY, [NSNumber numberWithInteger:prefetchingResults], COUNT_KEY, [NSNumber numberWithInteger:prefetchStartIndex], START_KEY, nil]];
+    prefetchingResults = 0;
+    
+    if (isWaitingForPrefetch) {
+        // reset the state, so fetch uses the page we just got, or downloads it normally if that failed
+        isWaitingForPrefetch = NO;
+        downloadState = BDSKIdleState;
+        [self fetch];
+    } else {
+        [self prefetch];
+    }
+}
+
+- (void)prefetchDidFail;
+{
+    BDSKDESTROY(prefetchDownload);
+    if (prefetchFilePath) {
+        [[NSFileManager defaultManager] removeItemAtPath:prefetchFilePath error:NULL];
+        BDSKDESTROY(prefetchFilePath);
+    }
+    prefetchingResults = 0;
+    
+    // a failed prefetch is not an error, we just download the page normally when it's needed
+    if (isWaitingForPrefetch) {
+        isWaitingForPrefetch = NO;
+        downloadState = BDSKIdleState;
+        [self fetch];
+    }
+}
+
 @end
@@ -0,0 +1,359 @@
+//
+//  BDSKFederatedGroupServer.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKFederatedGroupServer.h"
+#import "BDSKServerInfo.h"
+#import "BibItem.h"
+#import "NSString_BDSKExtensions.h"
+
+@interface BDSKFederatedSearchSource : NSObject <BDSKSearchGroup> {
+    BDSKFederatedGroupServer *federatedServer;
+    id<BDSKSearchGroupServer> server;
+    NSTimer *timeoutTimer;
+    BOOL isRetrieving;
+    BOOL timedOut;
+}
+- (id)initWithFederatedServer:(BDSKFederatedGroupServer *)aServer serverInfo:(BDSKServerInfo *)info;
+- (id<BDSKSearchGroupServer>)server;
+- (void)retrieveWithSearchTerm:(NSString *)aSearchTerm timeout:(NSTimeInterval)timeout;
+- (void)cancel;
+- (BOOL)isRetrieving;
+- (BOOL)failedDownload;
+- (NSString *)errorMessage;
+@end
+
+@interface BDSKFederatedGroupServer (BDSKPrivate)
+- (id<BDSKSearchGroup>)group;
+- (void)source:(BDSKFederatedSearchSource *)source didFindPublications:(NSArray *)pubs;
+@end
+
+// the same publication from different servers rarely has the same fields, so we compare the DOI, or otherwise the title and year
+static NSString *duplicateKeyForPublication(BibItem *pub) {
+    NSString *doi = [[pub stringValueOfField:BDSKDoiString inherit:NO] lowercaseString];
+    if ([NSString isEmptyString:doi] == NO) {
+        if ([doi hasPrefix:@"doi:"])
+            doi = [doi substringFromIndex:4];
+        return [@"doi:" stringByAppendingString:[doi stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]]];
+    }
+    NSString *title = [[[pub title] stringByRemovingTeX] lossyASCIIString];
+    if ([NSString isEmptyString:title])
+        return nil;
+    NSMutableString *key = [NSMutableString stringWithString:@"title:"];
+    NSCharacterSet *alphanumericSet = [NSCharacterSet alphanumericCharacterSet];
+    NSUInteger i, iMax = [title length];
+    for (i = 0; i < iMax; i++) {
+        unichar ch = [title characterAtIndex:i];
+        if ([alphanumericSet characterIsMember:ch])
+            [key appendFormat:@"%C", (unichar)(ch < 128 ? tolower(ch) : ch)];
+    }
+    [key appendFormat:@":%@", [pub stringValueOfField:BDSKYearString inherit:NO] ?: @""];
+    return key;
+}
+
+@implementation BDSKFederatedGroupServer
+
+- (id)initWithGroup:(id<BDSKSearchGroup>)aGroup serverInfo:(BDSKServerInfo *)info;
+{
+    self = [super init];
+    if (self) {
+        group = aGroup;
+        serverInfo = nil;
+        sources = nil;
+        searchTerm = nil;
+        foundKeys = [[NSMutableSet alloc] init];
+        needsReset = NO;
+        [self setServerInfo:info];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    group = nil;
+    [sources makeObjectsPerformSelector:@selector(cancel)];
+    BDSKDESTROY(sources);
+    BDSKDESTROY(serverInfo);
+    BDSKDESTROY(searchTerm);
+    BDSKDESTROY(foundKeys);
+    [super dealloc];
+}
+
+- (id<BDSKSearchGroupServer>)newServerWithGroup:(id<BDSKSearchGroup>)aGroup serverInfo:(BDSKServerInfo *)info {
+    return [[[BDSKSearchGroup serverClassForType:[info type]] alloc] initWithGroup:aGroup serverInfo:info];
+}
+
+- (id<BDSKSearchGroup>)group { return group; }
+
+#pragma mark BDSKSearchGroupServer protocol
+
+- (NSString *)type { return BDSKSearchGroupFederated; }
+
+- (BDSKServerInfo *)serverInfo { return serverInfo; }
+
+- (void)setServerInfo:(BDSKServerInfo *)info;
+{
+    if (serverInfo != info) {
+        [serverInfo release];
+        serverInfo = [info copy];
+        
+        for (BDSKFederatedSearchSource *source in sources) {
+            [source cancel];
+            [[source server] terminate];
+        }
+        
+        NSMutableArray *newSources = [NSMutableArray array];
+        for (BDSKServerInfo *sourceInfo in [serverInfo serverInfos]) {
+            BDSKFederatedSearchSource *source = [[BDSKFederatedSearchSource alloc] initWithFederatedServer:self serverInfo:sourceInfo];
+            if ([source server])
+                [newSources addObject:source];
+            [source release];
+        }
+        [sources release];
+        sources = [newSources copy];
+        
+        needsReset = YES;
+    }
+}
+
+- (NSInteger)numberOfAvailableResults {
+    NSInteger count = 0;
+    for (BDSKFederatedSearchSource *source in sources)
+        count += [[source server] numberOfAvailableResults];
+    return count;
+}
+
+- (NSInteger)numberOfFetchedResults {
+    NSInteger count = 0;
+    for (BDSKFederatedSearchSource *source in sources)
+        count += [[source server] numberOfFetchedResults];
+    return count;
+}
+
+// we only fail when none of the servers could give us anything
+- (BOOL)failedDownload {
+    if ([sources count] == 0)
+        return NO;
+    for (BDSKFederatedSearchSource *source in sources) {
+        if ([source failedDownload] == NO)
+            return NO;
+    }
+    return YES;
+}
+
+- (NSString *)errorMessage {
+    NSMutableArray *messages = [NSMutableArray array];
+    for (BDSKFederatedSearchSource *source in sources) {
+        if ([source failedDownload])
+            [messages addObject:[NSString stringWithFormat:@"%@: %@", [[[source server] serverInfo] name], [source errorMessage] ?: NSLocalizedString(@"Unknown error", @"")]];
+    }
+    return [messages count] ? [messages componentsJoinedByString:@"\n"] : nil;
+}
+
+- (BOOL)isRetrieving {
+    for (BDSKFederatedSearchSource *source in sources) {
+        if ([source isRetrieving])
+            return YES;
+    }
+    return NO;
+}
+
+- (void)retrieveWithSearchTerm:(NSString *)aSearchTerm {
+    BOOL isNewSearch = needsReset || [searchTerm isEqualToString:aSearchTerm] == NO;
+    BOOL didStart = NO;
+    
+    if (isNewSearch) {
+        [self reset];
+        [searchTerm release];
+        searchTerm = [aSearchTerm copy];
+        needsReset = NO;
+    }
+    
+    if ([NSString isEmptyString:searchTerm] == NO) {
+        // ask all servers at once, the results are added as each of them answers
+        for (BDSKFederatedSearchSource *source in sources) {
+            id<BDSKSearchGroupServer> sourceServer = [source server];
+            if ([source isRetrieving] == NO && (isNewSearch || ([source failedDownload] == NO && [sourceServer numberOfAvailableResults] > [sourceServer numberOfFetchedResults]))) {
+                [source retrieveWithSearchTerm:searchTerm timeout:[serverInfo timeout]];
+                didStart = YES;
+            }
+        }
+    }
+    
+    // make sure the group redraws when there was nothing to get
+    if (didStart == NO)
+        [group addPublications:[NSArray array]];
+}
+
+- (void)reset {
+    for (BDSKFederatedSearchSource *source in sources) {
+        [source cancel];
+        [[source server] reset];
+    }
+    [foundKeys removeAllObjects];
+}
+
+- (void)terminate {
+    for (BDSKFederatedSearchSource *source in sources) {
+        [source cancel];
+        [[source server] terminate];
+    }
+}
+
+// the servers have different search syntaxes
+- (NSFormatter *)searchStringFormatter { return nil; }
+
+#pragma mark Merging results
+
+- (void)source:(BDSKFederatedSearchSource *)source didFindPublications:(NSArray *)pubs {
+    NSMutableArray *newPubs = nil;
+    
+    if (pubs) {
+        newPubs = [NSMutableArray arrayWithCapacity:[pubs count]];
+        for (BibItem *pub in pubs) {
+            NSString *key = duplicateKeyForPublication(pub);
+            if (key == nil || [foundKeys containsObject:key] == NO) {
+                if (key)
+                    [foundKeys addObject:key];
+                [newPubs addObject:pub];
+            }
+        }
+    } else if ([self failedDownload] == NO) {
+        // only this server failed, the group should just redraw
+        newPubs = [NSMutableArray array];
+    }
+    
+    [group addPublications:newPubs];
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKFederatedSearchSource
+
+- (id)initWithFederatedServer:(BDSKFederatedGroupServer *)aServer serverInfo:(BDSKServerInfo *)info {
+    self = [super init];
+    if (self) {
+        federatedServer = aServer;
+        server = [aServer newServerWithGroup:self serverInfo:info];
+        timeoutTimer = nil;
+        isRetrieving = NO;
+        timedOut = NO;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    federatedServer = nil;
+    BDSKDESTROY(server);
+    [super dealloc];
+}
+
+- (id<BDSKSearchGroupServer>)server { return server; }
+
+- (BOOL)isRetrieving { return isRetrieving; }
+
+- (BOOL)failedDownload { return timedOut || [server failedDownload]; }
+
+- (NSString *)errorMessage {
+    return timedOut ? NSLocalizedString(@"The server did not respond in time", @"Error message for federated search") : [server errorMessage];
+}
+
+- (void)finishWithPublications:(NSArray *)pubs {
+    [timeoutTimer invalidate];
+    BDSKDESTROY(timeoutTimer);
+    isRetrieving = NO;
+    [federatedServer source:self didFindPublications:pubs];
+}
+
+- (void)retrieveWithSearchTerm:(NSString *)aSearchTerm timeout:(NSTimeInterval)timeout {
+    [timeoutTimer invalidate];
+    [timeoutTimer release];
+    timeoutTimer = [[NSTimer scheduledTimerWithTimeInterval:timeout target:self selector:@selector(handleTimeout:) userInfo:nil repeats:NO] retain];
+    timedOut = NO;
+    isRetrieving = YES;
+    [server retrieveWithSearchTerm:aSearchTerm];
+    // some servers fail immediately, e.g. when there is no network connection
+    if (isRetrieving && [server isRetrieving] == NO && [server failedDownload])
+        [self finishWithPublications:nil];
+}
+
+- (void)handleTimeout:(NSTimer *)timer {
+    if (isRetrieving) {
+        timedOut = YES;
+        // this stops the running request, if any
+        [server reset];
+        [self finishWithPublications:nil];
+    }
+}
+
+- (void)cancel {
+    [timeoutTimer invalidate];
+    BDSKDESTROY(timeoutTimer);
+    isRetrieving = NO;
+    timedOut = NO;
+}
+
+#pragma mark BDSKSearchGroup protocol
+
+- (void)addPublications:(NSArray *)pubs {
+    // ignore anything that comes in after a timeout or a reset
+    if (isRetrieving == NO)
+        return;
+    // some servers add the results of a page in parts while it is still downloading
+    if (pubs && [server isRetrieving])
+        [federatedServer source:self didFindPublications:pubs];
+    else
+        [self finishWithPublications:pubs];
+}
+
+- (BOOL)isDocument { return NO; }
+
+- (BDSKPublicationsArray *)publications { return [[federatedServer group] publications]; }
+
+- (BDSKMacroResolver *)macroResolver { return [[federatedServer group] macroResolver]; }
+
+- (NSUndoManager *)undoManager { return nil; }
+
+- (NSURL *)fileURL { return nil; }
+
+- (NSString *)documentInfoForKey:(NSString *)key { return nil; }
+
+- (BDSKItemSearchIndexes *)searchIndexes { return [[federatedServer group] searchIndexes]; }
+
+@end
@@ -0,0 +1,194 @@
+//
+//  BDSKFieldDictionary.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKFieldDictionary.h"
+#import "BDSKTypeManager.h"
+
+
+@implementation BDSKFieldDictionary
+
+static inline NSUInteger indexOfFieldID(BDSKFieldEntry *entries, NSUInteger count, NSUInteger fieldID, BOOL *found) {
+    NSUInteger low = 0, high = count, mid;
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (entries[mid].fieldID < fieldID)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *found = (low < count && entries[low].fieldID == fieldID);
+    return low;
+}
+
+- (void)growToCapacity:(NSUInteger)newCapacity {
+    if (newCapacity > capacity) {
+        capacity = MAX(newCapacity, 2 * capacity);
+        if (entries == NULL)
+            entries = (BDSKFieldEntry *)NSZoneMalloc([self zone], capacity * sizeof(BDSKFieldEntry));
+        else
+            entries = (BDSKFieldEntry *)NSZoneRealloc([self zone], entries, capacity * sizeof(BDSKFieldEntry));
+    }
+}
+
+- (id)initWithCapacity:(NSUInteger)numItems {
+    self = [super init];
+    if (self) {
+        count = 0;
+        capacity = 0;
+        entries = NULL;
+        [self growToCapacity:numItems];
+    }
+    return self;
+}
+
+- (id)init {
+    return [self initWithCapacity:0];
+}
+
+- (id)initWithObjects:(id *)objects forKeys:(id *)keys count:(NSUInteger)cnt {
+    self = [self initWithCapacity:cnt];
+    if (self) {
+        NSUInteger i;
+        for (i = 0; i < cnt; i++)
+            [self setObject:objects[i] forKey:keys[i]];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    NSUInteger i;
+    for (i = 0; i < count; i++)
+        [entries[i].value release];
+    BDSKZONEDESTROY(entries);
+    [super dealloc];
+}
+
+// we archive as a normal dictionary, so other versions can read it
+- (Class)classForCoder { return [NSMutableDictionary class]; }
+
+- (Class)classForKeyedArchiver { return [NSMutableDictionary class]; }
+
+- (NSUInteger)count {
+    return count;
+}
+
+- (id)objectForKey:(id)aKey {
+    if (aKey == nil || count == 0)
+        return nil;
+    // don't add unknown keys to the global table
+    NSUInteger fieldID = [BDSKTypeManager existingFieldIDForFieldName:aKey];
+    if (fieldID == NSNotFound)
+        return nil;
+    BOOL found;
+    NSUInteger idx = indexOfFieldID(entries, count, fieldID, &found);
+    return found ? entries[idx].value : nil;
+}
+
+- (NSArray *)allKeys {
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger i;
+    for (i = 0; i < count; i++)
+        [keys addObject:[BDSKTypeManager fieldNameForFieldID:entries[i].fieldID]];
+    return keys;
+}
+
+- (NSArray *)allValues {
+    NSMutableArray *values = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger i;
+    for (i = 0; i < count; i++)
+        [values addObject:entries[i].value];
+    return values;
+}
+
+- (NSEnumerator *)keyEnumerator {
+    return [[self allKeys] objectEnumerator];
+}
+
+- (NSEnumerator *)objectEnumerator {
+    return [[self allValues] objectEnumerator];
+}
+
+- (void)setObject:(id)anObject forKey:(id)aKey {
+    if (anObject == nil || aKey == nil)
+        [NSException raise:NSInvalidArgumentException format:@"*** -[%@ %@]: attempt to insert nil key or value", [self class], NSStringFromSelector(_cmd)];
+    
+    BOOL found;
+    NSUInteger fieldID = [BDSKTypeManager fieldIDForFieldName:aKey];
+    NSUInteger idx = indexOfFieldID(entries, count, fieldID, &found);
+    
+    [anObject retain];
+    if (found) {
+        [entries[idx].value release];
+    } else {
+        [self growToCapacity:count + 1];
+        if (idx < count)
+            memmove(&entries[idx + 1], &entries[idx], (count - idx) * sizeof(BDSKFieldEntry));
+        entries[idx].fieldID = fieldID;
+        count++;
+    }
+    entries[idx].value = anObject;
+}
+
+- (void)removeObjectForKey:(id)aKey {
+    if (aKey == nil || count == 0)
+        return;
+    
+    NSUInteger fieldID = [BDSKTypeManager existingFieldIDForFieldName:aKey];
+    if (fieldID == NSNotFound)
+        return;
+    
+    BOOL found;
+    NSUInteger idx = indexOfFieldID(entries, count, fieldID, &found);
+    
+    if (found) {
+        id value = entries[idx].value;
+        count--;
+        if (idx < count)
+            memmove(&entries[idx], &entries[idx + 1], (count - idx) * sizeof(BDSKFieldEntry));
+        [value release];
+    }
+}
+
+- (void)removeAllObjects {
+    NSUInteger i, oldCount = count;
+    count = 0;
+    for (i = 0; i < oldCount; i++)
+        [entries[i].value release];
+}
+
+@end
@@ -0,0 +1,224 @@
+//
+//  BDSKFileMatchScorer.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKFileMatchScorer.h"
+#import "BDSKTreeNode.h"
+#import "BDSKTextWithIconCell.h"
+
+// a file is a candidate for a publication when it contains the author and at least this fraction of the (weighted) title terms
+#define MIN_TITLE_COVERAGE 0.75
+// terms occurring in more than this fraction of the files do not tell them apart, so they are ignored
+#define MAX_TERM_FREQUENCY 0.5
+
+NSString *BDSKFileMatchTitleTermsKey = @"titleTerms";
+NSString *BDSKFileMatchNameTermsKey = @"nameTerms";
+
+// normalize scores on a per-parent basis
+static void normalizeScoresForItem(BDSKTreeNode *parent, CGFloat maxScore)
+{
+    // nodes are shallow, so we only traverse 1 deep
+    NSUInteger i, iMax = [parent countOfChildren];
+    for (i = 0; i < iMax; i++) {
+        BDSKTreeNode *child = [parent objectInChildrenAtIndex:i];
+        NSNumber *score = [child valueForKey:@"score"];
+        if (score) {
+            CGFloat oldValue = [score doubleValue];
+            double newValue = oldValue/maxScore;
+            [child setValue:[NSNumber numberWithDouble:newValue] forKey:@"score"];
+        }
+    }
+}
+
+@implementation BDSKFileMatchScorer
+
+// reads the postings of all terms up front, so scoring only reads this immutable dictionary and can run on several threads
+- (id)initWithIndex:(SKIndexRef)anIndex terms:(NSSet *)terms;
+{
+    self = [super init];
+    if (self) {
+        searchIndex = (SKIndexRef)CFRetain(anIndex);
+        documentCount = SKIndexGetDocumentCount(searchIndex);
+        maxDocumentID = SKIndexGetMaximumDocumentID(searchIndex);
+        
+        NSMutableDictionary *termPostings = [[NSMutableDictionary alloc] initWithCapacity:[terms count]];
+        for (NSString *term in terms) {
+            CFIndex termID = SKIndexGetTermIDForTermString(searchIndex, (CFStringRef)term);
+            CFArrayRef docIDs = (termID > 0 && termID != kCFNotFound) ? SKIndexCopyDocumentIDArrayForTermID(searchIndex, termID) : NULL;
+            CFIndex i, count = docIDs ? CFArrayGetCount(docIDs) : 0;
+            NSMutableData *data = [[NSMutableData alloc] initWithLength:count * sizeof(SKDocumentID)];
+            SKDocumentID *ids = (SKDocumentID *)[data mutableBytes];
+            for (i = 0; i < count; i++)
+                CFNumberGetValue(CFArrayGetValueAtIndex(docIDs, i), kCFNumberCFIndexType, &ids[i]);
+            [termPostings setObject:data forKey:term];
+            [data release];
+            if (docIDs)
+                CFRelease(docIDs);
+        }
+        postings = termPostings;
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    BDSKCFDESTROY(searchIndex);
+    BDSKDESTROY(postings);
+    [super dealloc];
+}
+
+// called on an operation queue; only touches the nodes passed in, which nobody else touches until the operation is done
+- (void)scoreTreeNodes:(NSArray *)nodes;
+{
+    NSAutoreleasePool *pool = [NSAutoreleasePool new];
+    
+    // accumulated scores by document ID, plus the list of IDs we touched so we can reset them for the next node
+    NSUInteger numberOfIDs = maxDocumentID + 1;
+    double *scores = (double *)NSZoneCalloc(NULL, numberOfIDs, sizeof(double));
+    NSUInteger *nameCounts = (NSUInteger *)NSZoneCalloc(NULL, numberOfIDs, sizeof(NSUInteger));
+    SKDocumentID *touched = (SKDocumentID *)NSZoneMalloc(NULL, numberOfIDs * sizeof(SKDocumentID));
+    NSSortDescriptor *sort = [[NSSortDescriptor alloc] initWithKey:@"score" ascending:YES];
+    NSArray *sortDescriptors = [[NSArray alloc] initWithObjects:sort, nil];
+    double maxFrequency = MAX_TERM_FREQUENCY * documentCount;
+    
+    for (BDSKTreeNode *node in nodes) {
+        
+        NSArray *nameTerms = [node valueForKey:BDSKFileMatchNameTermsKey];
+        NSUInteger numberOfTouched = 0, numberOfNameTerms = 0;
+        double totalWeight = 0.0, maxScore = 0.0;
+        NSData *data;
+        NSUInteger i, count;
+        const SKDocumentID *ids;
+        
+        for (NSString *term in [node valueForKey:BDSKFileMatchTitleTermsKey]) {
+            data = [postings objectForKey:term];
+            count = [data length] / sizeof(SKDocumentID);
+            // very common terms are like stop words
+            if (count > maxFrequency && documentCount > 1)
+                continue;
+            // rare terms weigh more; terms that are in no file count against every file
+            double weight = log((double)(documentCount + 1) / (double)(count + 1)) + 1.0;
+            totalWeight += weight;
+            ids = (const SKDocumentID *)[data bytes];
+            for (i = 0; i < count; i++) {
+                if (ids[i] < 0 || (NSUInteger)ids[i] >= numberOfIDs)
+                    continue;
+                if (scores[ids[i]] == 0.0)
+                    touched[numberOfTouched++] = ids[i];
+                scores[ids[i]] += weight;
+            }
+        }
+        
+        // like the AND in the search string, the author's name should be in the file
+        for (NSString *term in nameTerms) {
+            data = [postings objectForKey:term];
+            count = [data length] / sizeof(SKDocumentID);
+            ids = (const SKDocumentID *)[data bytes];
+            for (i = 0; i < count; i++) {
+                if (ids[i] >= 0 && (NSUInteger)ids[i] < numberOfIDs)
+                    nameCounts[ids[i]]++;
+            }
+            numberOfNameTerms++;
+        }
+        
+        NSMutableArray *candidates = [NSMutableArray array];
+        for (i = 0; i < numberOfTouched; i++) {
+            SKDocumentID docID = touched[i];
+            double score = scores[docID] / totalWeight;
+            if (score >= MIN_TITLE_COVERAGE && nameCounts[docID] == numberOfNameTerms) {
+                [candidates addObject:[NSNumber numberWithLong:docID]];
+                maxScore = MAX(maxScore, score);
+            }
+        }
+        
+        NSUInteger numberOfCandidates = [candidates count];
+        if (numberOfCandidates) {
+            SKDocumentID *docIDs = (SKDocumentID *)NSZoneMalloc(NULL, numberOfCandidates * sizeof(SKDocumentID));
+            CFURLRef *urls = (CFURLRef *)NSZoneMalloc(NULL, numberOfCandidates * sizeof(CFURLRef));
+            NSString *searchString = [node valueForKey:@"searchString"];
+            NSMutableArray *children = [node mutableArrayValueForKey:@"children"];
+            
+            for (i = 0; i < numberOfCandidates; i++)
+                docIDs[i] = [[candidates objectAtIndex:i] longValue];
+            SKIndexCopyDocumentURLsForDocumentIDs(searchIndex, numberOfCandidates, docIDs, urls);
+            
+            // now we have a matching file; we could remove it from the index, but multiple matches are reasonable
+            for (i = 0; i < numberOfCandidates; i++) {
+                if (urls[i] == NULL)
+                    continue;
+                BDSKTreeNode *child = [[BDSKTreeNode alloc] init];
+                [child setValue:(id)urls[i] forKey:@"fileURL"];
+                [child setValue:[[(id)urls[i] path] stringByAbbreviatingWithTildeInPath] forKey:BDSKTextWithIconStringKey];
+                [child setValue:[[NSWorkspace sharedWorkspace] iconForFile:[(NSURL *)urls[i] path]] forKey:BDSKTextWithIconImageKey];
+                [child setValue:searchString forKey:@"searchString"];
+                [child setValue:[NSNumber numberWithDouble:scores[docIDs[i]] / totalWeight] forKey:@"score"];
+                [children addObject:child];
+                [child release];
+                CFRelease(urls[i]);
+            }
+            
+            NSZoneFree(NULL, docIDs);
+            NSZoneFree(NULL, urls);
+            
+            normalizeScoresForItem(node, maxScore);
+            [node setValue:[NSString stringWithFormat:@"%ld", (long)[node countOfChildren]] forKey:@"score"];
+            [children sortUsingDescriptors:sortDescriptors];
+        }
+        
+        // reset the accumulators for the next node
+        for (i = 0; i < numberOfTouched; i++)
+            scores[touched[i]] = 0.0;
+        for (NSString *term in nameTerms) {
+            data = [postings objectForKey:term];
+            count = [data length] / sizeof(SKDocumentID);
+            ids = (const SKDocumentID *)[data bytes];
+            for (i = 0; i < count; i++) {
+                if (ids[i] >= 0 && (NSUInteger)ids[i] < numberOfIDs)
+                    nameCounts[ids[i]] = 0;
+            }
+        }
+    }
+    
+    [sort release];
+    [sortDescriptors release];
+    NSZoneFree(NULL, scores);
+    NSZoneFree(NULL, nameCounts);
+    NSZoneFree(NULL, touched);
+    [pool release];
+}
+
+@end
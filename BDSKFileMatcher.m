@@ -54,10 +54,15 @@
 #import "NSParagraphStyle_BDSKExtensions.h"
 #import "NSInvocation_BDSKExtensions.h"
 #import "NSWindowController_BDSKExtensions.h"
+#import "BDSKTextExtractionCache.h"
+#import "BDSKFileMatchScorer.h"
 
 #define BDSKShouldLogFilesAddedToMatchingSearchIndexKey @"BDSKShouldLogFilesAddedToMatchingSearchIndex"
 
-#define MAX_SEARCHKIT_RESULTS 10
+// publications are scored in parallel in chunks of this size, and added to the results in batches
+#define SCORE_CHUNK_SIZE 16
+#define SCORE_BATCH_SIZE 256
+
 static CGFloat LEAF_ROW_HEIGHT = 20.0;
 static CGFloat GROUP_ROW_HEIGHT = 24.0;
 
@@ -394,6 +399,21 @@ static NSString *searchStringWithPub(BibItem *pub)
     return searchString;
 }
 
+// the same tokenization as SearchKit uses by default: terms are lowercase runs of letters and numbers
+static NSArray *termsWithString(NSString *string)
+{
+    static NSCharacterSet *separatorSet = nil;
+    if (separatorSet == nil)
+        separatorSet = [[[NSCharacterSet alphanumericCharacterSet] invertedSet] copy];
+    NSMutableArray *terms = [NSMutableArray array];
+    for (NSString *term in [[string lowercaseString] componentsSeparatedByCharactersInSet:separatorSet]) {
+        // single characters match almost anything
+        if ([term length] > 1 && [terms containsObject:term] == NO)
+            [terms addObject:term];
+    }
+    return terms;
+}
+
 static NSString *titleStringWithPub(BibItem *pub)
 {
     return [NSString stringWithFormat:@"%@ (%@)", [pub displayTitle], [pub pubAuthorsForDisplay]];
@@ -414,6 +434,8 @@ static NSString *titleStringWithPub(BibItem *pub)
         // grab these strings on the main thread, since we need them in the worker thread
         [theNode setValue:titleStringWithPub(pub)  forKey:BDSKTextWithIconStringKey];
         [theNode setValue:searchStringWithPub(pub) forKey:@"searchString"];
+        [theNode setValue:termsWithString([[pub title] stringByRemovingTeX]) forKey:BDSKFileMatchTitleTermsKey];
+        [theNode setValue:termsWithString([[pub firstAuthorOrEditor] lastName]) forKey:BDSKFileMatchNameTermsKey];
 
         [theNode setValue:[NSImage imageNamed:@"cacheDoc"] forKey:BDSKTextWithIconImageKey];
 
@@ -423,23 +445,8 @@ static NSString *titleStringWithPub(BibItem *pub)
     return nodes;
 }
 
-// normalize scores on a per-parent basis
-static void normalizeScoresForItem(BDSKTreeNode *parent, CGFloat maxScore)
-{
-    // nodes are shallow, so we only traverse 1 deep
-    NSUInteger i, iMax = [parent countOfChildren];
-    for (i = 0; i < iMax; i++) {
-        BDSKTreeNode *child = [parent objectInChildrenAtIndex:i];
-        NSNumber *score = [child valueForKey:@"score"];
-        if (score) {
-            CGFloat oldValue = [score doubleValue];
-            double newValue = oldValue/maxScore;
-            [child setValue:[NSNumber numberWithDouble:newValue] forKey:@"score"];
-        }
-    }
-}
-
 // this method iterates available publications, trying to match them up with a file
+// rather than running a SearchKit query for each publication, the postings of all title and author terms are read from the index once, and the publications are scored against them in parallel
 - (void)doSearch;
 {
     // get the root nodes array on the main thread, since it uses BibItem methods
@@ -457,75 +464,47 @@ static void normalizeScoresForItem(BDSKTreeNode *parent, CGFloat maxScore)
     [self performSelectorOnMainThread:@selector(updateProgressIndicatorWithNumber:) withObject:[NSNumber numberWithDouble:(1.0)] waitUntilDone:NO];
     [statusField performSelectorOnMainThread:@selector(setStringValue:) withObject:[NSLocalizedString(@"Searching document", @"") stringByAppendingEllipsis] waitUntilDone:NO];
 
-    double val = 0;
-    double max = [treeNodes count];
-    
+    NSMutableSet *terms = [NSMutableSet set];
     for (BDSKTreeNode *node in treeNodes) {
+        [terms addObjectsFromArray:[node valueForKey:BDSKFileMatchTitleTermsKey]];
+        [terms addObjectsFromArray:[node valueForKey:BDSKFileMatchNameTermsKey]];
+    }
     
-        if (_matchFlags.shouldAbortThread) break;
+    BDSKFileMatchScorer *scorer = [[BDSKFileMatchScorer alloc] initWithIndex:searchIndex terms:terms];
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    [queue setMaxConcurrentOperationCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+    
+    NSUInteger i, iMax = [treeNodes count], j, jMax;
+    
+    for (i = 0; i < iMax && 0 == _matchFlags.shouldAbortThread; i += SCORE_BATCH_SIZE) {
         
         NSAutoreleasePool *pool = [NSAutoreleasePool new];
         
-        NSString *searchString = [node valueForKey:@"searchString"];
-        
-        SKSearchRef search = SKSearchCreate(searchIndex, (CFStringRef)searchString, kSKSearchOptionDefault);
-        
-        // if we get more than 10 matches back per pub, the results will be pretty useless anyway
-        SKDocumentID docID[MAX_SEARCHKIT_RESULTS];
-        float scores[MAX_SEARCHKIT_RESULTS];
-        
-        CFIndex numFound;
+        NSArray *batch = [treeNodes subarrayWithRange:NSMakeRange(i, MIN(SCORE_BATCH_SIZE, iMax - i))];
+        NSMutableArray *operations = [NSMutableArray array];
         
-        Boolean moreToFind;
-        float thisScore, maxScore = 0.0f;
+        for (j = 0, jMax = [batch count]; j < jMax; j += SCORE_CHUNK_SIZE) {
+            NSArray *chunk = [batch subarrayWithRange:NSMakeRange(j, MIN(SCORE_CHUNK_SIZE, jMax - j))];
+            NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:scorer selector:@selector(scoreTreeNodes:) object:chunk];
+            [operations addObject:operation];
+            [operation release];
+        }
+        [queue addOperations:operations waitUntilFinished:YES];
         
-        do {
-            
-            moreToFind = SKSearchFindMatches(search, MAX_SEARCHKIT_RESULTS, docID, scores, (CFTimeInterval)(MAX_SEARCHKIT_RESULTS/2.0), &numFound);
-            
-            if (numFound) {
-                
-                CFURLRef urls[MAX_SEARCHKIT_RESULTS];
-                SKIndexCopyDocumentURLsForDocumentIDs(searchIndex, numFound, docID, urls);
-                
-                NSInteger i, iMax = numFound;
-                
-                // now we have a matching file; we could remove it from the index, but multiple matches are reasonable
-                for (i =  0; i < iMax; i++) {
-                    BDSKTreeNode *child = [[BDSKTreeNode alloc] init];
-                    [child setValue:(id)urls[i] forKey:@"fileURL"];
-                    [child setValue:[[(id)urls[i] path] stringByAbbreviatingWithTildeInPath] forKey:BDSKTextWithIconStringKey];
-                    [child setValue:[[NSWorkspace sharedWorkspace] iconForFile:[(NSURL *)urls[i] path]] forKey:BDSKTextWithIconImageKey];
-                    [child setValue:searchString forKey:@"searchString"];
-                    thisScore = scores[i];
-                    maxScore = MAX(maxScore, thisScore);
-                    [child setValue:[NSNumber numberWithDouble:thisScore] forKey:@"score"];
-                    [[node mutableArrayValueForKey:@"children"] addObject:child];
-                    [child release];
-                    CFRelease(urls[i]);
-                }
+        // add the results in the order of the publications
+        for (BDSKTreeNode *node in batch) {
+            if ([node countOfChildren])
                 [matches addObject:node];
-            }
-            
-        } while (numFound && moreToFind);
-        
-        SKSearchCancel(search);
-        CFRelease(search);
-        
-        normalizeScoresForItem(node, maxScore);
-        [node setValue:[NSString stringWithFormat:@"%ld", (long)[node countOfChildren]] forKey:@"score"];
-        NSSortDescriptor *sort = [[NSSortDescriptor alloc] initWithKey:@"score" ascending:YES];
-        NSArray *sortDescriptors = [[NSArray alloc] initWithObjects:sort, nil];
-        [[node mutableArrayValueForKey:@"children"] sortUsingDescriptors:sortDescriptors];
-        [sort release];
-        [sortDescriptors release];
+        }
         
-        val++;
         [outlineView performSelectorOnMainThread:@selector(reloadData) withObject:nil waitUntilDone:NO];
-        [self performSelectorOnMainThread:@selector(updateProgressIndicatorWithNumber:) withObject:[NSNumber numberWithDouble:(val/max)] waitUntilDone:NO];
+        [self performSelectorOnMainThread:@selector(updateProgressIndicatorWithNumber:) withObject:[NSNumber numberWithDouble:((double)(i + [batch count]) / iMax)] waitUntilDone:NO];
         [pool release];
     }
     
+    [queue release];
+    [scorer release];
+    
     if (0 == _matchFlags.shouldAbortThread) {
         [self performSelectorOnMainThread:@selector(updateProgressIndicatorWithNumber:) withObject:[NSNumber numberWithDouble:(1.0)] waitUntilDone:NO];
         [statusField performSelectorOnMainThread:@selector(setStringValue:) withObject:NSLocalizedString(@"Search complete!", @"") waitUntilDone:NO];
@@ -590,7 +569,11 @@ static void normalizeScoresForItem(BDSKTreeNode *parent, CGFloat maxScore)
             NSLog(@"%@", url);
         
         if (doc) {
-            SKIndexAddDocument(searchIndex, doc, NULL, TRUE);
+            NSString *text = [[BDSKTextExtractionCache sharedCache] textForFileURL:url];
+            if (text)
+                SKIndexAddDocumentWithText(searchIndex, doc, (CFStringRef)text, TRUE);
+            else
+                SKIndexAddDocument(searchIndex, doc, NULL, TRUE);
             CFRelease(doc);
         }
         // forcing a redisplay at every step is ok since adding documents to the index is pretty slow
@@ -130,41 +130,28 @@
     [[progressBar superview] replaceSubview:progressBar with:newProgressBar];
     progressBar = newProgressBar;
 
-    [progressBar setDoubleValue:0.0];
-    [progressBar setMaxValue:[pubs count]];
+    // the publications are migrated in a single batch, so we can't show the progress per item
+    // the main thread blocks while the files are resolved, so the bar needs to animate on its own thread; the copy may not keep this
+    [progressBar setUsesThreadedAnimation:YES];
+    [progressBar setIndeterminate:YES];
     [progressBar setHidden:NO];
+    [progressBar startAnimation:nil];
     [migrateButton setEnabled:NO];
+    [statusField setStringValue:[NSString stringWithFormat:NSLocalizedString(@"Converting %ld items%@", @"Status message"), (long)[pubs count], [NSString horizontalEllipsisString]]];
+    [[self window] displayIfNeeded];
     
-    NSInteger current = 0, final = [pubs count];
-    NSInteger numberOfAddedFiles = 0, numberOfRemovedFields = 0, addedFiles, removedFields;
+    NSInteger numberOfAddedFiles = 0, numberOfRemovedFields = 0;
     NSInteger mask = BDSKRemoveNoFields;
     if (keepLocalFileFields == NO)
         mask |= BDSKRemoveLocalFileFieldsMask;
     if (keepRemoteURLFields == NO)
         mask |= BDSKRemoveRemoteURLFieldsMask;
-        
-    for (BibItem *aPub in pubs) {
-        
-        // Causes the progress bar and other UI to update
-        if ((current++ % 5) == 0)
-            [[self window] displayIfNeeded];
-        
-        NSError *error;
-        if (NO == [aPub migrateFilesWithRemoveOptions:mask numberOfAddedFiles:&addedFiles numberOfRemovedFields:&removedFields error:&error]) {
-            NSArray *messages = [error valueForKey:@"messages"];
-            for (NSDictionary *dict in messages) {
-                NSMutableDictionary *displayDict = [dict mutableCopy];
-                [displayDict setObject:aPub forKey:@"publication"];
-                [observedResults addObject:displayDict];
-                [displayDict release];
-            }
-        }
-        numberOfAddedFiles += addedFiles;
-        numberOfRemovedFields += removedFields;
-        [progressBar incrementBy:1.0];
-        [statusField setStringValue:[NSString stringWithFormat:NSLocalizedString(@"%ld of %ld", @"Status message"), (long)current, (long)final]];
-    }
     
+    NSError *error;
+    if (NO == [BibItem migrateFilesForPublications:pubs withRemoveOptions:mask numberOfAddedFiles:&numberOfAddedFiles numberOfRemovedFields:&numberOfRemovedFields error:&error])
+        [observedResults addObjectsFromArray:[error valueForKey:@"messages"]];
+    
+    [progressBar stopAnimation:nil];
     [progressBar setHidden:YES];
     [migrateButton setEnabled:YES];
     
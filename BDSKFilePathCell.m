@@ -39,6 +39,7 @@
 #import "BDSKFilePathCell.h"
 #import "NSImage_BDSKExtensions.h"
 #import "NSFileManager_BDSKExtensions.h"
+#import "BDSKFileStatusCache.h"
 
 
 @implementation BDSKFilePathCell
@@ -57,11 +58,11 @@
     NSImage *image = nil;
     if ([(id)obj isKindOfClass:[NSString class]]) {
         NSString *path = [(NSString *)obj stringByStandardizingPath];
-        if(path && [[NSFileManager defaultManager] fileExistsAtPath:path])
-            image = [[NSWorkspace sharedWorkspace] iconForFile:path];
+        if(path)
+            image = [[BDSKFileStatusCache sharedCache] iconForURL:[NSURL fileURLWithPath:path]];
     } else if ([(id)obj isKindOfClass:[NSURL class]]) {
         NSURL *fileURL = (NSURL *)obj;
-        if([[NSFileManager defaultManager] objectExistsAtFileURL:fileURL])
+        if([[BDSKFileStatusCache sharedCache] fileExistsAtURL:fileURL])
             image = [NSImage imageForURL:fileURL];
     }
     return image;
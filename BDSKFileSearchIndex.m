@@ -46,6 +46,7 @@
 #import "NSArray_BDSKExtensions.h"
 #import "UKDirectoryEnumerator.h"
 #import "BDSKReadWriteLock.h"
+#import "BDSKTextExtractionCache.h"
 
 #define BDSKDisableFileSearchIndexCacheKey @"BDSKDisableFileSearchIndexCacheKey"
 
@@ -214,8 +215,8 @@
 
 // this can return any object conforming to NSCoding
 static inline id signatureForURL(NSURL *aURL) {
-    // Use the SHA1 signature if we can get it
-    id signature = [NSData sha1SignatureForFile:[aURL path]];
+    // Use the SHA1 signature if we can get it, the cache only reads the file when it changed
+    id signature = [[BDSKTextExtractionCache sharedCache] signatureForFileURL:aURL];
     if (signature == nil) {
         // this could happen for packages, use a timestamp instead
         FSRef fileRef;
@@ -373,7 +374,12 @@ static inline BOOL isIndexCacheForDocumentURL(NSString *path, NSURL *documentURL
             BDSKASSERT(signature);
             [signatures setObject:signature forKey:aURL];
             
-            SKIndexAddDocument(skIndex, skDocument, NULL, TRUE);
+            // the extracted text is shared with the other indexes, so files are only extracted once
+            NSString *text = [[BDSKTextExtractionCache sharedCache] textForFileURL:aURL signature:[signature isKindOfClass:[NSData class]] && [signature length] ? signature : nil];
+            if (text)
+                SKIndexAddDocumentWithText(skIndex, skDocument, (CFStringRef)text, TRUE);
+            else
+                SKIndexAddDocument(skIndex, skDocument, NULL, TRUE);
             CFRelease(skDocument);
         }
     }
@@ -0,0 +1,66 @@
+//
+//  BDSKFileStatusCache.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+extern NSString *BDSKFileStatusDidChangeNotification;
+extern NSString *BDSKFileStatusDirectoriesKey;
+
+// Keeps the status of files in memory, such as existence, modification date, size and icon, so drawing and filtering don't need to go to the file system.
+// The directories of the files are watched using BDSKDirectoryWatcher, the entries for a changed directory are removed and a coalesced notification is posted.
+// When the cache grows too large, the entries for some directories are evicted and those directories are no longer watched.
+// Should only be used from the main thread.
+@interface BDSKFileStatusCache : NSObject {
+    NSMutableDictionary *entries;
+    NSMutableDictionary *pathsForDirectories;
+    NSMutableSet *changedDirectories;
+}
+
++ (id)sharedCache;
+
+// the URL with Finder aliases resolved, or nil when the file does not exist; remote URLs are returned as is
+- (NSURL *)resolvedURLForURL:(NSURL *)aURL;
+- (BOOL)fileExistsAtURL:(NSURL *)aURL;
+
+- (NSDate *)modificationDateForURL:(NSURL *)aURL;
+- (unsigned long long)fileSizeForURL:(NSURL *)aURL;
+
+// icon for the resolved file, or nil when the file does not exist
+- (NSImage *)iconForURL:(NSURL *)aURL;
+
+@end
@@ -0,0 +1,267 @@
+//
+//  BDSKFileStatusCache.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKFileStatusCache.h"
+#import "BDSKDirectoryWatcher.h"
+#import "NSURL_BDSKExtensions.h"
+#import "NSImage_BDSKExtensions.h"
+
+NSString *BDSKFileStatusDidChangeNotification = @"BDSKFileStatusDidChangeNotification";
+NSString *BDSKFileStatusDirectoriesKey = @"directories";
+
+#define COALESCE_DELAY 0.1
+
+// when either is reached, we evict directories until we're below half of them
+#define MAX_ENTRY_COUNT 10000
+#define MAX_DIRECTORY_COUNT 1000
+
+@interface BDSKFileStatus : NSObject {
+    NSURL *resolvedURL;
+    NSDate *modificationDate;
+    unsigned long long fileSize;
+    NSImage *icon;
+}
+- (id)initWithURL:(NSURL *)aURL;
+- (NSURL *)resolvedURL;
+- (NSDate *)modificationDate;
+- (unsigned long long)fileSize;
+- (NSImage *)icon;
+@end
+
+@interface BDSKFileStatusCache (Private)
+- (BDSKFileStatus *)statusForURL:(NSURL *)aURL;
+- (void)addPath:(NSString *)path forDirectory:(NSString *)directory;
+- (void)removeDirectory:(NSString *)directory;
+- (void)evictEntries;
+- (void)postChangeNotification;
+- (void)handleDirectoriesDidChangeNotification:(NSNotification *)notification;
+@end
+
+@implementation BDSKFileStatusCache
+
++ (id)sharedCache {
+    static BDSKFileStatusCache *sharedCache = nil;
+    if (sharedCache == nil)
+        sharedCache = [[self alloc] init];
+    return sharedCache;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        entries = [[NSMutableDictionary alloc] init];
+        pathsForDirectories = [[NSMutableDictionary alloc] init];
+        changedDirectories = [[NSMutableSet alloc] init];
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(handleDirectoriesDidChangeNotification:) name:BDSKDirectoryWatcherDirectoriesDidChangeNotification object:[BDSKDirectoryWatcher sharedWatcher]];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+    for (NSString *directory in pathsForDirectories)
+        [[BDSKDirectoryWatcher sharedWatcher] unwatchDirectory:directory];
+    BDSKDESTROY(entries);
+    BDSKDESTROY(pathsForDirectories);
+    BDSKDESTROY(changedDirectories);
+    [super dealloc];
+}
+
+- (NSURL *)resolvedURLForURL:(NSURL *)aURL {
+    if ([aURL isFileURL] == NO)
+        return aURL;
+    return [[self statusForURL:aURL] resolvedURL];
+}
+
+- (BOOL)fileExistsAtURL:(NSURL *)aURL {
+    return [[self statusForURL:aURL] resolvedURL] != nil;
+}
+
+- (NSDate *)modificationDateForURL:(NSURL *)aURL {
+    return [[self statusForURL:aURL] modificationDate];
+}
+
+- (unsigned long long)fileSizeForURL:(NSURL *)aURL {
+    return [[self statusForURL:aURL] fileSize];
+}
+
+- (NSImage *)iconForURL:(NSURL *)aURL {
+    if ([aURL isFileURL] == NO)
+        return [NSImage imageForURL:aURL];
+    return [[self statusForURL:aURL] icon];
+}
+
+@end
+
+@implementation BDSKFileStatusCache (Private)
+
+- (BDSKFileStatus *)statusForURL:(NSURL *)aURL {
+    BDSKASSERT([NSThread isMainThread]);
+    
+    NSString *path = [aURL isFileURL] ? [aURL path] : nil;
+    if (path == nil)
+        return nil;
+    
+    BDSKFileStatus *status = [entries objectForKey:path];
+    if (status == nil) {
+        if ([entries count] >= MAX_ENTRY_COUNT || [pathsForDirectories count] >= MAX_DIRECTORY_COUNT)
+            [self evictEntries];
+        
+        status = [[BDSKFileStatus alloc] initWithURL:aURL];
+        [entries setObject:status forKey:path];
+        [status release];
+        
+        // watch the directory of the file, and the directory of the resolved file when it was an alias
+        [self addPath:path forDirectory:[path stringByDeletingLastPathComponent]];
+        NSString *resolvedPath = [[status resolvedURL] path];
+        if (resolvedPath && [resolvedPath isEqualToString:path] == NO)
+            [self addPath:path forDirectory:[resolvedPath stringByDeletingLastPathComponent]];
+    }
+    return status;
+}
+
+// the directory is keyed by its real path, as that's what the watcher reports
+// we keep a single watch for every directory in pathsForDirectories
+- (void)addPath:(NSString *)path forDirectory:(NSString *)directory {
+    directory = [[BDSKDirectoryWatcher sharedWatcher] watchDirectory:directory];
+    NSMutableSet *paths = [pathsForDirectories objectForKey:directory];
+    if (paths == nil) {
+        paths = [[NSMutableSet alloc] init];
+        [pathsForDirectories setObject:paths forKey:directory];
+        [paths release];
+    } else {
+        [[BDSKDirectoryWatcher sharedWatcher] unwatchDirectory:directory];
+    }
+    [paths addObject:path];
+}
+
+- (void)removeDirectory:(NSString *)directory {
+    NSSet *paths = [pathsForDirectories objectForKey:directory];
+    if (paths) {
+        [entries removeObjectsForKeys:[paths allObjects]];
+        [pathsForDirectories removeObjectForKey:directory];
+        [[BDSKDirectoryWatcher sharedWatcher] unwatchDirectory:directory];
+    }
+}
+
+// we have no access order, so directories that changed and have no entries left go first, then any others
+- (void)evictEntries {
+    NSArray *directories = [pathsForDirectories allKeys];
+    for (NSString *directory in directories) {
+        if ([[pathsForDirectories objectForKey:directory] count] == 0)
+            [self removeDirectory:directory];
+    }
+    for (NSString *directory in directories) {
+        if ([entries count] <= MAX_ENTRY_COUNT / 2 && [pathsForDirectories count] <= MAX_DIRECTORY_COUNT / 2)
+            break;
+        [self removeDirectory:directory];
+    }
+}
+
+- (void)postChangeNotification {
+    NSArray *directories = [changedDirectories allObjects];
+    [changedDirectories removeAllObjects];
+    [[NSNotificationCenter defaultCenter] postNotificationName:BDSKFileStatusDidChangeNotification object:self userInfo:[NSDictionary dictionaryWithObjectsAndKeys:directories, BDSKFileStatusDirectoriesKey, nil]];
+}
+
+- (void)handleDirectoriesDidChangeNotification:(NSNotification *)notification {
+    NSArray *directories = [[notification userInfo] objectForKey:BDSKDirectoryWatcherDirectoriesKey];
+    
+    // we keep watching the directory, as its files are usually asked for again right away
+    for (NSString *directory in directories) {
+        NSMutableSet *paths = [pathsForDirectories objectForKey:directory];
+        if (paths) {
+            [entries removeObjectsForKeys:[paths allObjects]];
+            [paths removeAllObjects];
+        }
+    }
+    
+    if ([directories count]) {
+        // the watcher also watches directories for others, we pass on all changes so observers only need to observe us
+        if ([changedDirectories count] == 0)
+            [self performSelector:@selector(postChangeNotification) withObject:nil afterDelay:COALESCE_DELAY];
+        [changedDirectories addObjectsFromArray:directories];
+    }
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKFileStatus
+
+- (id)initWithURL:(NSURL *)aURL {
+    self = [super init];
+    if (self) {
+        resolvedURL = [[aURL fileURLByResolvingAliases] retain];
+        NSDictionary *attributes = resolvedURL ? [[NSFileManager defaultManager] attributesOfItemAtPath:[resolvedURL path] error:NULL] : nil;
+        modificationDate = [[attributes fileModificationDate] retain];
+        fileSize = [attributes fileSize];
+        icon = nil;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(resolvedURL);
+    BDSKDESTROY(modificationDate);
+    BDSKDESTROY(icon);
+    [super dealloc];
+}
+
+- (NSURL *)resolvedURL {
+    return resolvedURL;
+}
+
+- (NSDate *)modificationDate {
+    return modificationDate;
+}
+
+- (unsigned long long)fileSize {
+    return fileSize;
+}
+
+// the icon is only needed for drawing, so we get it lazily
+- (NSImage *)icon {
+    if (icon == nil && resolvedURL)
+        icon = [[NSImage imageForURL:resolvedURL] retain];
+    return icon;
+}
+
+@end
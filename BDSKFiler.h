@@ -68,10 +68,42 @@ typedef NSUInteger BDSKFilerOptions;
 
 @interface BDSKFiler : NSWindowController {
 	IBOutlet NSProgressIndicator *progressIndicator;
+    NSOperationQueue *moveQueue;
 }
 
 + (BDSKFiler *)sharedFiler;
 
+/*!
+	@method		recoverInterruptedMoves
+	@abstract	Moves back files from a batch of moves that was interrupted, e.g. by a crash.
+	@discussion	Batches of moves are journaled, so the files can be put back where the saved documents expect them. 
+This should be called once at launch. 
+*/
++ (void)recoverInterruptedMoves;
+
+/*!
+	@method		recoverMovesFromJournalAtPath:
+	@abstract	Moves back files from the journal at journalPath, and removes the journal.
+	@discussion	Only items that are still the ones that were moved are moved back, and only when nothing took their original location. 
+A journal that cannot be read is removed without moving anything. 
+*/
++ (void)recoverMovesFromJournalAtPath:(NSString *)journalPath;
+
+/*!
+	@method		writeJournalForMovesFromPaths:toPaths:atPath:
+	@abstract	Writes a journal for the planned moves, recording the identity of the items at oldPaths.
+	@discussion	-
+*/
++ (void)writeJournalForMovesFromPaths:(NSArray *)oldPaths toPaths:(NSArray *)newPaths atPath:(NSString *)journalPath;
+
+/*!
+	@method		indexesOfIndependentMovesFromPaths:toPaths:
+	@abstract	Returns the indexes of the moves that can be done concurrently.
+	@discussion	A move is independent when its target is neither claimed by an earlier move nor the source of another move. 
+Paths are compared ignoring case and Unicode normalization, as the volume may do so. 
+*/
++ (NSIndexSet *)indexesOfIndependentMovesFromPaths:(NSArray *)oldPaths toPaths:(NSArray *)newPaths;
+
 /*!
 	@method		autoFileLinkedFiles:fromDocument:doc:check:
 	@abstract	Main auto-file routine to file papers in the Papers folder according to a generated location.
@@ -97,6 +129,7 @@ Aliases and symlinks are moved unresolved. Relative paths in symlinks will be ma
 BDSKInitialAutoFileOptionMask should be used for initial autofile moves, the new path will be generated. 
 BDSKCheckCompleteAutoFileOptionMask indicates that for initial moves a check will be done whether all required fields are set. 
 BDSKForceAutoFileOptionMask forces AutoFiling, even if there may be problems moving the file. 
+When moving several papers, all target paths are generated first, and papers that do not compete for a location are moved concurrently. 
 */
 - (BOOL)movePapers:(NSArray *)paperInfos forField:(NSString *)field fromDocument:(BibDocument *)doc options:(BDSKFilerOptions)masks;
 
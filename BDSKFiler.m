@@ -46,6 +46,7 @@
 #import "BDSKPreferenceController.h"
 #import "BDSKFilerErrorController.h"
 #import "NSString_BDSKExtensions.h"
+#include <sys/stat.h>
 
 #define BDSKFilerErrorDomain @"BDSKFilerErrorDomain"
 
@@ -57,6 +58,32 @@ NSString *BDSKFilerStatusKey = @"status";
 NSString *BDSKFilerFlagKey = @"flag";
 NSString *BDSKFilerFixKey = @"fix";
 
+#define MOVE_INFO_KEY       @"info"
+#define MOVE_OLDPATH_KEY    @"oldPath"
+#define MOVE_NEWPATH_KEY    @"newPath"
+#define MOVE_FORCE_KEY      @"force"
+#define MOVE_ERROR_KEY      @"error"
+
+#define JOURNAL_DEVICE_KEY  @"device"
+#define JOURNAL_INODE_KEY   @"inode"
+#define JOURNAL_SIZE_KEY    @"size"
+#define JOURNAL_DATE_KEY    @"modificationDate"
+
+// moves are done concurrently in batches of this size, the progress is updated between batches
+#define MOVE_BATCH_SIZE 64
+#define PROGRESS_INTERVAL 64
+
+// private error code, used when a folder move needs to be confirmed on the main thread
+#define BDSKFolderMoveNeedsConfirmationErrorMask (1 << 16)
+
+@interface NSFileManager (BDSKPrivateFilerExtensions)
+- (BOOL)movePath:(NSString *)path toPath:(NSString *)newPath force:(BOOL)force confirmFolderMove:(BOOL)confirm error:(NSError **)error;
+@end
+
+@interface BDSKFiler (BDSKPrivate)
++ (NSString *)journalPath;
+@end
+
 @implementation BDSKFiler
 
 static BDSKFiler *sharedFiler = nil;
@@ -69,7 +96,13 @@ static BDSKFiler *sharedFiler = nil;
 
 - (id)init{
     BDSKPRECONDITION(sharedFiler == nil);
-	return [super initWithWindowNibName:@"AutoFileProgress"];
+	self = [super initWithWindowNibName:@"AutoFileProgress"];
+    if (self) {
+        // moves are mostly waiting for the file system, so we can use more workers than processors
+        moveQueue = [[NSOperationQueue alloc] init];
+        [moveQueue setMaxConcurrentOperationCount:MAX(4, [[NSProcessInfo processInfo] activeProcessorCount])];
+    }
+    return self;
 }
 
 #pragma mark Auto file methods
@@ -117,16 +150,37 @@ static BDSKFiler *sharedFiler = nil;
 	return [self movePapers:paperInfos forField:BDSKLocalFileString fromDocument:doc options:mask];
 }
 
+// conservative key to find moves that may compete, as the volume may be case insensitive and file names may differ in normalization
+static inline NSString *collisionKeyForPath(NSString *path) {
+    return [[path decomposedStringWithCanonicalMapping] lowercaseString];
+}
+
+// called on the moveQueue, the error is returned in the move info
+- (void)moveFileWithInfo:(NSMutableDictionary *)move {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSFileManager *fm = [[NSFileManager alloc] init];
+    NSError *error = nil;
+    if (NO == [fm movePath:[move objectForKey:MOVE_OLDPATH_KEY] toPath:[move objectForKey:MOVE_NEWPATH_KEY] force:[[move objectForKey:MOVE_FORCE_KEY] boolValue] confirmFolderMove:NO error:&error])
+        [move setObject:error forKey:MOVE_ERROR_KEY];
+    [fm release];
+    [pool release];
+}
+
 - (BOOL)movePapers:(NSArray *)paperInfos forField:(NSString *)field fromDocument:(BibDocument *)doc options:(BDSKFilerOptions)mask{
 	NSFileManager *fm = [NSFileManager defaultManager];
     NSInteger numberOfPapers = [paperInfos count];
+    NSInteger numberOfPrepared = 0;
 	BibItem *pub = nil;
 	BDSKLinkedFile *file = nil;
 	NSString *oldPath = nil;
 	NSString *newPath = nil;
 	NSMutableArray *fileInfoDicts = [NSMutableArray arrayWithCapacity:numberOfPapers];
 	NSMutableArray *errorInfoDicts = [NSMutableArray arrayWithCapacity:5];
+	NSMutableArray *moves = [NSMutableArray arrayWithCapacity:numberOfPapers];
+	NSMutableArray *concurrentMoves = [NSMutableArray arrayWithCapacity:numberOfPapers];
+	NSMutableArray *serialMoves = [NSMutableArray array];
 	NSMutableDictionary *info = nil;
+	NSMutableDictionary *move = nil;
 	NSError *error = nil;
     
     BOOL initial = (mask & BDSKInitialAutoFileOptionMask);
@@ -141,11 +195,12 @@ static BDSKFiler *sharedFiler = nil;
 	
 	if (numberOfPapers > 1) {
         [self window];
-		[progressIndicator setMaxValue:numberOfPapers];
+		[progressIndicator setMaxValue:2 * numberOfPapers];
 		[progressIndicator setDoubleValue:0.0];
         [[self window] orderFront:nil];
 	}
 	
+    // first generate all the target locations, this needs the publications so it is done on the main thread
 	for (id paperInfo in paperInfos) {
 		
         file = [paperInfo valueForKey:BDSKFilerFileKey];
@@ -156,8 +211,8 @@ static BDSKFiler *sharedFiler = nil;
 		else // an explicit move, possibly from undo: a list of info dictionaries
 			newPath = [paperInfo valueForKey:BDSKFilerNewPathKey];
 		
-		if (numberOfPapers > 1) {
-			[progressIndicator incrementBy:1.0];
+		if (numberOfPapers > 1 && ++numberOfPrepared % PROGRESS_INTERVAL == 0) {
+			[progressIndicator setDoubleValue:numberOfPrepared];
 			[progressIndicator displayIfNeeded];
 		}
 			
@@ -170,7 +225,6 @@ static BDSKFiler *sharedFiler = nil;
 		[info setValue:file forKey:BDSKFilerFileKey];
 		[info setValue:oldPath forKey:BDSKFilerOldPathKey];
 		[info setValue:pub forKey:BDSKFilerPublicationKey];
-        error = nil;
         
         if (check && NO == [pub canSetURLForLinkedFile:file]) {
             
@@ -186,11 +240,80 @@ static BDSKFiler *sharedFiler = nil;
             
         } else {
             
-            [[BDSKScriptHookManager sharedManager] runScriptHookWithName:BDSKWillAutoFileScriptHookName 
-                forPublications:[NSArray arrayWithObject:pub] document:doc 
-                field:field oldValues:[NSArray arrayWithObject:oldPath] newValues:[NSArray arrayWithObject:newPath]];
+            [moves addObject:[NSMutableDictionary dictionaryWithObjectsAndKeys:info, MOVE_INFO_KEY, oldPath, MOVE_OLDPATH_KEY, newPath, MOVE_NEWPATH_KEY, [NSNumber numberWithBool:force], MOVE_FORCE_KEY, nil]];
+            
+        }
+	}
+    
+    if ([moves count]) {
+        
+        // moves that compete are done in order afterwards, so they get the same result as before
+        // forced moves back up existing files to the Desktop, choosing the backup name is not atomic so they are always done in order
+        NSIndexSet *independentIndexes = nil;
+        if (force == NO && [moves count] > 1)
+            independentIndexes = [[self class] indexesOfIndependentMovesFromPaths:[moves valueForKey:MOVE_OLDPATH_KEY] toPaths:[moves valueForKey:MOVE_NEWPATH_KEY]];
+        NSUInteger idx = 0;
+        for (move in moves) {
+            if ([independentIndexes containsIndex:idx++])
+                [concurrentMoves addObject:move];
+            else
+                [serialMoves addObject:move];
+        }
+        
+        [[BDSKScriptHookManager sharedManager] runScriptHookWithName:BDSKWillAutoFileScriptHookName 
+            forPublications:[moves valueForKeyPath:@"info.publication"] document:doc 
+            field:field oldValues:[moves valueForKey:MOVE_OLDPATH_KEY] newValues:[moves valueForKey:MOVE_NEWPATH_KEY]];
+        
+        // record what we are about to do, so an interrupted batch can be rolled back at the next launch
+        [[self class] writeJournalForMovesFromPaths:[moves valueForKey:MOVE_OLDPATH_KEY] toPaths:[moves valueForKey:MOVE_NEWPATH_KEY] atPath:[[self class] journalPath]];
+        
+        NSUInteger i, iMax = [concurrentMoves count];
+        for (i = 0; i < iMax; i += MOVE_BATCH_SIZE) {
+            NSRange range = NSMakeRange(i, MIN(MOVE_BATCH_SIZE, iMax - i));
+            NSMutableArray *operations = [NSMutableArray arrayWithCapacity:range.length];
+            for (move in [concurrentMoves subarrayWithRange:range]) {
+                NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:self selector:@selector(moveFileWithInfo:) object:move];
+                [operations addObject:operation];
+                [operation release];
+            }
+            [moveQueue addOperations:operations waitUntilFinished:YES];
             
-            if (NO == [fm movePath:oldPath toPath:newPath force:force error:&error]){ 
+            // folder moves may need to be confirmed by the user, which is only possible on the main thread
+            for (move in [concurrentMoves subarrayWithRange:range]) {
+                if ([[move objectForKey:MOVE_ERROR_KEY] code] == BDSKFolderMoveNeedsConfirmationErrorMask) {
+                    [move removeObjectForKey:MOVE_ERROR_KEY];
+                    [serialMoves addObject:move];
+                }
+            }
+            
+            if (numberOfPapers > 1) {
+                [progressIndicator setDoubleValue:numberOfPapers + NSMaxRange(range)];
+                [progressIndicator displayIfNeeded];
+            }
+        }
+        
+        for (move in serialMoves) {
+            error = nil;
+            if (NO == [fm movePath:[move objectForKey:MOVE_OLDPATH_KEY] toPath:[move objectForKey:MOVE_NEWPATH_KEY] force:force error:&error])
+                [move setObject:error forKey:MOVE_ERROR_KEY];
+        }
+        
+        [fm removeItemAtPath:[[self class] journalPath] error:NULL];
+        
+        NSMutableArray *movedPubs = [NSMutableArray array];
+        NSMutableArray *movedOldPaths = [NSMutableArray array];
+        NSMutableArray *movedNewPaths = [NSMutableArray array];
+        
+        // handle the results in the original order
+        for (move in moves) {
+            
+            info = [move objectForKey:MOVE_INFO_KEY];
+            file = [info objectForKey:BDSKFilerFileKey];
+            pub = [info objectForKey:BDSKFilerPublicationKey];
+            oldPath = [move objectForKey:MOVE_OLDPATH_KEY];
+            newPath = [move objectForKey:MOVE_NEWPATH_KEY];
+            
+            if ((error = [move objectForKey:MOVE_ERROR_KEY])) {
                 
                 NSDictionary *errorInfo = [error userInfo];
                 [info setValue:[errorInfo objectForKey:NSLocalizedRecoverySuggestionErrorKey] forKey:BDSKFilerFixKey];
@@ -209,9 +332,9 @@ static BDSKFiler *sharedFiler = nil;
                 [info setValue:oldPath forKey:BDSKFilerNewPathKey];
                 [fileInfoDicts addObject:info];
                 
-                [[BDSKScriptHookManager sharedManager] runScriptHookWithName:BDSKDidAutoFileScriptHookName 
-                    forPublications:[NSArray arrayWithObject:pub] document:doc 
-                    field:field oldValues:[NSArray arrayWithObject:oldPath] newValues:[NSArray arrayWithObject:newPath]];
+                [movedPubs addObject:pub];
+                [movedOldPaths addObject:oldPath];
+                [movedNewPaths addObject:newPath];
                 
             }
             
@@ -219,7 +342,12 @@ static BDSKFiler *sharedFiler = nil;
             [pub removeFileToBeFiled:file];
             
         }
-	}
+        
+        if ([movedPubs count])
+            [[BDSKScriptHookManager sharedManager] runScriptHookWithName:BDSKDidAutoFileScriptHookName 
+                forPublications:movedPubs document:doc 
+                field:field oldValues:movedOldPaths newValues:movedNewPaths];
+    }
 	
 	if (numberOfPapers > 1)
 		[[self window] orderOut:nil];
@@ -236,18 +364,166 @@ static BDSKFiler *sharedFiler = nil;
     return [fileInfoDicts count] > 0;
 }
 
++ (NSIndexSet *)indexesOfIndependentMovesFromPaths:(NSArray *)oldPaths toPaths:(NSArray *)newPaths {
+    // a single pass: a target should not be claimed by an earlier move, or be the source of another move
+    NSMutableIndexSet *indexes = [NSMutableIndexSet indexSet];
+    NSMutableSet *sources = [NSMutableSet setWithCapacity:[oldPaths count]];
+    NSMutableSet *targets = [NSMutableSet setWithCapacity:[newPaths count]];
+    NSString *target;
+    NSUInteger i, iMax = [newPaths count];
+    for (NSString *path in oldPaths)
+        [sources addObject:collisionKeyForPath(path)];
+    for (i = 0; i < iMax; i++) {
+        target = collisionKeyForPath([newPaths objectAtIndex:i]);
+        if ([targets containsObject:target] == NO && [sources containsObject:target] == NO)
+            [indexes addIndex:i];
+        [targets addObject:target];
+    }
+    return indexes;
+}
+
+#pragma mark Journal
+
++ (NSString *)journalPath {
+    return [[[NSFileManager defaultManager] applicationSupportDirectory] stringByAppendingPathComponent:@"AutoFile Journal.plist"];
+}
+
+// identifies the item at path, so we only move back the item we moved ourselves
+static NSDictionary *fileIdentityAtPath(NSFileManager *fm, NSString *path) {
+    // as in movePath:toPath:force:error:, aliases are only resolved in the path to the containing folder
+    NSString *resolvedPath = [[fm resolveAliasesInPath:[path stringByDeletingLastPathComponent]] stringByAppendingPathComponent:[path lastPathComponent]];
+    struct stat sb;
+    if (resolvedPath == nil || 0 != lstat([resolvedPath fileSystemRepresentation], &sb))
+        return nil;
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+                [NSNumber numberWithLongLong:sb.st_dev], JOURNAL_DEVICE_KEY, 
+                [NSNumber numberWithUnsignedLongLong:sb.st_ino], JOURNAL_INODE_KEY, 
+                [NSNumber numberWithLongLong:sb.st_size], JOURNAL_SIZE_KEY, 
+                [NSNumber numberWithLong:sb.st_mtimespec.tv_sec], JOURNAL_DATE_KEY, nil];
+}
+
+// a move on the same volume keeps the inode, a copy to another volume keeps the size and modification date
+static BOOL isSameFileIdentity(NSDictionary *identity, NSDictionary *movedIdentity) {
+    if (identity == nil || movedIdentity == nil)
+        return NO;
+    if ([[identity objectForKey:JOURNAL_DEVICE_KEY] isEqual:[movedIdentity objectForKey:JOURNAL_DEVICE_KEY]])
+        return [[identity objectForKey:JOURNAL_INODE_KEY] isEqual:[movedIdentity objectForKey:JOURNAL_INODE_KEY]];
+    return [[identity objectForKey:JOURNAL_SIZE_KEY] isEqual:[movedIdentity objectForKey:JOURNAL_SIZE_KEY]] && 
+           [[identity objectForKey:JOURNAL_DATE_KEY] isEqual:[movedIdentity objectForKey:JOURNAL_DATE_KEY]];
+}
+
++ (void)writeJournalForMovesFromPaths:(NSArray *)oldPaths toPaths:(NSArray *)newPaths atPath:(NSString *)journalPath {
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSMutableArray *journal = [NSMutableArray arrayWithCapacity:[oldPaths count]];
+    NSUInteger i, iMax = [oldPaths count];
+    for (i = 0; i < iMax; i++) {
+        NSString *oldPath = [oldPaths objectAtIndex:i];
+        NSMutableDictionary *entry = [NSMutableDictionary dictionaryWithObjectsAndKeys:oldPath, MOVE_OLDPATH_KEY, [newPaths objectAtIndex:i], MOVE_NEWPATH_KEY, nil];
+        [entry addEntriesFromDictionary:fileIdentityAtPath(fm, oldPath)];
+        [journal addObject:entry];
+    }
+    NSData *data = [NSPropertyListSerialization dataFromPropertyList:journal format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
+    [data writeToFile:journalPath atomically:YES];
+}
+
++ (void)recoverInterruptedMoves {
+    [self recoverMovesFromJournalAtPath:[self journalPath]];
+}
+
++ (void)recoverMovesFromJournalAtPath:(NSString *)journalPath {
+    NSData *data = [NSData dataWithContentsOfFile:journalPath];
+    if (data == nil)
+        return;
+    
+    NSArray *journal = [NSPropertyListSerialization propertyListFromData:data mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:NULL];
+    NSFileManager *fm = [NSFileManager defaultManager];
+    
+    if ([journal isKindOfClass:[NSArray class]]) {
+        // the documents were not saved with the new locations, so move back whatever was moved, in reverse order
+        for (NSDictionary *move in [journal reverseObjectEnumerator]) {
+            NSString *oldPath = [move objectForKey:MOVE_OLDPATH_KEY];
+            NSString *newPath = [move objectForKey:MOVE_NEWPATH_KEY];
+            if ([oldPath isKindOfClass:[NSString class]] == NO || [newPath isKindOfClass:[NSString class]] == NO)
+                continue;
+            // only move back when the item at the target is still the one we moved, and nothing took its old place
+            if ([fm fileExistsAtPath:oldPath] == NO && isSameFileIdentity(move, fileIdentityAtPath(fm, newPath))) {
+                NSError *error = nil;
+                if ([fm movePath:newPath toPath:oldPath force:NO confirmFolderMove:NO error:&error])
+                    NSLog(@"Moved back %@ to %@ after an interrupted AutoFile", newPath, oldPath);
+                else
+                    NSLog(@"Unable to move back %@ to %@ after an interrupted AutoFile: %@", newPath, oldPath, [error localizedDescription]);
+            }
+        }
+    }
+    
+    [fm removeItemAtPath:journalPath error:NULL];
+}
+
 @end
 
 
 @implementation NSFileManager (BDSKFilerExtensions)
 
 - (BOOL)movePath:(NSString *)path toPath:(NSString *)newPath force:(BOOL)force error:(NSError **)error{
+    return [self movePath:path toPath:newPath force:force confirmFolderMove:YES error:error];
+}
+
+// Moves may run concurrently, so the move should never replace an item at the target, as rename(2) would. We claim the target atomically on the same volume: by a hard link for a file, or by an empty folder that rename(2) may replace for a folder. NSFileManager is only used when that fails, e.g. to copy across volumes, and it also refuses to replace an existing item. When the target exists, targetExists is set and the original is left alone. Symlinks are refused, as link(2) may follow them and link the target instead; movePath:toPath:force:error: moves them itself.
+static BOOL exclusiveMoveItem(NSFileManager *fm, NSString *path, NSString *newPath, BOOL *targetExists) {
+    const char *src = [path fileSystemRepresentation];
+    const char *dst = [newPath fileSystemRepresentation];
+    struct stat sb;
+    
+    if (targetExists)
+        *targetExists = NO;
+    if (0 != lstat(src, &sb) || S_ISLNK(sb.st_mode))
+        return NO;
+    
+    if (S_ISDIR(sb.st_mode)) {
+        if (0 == mkdir(dst, S_IRWXU)) {
+            if (0 == rename(src, dst))
+                return YES;
+            rmdir(dst);
+        } else if (errno == EEXIST) {
+            if (targetExists)
+                *targetExists = YES;
+            return NO;
+        }
+    } else {
+        if (0 == link(src, dst)) {
+            if (0 == unlink(src))
+                return YES;
+            unlink(dst);
+            return NO;
+        } else if (errno == EEXIST) {
+            if (targetExists)
+                *targetExists = YES;
+            return NO;
+        }
+    }
+    
+    if ([fm fileExistsAtPath:newPath]) {
+        if (targetExists)
+            *targetExists = YES;
+        return NO;
+    }
+    return [fm moveItemAtPath:path toPath:newPath error:NULL];
+}
+
+@end
+
+
+@implementation NSFileManager (BDSKPrivateFilerExtensions)
+
+// when confirm is NO, moving a folder that needs confirmation fails with BDSKFolderMoveNeedsConfirmationErrorMask, so this can be used off the main thread
+- (BOOL)movePath:(NSString *)path toPath:(NSString *)newPath force:(BOOL)force confirmFolderMove:(BOOL)confirm error:(NSError **)error{
     NSString *resolvedPath = nil;
     NSString *resolvedNewPath = nil;
     NSString *status = nil;
     NSString *fix = nil;
     NSInteger statusFlag = BDSKNoError;
     BOOL ignoreMove = NO;
+    BOOL targetExists = NO;
     
     // filemanager needs aliases resolved for moving and existence checks
     // ...however we want to move aliases, not their targets
@@ -307,6 +583,11 @@ static BDSKFiler *sharedFiler = nil;
             NSString *fileType = [[self attributesOfItemAtPath:resolvedPath error:NULL] fileType];
             if([fileType isEqualToString:NSFileTypeDirectory] && [[NSWorkspace sharedWorkspace] isFilePackageAtPath:resolvedPath] == NO && force == NO && 
                [[NSUserDefaults standardUserDefaults] boolForKey:BDSKWarnOnMoveFolderKey]){
+                if (confirm == NO) {
+                    if (error)
+                        *error = [NSError errorWithDomain:BDSKFilerErrorDomain code:BDSKFolderMoveNeedsConfirmationErrorMask userInfo:nil];
+                    return NO;
+                }
                 NSAlert *alert = [NSAlert alertWithMessageText:NSLocalizedString(@"Really Move Folder?", @"Message in alert dialog when trying to auto file a folder")
                                                  defaultButton:NSLocalizedString(@"Move", @"Button title")
                                                alternateButton:NSLocalizedString(@"Don't Move", @"Button title") 
@@ -342,14 +623,22 @@ static BDSKFiler *sharedFiler = nil;
                         }
                     }
                 }
-            }else if([self moveItemAtPath:resolvedPath toPath:resolvedNewPath error:NULL]){
+            }else if(exclusiveMoveItem(self, resolvedPath, resolvedNewPath, &targetExists)){
                 if([[resolvedPath pathExtension] isCaseInsensitiveEqual:@"pdf"]){
                     NSString *notesPath = [[resolvedPath stringByDeletingPathExtension] stringByAppendingPathExtension:@"skim"];
                     NSString *newNotesPath = [[resolvedNewPath stringByDeletingPathExtension] stringByAppendingPathExtension:@"skim"];
                     if([self fileExistsAtPath:notesPath] && [self fileExistsAtPath:newNotesPath] == NO){
-                        [self moveItemAtPath:notesPath toPath:newNotesPath error:NULL];
+                        exclusiveMoveItem(self, notesPath, newNotesPath, NULL);
                     }
                 }
+            }else if(targetExists){ // another item took the target location in the meantime, it should not be touched
+                if([self isDeletableFileAtPath:resolvedNewPath]){
+                    status = NSLocalizedString(@"File exists at target location.", @"AutoFile error message");
+                    fix = NSLocalizedString(@"Overwrite existing file.", @"AutoFile fix");
+                }else{
+                    status = NSLocalizedString(@"Undeletable file exists at target location.", @"AutoFile error message");
+                }
+                statusFlag = BDSKTargetFileExistsErrorMask;
             }else if([self fileExistsAtPath:resolvedNewPath]){ // error remove original file
                 if(force == NO){
                     status = NSLocalizedString(@"Unable to remove original file.", @"AutoFile error message");
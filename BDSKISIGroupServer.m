@@ -39,6 +39,7 @@
 #import "BDSKISIGroupServer.h"
 #import "BDSKISIWebServices.h"
 #import "BDSKLinkedFile.h"
+#import "BDSKSearchGroupCache.h"
 #import "BDSKServerInfo.h"
 #import "BibItem.h"
 #import "NSArray_BDSKExtensions.h"
@@ -165,7 +166,8 @@ static NSArray *publicationsFromData(NSData *data);
 
 - (void)retrieveWithSearchTerm:(NSString *)aSearchTerm
 {
-    if ([[self class] canConnect]) {
+    // a new search term resets the server, so the fetched results are the start index of the next page
+    if ([[self class] canConnect] || [[BDSKSearchGroupCache sharedCache] hasResultsForServerInfo:[self serverInfo] searchTerm:aSearchTerm startIndex:[self numberOfFetchedResults]]) {
         OSAtomicCompareAndSwap32Barrier(1, 0, &flags.failedDownload);
         
         OSAtomicCompareAndSwap32Barrier(0, 1, &flags.isRetrieving);
@@ -243,6 +245,22 @@ static NSArray *publicationsFromData(NSData *data);
     enum operationTypes { search, retrieve, retrieveRecid, citedReferences, citingArticles, citingArticlesByRecids } operation = search;
     NSInteger availableResultsLocal = [self numberOfAvailableResults];
     NSInteger fetchedResultsLocal = [self numberOfFetchedResults];
+    NSString *cacheSearchTerm = searchTerm;
+    NSInteger cacheStartIndex = fetchedResultsLocal;
+    NSInteger cachedCount = 0;
+    NSData *data = nil;
+    
+    // use the cached page when we have one, an expired one is still better than nothing when we cannot connect
+    if (NO == [NSString isEmptyString:searchTerm])
+        data = [[BDSKSearchGroupCache sharedCache] resultsForServerInfo:[self serverInfo] searchTerm:searchTerm startIndex:fetchedResultsLocal count:&cachedCount availableResults:&availableResultsLocal allowExpired:NO == [[self class] canConnect]];
+    
+    if (data) {
+        OSAtomicCompareAndSwap32Barrier(availableResults, availableResultsLocal, &availableResults);
+        OSAtomicCompareAndSwap32Barrier(fetchedResults, fetchedResultsLocal + cachedCount, &fetchedResults);
+        OSAtomicCompareAndSwap32Barrier(1, 0, &flags.isRetrieving);
+        [[self serverOnMainThread] addPublicationsToGroup:data];
+        return;
+    }
     
     if (NO == [NSString isEmptyString:searchTerm]){
         
@@ -440,7 +458,10 @@ static NSArray *publicationsFromData(NSData *data);
     // set this flag before adding pubs, or the client will think we're still retrieving (and spinners don't stop)
     OSAtomicCompareAndSwap32Barrier(1, 0, &flags.isRetrieving);
     
-    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:pubs];
+    data = [NSKeyedArchiver archivedDataWithRootObject:pubs];
+    
+    if ([pubs count] && [self failedDownload] == NO)
+        [[BDSKSearchGroupCache sharedCache] setResults:data count:[pubs count] availableResults:availableResultsLocal forServerInfo:[self serverInfo] searchTerm:cacheSearchTerm startIndex:cacheStartIndex];
     
     // this will create the array if it doesn't exist
     [[self serverOnMainThread] addPublicationsToGroup:data];
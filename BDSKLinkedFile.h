@@ -76,6 +76,12 @@
 - (void)update;
 - (void)updateWithPath:(NSString *)aPath;
 
+// an immutable object that archives like the receiver, so it can be archived on another thread
+- (id<NSCoding>)archivableSnapshot;
+
+// the local files with a cached URL that depends on one of the directories, as reported by BDSKDirectoryWatcher; should only be used from the main thread
++ (NSArray *)linkedFilesInDirectories:(NSArray *)directories;
+
 @end
 
 
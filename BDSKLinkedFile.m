@@ -40,9 +40,20 @@
 #import <CoreServices/CoreServices.h>
 #import "BDSKRuntime.h"
 #import "NSData_BDSKExtensions.h"
+#import "BDSKDirectoryWatcher.h"
 
 #define WEAK_NULL NULL
 
+#define BATCH_SIZE 64
+
+#define FILE_KEY            @"file"
+#define ALIASDATA_KEY       @"aliasData"
+#define FILEREF_KEY         @"fileRef"
+#define RELATIVEPATH_KEY    @"relativePath"
+#define BASEPATH_KEY        @"basePath"
+#define GENERATION_KEY      @"generation"
+#define PATH_KEY            @"path"
+
 static void BDSKDisposeAliasHandle(AliasHandle inAlias)
 {
     if (inAlias != NULL)
@@ -168,12 +179,25 @@ static AliasHandle BDSKPathToAliasHandle(CFStringRef inPath, CFStringRef inBaseP
     NSURL *lastURL;
     BOOL isInitial;
     id delegate;
+    NSString *cachedDirectory;
+    NSUInteger cachedGeneration;
+    BOOL hasCachedURL;
+    BOOL isResolving;
 }
 
 - (id)initWithPath:(NSString *)aPath delegate:(id)aDelegate;
 
 - (const FSRef *)fileRef;
 
+- (NSURL *)resolveURL;
+
+- (BOOL)hasCurrentCachedURL;
+- (void)setCachedDirectory:(NSString *)directory;
+- (void)cacheURLWithGeneration:(NSUInteger)aGeneration;
+
+- (NSDictionary *)resolveRequest;
+- (void)finishResolvingWithInfo:(NSDictionary *)info;
+
 - (NSData *)aliasDataRelativeToPath:(NSString *)newBasePath;
 
 - (void)updateWithPath:(NSString *)path basePath:(NSString *)basePath baseRef:(const FSRef *)baseRef;
@@ -189,6 +213,32 @@ static AliasHandle BDSKPathToAliasHandle(CFStringRef inPath, CFStringRef inBaseP
 
 #pragma mark -
 
+// Private class resolving linked files in the background, in batches
+
+@interface BDSKLinkedFileResolver : NSObject {
+    NSOperationQueue *queue;
+    NSMutableArray *pendingFiles;
+}
++ (id)sharedResolver;
+- (void)resolveLinkedFile:(BDSKLinkedAliasFile *)file;
+@end
+
+#pragma mark -
+
+// Private class holding the archived data of a BDSKLinkedAliasFile
+
+@interface BDSKArchivedAliasFile : NSObject <NSCoding> {
+    NSData *aliasData;
+    NSString *relativePath;
+}
+- (id)initWithAliasData:(NSData *)data relativePath:(NSString *)relPath;
+@end
+
+#pragma mark -
+
+// the linked alias files with a cached URL for each watched directory, the files are not retained; only used on the main thread
+static CFMutableDictionaryRef cachedFilesForDirectories = NULL;
+
 // Abstract superclass
 
 @implementation BDSKLinkedFile
@@ -294,6 +344,23 @@ static Class BDSKLinkedFileClass = Nil;
 - (void)setDelegate:(id<BDSKLinkedFileDelegate>)aDelegate {}
 - (id<BDSKLinkedFileDelegate>)delegate { return nil; }
 
+- (id<NSCoding>)archivableSnapshot {
+    return [[self copy] autorelease];
+}
+
++ (NSArray *)linkedFilesInDirectories:(NSArray *)directories {
+    BDSKASSERT([NSThread isMainThread]);
+    NSMutableArray *files = [NSMutableArray array];
+    if (cachedFilesForDirectories) {
+        for (NSString *directory in directories) {
+            CFSetRef set = (CFSetRef)CFDictionaryGetValue(cachedFilesForDirectories, (const void *)directory);
+            if (set)
+                [files addObjectsFromArray:[(NSSet *)set allObjects]];
+        }
+    }
+    return files;
+}
+
 - (NSString *)stringValue {
     return [[self URL] absoluteString];
 }
@@ -370,6 +437,10 @@ static Class BDSKLinkedFileClass = Nil;
         delegate = aDelegate;
         lastURL = nil;
         isInitial = YES;
+        cachedDirectory = nil;
+        cachedGeneration = 0;
+        hasCachedURL = NO;
+        isResolving = NO;
     }
     return self;    
 }
@@ -477,6 +548,7 @@ static Class BDSKLinkedFileClass = Nil;
     BDSKDisposeAliasHandle(alias); alias = NULL;
     BDSKDESTROY(relativePath);
     BDSKDESTROY(lastURL);
+    [self setCachedDirectory:nil];
     [super dealloc];
 }
 
@@ -504,12 +576,19 @@ static Class BDSKLinkedFileClass = Nil;
     BDSKASSERT(nil == newDelegate || [newDelegate respondsToSelector:@selector(basePathForLinkedFile:)]);
     
     delegate = newDelegate;
+    hasCachedURL = NO;
 }
 
 - (NSString *)relativePath {
     return relativePath;
 }
 
+- (id<NSCoding>)archivableSnapshot {
+    // the alias data depends on the delegate and the file system, so we get it now
+    NSData *data = [self aliasDataRelativeToPath:[delegate basePathForLinkedFile:self]];
+    return data ? [[[BDSKArchivedAliasFile alloc] initWithAliasData:data relativePath:relativePath] autorelease] : nil;
+}
+
 - (void)setFileRef:(const FSRef *)newFileRef;
 {
     if (fileRef != NULL) {
@@ -563,7 +642,19 @@ static Class BDSKLinkedFileClass = Nil;
     return fileRef;
 }
 
-- (NSURL *)URL;
+- (void)setLastURL:(NSURL *)aURL {
+    BOOL changed = [aURL isEqual:lastURL] == NO && (aURL != nil || lastURL != nil);
+    if (changed) {
+        [lastURL release];
+        lastURL = [aURL retain];
+        if (isInitial == NO)
+            [delegate performSelector:@selector(linkedFileURLChanged:) withObject:self afterDelay:0.0];
+    }
+    isInitial = NO;
+}
+
+// resolves the URL from the file system, without using the cached URL
+- (NSURL *)resolveURL;
 {
     BOOL hadFileRef = fileRef != NULL;
     CFURLRef aURL = (hadFileRef || [self fileRef]) ? CFURLCreateFromFSRef(NULL, fileRef) : NULL;
@@ -574,17 +665,132 @@ static Class BDSKLinkedFileClass = Nil;
         if ([self fileRef] != NULL)
             aURL = CFURLCreateFromFSRef(NULL, fileRef);
     }
-    BOOL changed = [(NSURL *)aURL isEqual:lastURL] == NO && (aURL != NULL || lastURL != nil);
-    if (changed) {
-        [lastURL release];
-        lastURL = [(NSURL *)aURL retain];
-        if (isInitial == NO)
-            [delegate performSelector:@selector(linkedFileURLChanged:) withObject:self afterDelay:0.0];
-    }
-    isInitial = NO;
+    [self setLastURL:(NSURL *)aURL];
     return [(NSURL *)aURL autorelease];
 }
 
+- (NSURL *)URL;
+{
+    // the watcher and the resolver are only used from the main thread, other threads always go to the file system
+    if ([NSThread isMainThread] == NO)
+        return [self resolveURL];
+    
+    if (hasCachedURL) {
+        if (isResolving == NO && [self hasCurrentCachedURL] == NO)
+            // the directory changed, we use the last URL until the file is resolved again in the background
+            [[BDSKLinkedFileResolver sharedResolver] resolveLinkedFile:self];
+        return [[lastURL retain] autorelease];
+    }
+    
+    NSUInteger aGeneration = [[BDSKDirectoryWatcher sharedWatcher] generation];
+    NSURL *aURL = [self resolveURL];
+    [self cacheURLWithGeneration:aGeneration];
+    return aURL;
+}
+
+- (BOOL)hasCurrentCachedURL {
+    return hasCachedURL && NO == [[BDSKDirectoryWatcher sharedWatcher] directory:cachedDirectory hasChangedSinceGeneration:cachedGeneration];
+}
+
+- (void)cacheURLWithGeneration:(NSUInteger)aGeneration {
+    // a missing file is cached using the directory it should be in, if we know it
+    NSString *basePath = [delegate basePathForLinkedFile:self];
+    NSString *directory = nil;
+    if (lastURL)
+        directory = [[lastURL path] stringByDeletingLastPathComponent];
+    else if (relativePath && basePath)
+        directory = [[[basePath stringByAppendingPathComponent:relativePath] stringByStandardizingPath] stringByDeletingLastPathComponent];
+    
+    cachedGeneration = aGeneration;
+    // without a delegate the base path can still change, so we don't cache
+    // we also don't cache a missing file when its directory is missing, e.g. on a volume that is not mounted, as FSEvents may not see it appear
+    hasCachedURL = directory != nil && delegate != nil && (lastURL != nil || [[NSFileManager defaultManager] fileExistsAtPath:directory]);
+    [self setCachedDirectory:hasCachedURL ? [[BDSKDirectoryWatcher sharedWatcher] watchDirectory:directory] : nil];
+}
+
+// registers the file for its cached directory, so only the files in a changed directory need to be checked
+// the directory should have just been watched, as we keep a single watch for the cached directory
+- (void)setCachedDirectory:(NSString *)directory {
+    if (cachedDirectory)
+        [[BDSKDirectoryWatcher sharedWatcher] unwatchDirectory:cachedDirectory];
+    if (cachedDirectory == directory || [cachedDirectory isEqualToString:directory])
+        return;
+    if (cachedDirectory) {
+        CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(cachedFilesForDirectories, (const void *)cachedDirectory);
+        if (set) {
+            CFSetRemoveValue(set, (const void *)self);
+            if (CFSetGetCount(set) == 0)
+                CFDictionaryRemoveValue(cachedFilesForDirectories, (const void *)cachedDirectory);
+        }
+        BDSKDESTROY(cachedDirectory);
+    }
+    if (directory) {
+        cachedDirectory = [directory copy];
+        if (cachedFilesForDirectories == NULL)
+            cachedFilesForDirectories = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+        CFMutableSetRef set = (CFMutableSetRef)CFDictionaryGetValue(cachedFilesForDirectories, (const void *)cachedDirectory);
+        if (set == NULL) {
+            set = CFSetCreateMutable(kCFAllocatorDefault, 0, NULL);
+            CFDictionarySetValue(cachedFilesForDirectories, (const void *)cachedDirectory, set);
+            CFRelease(set);
+        }
+        CFSetAddValue(set, (const void *)self);
+    }
+}
+
+// the information needed to resolve the file on another thread
+- (NSDictionary *)resolveRequest {
+    NSMutableDictionary *request = [NSMutableDictionary dictionaryWithObjectsAndKeys:self, FILE_KEY, [NSNumber numberWithUnsignedInteger:[[BDSKDirectoryWatcher sharedWatcher] generation]], GENERATION_KEY, nil];
+    NSString *basePath = [delegate basePathForLinkedFile:self];
+    NSData *data = alias != NULL ? (NSData *)BDSKCopyAliasHandleToData(alias) : nil;
+    if (data) {
+        [request setObject:data forKey:ALIASDATA_KEY];
+        [data release];
+    }
+    if (fileRef)
+        [request setObject:[NSData dataWithBytes:fileRef length:sizeof(FSRef)] forKey:FILEREF_KEY];
+    if (relativePath)
+        [request setObject:relativePath forKey:RELATIVEPATH_KEY];
+    if (basePath)
+        [request setObject:basePath forKey:BASEPATH_KEY];
+    isResolving = YES;
+    return request;
+}
+
+- (void)finishResolvingWithInfo:(NSDictionary *)info {
+    // the file was updated synchronously in the meantime
+    if (isResolving == NO)
+        return;
+    isResolving = NO;
+    
+    NSString *basePath = [delegate basePathForLinkedFile:self];
+    
+    // ignore the result when we were resolved synchronously in the meantime, or the base path changed
+    if (delegate == nil || [self hasCurrentCachedURL] || (basePath != [info objectForKey:BASEPATH_KEY] && [basePath isEqualToString:[info objectForKey:BASEPATH_KEY]] == NO))
+        return;
+    
+    NSString *path = [info objectForKey:PATH_KEY];
+    NSData *refData = [info objectForKey:FILEREF_KEY];
+    NSData *aliasData = [info objectForKey:ALIASDATA_KEY];
+    
+    [self setFileRef:path && refData ? (const FSRef *)[refData bytes] : NULL];
+    
+    if (path && aliasData) {
+        AliasHandle anAlias = BDSKDataToAliasHandle((CFDataRef)aliasData);
+        if (anAlias != NULL) {
+            BDSKDisposeAliasHandle(alias);
+            alias = anAlias;
+        }
+    }
+    if (path && basePath) {
+        [relativePath release];
+        relativePath = [[path relativePathFromPath:basePath] retain];
+    }
+    
+    [self setLastURL:path ? [NSURL fileURLWithPath:path] : nil];
+    [self cacheURLWithGeneration:[[info objectForKey:GENERATION_KEY] unsignedIntegerValue]];
+}
+
 - (NSURL *)displayURL;
 {
     NSURL *displayURL = [self URL];
@@ -596,7 +802,7 @@ static Class BDSKLinkedFileClass = Nil;
 - (NSData *)aliasDataRelativeToPath:(NSString *)basePath;
 {
     // make sure the fileRef is valid
-    [self URL];
+    [self resolveURL];
     
     FSRef *fsRef = (FSRef *)[self fileRef];
     FSRef baseRef;
@@ -632,6 +838,18 @@ static Class BDSKLinkedFileClass = Nil;
 - (void)updateWithPath:(NSString *)aPath {
     NSString *basePath = [delegate basePathForLinkedFile:self];
     
+    hasCachedURL = NO;
+    
+    if (fileRef == NULL && aPath == nil && [NSThread isMainThread]) {
+        // not resolved yet, e.g. after opening a document, this is done in the background together with the other files
+        if (isResolving == NO)
+            [[BDSKLinkedFileResolver sharedResolver] resolveLinkedFile:self];
+        return;
+    }
+    
+    // this supersedes a pending background resolution
+    isResolving = NO;
+    
     if (fileRef == NULL) {
         // this does the updating if possible
         [self fileRef];
@@ -782,3 +1000,157 @@ static Class BDSKLinkedFileClass = Nil;
 }
 
 @end
+
+#pragma mark -
+
+@implementation BDSKLinkedFileResolver
+
++ (id)sharedResolver {
+    static BDSKLinkedFileResolver *sharedResolver = nil;
+    if (sharedResolver == nil)
+        sharedResolver = [[self alloc] init];
+    return sharedResolver;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        queue = [[NSOperationQueue alloc] init];
+        pendingFiles = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(queue);
+    BDSKDESTROY(pendingFiles);
+    [super dealloc];
+}
+
+- (void)resolveLinkedFile:(BDSKLinkedAliasFile *)file {
+    BDSKASSERT([NSThread isMainThread]);
+    // collect the files from this run loop cycle, so e.g. all files of a document are resolved in batches
+    if ([pendingFiles count] == 0)
+        [self performSelector:@selector(startResolving) withObject:nil afterDelay:0.0];
+    [pendingFiles addObject:[file resolveRequest]];
+}
+
+- (void)startResolving {
+    NSUInteger i, iMax = [pendingFiles count];
+    for (i = 0; i < iMax; i += BATCH_SIZE) {
+        NSArray *requests = [pendingFiles subarrayWithRange:NSMakeRange(i, MIN(BATCH_SIZE, iMax - i))];
+        NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:self selector:@selector(resolveRequests:) object:requests];
+        [queue addOperation:operation];
+        [operation release];
+    }
+    [pendingFiles removeAllObjects];
+}
+
+// runs on the queue, this does the same as -[BDSKLinkedAliasFile resolveURL] without touching the linked file
+- (void)resolveRequests:(NSArray *)requests {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:[requests count]];
+    
+    for (NSDictionary *request in requests) {
+        NSMutableDictionary *result = [NSMutableDictionary dictionaryWithObjectsAndKeys:[request objectForKey:FILE_KEY], FILE_KEY, [request objectForKey:GENERATION_KEY], GENERATION_KEY, nil];
+        NSString *basePath = [request objectForKey:BASEPATH_KEY];
+        NSString *relPath = [request objectForKey:RELATIVEPATH_KEY];
+        NSData *data = [request objectForKey:FILEREF_KEY];
+        FSRef baseRef, aRef;
+        Boolean hasBaseRef = basePath && BDSKPathToFSRef((CFStringRef)basePath, &baseRef);
+        Boolean shouldUpdate = false;
+        CFURLRef aURL = NULL;
+        
+        if (basePath)
+            [result setObject:basePath forKey:BASEPATH_KEY];
+        
+        // a previous fileRef follows the file when it was moved
+        if (data) {
+            bcopy([data bytes], &aRef, sizeof(FSRef));
+            aURL = CFURLCreateFromFSRef(NULL, &aRef);
+        }
+        if (aURL == NULL && hasBaseRef && relPath) {
+            if (BDSKPathToFSRef((CFStringRef)[basePath stringByAppendingPathComponent:relPath], &aRef))
+                aURL = CFURLCreateFromFSRef(NULL, &aRef);
+        }
+        if (aURL == NULL && (data = [request objectForKey:ALIASDATA_KEY])) {
+            AliasHandle anAlias = BDSKDataToAliasHandle((CFDataRef)data);
+            if (anAlias != NULL && BDSKAliasHandleToFSRef(anAlias, hasBaseRef ? &baseRef : NULL, &aRef, &shouldUpdate))
+                aURL = CFURLCreateFromFSRef(NULL, &aRef);
+            BDSKDisposeAliasHandle(anAlias);
+        }
+        
+        if (aURL != NULL) {
+            [result setObject:[(NSURL *)aURL path] forKey:PATH_KEY];
+            [result setObject:[NSData dataWithBytes:&aRef length:sizeof(FSRef)] forKey:FILEREF_KEY];
+            // update the alias relative to the base path, as -fileRef does
+            if (hasBaseRef) {
+                AliasHandle anAlias = BDSKFSRefToAliasHandle(&aRef, &baseRef);
+                if (anAlias != NULL) {
+                    data = (NSData *)BDSKCopyAliasHandleToData(anAlias);
+                    if (data)
+                        [result setObject:data forKey:ALIASDATA_KEY];
+                    [data release];
+                    BDSKDisposeAliasHandle(anAlias);
+                }
+            }
+            CFRelease(aURL);
+        }
+        
+        [results addObject:result];
+    }
+    
+    [self performSelectorOnMainThread:@selector(finishResolving:) withObject:results waitUntilDone:NO];
+    
+    [pool release];
+}
+
+- (void)finishResolving:(NSArray *)results {
+    for (NSDictionary *result in results)
+        [[result objectForKey:FILE_KEY] finishResolvingWithInfo:result];
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKArchivedAliasFile
+
+- (id)initWithAliasData:(NSData *)data relativePath:(NSString *)relPath {
+    self = [super init];
+    if (self) {
+        aliasData = [data copy];
+        relativePath = [relPath copy];
+    }
+    return self;
+}
+
+- (id)initWithCoder:(NSCoder *)coder {
+    if ([coder allowsKeyedCoding])
+        return [self initWithAliasData:[coder decodeObjectForKey:@"aliasData"] relativePath:[coder decodeObjectForKey:@"relativePath"]];
+    NSData *data = [coder decodeObject];
+    return [self initWithAliasData:data relativePath:[coder decodeObject]];
+}
+
+- (void)dealloc {
+    BDSKDESTROY(aliasData);
+    BDSKDESTROY(relativePath);
+    [super dealloc];
+}
+
+// this should be unarchived as a linked file
+- (Class)classForCoder { return [BDSKLinkedAliasFile class]; }
+- (Class)classForKeyedArchiver { return [BDSKLinkedAliasFile class]; }
+
+// same as -[BDSKLinkedAliasFile encodeWithCoder:]
+- (void)encodeWithCoder:(NSCoder *)coder {
+    if ([coder allowsKeyedCoding]) {
+        [coder encodeObject:aliasData forKey:@"aliasData"];
+        [coder encodeObject:relativePath forKey:@"relativePath"];
+    } else {
+        [coder encodeObject:aliasData];
+        [coder encodeObject:relativePath];
+    }
+}
+
+@end
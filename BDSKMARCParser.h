@@ -42,4 +42,7 @@
 
 @interface BDSKMARCParser: NSObject <BDSKStringParser>
 + (NSArray *)itemsFromMARCXMLString:(NSString *)itemString error:(NSError **)outError;
+// parses ISO 2709 records directly from their bytes, decoding MARC-8 or UTF-8 fields as indicated in the leader; the formatted record is only added as annote when includeAnnote is YES
++ (BOOL)canParseMARCData:(NSData *)data;
++ (NSArray *)itemsFromMARCData:(NSData *)data includeAnnote:(BOOL)includeAnnote error:(NSError **)outError;
 @end
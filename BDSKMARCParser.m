@@ -54,12 +54,31 @@
 - (NSString *)stringByRemovingPunctuationCharactersAndBracketedText;
 @end
 
+#define RECORD_TERMINATOR   0x1D
+#define FIELD_TERMINATOR    0x1E
+#define SUBFIELD_INDICATOR  0x1F
+#define LEADER_LENGTH       24
+#define DIRECTORY_ENTRY_LENGTH 12
+
+static NSArray *itemsFromMARCBytes(NSData *data, BOOL isUnicode, BOOL includeAnnote);
 static void addStringToDictionary(NSString *value, NSMutableDictionary *dict, NSString *tag, NSString *subFieldIndicator, BOOL isUNIMARC);
 static void addSubstringToDictionary(NSString *subValue, NSMutableDictionary *pubDict, NSString *tag, NSString *subTag, BOOL isUNIMARC);
 static BibItem *createPublicationWithRecord(NSXMLNode *record);
 
+// set up in +initialize rather than lazily, as the parser can be used on several threads at once
+static AGRegex *findYearRegex = nil;
+static NSCharacterSet *punctuationCharacterSet = nil;
+static NSCharacterSet *bracketCharacterSet = nil;
+
 @implementation BDSKMARCParser
 
++ (void)initialize{
+    BDSKINITIALIZE;
+    findYearRegex = [[AGRegex alloc] initWithPattern:@"(.*)(\\d{4})(.*)"];
+    punctuationCharacterSet = [[NSCharacterSet characterSetWithCharactersInString:@".,:;/"] retain];
+    bracketCharacterSet = [[NSCharacterSet characterSetWithCharactersInString:@"[]"] retain];
+}
+
 + (BOOL)canParseString:(NSString *)string{
 	return [string isMARCString] || [string isFormattedMARCString] || [string isMARCXMLString];
 }
@@ -171,81 +190,33 @@ static BibItem *createPublicationWithRecord(NSXMLNode *record);
 + (NSArray *)itemsFromMARCString:(NSString *)itemString error:(NSError **)outError{
     // make sure that we only have one type of space and line break to deal with, since HTML copy/paste can have odd whitespace characters
     itemString = [itemString stringByNormalizingSpacesAndLineBreaks];
-	
-    BibItem *newBI = nil;
-    NSMutableArray *returnArray = [NSMutableArray arrayWithCapacity:10];
-    
-    NSString *recordTerminator = [NSString stringWithFormat:@"%C", (unichar)0x1D];
-    NSString *fieldTerminator = [NSString stringWithFormat:@"%C", (unichar)0x1E];
-    NSString *subFieldIndicator = [NSString stringWithFormat:@"%C", (unichar)0x1F];
-	
-    BOOL isUNIMARC = [itemString characterAtIndex:23] == ' ';
-    
-    NSArray *records = [itemString componentsSeparatedByString:recordTerminator];
-    
-    //dictionary is the publication entry
-    NSMutableDictionary *pubDict = [[NSMutableDictionary alloc] init];
-    
-    NSMutableString *formattedString = [NSMutableString string];
-    
-    NSArray *fields;
-    NSString *tag = nil, *field = nil, *value = nil, *dir = nil;
-    NSUInteger base, fieldsStart, i, dirLength;
-    BOOL isControlField;
-    
-    for (NSString *record in records) {
-        
-        if([record length] < 25)
-            continue;
-        
-        base = [[record substringWithRange:NSMakeRange(12, 5)] integerValue];
-        dir = [record substringWithRange:NSMakeRange(24, base - 25)];
-        dirLength = [dir length] / 12;
-        
-        fieldsStart = base + [[dir substringWithRange:NSMakeRange(7, 5)] integerValue];
-        fields = [[record substringFromIndex:fieldsStart] componentsSeparatedByString:fieldTerminator];
-        
-        [formattedString setString:@""];
-        [formattedString appendStrings:@"LDR    ", [record substringToIndex:24], @"\n", nil];
-        
-        for(i = 0; i < dirLength; i++){
-            
-            if ([fields count] <= i)
-                break;
-            
-            tag = [dir substringWithRange:NSMakeRange(12 * i, 3)];
-            field = [fields objectAtIndex:i];
-            isControlField = [tag hasPrefix:@"00"];
-            
-            if (isControlField == NO && [field length] < 2)
-                continue;
-            
-            // the first 2 characters are indicators
-            value = [field substringFromIndex:isControlField ? 0 : 2];
-            
-            addStringToDictionary(value, pubDict, tag, subFieldIndicator, isUNIMARC);
-            
-            [formattedString appendStrings:tag, @" ", isControlField ? @"  " : [field substringToIndex:2], @" ", nil];
-            [formattedString appendStrings:[value stringByReplacingOccurrencesOfString:subFieldIndicator withString:@"$"], @"\n", nil];
-        }
-        
-        if([pubDict count] > 0){
-            value = [formattedString copy];
-            [pubDict setObject:value forKey:BDSKAnnoteString];
-            [value release];
-            
-            newBI = [[BibItem alloc] initWithType:BDSKBookString
-                                          citeKey:nil
-                                        pubFields:pubDict
-                                            isNew:YES];
-            [returnArray addObject:newBI];
-            [newBI release];
-        }
-        
+    // the string is already decoded, so the fields should not be decoded as MARC-8 again
+    return itemsFromMARCBytes([itemString dataUsingEncoding:NSUTF8StringEncoding], YES, YES);
+}
+
+// the same check as -isMARCString, on the raw bytes
++ (BOOL)canParseMARCData:(NSData *)data{
+    NSUInteger i, length = [data length];
+    const uint8_t *bytes = [data bytes];
+    if (length < 24 + 12 + 1)
+        return NO;
+    for (i = 0; i < 5; i++) {
+        if (isdigit(bytes[i]) == 0)
+            return NO;
     }
-    
-    [pubDict release];
-    return returnArray;
+    for (i = 5; i < 24; i++) {
+        if (isalnum(bytes[i]) == 0 && bytes[i] != ' ' && bytes[i] != '-' && bytes[i] != '.')
+            return NO;
+    }
+    for (i = 24; i < length && bytes[i] != FIELD_TERMINATOR; i++) {
+        if (isdigit(bytes[i]) == 0)
+            return NO;
+    }
+    return i < length && i > 24 && (i - 24) % 12 == 0;
+}
+
++ (NSArray *)itemsFromMARCData:(NSData *)data includeAnnote:(BOOL)includeAnnote error:(NSError **)outError{
+    return itemsFromMARCBytes(data, NO, includeAnnote);
 }
 
 + (NSArray *)itemsFromMARCXMLString:(NSString *)itemString error:(NSError **)outError{
@@ -288,6 +259,251 @@ static BibItem *createPublicationWithRecord(NSXMLNode *record);
 
 #pragma mark -
 
+// MARC-8 extended Latin (ANSEL), for the bytes 0xA1-0xFE; 0 for undefined characters
+static const unichar MARC8ExtendedLatin[94] = {
+            0x0141, 0x00D8, 0x0110, 0x00DE, 0x00C6, 0x0152, 0x02B9, 0x00B7, 0x266D, 0x00AE, 0x00B1, 0x01A0, 0x01AF, 0x02BC, 0,      // A1-AF
+    0x02BB, 0x0142, 0x00F8, 0x0111, 0x00FE, 0x00E6, 0x0153, 0x02BA, 0x0131, 0x00A3, 0x00F0, 0,      0x01A1, 0x01B0, 0,      0,      // B0-BF
+    0x00B0, 0x2113, 0x2117, 0x00A9, 0x266F, 0x00BF, 0x00A1, 0x00DF, 0x20AC, 0,      0,      0,      0,      0,      0,      0,      // C0-CF
+    0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      0,      // D0-DF
+    0x0309, 0x0300, 0x0301, 0x0302, 0x0303, 0x0304, 0x0306, 0x0307, 0x0308, 0x030C, 0x030A, 0xFE20, 0xFE21, 0x0315, 0x030B, 0x0310, // E0-EF
+    0x0327, 0x0328, 0x0323, 0x0324, 0x0325, 0x0333, 0x0332, 0x0326, 0x031C, 0x032E, 0xFE22, 0xFE23, 0,      0,      0x0313          // F0-FE
+};
+
+#define MAX_COMBINING_MARKS 8
+
+// MARC-8 puts combining diacritics before the base character, Unicode after it
+static NSString *createStringFromMARC8Bytes(const uint8_t *bytes, NSUInteger length) {
+    NSUInteger i;
+    
+    for (i = 0; i < length && bytes[i] < 0x80 && bytes[i] != 0x1B; i++) {}
+    if (i == length)
+        return (NSString *)CFStringCreateWithBytes(NULL, bytes, length, kCFStringEncodingASCII, FALSE);
+    
+    unichar *chars = (unichar *)NSZoneMalloc(NULL, (length + MAX_COMBINING_MARKS) * sizeof(unichar));
+    unichar marks[MAX_COMBINING_MARKS];
+    NSUInteger numChars = 0, numMarks = 0, j;
+    
+    for (i = 0; i < length; i++) {
+        uint8_t c = bytes[i];
+        unichar uc = 0;
+        if (c == 0x1B) {
+            // we only support the default character sets, so skip escape sequences: an optional intermediate character and a final character
+            if (i + 1 < length && (bytes[i + 1] == '(' || bytes[i + 1] == ',' || bytes[i + 1] == '$' || bytes[i + 1] == ')' || bytes[i + 1] == '-'))
+                i++;
+            i++;
+            continue;
+        } else if (c < 0x80) {
+            uc = c;
+        } else if (c >= 0xA1 && c <= 0xFE) {
+            uc = MARC8ExtendedLatin[c - 0xA1];
+            if ((uc >= 0x0300 && uc < 0x0370) || (uc >= 0xFE20 && uc <= 0xFE23)) {
+                if (numMarks < MAX_COMBINING_MARKS)
+                    marks[numMarks++] = uc;
+                continue;
+            }
+        }
+        if (uc == 0)
+            continue;
+        chars[numChars++] = uc;
+        for (j = 0; j < numMarks; j++)
+            chars[numChars++] = marks[j];
+        numMarks = 0;
+    }
+    
+    CFMutableStringRef string = CFStringCreateMutable(NULL, 0);
+    CFStringAppendCharacters(string, chars, numChars);
+    CFStringNormalize(string, kCFStringNormalizationFormC);
+    NSZoneFree(NULL, chars);
+    
+    return (NSString *)string;
+}
+
+static NSString *createStringFromMARCBytes(const uint8_t *bytes, NSUInteger length, BOOL isUTF8) {
+    NSString *string = nil;
+    if (isUTF8) {
+        string = (NSString *)CFStringCreateWithBytes(NULL, bytes, length, kCFStringEncodingUTF8, FALSE);
+        // some records lie about their encoding
+        if (string == nil)
+            string = (NSString *)CFStringCreateWithBytes(NULL, bytes, length, kCFStringEncodingISOLatin1, FALSE);
+    } else {
+        string = createStringFromMARC8Bytes(bytes, length);
+    }
+    return string;
+}
+
+static inline NSUInteger integerFromDigits(const uint8_t *bytes, NSUInteger length, BOOL *isValid) {
+    NSUInteger i, value = 0;
+    for (i = 0; i < length; i++) {
+        if (bytes[i] < '0' || bytes[i] > '9') {
+            *isValid = NO;
+            return 0;
+        }
+        value = 10 * value + (bytes[i] - '0');
+    }
+    return value;
+}
+
+// works directly on the bytes of the records, using the directory for the tags and the locations of the fields
+// only the subfields we use are decoded, and only when we use them, unless we need the formatted record for the annote
+static NSArray *itemsFromMARCBytes(NSData *data, BOOL isUnicode, BOOL includeAnnote) {
+    const uint8_t *bytes = [data bytes];
+    NSUInteger length = [data length];
+    NSUInteger pos = 0;
+    
+    NSMutableArray *returnArray = [NSMutableArray arrayWithCapacity:10];
+    
+    if (length < LEADER_LENGTH + 1)
+        return returnArray;
+    
+    BOOL isUNIMARC = bytes[23] == ' ';
+    BDSKTypeManager *typeManager = [BDSKTypeManager sharedManager];
+    NSMutableDictionary *pubDict = [[NSMutableDictionary alloc] init];
+    NSMutableData *formattedData = includeAnnote ? [[NSMutableData alloc] init] : nil;
+    NSString *subTags[128];
+    NSUInteger i;
+    
+    for (i = 0; i < 128; i++)
+        subTags[i] = nil;
+    
+    while (pos < length) {
+        
+        // skip anything between records, such as line breaks
+        while (pos < length && isdigit(bytes[pos]) == 0)
+            pos++;
+        if (pos + LEADER_LENGTH >= length)
+            break;
+        
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        const uint8_t *record = bytes + pos;
+        BOOL isValid = YES;
+        NSUInteger recordLength = integerFromDigits(record, 5, &isValid);
+        
+        // trust the record length only when it points to a record terminator
+        if (isValid == NO || recordLength <= LEADER_LENGTH || pos + recordLength > length || record[recordLength - 1] != RECORD_TERMINATOR) {
+            const uint8_t *end = memchr(record, RECORD_TERMINATOR, length - pos);
+            recordLength = end ? (NSUInteger)(end - record) + 1 : length - pos;
+        }
+        pos += recordLength;
+        
+        isValid = YES;
+        NSUInteger base = integerFromDigits(record + 12, 5, &isValid);
+        const uint8_t *dirEnd = memchr(record + LEADER_LENGTH, FIELD_TERMINATOR, recordLength - LEADER_LENGTH);
+        if (dirEnd == NULL) {
+            [pool release];
+            continue;
+        }
+        if (isValid == NO || base <= LEADER_LENGTH || base > recordLength || record[base - 1] != FIELD_TERMINATOR)
+            base = (NSUInteger)(dirEnd - record) + 1;
+        
+        BOOL isUTF8 = isUnicode || record[9] == 'a';
+        NSUInteger numberOfEntries = (NSUInteger)(dirEnd - record - LEADER_LENGTH) / DIRECTORY_ENTRY_LENGTH;
+        NSUInteger next = base;
+        
+        [pubDict removeAllObjects];
+        if (includeAnnote) {
+            [formattedData setLength:0];
+            [formattedData appendBytes:"LDR    " length:7];
+            [formattedData appendBytes:record length:LEADER_LENGTH];
+            [formattedData appendBytes:"\n" length:1];
+        }
+        
+        for (i = 0; i < numberOfEntries; i++) {
+            const uint8_t *entry = record + LEADER_LENGTH + DIRECTORY_ENTRY_LENGTH * i;
+            NSUInteger fieldStart, fieldEnd;
+            
+            isValid = YES;
+            NSUInteger fieldLength = integerFromDigits(entry + 3, 4, &isValid);
+            fieldStart = base + integerFromDigits(entry + 7, 5, &isValid);
+            fieldEnd = fieldStart + fieldLength;
+            
+            // the directory counts bytes in the original encoding, so when that does not match we take the next field instead
+            if (isValid == NO || fieldLength == 0 || fieldEnd > recordLength || record[fieldEnd - 1] != FIELD_TERMINATOR) {
+                if (next >= recordLength)
+                    break;
+                const uint8_t *end = memchr(record + next, FIELD_TERMINATOR, recordLength - next);
+                fieldStart = next;
+                fieldEnd = end ? (NSUInteger)(end - record) + 1 : recordLength;
+            }
+            next = fieldEnd;
+            
+            const uint8_t *field = record + fieldStart;
+            NSUInteger valueLength = fieldEnd - fieldStart - (record[fieldEnd - 1] == FIELD_TERMINATOR ? 1 : 0);
+            BOOL isControlField = entry[0] == '0' && entry[1] == '0';
+            
+            if (isControlField == NO && valueLength < 2)
+                continue;
+            
+            if (includeAnnote) {
+                NSUInteger j;
+                [formattedData appendBytes:entry length:3];
+                [formattedData appendBytes:" " length:1];
+                [formattedData appendBytes:isControlField ? (const uint8_t *)"  " : field length:2];
+                [formattedData appendBytes:" " length:1];
+                for (j = isControlField ? 0 : 2; j < valueLength; j++)
+                    [formattedData appendBytes:field[j] == SUBFIELD_INDICATOR ? (const uint8_t *)"$" : field + j length:1];
+                [formattedData appendBytes:"\n" length:1];
+            }
+            
+            // control fields have no subfields
+            if (isControlField)
+                continue;
+            
+            NSString *tag = [[NSString alloc] initWithBytes:entry length:3 encoding:NSASCIIStringEncoding];
+            NSDictionary *subTagKeys = isUNIMARC ? [typeManager fieldNamesForUNIMARCTag:tag] : [typeManager fieldNamesForMARCTag:tag];
+            
+            if ([subTagKeys count]) {
+                // the first 2 characters are indicators
+                const uint8_t *p = field + 2, *end = field + valueLength;
+                while (p < end && *p == SUBFIELD_INDICATOR && p + 1 < end) {
+                    uint8_t subTag = p[1];
+                    const uint8_t *subValue = p + 2;
+                    const uint8_t *subValueEnd = memchr(subValue, SUBFIELD_INDICATOR, end - subValue);
+                    p = subValueEnd ? subValueEnd : end;
+                    if (subTag >= 128 || p == subValue)
+                        continue;
+                    if (subTags[subTag] == nil)
+                        subTags[subTag] = [[NSString alloc] initWithFormat:@"%c", subTag];
+                    if ([subTagKeys objectForKey:subTags[subTag]] == nil)
+                        continue;
+                    NSString *value = createStringFromMARCBytes(subValue, p - subValue, isUTF8);
+                    if (value) {
+                        addSubstringToDictionary([value stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]], pubDict, tag, subTags[subTag], isUNIMARC);
+                        [value release];
+                    }
+                }
+            }
+            
+            [tag release];
+        }
+        
+        if([pubDict count] > 0){
+            if (includeAnnote) {
+                NSString *formattedString = createStringFromMARCBytes([formattedData bytes], [formattedData length], isUTF8);
+                if (formattedString) {
+                    [pubDict setObject:formattedString forKey:BDSKAnnoteString];
+                    [formattedString release];
+                }
+            }
+            
+            BibItem *newBI = [[BibItem alloc] initWithType:BDSKBookString
+                                                   citeKey:nil
+                                                 pubFields:pubDict
+                                                     isNew:YES];
+            [returnArray addObject:newBI];
+            [newBI release];
+        }
+        
+        [pool release];
+    }
+    
+    for (i = 0; i < 128; i++)
+        [subTags[i] release];
+    [formattedData release];
+    [pubDict release];
+    
+    return returnArray;
+}
+
 static void addStringToDictionary(NSString *value, NSMutableDictionary *pubDict, NSString *tag, NSString *subFieldIndicator, BOOL isUNIMARC){
 	unichar subTag = 0;
     NSString *subValue = nil;
@@ -364,9 +580,6 @@ static void addSubstringToDictionary(NSString *subValue, NSMutableDictionary *pu
         tmpValue = nil;
     }else if([key isEqualToString:BDSKYearString]){
         // This is used for stripping extraneous characters from BibTeX year fields
-        static AGRegex *findYearRegex = nil;
-        if(findYearRegex == nil)
-            findYearRegex = [[AGRegex alloc] initWithPattern:@"(.*)(\\d{4})(.*)"];
         subValue = [findYearRegex replaceWithString:@"$2" inString:subValue];
     }
     
@@ -477,13 +690,6 @@ static BibItem *createPublicationWithRecord(NSXMLNode *record) {
 }
 
 - (NSString *)stringByRemovingPunctuationCharactersAndBracketedText{
-    static NSCharacterSet *punctuationCharacterSet = nil;
-    if(punctuationCharacterSet == nil)
-        punctuationCharacterSet = [[NSCharacterSet characterSetWithCharactersInString:@".,:;/"] retain];
-    static NSCharacterSet *bracketCharacterSet = nil;
-    if(bracketCharacterSet == nil)
-        bracketCharacterSet = [[NSCharacterSet characterSetWithCharactersInString:@"[]"] retain];
-    
     NSString *string = self;
     NSUInteger length = [string length];
     NSRange range = [self rangeOfString:@"["];
@@ -41,7 +41,17 @@
 
 @interface BDSKMetadataCacheOperation : NSOperation {
     NSArray *publicationInfos;
+    NSArray *citeKeys;
     NSURL *documentURL;
+    BOOL started;
+    BOOL relinquished;
 }
+// citeKeys are the keys of all publications in the document, cache files of other keys written for this document are removed; can be nil
+- (id)initWithPublicationInfos:(NSArray *)pubInfos citeKeys:(NSArray *)keys forDocumentURL:(NSURL *)aURL;
 - (id)initWithPublicationInfos:(NSArray *)pubInfos forDocumentURL:(NSURL *)aURL;
+
+- (NSURL *)documentURL;
+
+// takes over the publications of an operation for the same document that has not started yet, returns NO if it already started
+- (BOOL)coalesceWithOperation:(BDSKMetadataCacheOperation *)operation;
 @end
@@ -40,33 +40,109 @@
 #import "NSFileManager_BDSKExtensions.h"
 #import "NSError_BDSKExtensions.h"
 #import "BDAlias.h"
+#import "NSData_BDSKExtensions.h"
+#import "BDSKSpotlightCachePack.h"
 #import <libkern/OSAtomic.h>
 
 #define BDSKUseXMLSpotlightCacheKey @"BDSKUseXMLSpotlightCache"
+#define BDSKUsePackedSpotlightCacheKey @"BDSKUsePackedSpotlightCache"
+
+#define MANIFEST_VERSION @"1"
+
+#define VERSION_KEY         @"version"
+#define DOCUMENTPATH_KEY    @"documentPath"
+#define HASHES_KEY          @"hashes"
+#define CITEKEY_KEY         @"net_sourceforge_bibdesk_citekey"
+#define OWNINGFILEPATH_KEY  @"net_sourceforge_bibdesk_owningfilepath"
+
+@interface BDSKMetadataCacheOperation (Private)
+- (NSArray *)relinquishPublicationInfos;
+- (NSArray *)itemsFromPack:(BDSKSpotlightCachePack *)pack notInInfos:(NSArray *)infos citeKeys:(NSArray *)keys;
+- (NSData *)packDataWithDocumentInfo:(NSDictionary *)docInfo infos:(NSArray *)infos citeKeys:(NSArray *)keys previousPack:(BDSKSpotlightCachePack *)pack separateCiteKeys:(NSMutableArray *)separateKeys fileManager:(NSFileManager *)fileManager;
+- (void)removeCacheFileForCiteKey:(NSString *)citeKey documentPath:(NSString *)docPath fileManager:(NSFileManager *)fileManager;
+@end
 
 @implementation BDSKMetadataCacheOperation
 
-- (id)initWithPublicationInfos:(NSArray *)pubInfos forDocumentURL:(NSURL *)aURL {
+- (id)initWithPublicationInfos:(NSArray *)pubInfos citeKeys:(NSArray *)keys forDocumentURL:(NSURL *)aURL {
     self = [super init];
     if (self) {
         publicationInfos = [pubInfos copy];
+        citeKeys = [keys copy];
         documentURL = [aURL copy];
+        started = NO;
+        relinquished = NO;
     }
     return self;
 }
 
+- (id)initWithPublicationInfos:(NSArray *)pubInfos forDocumentURL:(NSURL *)aURL {
+    return [self initWithPublicationInfos:pubInfos citeKeys:nil forDocumentURL:aURL];
+}
+
 - (void)dealloc {
     BDSKDESTROY(publicationInfos);
+    BDSKDESTROY(citeKeys);
     BDSKDESTROY(documentURL);
     [super dealloc];
 }
 
+- (NSURL *)documentURL {
+    return documentURL;
+}
+
+- (BOOL)coalesceWithOperation:(BDSKMetadataCacheOperation *)operation {
+    if ([[operation documentURL] isEqual:documentURL] == NO)
+        return NO;
+    NSArray *olderInfos = [operation relinquishPublicationInfos];
+    if (olderInfos == nil)
+        return NO;
+    @synchronized(self) {
+        // our own infos are newer, so they replace those for the same cite key
+        NSMutableArray *infos = [NSMutableArray arrayWithCapacity:[olderInfos count] + [publicationInfos count]];
+        NSSet *newKeys = [NSSet setWithArray:[publicationInfos valueForKey:CITEKEY_KEY]];
+        for (NSDictionary *info in olderInfos) {
+            if ([newKeys containsObject:[info objectForKey:CITEKEY_KEY]] == NO)
+                [infos addObject:info];
+        }
+        [infos addObjectsFromArray:publicationInfos];
+        [publicationInfos release];
+        publicationInfos = [infos copy];
+    }
+    return YES;
+}
+
++ (NSString *)manifestPathForDocumentPath:(NSString *)docPath {
+    static NSString *manifestFolder = nil;
+    @synchronized(self) {
+        if (manifestFolder == nil) {
+            NSFileManager *fm = [[NSFileManager alloc] init];
+            manifestFolder = [[fm cachesFolderForClass:self version:MANIFEST_VERSION] copy];
+            [fm release];
+        }
+    }
+    NSString *name = [[[docPath dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString];
+    return [manifestFolder stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"plist"]];
+}
+
 - (void)main {
     if ([self isCancelled]) {
         NSLog(@"Application will quit without writing metadata cache.");
         return;
     }
 
+    NSArray *infos = nil;
+    NSArray *keys = nil;
+    
+    // a later save of the same document may have taken over our items
+    @synchronized(self) {
+        if (relinquished)
+            return;
+        started = YES;
+        infos = [[publicationInfos retain] autorelease];
+        keys = [[citeKeys retain] autorelease];
+    }
+    
     NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
     NSError *error = nil;
@@ -99,36 +175,100 @@
             @throw [NSException exceptionWithName:NSObjectNotAvailableException reason:[NSString stringWithFormat:@"Unable to get an alias for file %@", docPath] userInfo:nil];
         }
         
-        NSDictionary *docInfo = [NSDictionary dictionaryWithObjectsAndKeys:docPath, @"net_sourceforge_bibdesk_owningfilepath", [alias aliasData], @"FileAlias", nil];
+        NSDictionary *docInfo = [NSDictionary dictionaryWithObjectsAndKeys:docPath, OWNINGFILEPATH_KEY, [alias aliasData], @"FileAlias", nil];
         
         [alias release];
         
-        for (NSDictionary *anItem in publicationInfos) {
-            if ([self isCancelled]) {
-                NSLog(@"Application will quit without finishing writing metadata cache.");
-                break;
-            } else {
-                NSString *citeKey = [anItem objectForKey:@"net_sourceforge_bibdesk_citekey"];
-                if (citeKey) {
-                    NSString *path = [fileManager spotlightCacheFilePathWithCiteKey:citeKey];
-                    // Save the plist; we can get an error if these are not plist objects, or the file couldn't be written.  The first case is a programmer error, and the second should have been caught much earlier in this code.
-                    if (path) {
-                        NSMutableDictionary *metadata = [docInfo mutableCopy];
-                        [metadata addEntriesFromDictionary:anItem];
-                        NSString *errString = nil;
-                        NSData *data = [NSPropertyListSerialization dataFromPropertyList:metadata format:plistFormat errorDescription:&errString];
-                        [metadata release];
-                        if (nil == data) {
-                            error = [NSError localErrorWithCode:kBDSKPropertyListSerializationFailed localizedDescription:[NSString stringWithFormat:NSLocalizedString(@"Unable to save metadata cache file for item with cite key \"%@\".  The error was \"%@\"", @"Error description"), citeKey, errString]];
-                            [errString release];
-                            @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"Unable to create cache file for %@", anItem] userInfo:nil];
-                        } else if (NO == [data writeToFile:path options:NSAtomicWrite error:&error]) {
-                            @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"Unable to create cache file for %@", anItem] userInfo:nil];
+        // the manifest has the hashes of the cache files we wrote for this document, so we only rewrite the ones that changed
+        NSString *manifestPath = [[self class] manifestPathForDocumentPath:docPath];
+        NSDictionary *manifest = nil;
+        NSData *manifestData = [NSData dataWithContentsOfFile:manifestPath];
+        if (manifestData) {
+            manifest = [NSPropertyListSerialization propertyListFromData:manifestData mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:NULL];
+            if ([manifest isKindOfClass:[NSDictionary class]] == NO || [[manifest objectForKey:VERSION_KEY] isEqualToString:MANIFEST_VERSION] == NO || [[manifest objectForKey:DOCUMENTPATH_KEY] isEqualToString:docPath] == NO)
+                manifest = nil;
+        }
+        NSMutableDictionary *hashes = [NSMutableDictionary dictionaryWithDictionary:[manifest objectForKey:HASHES_KEY]];
+        
+        // a packed cache file for this document, which has all the items in a single file
+        NSString *packPath = [fileManager spotlightCachePackPathWithDocumentPath:docPath];
+        BDSKSpotlightCachePack *pack = packPath ? [[[BDSKSpotlightCachePack alloc] initWithContentsOfFile:packPath] autorelease] : nil;
+        
+        // hidden option to write a single packed file per document rather than a file per item, the BibImporter plugin handles both
+        if (packPath && [[NSUserDefaults standardUserDefaults] boolForKey:BDSKUsePackedSpotlightCacheKey]) {
+            
+            NSMutableArray *separateKeys = [NSMutableArray array];
+            NSData *data = [self packDataWithDocumentInfo:docInfo infos:infos citeKeys:keys previousPack:pack separateCiteKeys:separateKeys fileManager:fileManager];
+            
+            if (nil == data) {
+                error = [NSError localErrorWithCode:kBDSKPropertyListSerializationFailed localizedDescription:[NSString stringWithFormat:NSLocalizedString(@"Unable to save metadata cache file for document \"%@\".", @"Error description"), docPath]];
+                @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"Unable to create packed cache file for %@", docPath] userInfo:nil];
+            } else if ([data isEqualToData:[pack data]] == NO && NO == [data writeToFile:packPath options:NSAtomicWrite error:&error]) {
+                @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"Unable to create packed cache file for %@", docPath] userInfo:nil];
+            }
+            
+            // the items are now in the pack, so remove the separate files we wrote for them before
+            [separateKeys addObjectsFromArray:[hashes allKeys]];
+            for (NSString *citeKey in separateKeys)
+                [self removeCacheFileForCiteKey:citeKey documentPath:docPath fileManager:fileManager];
+            [hashes removeAllObjects];
+            
+        } else {
+            
+            // when we used the packed cache before, we also need to write the items that did not change
+            if (pack)
+                infos = [infos arrayByAddingObjectsFromArray:[self itemsFromPack:pack notInInfos:infos citeKeys:keys]];
+            
+            for (NSDictionary *anItem in infos) {
+                if ([self isCancelled]) {
+                    NSLog(@"Application will quit without finishing writing metadata cache.");
+                    break;
+                } else {
+                    NSString *citeKey = [anItem objectForKey:CITEKEY_KEY];
+                    if (citeKey) {
+                        NSString *path = [fileManager spotlightCacheFilePathWithCiteKey:citeKey];
+                        NSString *hash = [[[NSPropertyListSerialization dataFromPropertyList:anItem format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL] sha1Signature] hexString];
+                        // skip items that did not change since we last wrote them, as long as the file is still there
+                        if (path && hash && [[hashes objectForKey:citeKey] isEqualToString:hash] && [fileManager fileExistsAtPath:path])
+                            continue;
+                        // Save the plist; we can get an error if these are not plist objects, or the file couldn't be written.  The first case is a programmer error, and the second should have been caught much earlier in this code.
+                        if (path) {
+                            NSMutableDictionary *metadata = [docInfo mutableCopy];
+                            [metadata addEntriesFromDictionary:anItem];
+                            NSString *errString = nil;
+                            NSData *data = [NSPropertyListSerialization dataFromPropertyList:metadata format:plistFormat errorDescription:&errString];
+                            [metadata release];
+                            if (nil == data) {
+                                error = [NSError localErrorWithCode:kBDSKPropertyListSerializationFailed localizedDescription:[NSString stringWithFormat:NSLocalizedString(@"Unable to save metadata cache file for item with cite key \"%@\".  The error was \"%@\"", @"Error description"), citeKey, errString]];
+                                [errString release];
+                                @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"Unable to create cache file for %@", anItem] userInfo:nil];
+                            } else if (NO == [data writeToFile:path options:NSAtomicWrite error:&error]) {
+                                @throw [NSException exceptionWithName:NSInternalInconsistencyException reason:[NSString stringWithFormat:@"Unable to create cache file for %@", anItem] userInfo:nil];
+                            } else if (hash) {
+                                [hashes setObject:hash forKey:citeKey];
+                            }
                         }
                     }
                 }
             }
+            
+            // remove the files we wrote for items that are no longer in the document
+            if (keys && [self isCancelled] == NO) {
+                NSSet *currentKeys = [NSSet setWithArray:keys];
+                for (NSString *citeKey in [hashes allKeys]) {
+                    if ([currentKeys containsObject:citeKey] == NO) {
+                        [self removeCacheFileForCiteKey:citeKey documentPath:docPath fileManager:fileManager];
+                        [hashes removeObjectForKey:citeKey];
+                    }
+                }
+            }
+            
+            if (pack && [self isCancelled] == NO)
+                [fileManager deleteObjectAtFileURL:[NSURL fileURLWithPath:packPath] error:NULL];
         }
+        
+        manifest = [NSDictionary dictionaryWithObjectsAndKeys:MANIFEST_VERSION, VERSION_KEY, docPath, DOCUMENTPATH_KEY, hashes, HASHES_KEY, nil];
+        [[NSPropertyListSerialization dataFromPropertyList:manifest format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL] writeToFile:manifestPath atomically:YES];
     }    
     @catch (id localException) {
         NSLog(@"-[%@ %@] discarding exception %@", [self class], NSStringFromSelector(_cmd), [localException description]);
@@ -143,3 +283,100 @@
 }
 
 @end
+
+@implementation BDSKMetadataCacheOperation (Private)
+
+- (NSArray *)relinquishPublicationInfos {
+    NSArray *infos = nil;
+    @synchronized(self) {
+        if (started == NO && relinquished == NO) {
+            relinquished = YES;
+            infos = [[publicationInfos retain] autorelease];
+        }
+    }
+    return infos;
+}
+
+- (NSArray *)itemsFromPack:(BDSKSpotlightCachePack *)pack notInInfos:(NSArray *)infos citeKeys:(NSArray *)keys {
+    NSSet *currentKeys = keys ? [NSSet setWithArray:keys] : nil;
+    NSSet *changedKeys = [NSSet setWithArray:[infos valueForKey:CITEKEY_KEY]];
+    NSMutableArray *items = [NSMutableArray array];
+    NSUInteger i, iMax = [pack count];
+    for (i = 0; i < iMax; i++) {
+        NSString *citeKey = [pack citeKeyAtIndex:i];
+        if (citeKey && [changedKeys containsObject:citeKey] == NO && (currentKeys == nil || [currentKeys containsObject:citeKey])) {
+            NSDictionary *item = [pack itemAtIndex:i];
+            if (item)
+                [items addObject:item];
+        }
+    }
+    return items;
+}
+
+- (NSData *)packDataWithDocumentInfo:(NSDictionary *)docInfo infos:(NSArray *)infos citeKeys:(NSArray *)keys previousPack:(BDSKSpotlightCachePack *)pack separateCiteKeys:(NSMutableArray *)separateKeys fileManager:(NSFileManager *)fileManager {
+    NSMutableDictionary *records = [NSMutableDictionary dictionaryWithCapacity:[infos count]];
+    NSString *docPath = [docInfo objectForKey:OWNINGFILEPATH_KEY];
+    
+    for (NSDictionary *anItem in infos) {
+        NSString *citeKey = [anItem objectForKey:CITEKEY_KEY];
+        if (citeKey) {
+            NSData *record = [NSPropertyListSerialization dataFromPropertyList:anItem format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
+            if (record == nil)
+                return nil;
+            [records setObject:record forKey:citeKey];
+        }
+    }
+    
+    if (keys == nil) {
+        NSMutableArray *allKeys = [NSMutableArray array];
+        NSUInteger i, iMax = [pack count];
+        for (i = 0; i < iMax; i++)
+            [allKeys addObject:[pack citeKeyAtIndex:i] ?: @""];
+        keys = [allKeys arrayByAddingObjectsFromArray:[records allKeys]];
+    }
+    
+    NSMutableSet *seenKeys = [NSMutableSet setWithCapacity:[keys count]];
+    NSMutableArray *packKeys = [NSMutableArray arrayWithCapacity:[keys count]];
+    NSMutableArray *packRecords = [NSMutableArray arrayWithCapacity:[keys count]];
+    
+    for (NSString *citeKey in keys) {
+        if ([citeKey length] == 0 || [seenKeys containsObject:citeKey])
+            continue;
+        [seenKeys addObject:citeKey];
+        
+        // the items that did not change are copied from the previous pack without parsing them
+        NSData *record = [records objectForKey:citeKey];
+        if (record == nil) {
+            NSUInteger idx = [pack indexOfCiteKey:citeKey];
+            if (idx != NSNotFound) {
+                record = [pack itemDataAtIndex:idx];
+            } else {
+                // when we did not use the pack before, an item that did not change is in a separate cache file
+                NSString *path = [fileManager spotlightCacheFilePathWithCiteKey:citeKey];
+                NSMutableDictionary *metadata = path ? [NSMutableDictionary dictionaryWithContentsOfFile:path] : nil;
+                if ([[metadata objectForKey:OWNINGFILEPATH_KEY] isEqualToString:docPath]) {
+                    [metadata removeObjectsForKeys:[docInfo allKeys]];
+                    record = [NSPropertyListSerialization dataFromPropertyList:metadata format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
+                    if (record)
+                        [separateKeys addObject:citeKey];
+                }
+            }
+        }
+        if (record) {
+            [packKeys addObject:citeKey];
+            [packRecords addObject:record];
+        }
+    }
+    
+    return [BDSKSpotlightCachePack dataWithDocumentInfo:docInfo citeKeys:packKeys itemData:packRecords];
+}
+
+- (void)removeCacheFileForCiteKey:(NSString *)citeKey documentPath:(NSString *)docPath fileManager:(NSFileManager *)fileManager {
+    // cite keys are not unique between documents, so make sure the file is still ours
+    NSString *path = [fileManager spotlightCacheFilePathWithCiteKey:citeKey];
+    NSDictionary *metadata = path ? [NSDictionary dictionaryWithContentsOfFile:path] : nil;
+    if ([[metadata objectForKey:OWNINGFILEPATH_KEY] isEqualToString:docPath])
+        [fileManager removeSpotlightCacheFileForCiteKey:citeKey];
+}
+
+@end
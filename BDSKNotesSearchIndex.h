@@ -46,7 +46,6 @@
     NSConditionLock *queueLock;
     NSMutableArray *queue;
     NSConditionLock *setupLock;
-    NSFileManager *fileManager;
 }
 
 - (void)removePublications:(NSArray *)pubs;
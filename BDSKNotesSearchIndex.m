@@ -41,7 +41,7 @@
 #import "BDSKStringConstants.h"
 #import "NSURL_BDSKExtensions.h"
 #import <libkern/OSAtomic.h>
-#import <SkimNotesBase/SkimNotesBase.h>
+#import "BDSKTextExtractionCache.h"
 
 
 @interface BDSKNotesSearchIndex (BDSKPrivate)
@@ -172,26 +172,7 @@
         if ([fileURLs count]) {
             searchText = [NSMutableString string];
             for (NSURL *fileURL in fileURLs) {
-                NSString *notesString = nil;
-                FSRef fileRef;
-                CFStringRef theUTI = NULL;
-                if (CFURLGetFSRef((CFURLRef)fileURL, &fileRef))
-                    LSCopyItemAttribute(&fileRef, kLSRolesAll, kLSItemContentType, (CFTypeRef *)&theUTI);
-                if (theUTI && UTTypeConformsTo(theUTI, CFSTR("net.sourceforge.skim-app.pdfd")))
-                    notesString = [fileManager readSkimTextNotesFromPDFBundleAtURL:fileURL error:NULL];
-                else
-                    notesString = [fileManager readSkimTextNotesFromExtendedAttributesAtURL:fileURL error:NULL];
-                if (notesString == nil) {
-                    NSArray *notes = nil;
-                    if (theUTI && UTTypeConformsTo(theUTI, CFSTR("net.sourceforge.skim-app.pdfd")))
-                        notes = [fileManager readSkimNotesFromPDFBundleAtURL:fileURL error:NULL];
-                    else if (theUTI && UTTypeConformsTo(theUTI, CFSTR("net.sourceforge.skim-app.skimnotes")))
-                        notes = [fileManager readSkimNotesFromSkimFileAtURL:fileURL error:NULL];
-                    else
-                        notes = [fileManager readSkimNotesFromExtendedAttributesAtURL:fileURL error:NULL];
-                    if (notes)
-                        notesString = SKNSkimTextNotes(notes);
-                }
+                NSString *notesString = [[BDSKTextExtractionCache sharedCache] notesForFileURL:fileURL];
                 if ([notesString length]) {
                     if ([searchText length])
                         [searchText appendString:@"\n"];
@@ -223,8 +204,6 @@
 {
 	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
     
-    fileManager = [[NSFileManager alloc] init];
-    
     [setupLock lockWhenCondition:INDEX_STARTUP];
     [setupLock unlockWithCondition:INDEX_STARTUP_COMPLETE];
     [setupLock lockWhenCondition:INDEX_THREAD_WORKING];
@@ -257,7 +236,6 @@
     }
     @finally {
         // allow the top-level pool to catch this autorelease pool
-        [fileManager release];
         [setupLock unlockWithCondition:INDEX_THREAD_DONE];
         [pool release];
     }
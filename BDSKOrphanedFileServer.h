@@ -69,12 +69,23 @@
 {
     NSMutableArray *foundFiles;     // cache of file URLs from UKDirectoryEnumerator minus knownFiles
     NSSet *knownFiles;              // file paths from BibItem
+    NSSet *knownPaths;              // lowercase paths of knownFiles, for a quick first check
     NSURL *baseURL;                 // root URL to start enumerating
+    NSOperationQueue *directoryQueue;       // scans one directory per operation
+    NSCondition *directoryCondition;        // guards foundFiles and the scan state below, signals the server thread
+    NSInteger pendingDirectories;
+    NSMutableSet *visitedDirectories;
+    NSString *snapshotFolder;               // where the snapshots of scanned folders are kept
+    NSDictionary *previousSnapshot;         // directory path -> entries from the last scan of baseURL
+    NSMutableDictionary *currentSnapshot;
     int32_t keepEnumerating;
     int32_t allFilesEnumerated;
     id<BDSKOrphanedFileServerDelegate> delegate;
 }
 
+// designated initializer; a nil folder keeps the snapshots in the caches folder
+- (id)initWithSnapshotFolder:(NSString *)folder;
+
 - (id<BDSKOrphanedFileServerDelegate>)delegate;
 - (void)setDelegate:(id<BDSKOrphanedFileServerDelegate>)newDelegate;
 
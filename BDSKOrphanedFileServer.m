@@ -40,6 +40,26 @@
 #import "UKDirectoryEnumerator.h"
 #import "NSURL_BDSKExtensions.h"
 #import "BDSKFile.h"
+#import "NSData_BDSKExtensions.h"
+#import "NSFileManager_BDSKExtensions.h"
+#import <sys/stat.h>
+#import <dirent.h>
+
+#define SNAPSHOT_VERSION @"2"
+
+#define VERSION_KEY         @"version"
+#define BASEPATH_KEY        @"basePath"
+#define DIRECTORIES_KEY     @"directories"
+#define DATE_KEY            @"date"
+#define HIDDEN_KEY          @"hidden"
+#define SCANNED_KEY         @"scanned"
+#define FILES_KEY           @"files"
+#define SUBDIRECTORIES_KEY  @"subdirectories"
+#define ALIASES_KEY         @"aliases"
+
+// found files are sent to the main thread when we have this many, or when the scan has been quiet for a while
+#define FLUSH_COUNT 16
+#define FLUSH_INTERVAL 0.5
 
 @interface BDSKOrphanedFileServer (PrivateServerThread)
 
@@ -47,22 +67,48 @@
 - (void)checkAllFilesInDirectoryRootedAtURL:(NSURL *)theURL;
 - (void)setBaseURL:(NSURL *)theURL;
 - (void)setKnownFiles:(NSSet *)theFiles;
+- (NSString *)snapshotPath;
+- (void)loadSnapshot;
+- (void)saveSnapshotPruning:(BOOL)prune;
 - (void)flushFoundFiles;
 - (void)clearFoundFiles;
 
 @end
 
+@interface BDSKOrphanedFileServer (PrivateWorkerThread)
+
+// sent on the operations of directoryQueue
+- (NSDictionary *)newEntryForDirectoryAtURL:(NSURL *)theURL files:(NSMutableArray *)files;
+- (void)checkDirectoryAtPath:(NSString *)path;
+
+@end
+
 #pragma mark -
 
 @implementation BDSKOrphanedFileServer
 
-- (id)init;
+- (id)initWithSnapshotFolder:(NSString *)folder;
 {
     self = [super init];
     if (self) {
+        if (folder == nil) {
+            NSFileManager *fm = [[NSFileManager alloc] init];
+            folder = [fm cachesFolderForClass:[self class] version:SNAPSHOT_VERSION];
+            [fm release];
+        }
+        snapshotFolder = [folder copy];
         foundFiles = [[NSMutableArray alloc] initWithCapacity:32];
         knownFiles = nil;
+        knownPaths = nil;
         baseURL = nil;
+        // directory scanning is mostly waiting for the disk or the network, so use more workers than processors
+        directoryQueue = [[NSOperationQueue alloc] init];
+        [directoryQueue setMaxConcurrentOperationCount:MAX(4, 2 * (NSInteger)[[NSProcessInfo processInfo] activeProcessorCount])];
+        directoryCondition = [[NSCondition alloc] init];
+        pendingDirectories = 0;
+        visitedDirectories = [[NSMutableSet alloc] init];
+        previousSnapshot = nil;
+        currentSnapshot = [[NSMutableDictionary alloc] init];
         keepEnumerating = 0;
         allFilesEnumerated = 0;
         delegate = nil;
@@ -71,11 +117,23 @@
     return self;
 }
 
+- (id)init;
+{
+    return [self initWithSnapshotFolder:nil];
+}
+
 - (void)dealloc
 {
     BDSKDESTROY(foundFiles);
     BDSKDESTROY(knownFiles);
+    BDSKDESTROY(knownPaths);
     BDSKDESTROY(baseURL);
+    BDSKDESTROY(directoryQueue);
+    BDSKDESTROY(directoryCondition);
+    BDSKDESTROY(visitedDirectories);
+    BDSKDESTROY(snapshotFolder);
+    BDSKDESTROY(previousSnapshot);
+    BDSKDESTROY(currentSnapshot);
     [super dealloc];
 }
 
@@ -120,7 +178,10 @@
         limit.rlim_cur = RLIM_INFINITY;
         (void) setrlimit(RLIMIT_NOFILE, &limit);
     }
-        
+    
+    // directories that did not change since the last scan of this folder are not read again
+    [self loadSnapshot];
+    
     // run directory enumerator; if knownFiles doesn't contain object, add to foundFiles
     [self checkAllFilesInDirectoryRootedAtURL:baseURL];
     
@@ -132,6 +193,9 @@
     if (keepEnumerating == 1)
         OSAtomicCompareAndSwap32Barrier(0, 1, &allFilesEnumerated);
     
+    // when stopped we keep the old entries of the directories we did not reach, as they are still validated by their dates
+    [self saveSnapshotPruning:allFilesEnumerated == 1];
+    
     // notify the delegate that we're done
     [[self serverOnMainThread] serverDidFinish];
 }
@@ -157,16 +221,192 @@
 @implementation BDSKOrphanedFileServer (PrivateServerThread)
 
 // must not be oneway; we need to wait for this method to return and set a flag when enumeration is complete (or been stopped)
+// directories are scanned breadth first by the operations of directoryQueue, each operation queueing the subdirectories it finds, while this thread passes the found files on to the main thread
 - (void)checkAllFilesInDirectoryRootedAtURL:(NSURL *)theURL
 {
-    UKDirectoryEnumerator *enumerator = [UKDirectoryEnumerator enumeratorWithURL:theURL];
+    NSString *path = [[theURL path] stringByStandardizingPath];
+    
+    [directoryCondition lock];
+    [visitedDirectories removeAllObjects];
+    [visitedDirectories addObject:path];
+    pendingDirectories = 1;
+    [directoryQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(checkDirectoryAtPath:) object:path] autorelease]];
+    
+    while (pendingDirectories > 0) {
+        [directoryCondition waitUntilDate:[NSDate dateWithTimeIntervalSinceNow:FLUSH_INTERVAL]];
+        if ([foundFiles count]) {
+            NSArray *newFiles = [foundFiles copy];
+            [foundFiles removeAllObjects];
+            [directoryCondition unlock];
+            [[self serverOnMainThread] serverFoundFiles:newFiles];
+            [newFiles release];
+            [directoryCondition lock];
+        }
+    }
+    
+    [directoryCondition unlock];
+}
+
+- (void)setBaseURL:(NSURL *)theURL;
+{
+    NSParameterAssert([theURL isFileURL]);
+    [baseURL autorelease];
+    baseURL = [theURL copy];
+}
+
+- (void)setKnownFiles:(NSSet *)theFiles;
+{
+    [knownFiles autorelease];
+    knownFiles = [theFiles copy];
+    
+    NSMutableSet *paths = [[NSMutableSet alloc] initWithCapacity:[knownFiles count]];
+    NSString *path;
+    for (BDSKFile *aFile in knownFiles) {
+        if ((path = [aFile path]))
+            [paths addObject:path];
+    }
+    [knownPaths release];
+    knownPaths = paths;
+}
+
+- (void)flushFoundFiles;
+{
+    [directoryCondition lock];
+    NSArray *newFiles = [foundFiles count] ? [foundFiles copy] : nil;
+    [foundFiles removeAllObjects];
+    [directoryCondition unlock];
+    if(newFiles){
+        [[self serverOnMainThread] serverFoundFiles:newFiles];
+        [newFiles release];
+    }
+}
+
+- (void)clearFoundFiles;
+{
+    [directoryCondition lock];
+    [foundFiles removeAllObjects];
+    [directoryCondition unlock];
+}
+
+- (NSString *)snapshotPath;
+{
+    NSString *name = [[[[baseURL path] dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString];
+    return [snapshotFolder stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"plist"]];
+}
+
+- (void)loadSnapshot;
+{
+    NSData *data = [NSData dataWithContentsOfFile:[self snapshotPath]];
+    NSDictionary *snapshot = nil;
+    if (data) {
+        snapshot = [NSPropertyListSerialization propertyListFromData:data mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:NULL];
+        // make sure this is really our snapshot, and not a damaged file or a hash collision
+        if ([snapshot isKindOfClass:[NSDictionary class]] == NO || [[snapshot objectForKey:VERSION_KEY] isEqualToString:SNAPSHOT_VERSION] == NO || [[snapshot objectForKey:BASEPATH_KEY] isEqualToString:[baseURL path]] == NO)
+            snapshot = nil;
+    }
+    [previousSnapshot release];
+    previousSnapshot = [[snapshot objectForKey:DIRECTORIES_KEY] retain];
+    [currentSnapshot removeAllObjects];
+}
+
+- (void)saveSnapshotPruning:(BOOL)prune;
+{
+    NSMutableDictionary *directories = [NSMutableDictionary dictionary];
+    if (prune == NO && previousSnapshot)
+        [directories addEntriesFromDictionary:previousSnapshot];
+    [directories addEntriesFromDictionary:currentSnapshot];
+    NSDictionary *snapshot = [NSDictionary dictionaryWithObjectsAndKeys:SNAPSHOT_VERSION, VERSION_KEY, [baseURL path], BASEPATH_KEY, directories, DIRECTORIES_KEY, nil];
+    NSData *data = [NSPropertyListSerialization dataFromPropertyList:snapshot format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
+    [data writeToFile:[self snapshotPath] atomically:YES];
+    BDSKDESTROY(previousSnapshot);
+    [currentSnapshot removeAllObjects];
+}
+
+@end
+
+#pragma mark -
 
-    // default is 16, which is a bit small (don't set it too large, though, since we use -cacheExhausted to signal that it's time to flush the found files)
+@implementation BDSKOrphanedFileServer (PrivateWorkerThread)
+
+static BOOL getModificationDate(NSString *path, NSTimeInterval *date) {
+    struct stat sb;
+    if (stat([path fileSystemRepresentation], &sb) != 0)
+        return NO;
+    *date = (NSTimeInterval)sb.st_mtimespec.tv_sec + 1.0e-9 * (NSTimeInterval)sb.st_mtimespec.tv_nsec;
+    return YES;
+}
+
+// hiding an item does not change the date of its directory, so we also keep the names of the hidden items; the file system keeps the Finder invisible flag in sync with UF_HIDDEN
+// this is a stat for each item, still much cheaper than listing the directory again, which also asks Launch Services about each subdirectory
+static NSArray *copyHiddenNames(NSString *path) {
+    const char *dirPath = [path fileSystemRepresentation];
+    DIR *dir = opendir(dirPath);
+    if (dir == NULL)
+        return nil;
+    NSMutableArray *names = [[NSMutableArray alloc] init];
+    char itemPath[PATH_MAX];
+    struct dirent *dp;
+    struct stat sb;
+    NSString *name;
+    while ((dp = readdir(dir))) {
+        // names starting with a period are always hidden, and renaming an item changes the date of the directory
+        if (dp->d_name[0] == '.')
+            continue;
+        // an item that just disappeared changed the date of the directory anyway
+        if (snprintf(itemPath, PATH_MAX, "%s/%s", dirPath, dp->d_name) >= PATH_MAX || lstat(itemPath, &sb) != 0)
+            continue;
+        if ((sb.st_flags & UF_HIDDEN) && (name = [NSString stringWithUTF8String:dp->d_name]))
+            [names addObject:name];
+    }
+    closedir(dir);
+    [names sortUsingSelector:@selector(compare:)];
+    return names;
+}
+
+static NSString *copyResolvedPath(NSString *path) {
+    NSURL *resolvedURL = (NSURL *)BDCopyFileURLResolvingAliases((CFURLRef)[NSURL fileURLWithPath:path]);
+    NSString *resolvedPath = [[[resolvedURL path] stringByStandardizingPath] copy];
+    if (resolvedURL)
+        CFRelease(resolvedURL);
+    return resolvedPath;
+}
+
+// the date of a directory changes whenever an item is added, removed or renamed in it
+static BOOL isValidEntry(NSDictionary *entry, NSString *path, NSTimeInterval date, NSArray *hiddenNames) {
+    if (entry == nil || [[entry objectForKey:DATE_KEY] doubleValue] != date || [[entry objectForKey:HIDDEN_KEY] isEqualToArray:hiddenNames] == NO)
+        return NO;
+    // the modification date has a resolution of a second on some file systems, so only trust entries read well after the last change
+    // the scan date is stored relative to 1970 like the modification date from stat, so they can be compared
+    if ([[entry objectForKey:SCANNED_KEY] doubleValue] <= date + 1.0)
+        return NO;
+    // moving the target of an alias changes neither date, so resolve the aliases again
+    NSDictionary *aliases = [entry objectForKey:ALIASES_KEY];
+    BOOL isValid = YES;
+    for (NSString *name in aliases) {
+        NSString *resolvedPath = copyResolvedPath([path stringByAppendingPathComponent:name]);
+        isValid = [resolvedPath isEqualToString:[aliases objectForKey:name]];
+        [resolvedPath release];
+        if (isValid == NO)
+            break;
+    }
+    return isValid;
+}
+
+// reads the visible files and the resolved subdirectories, the same way the enumeration always did
+- (NSDictionary *)newEntryForDirectoryAtURL:(NSURL *)theURL files:(NSMutableArray *)files
+{
+    UKDirectoryEnumerator *enumerator = [UKDirectoryEnumerator enumeratorWithURL:theURL];
+    
+    // default is 16, which is a bit small
     [enumerator setCacheSize:32];
     
     // get visibility and directory flags
     [enumerator setDesiredInfo:(kFSCatInfoFinderInfo | kFSCatInfoNodeFlags)];
     
+    NSMutableArray *fileNames = [NSMutableArray array];
+    NSMutableArray *subdirectories = [NSMutableArray array];
+    NSMutableDictionary *aliases = [NSMutableDictionary dictionary];
+    NSString *path = [[theURL path] stringByStandardizingPath];
     BOOL isDir, isHidden, isPackage;
     LSItemInfoRecord infoRec;
     BDSKFile *aFile;
@@ -174,66 +414,117 @@
     
     while ( (1 == keepEnumerating) && (aFile = [enumerator nextObjectFile]) ){
         
-        // periodically flush the cache        
-        if([enumerator cacheExhausted] && [foundFiles count] >= 16){
-            [self flushFoundFiles];
-        }
-        
         isDir = [enumerator isDirectory];
         isHidden = [enumerator isInvisible] || CFStringHasPrefix((CFStringRef)[aFile fileName], CFSTR("."));
-        isPackage = NO;
         
-        if (noErr == LSCopyItemInfoForRef([aFile fsRef], kLSRequestBasicFlagsOnly, &infoRec))
-            isPackage = (infoRec.flags & kLSItemInfoIsPackage) != 0;
-
         // ignore hidden files
         if (isHidden)
             continue;
         
+        isPackage = NO;
+        if (isDir && noErr == LSCopyItemInfoForRef([aFile fsRef], kLSRequestBasicFlagsOnly, &infoRec))
+            isPackage = (infoRec.flags & kLSItemInfoIsPackage) != 0;
+        
         if (isDir && NO == isPackage){
             
             // resolve aliases in parent directories, since that's what BibItem does
-            NSURL *resolvedURL = (NSURL *)BDCopyFileURLResolvingAliases((CFURLRef)[aFile fileURL]);
-            if(resolvedURL){
-                // recurse
-                [self checkAllFilesInDirectoryRootedAtURL:resolvedURL];
-                CFRelease(resolvedURL);
+            NSString *resolvedPath = copyResolvedPath([[aFile fileURL] path]);
+            if(resolvedPath){
+                [subdirectories addObject:resolvedPath];
+                // remember where aliases pointed, so we notice when their targets move
+                if([resolvedPath isEqualToString:[path stringByAppendingPathComponent:[aFile fileName]]] == NO)
+                    [aliases setObject:resolvedPath forKey:[aFile fileName]];
+                [resolvedPath release];
             }
             
-        } else if([knownFiles containsObject:aFile] == NO){
+        } else {
             
-            [foundFiles addObject:[aFile fileURL]];
+            [fileNames addObject:[aFile fileName]];
+            [files addObject:aFile];
             
         }
         OSMemoryBarrier();
     }
     
+    // an incomplete listing should not end up in the snapshot
+    if (keepEnumerating == 0)
+        return nil;
+    
+    return [[NSDictionary alloc] initWithObjectsAndKeys:fileNames, FILES_KEY, subdirectories, SUBDIRECTORIES_KEY, aliases, ALIASES_KEY, nil];
 }
 
-- (void)setBaseURL:(NSURL *)theURL;
-{
-    NSParameterAssert([theURL isFileURL]);
-    [baseURL autorelease];
-    baseURL = [theURL copy];
-}
-
-- (void)setKnownFiles:(NSSet *)theFiles;
-{
-    [knownFiles autorelease];
-    knownFiles = [theFiles copy];
-}
-
-- (void)flushFoundFiles;
+- (void)checkDirectoryAtPath:(NSString *)path;
 {
-    if([foundFiles count]){
-        [[self serverOnMainThread] serverFoundFiles:[[foundFiles copy] autorelease]];
-        [self clearFoundFiles];
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSMutableArray *newFiles = nil;
+    NSDictionary *entry = nil;
+    NSArray *subdirectories = nil;
+    NSArray *hiddenNames = nil;
+    NSTimeInterval date = 0.0;
+    
+    OSMemoryBarrier();
+    if (keepEnumerating == 1 && getModificationDate(path, &date) && (hiddenNames = copyHiddenNames(path))) {
+        
+        // the date and hidden names are read before the listing, so a change during the scan invalidates the entry next time
+        NSDictionary *oldEntry = [previousSnapshot objectForKey:path];
+        NSMutableArray *files = [NSMutableArray array];
+        if (isValidEntry(oldEntry, path, date, hiddenNames)) {
+            entry = [oldEntry retain];
+            for (NSString *fileName in [entry objectForKey:FILES_KEY])
+                [files addObject:[NSURL fileURLWithPath:[path stringByAppendingPathComponent:fileName]]];
+        } else {
+            NSDictionary *listing = [self newEntryForDirectoryAtURL:[NSURL fileURLWithPath:path] files:files];
+            if (listing) {
+                NSMutableDictionary *newEntry = [listing mutableCopy];
+                [newEntry setObject:[NSNumber numberWithDouble:date] forKey:DATE_KEY];
+                [newEntry setObject:hiddenNames forKey:HIDDEN_KEY];
+                [newEntry setObject:[NSNumber numberWithDouble:[[NSDate date] timeIntervalSince1970]] forKey:SCANNED_KEY];
+                [listing release];
+                entry = newEntry;
+            }
+        }
+        
+        subdirectories = [entry objectForKey:SUBDIRECTORIES_KEY];
+        newFiles = [NSMutableArray array];
+        
+        for (id aFile in files) {
+            NSURL *fileURL = [aFile isKindOfClass:[NSURL class]] ? aFile : [aFile fileURL];
+            // knownPaths catches most files without touching the disk; only for the others we compare the files themselves, which handles different paths to the same file, such as a different case on a case insensitive volume
+            if ([knownPaths containsObject:[fileURL path]])
+                continue;
+            if ([aFile isKindOfClass:[NSURL class]])
+                aFile = [BDSKFile fileWithURL:aFile];
+            if (aFile && [knownFiles containsObject:aFile] == NO)
+                [newFiles addObject:fileURL];
+        }
     }
-}
-
-- (void)clearFoundFiles;
-{
-    [foundFiles removeAllObjects];
+    
+    [directoryCondition lock];
+    
+    if (entry)
+        [currentSnapshot setObject:entry forKey:path];
+    [foundFiles addObjectsFromArray:newFiles];
+    
+    OSMemoryBarrier();
+    if (keepEnumerating == 1) {
+        for (NSString *subdirectory in subdirectories) {
+            // aliases may point back up the tree
+            if ([visitedDirectories containsObject:subdirectory])
+                continue;
+            [visitedDirectories addObject:subdirectory];
+            pendingDirectories++;
+            [directoryQueue addOperation:[[[NSInvocationOperation alloc] initWithTarget:self selector:@selector(checkDirectoryAtPath:) object:subdirectory] autorelease]];
+        }
+    }
+    
+    if (--pendingDirectories == 0 || [foundFiles count] >= FLUSH_COUNT)
+        [directoryCondition signal];
+    
+    [directoryCondition unlock];
+    
+    [entry release];
+    [hiddenNames release];
+    [pool release];
 }
 
 @end
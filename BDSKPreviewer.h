@@ -98,7 +98,7 @@ typedef NSInteger BDSKPreviewState;
     @abstract Given a BibTeX string, generates the PDF and RTF data and updates the previews
     @discussion Takes the bibtex string, runs aproprate TeX tasks, and loads the resulting PDF and RTF into their views.
 		Pass nil to reset the previews to their default state, showing the nopreview message. 
-		This is the main method to be called from outside, and is completely thread safe. 
+		This is the main method to be called from outside. It should only be called from the main thread; the TeX tasks run on a background queue. 
     @param bibStr The bibtex string source
 */
 - (void)updateWithBibTeXString:(NSString *)bibStr;
@@ -47,13 +47,20 @@
 #import "NSArray_BDSKExtensions.h"
 #import "NSWindowController_BDSKExtensions.h"
 #import "BDSKCollapsibleView.h"
-#import "BDSKAsynchronousDOServer.h"
 #import "BDSKDocumentController.h"
 #import "NSImage_BDSKExtensions.h"
 #import "NSPrintOperation_BDSKExtensions.h"
 #import "BDSKPreferenceController.h"
 
 #define BDSKPreviewPanelFrameAutosaveName @"BDSKPreviewPanel"
+#define BDSKPreviewerMaxWorkersKey @"BDSKPreviewerMaxWorkers"
+#define MAX_IDLE_TEX_TASKS 4
+
+#define TEX_TASK_KEY    @"texTask"
+#define SUCCESS_KEY     @"success"
+#define GENERATION_KEY  @"generation"
+#define LATENCY_KEY     @"latency"
+
 
 enum {
     BDSKPreviewerTabIndexPDF,
@@ -76,34 +83,43 @@ enum {
 
 #pragma mark -
 
-@protocol BDSKPreviewerServerThread <BDSKAsyncDOServerThread>
-- (oneway void)processNextTask;
-@end
-
-@protocol BDSKPreviewerServerMainThread <BDSKAsyncDOServerMainThread>
-- (void)serverFinishedWithResult:(BOOL)success;
-@end
-
 @protocol BDSKPreviewerServerDelegate <NSObject>
 @optional
 - (void)server:(BDSKPreviewerServer *)server finishedWithResult:(BOOL)success;
 @end
 
-@interface BDSKPreviewerServer : BDSKAsynchronousDOServer {
+@interface BDSKPreviewerServer : NSObject {
     BDSKTeXTask *texTask;
     id<BDSKPreviewerServerDelegate> delegate;
-    NSString *bibString;
-    NSRecursiveLock *nextTaskLock;
-    BDSKPreviewTask *nextTask;
-    volatile int32_t isProcessing;
-    volatile int32_t notifyWhenDone;
+    NSOperation *currentOperation;
+    NSUInteger generation;
+    NSTimeInterval lastLatency;
+    NSTimeInterval totalLatency;
+    NSUInteger finishedCount;
 }
 
 - (id<BDSKPreviewerServerDelegate>)delegate;
 - (void)setDelegate:(id<BDSKPreviewerServerDelegate>)newDelegate;
 - (BDSKTeXTask *)texTask;
 - (void)runTeXTaskInBackgroundWithInfo:(BDSKPreviewTask *)previewTask;
+- (void)terminate;
+
+- (NSUInteger)queueDepth;
+- (NSTimeInterval)lastLatency;
+- (NSTimeInterval)averageLatency;
+- (NSString *)queueStatisticsString;
+
+@end
+
+#pragma mark -
 
+@interface BDSKPreviewOperation : NSOperation {
+    BDSKPreviewerServer *server;
+    BDSKPreviewTask *previewTask;
+    NSUInteger generation;
+    NSDate *queuedDate;
+}
+- (id)initWithServer:(BDSKPreviewerServer *)aServer previewTask:(BDSKPreviewTask *)aTask generation:(NSUInteger)aGeneration;
 @end
 
 #pragma mark -
@@ -402,6 +418,7 @@ static BDSKPreviewer *sharedPreviewer = nil;
 			message = NSLocalizedString(@"***** ERROR:  unable to create preview *****\n\nsee the logs in the TeX Preview window", @"Preview message");
 		
         logString = [[server texTask] logFileString] ?: NSLocalizedString(@"Unable to read log file from TeX run.", @"Preview message");
+        logString = [logString stringByAppendingFormat:@"\n%@", [server queueStatisticsString]];
         
 		pdfData = [self PDFData];
         if(success == NO || pdfData == nil){
@@ -479,6 +496,7 @@ static BDSKPreviewer *sharedPreviewer = nil;
 }
 
 - (void)updateWithBibTeXString:(NSString *)bibStr citeKeys:(NSArray *)citeKeys{
+    BDSKASSERT([NSThread isMainThread]);
     
 	if([NSString isEmptyString:bibStr]){
 		// reset, also removes any waiting tasks from the nextTask
@@ -541,8 +559,8 @@ static BDSKPreviewer *sharedPreviewer = nil;
 	if (fabs(scaleFactor - [[NSUserDefaults standardUserDefaults] doubleForKey:BDSKPreviewRTFScaleFactorKey]) > 0.01)
 		[[NSUserDefaults standardUserDefaults] setDouble:scaleFactor forKey:BDSKPreviewRTFScaleFactorKey];
     
-    // make sure we don't process anything else; the TeX task will take care of its own cleanup
-    [server stopDOServer];
+    // make sure we don't process anything else, and don't leave TeX processes around
+    [server terminate];
     [server release];
     server = nil;
 }
@@ -550,7 +568,8 @@ static BDSKPreviewer *sharedPreviewer = nil;
 - (void)dealloc{
     [[NSNotificationCenter defaultCenter] removeObserver:self];
     // make sure we don't process anything else; the TeX task will take care of its own cleanup
-    [server stopDOServer];
+    [server setDelegate:nil];
+    [server runTeXTaskInBackgroundWithInfo:nil];
     BDSKDESTROY(server);
     [pdfView release];
     [[rtfPreviewView enclosingScrollView] release];
@@ -563,135 +582,209 @@ static BDSKPreviewer *sharedPreviewer = nil;
 
 @implementation BDSKPreviewerServer
 
+// all previewers share the workers, each worker runs its own TeX task in its own working directory
+static NSOperationQueue *previewQueue = nil;
+static NSMutableArray *idleTeXTasks = nil;
+static NSMutableSet *busyTeXTasks = nil;
+
++ (void)initialize {
+    BDSKINITIALIZE;
+    
+    NSInteger maxWorkers = [[NSUserDefaults standardUserDefaults] integerForKey:BDSKPreviewerMaxWorkersKey];
+    if (maxWorkers <= 0)
+        maxWorkers = MIN((NSInteger)[[NSProcessInfo processInfo] activeProcessorCount], 4);
+    previewQueue = [[NSOperationQueue alloc] init];
+    [previewQueue setMaxConcurrentOperationCount:maxWorkers];
+    
+    idleTeXTasks = [[NSMutableArray alloc] init];
+    busyTeXTasks = [[NSMutableSet alloc] init];
+}
+
+// thread safe
++ (BDSKTeXTask *)checkoutTeXTask {
+    BDSKTeXTask *aTexTask = nil;
+    @synchronized(idleTeXTasks) {
+        aTexTask = [[idleTeXTasks lastObject] retain];
+        if (aTexTask)
+            [idleTeXTasks removeLastObject];
+        else
+            aTexTask = [[BDSKTeXTask alloc] initWithFileName:@"bibpreview"];
+        [busyTeXTasks addObject:aTexTask];
+    }
+    return [aTexTask autorelease];
+}
+
+// thread safe
++ (void)returnTeXTask:(BDSKTeXTask *)aTexTask {
+    if (aTexTask == nil)
+        return;
+    @synchronized(idleTeXTasks) {
+        // a task that was terminated while busy is useless, so it is not pooled again
+        if ([busyTeXTasks containsObject:aTexTask] && [idleTeXTasks count] < MAX_IDLE_TEX_TASKS)
+            [idleTeXTasks addObject:aTexTask];
+        [busyTeXTasks removeObject:aTexTask];
+    }
+}
+
++ (void)terminateTeXTasks {
+    [previewQueue cancelAllOperations];
+    @synchronized(idleTeXTasks) {
+        [busyTeXTasks makeObjectsPerformSelector:@selector(terminate)];
+        [busyTeXTasks removeAllObjects];
+        [idleTeXTasks makeObjectsPerformSelector:@selector(terminate)];
+        [idleTeXTasks removeAllObjects];
+    }
+}
+
 - (id)init;
 {
     self = [super init];
     if (self) {
-        texTask = [[BDSKTeXTask alloc] initWithFileName:@"bibpreview"];
+        texTask = nil;
         delegate = nil;
-        bibString = nil;
-        nextTaskLock = [NSRecursiveLock new];
-        nextTask = nil;
-        isProcessing = 0;
-        notifyWhenDone = 0;
-        [self startDOServerSync];
+        currentOperation = nil;
+        generation = 0;
+        lastLatency = 0.0;
+        totalLatency = 0.0;
+        finishedCount = 0;
     }
     return self;
 }
 
 - (void)dealloc;
 {
+    [[self class] returnTeXTask:texTask];
     BDSKDESTROY(texTask);
-    BDSKDESTROY(nextTaskLock);
-    BDSKDESTROY(nextTask);
+    BDSKDESTROY(currentOperation);
     [super dealloc];
 }
 
-- (void)serverDidFinish{
-    [bibString release];
-    bibString = nil;
-    [texTask terminate];
+- (void)terminate{
+    BDSKASSERT([NSThread isMainThread]);
+    delegate = nil;
+    generation++;
+    [currentOperation cancel];
+    BDSKDESTROY(currentOperation);
+    [[self class] terminateTeXTasks];
 }
 
-// superclass overrides
-
-- (Protocol *)protocolForServerThread { return @protocol(BDSKPreviewerServerThread); }
-
-- (Protocol *)protocolForMainThread { return @protocol(BDSKPreviewerServerMainThread); }
-
-// main thread API
+// main thread API; generation and currentOperation are only used on the main thread, the operations get a copy of the generation and report back on the main thread
 
 - (id<BDSKPreviewerServerDelegate>)delegate { return delegate; }
 
 - (void)setDelegate:(id<BDSKPreviewerServerDelegate>)newDelegate { delegate = newDelegate; }
 
+// the task containing the results of the last finished run
 - (BDSKTeXTask *)texTask{
     return texTask;
 }
 
 - (void)runTeXTaskInBackgroundWithInfo:(BDSKPreviewTask *)previewTask{
-    [nextTaskLock lock];
-    [nextTask release];
-    nextTask = [previewTask retain];
-    [nextTaskLock unlock];
-    if(previewTask){
-        // If it's still working, we don't have to do anything; sending too many of these messages just replaces nextTask until the port starts dropping them.
-        OSMemoryBarrier();
-        if(isProcessing == 0)
-            [[self serverOnServerThread] processNextTask];
-        // start sending task finished messages to the previewer
-        OSAtomicCompareAndSwap32Barrier(0, 1, &notifyWhenDone);
-    }else{
-        // don't notify the previewer of any pending task results; it might be better if the previewer learned to ignore the messages?
-        OSAtomicCompareAndSwap32Barrier(1, 0, &notifyWhenDone);
+    BDSKASSERT([NSThread isMainThread]);
+    // anything queued or running for an earlier selection is stale now; a running TeX task finishes, but its results are ignored
+    generation++;
+    [currentOperation cancel];
+    BDSKDESTROY(currentOperation);
+    
+    if (previewTask) {
+        currentOperation = [[BDSKPreviewOperation alloc] initWithServer:self previewTask:previewTask generation:generation];
+        [previewQueue addOperation:currentOperation];
     }
 }
 
-// Server thread protocol
-
-- (oneway void)processNextTask{
-    OSAtomicCompareAndSwap32Barrier(0, 1, &isProcessing);
+- (void)operationFinishedWithInfo:(NSDictionary *)info{
+    BDSKTeXTask *aTexTask = [info objectForKey:TEX_TASK_KEY];
     
-    BDSKPreviewTask *previewTask = nil;
-    [nextTaskLock lock];
-    NSDate *distantFuture = [NSDate distantFuture];
-    NSRunLoop *rl = [NSRunLoop currentRunLoop];
+    if ([[info objectForKey:GENERATION_KEY] unsignedIntegerValue] != generation) {
+        // a newer task was queued or the previews were reset
+        [[self class] returnTeXTask:aTexTask];
+        return;
+    }
+    
+    BDSKDESTROY(currentOperation);
+    
+    lastLatency = [[info objectForKey:LATENCY_KEY] doubleValue];
+    totalLatency += lastLatency;
+    finishedCount++;
+    
+    // hold on to the task as long as we show its results
+    [[self class] returnTeXTask:texTask];
+    [texTask release];
+    texTask = [aTexTask retain];
     
-    do { 
-        // we're only interested in the latest addition to the nextTask
-        previewTask = nextTask;
-        // get rid of the nextTask, then allow the main thread to keep putting strings in it
-        nextTask = nil;
-        [nextTaskLock unlock];
-        
-        BOOL success = YES;
-        if (previewTask) {
-            BOOL didRun = YES;
-            if ([texTask isProcessing]) {
-                // poll the runloop while the task is still running
-                do {
-                    didRun = [rl runMode:NSDefaultRunLoopMode beforeDate:distantFuture];
-                } while (didRun && [texTask isProcessing]);
-                
-                // get the latest string; the nextTask may have changed while we waited for this task to finish (doesn't seem to be the case in practice)
-                [nextTaskLock lock];
-                if (nextTask) {
-                    [previewTask release];
-                    previewTask = nextTask;
-                    nextTask = nil;
-                }
-                [nextTaskLock unlock];
-            }
-            // previous task is done, so we can start a new one
-            success = [texTask runWithBibTeXString:[previewTask bibTeXString] citeKeys:[previewTask citeKeys] generatedTypes:[previewTask generatedTypes]];
-            [previewTask release];
-        }
-        
-        // always lock going into the top of the loop for checking count
-        [nextTaskLock lock];
-        
-        // Don't notify the main thread until we've processed all of the entries in the nextTask
-        OSMemoryBarrier();
-        if (1 == notifyWhenDone && nextTask == nil) {
-            // If the main thread is blocked on the nextTaskLock, we're hosed because it can't service the DO port!
-            [nextTaskLock unlock];
-            [[self serverOnMainThread] serverFinishedWithResult:success];
-            [nextTaskLock lock];
-        }
-        OSMemoryBarrier();
-    } while (1 == notifyWhenDone && nextTask);
-
-    // swap, then unlock, so if a potential caller is blocking on the lock, they know to call processNextTask
-    OSAtomicCompareAndSwap32Barrier(1, 0, &isProcessing);
-    [nextTaskLock unlock];
-}
-
-// Main thread protocol
-
-// If this message is sent oneway, there's no guarantee that any results exist when it's delivered, since some other task could have stomped on the files by that time, and the success variable would be stale.
-- (void)serverFinishedWithResult:(BOOL)success{
     if([delegate respondsToSelector:@selector(server:finishedWithResult:)])
-        [delegate server:self finishedWithResult:success];
+        [delegate server:self finishedWithResult:[[info objectForKey:SUCCESS_KEY] boolValue]];
+}
+
+// diagnostics
+
+- (NSUInteger)queueDepth{
+    return [previewQueue operationCount];
+}
+
+- (NSTimeInterval)lastLatency{
+    return lastLatency;
+}
+
+- (NSTimeInterval)averageLatency{
+    return finishedCount > 0 ? totalLatency / finishedCount : 0.0;
+}
+
+- (NSString *)queueStatisticsString{
+    NSMutableString *string = [NSMutableString string];
+    [string appendString:@"---------- Preview queue ---------\n"];
+    [string appendFormat:@"Workers: %ld\n", (long)[previewQueue maxConcurrentOperationCount]];
+    [string appendFormat:@"Queue depth: %lu\n", (unsigned long)[self queueDepth]];
+    [string appendFormat:@"Last latency: %.3f s\n", [self lastLatency]];
+    [string appendFormat:@"Average latency: %.3f s over %lu previews\n", [self averageLatency], (unsigned long)finishedCount];
+    return string;
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKPreviewOperation
+
+- (id)initWithServer:(BDSKPreviewerServer *)aServer previewTask:(BDSKPreviewTask *)aTask generation:(NSUInteger)aGeneration {
+    self = [super init];
+    if (self) {
+        server = [aServer retain];
+        previewTask = [aTask retain];
+        generation = aGeneration;
+        queuedDate = [[NSDate alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(server);
+    BDSKDESTROY(previewTask);
+    BDSKDESTROY(queuedDate);
+    [super dealloc];
+}
+
+- (void)main {
+    if ([self isCancelled])
+        return;
+    
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    
+    BDSKTeXTask *aTexTask = [BDSKPreviewerServer checkoutTeXTask];
+    BOOL success = [aTexTask runWithBibTeXString:[previewTask bibTeXString] citeKeys:[previewTask citeKeys] generatedTypes:[previewTask generatedTypes]];
+    
+    if ([self isCancelled]) {
+        [BDSKPreviewerServer returnTeXTask:aTexTask];
+    } else {
+        NSDictionary *info = [NSDictionary dictionaryWithObjectsAndKeys:
+                              aTexTask, TEX_TASK_KEY,
+                              [NSNumber numberWithBool:success], SUCCESS_KEY,
+                              [NSNumber numberWithUnsignedInteger:generation], GENERATION_KEY,
+                              [NSNumber numberWithDouble:-[queuedDate timeIntervalSinceNow]], LATENCY_KEY, nil];
+        [server performSelectorOnMainThread:@selector(operationFinishedWithInfo:) withObject:info waitUntilDone:NO];
+    }
+    
+    [pool release];
 }
 
 @end
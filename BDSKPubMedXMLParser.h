@@ -46,5 +46,7 @@
 + (BOOL)canParseString:(NSString *)string;
 + (NSArray *)itemsFromString:(NSString *)itemString error:(NSError **)outError;
 + (NSArray *)itemsFromData:(NSData *)itemData error:(NSError **)outError;
+// parses the complete PubmedArticle elements after location, and moves location past them; this can be used for data that is still being downloaded
++ (NSArray *)itemsFromPartialData:(NSData *)itemData location:(NSUInteger *)location error:(NSError **)outError;
 
 @end
@@ -47,31 +47,90 @@
  
  http://www.nlm.nih.gov/bsd/licensee/elements_descriptions.html
  
+ We parse with NSXMLParser rather than building an NSXMLDocument, so we never hold the tree for a complete efetch page, and we don't need to evaluate XPaths for every field.  The elements we use are identified by their path relative to the PubmedArticle element.
+ 
  */
 
-@interface NSXMLNode (BDSKPubMedExtensions)
-- (NSXMLNode *)firstNodeForXPath:(NSString *)xpath;
-@end
+enum {
+    BDSKPubMedNoElement,
+    BDSKPubMedAuthorElement,
+    BDSKPubMedKeywordListElement,
+    BDSKPubMedJournalTitleElement,
+    BDSKPubMedVolumeElement,
+    BDSKPubMedIssueElement,
+    BDSKPubMedYearElement,
+    BDSKPubMedMonthElement,
+    BDSKPubMedMedlineDateElement,
+    BDSKPubMedArticleTitleElement,
+    BDSKPubMedPaginationElement,
+    BDSKPubMedPMIDElement,
+    BDSKPubMedPublicationStatusElement,
+    BDSKPubMedMedlineTAElement,
+    BDSKPubMedLastNameElement,
+    BDSKPubMedFirstNameElement,
+    BDSKPubMedMiddleNameElement,
+    BDSKPubMedSuffixElement,
+    BDSKPubMedCollectiveNameElement,
+    BDSKPubMedMeshDescriptorElement,
+    BDSKPubMedKeywordElement,
+    BDSKPubMedAbstractTextElement,
+    BDSKPubMedArticleIdElement
+};
+typedef NSInteger BDSKPubMedElement;
 
-@implementation NSXMLNode (BDSKPubMedExtensions)
+#define LAST_NAME_KEY   @"lastName"
+#define FIRST_NAME_KEY  @"firstName"
+#define MIDDLE_NAME_KEY @"middleName"
+#define SUFFIX_KEY      @"suffix"
 
-- (NSXMLNode *)firstNodeForXPath:(NSString *)xpath;
-{
-    NSError *error;
-    NSArray *nodes = [self nodesForXPath:xpath error:&error];
-    return [nodes count] ? [nodes objectAtIndex:0] : nil;
+@interface BDSKPubMedXMLParserDelegate : NSObject <NSXMLParserDelegate> {
+    NSMutableArray *items;
+    
+    // path of the current element relative to the PubmedArticle, and the lengths of the path of its ancestors
+    NSMutableString *elementPath;
+    NSUInteger *pathLengths;
+    NSUInteger pathCapacity;
+    NSUInteger depth;
+    NSUInteger articleDepth;
+    
+    // text of the element we're collecting, including the text of nested markup
+    BDSKPubMedElement textElement;
+    NSUInteger textDepth;
+    NSMutableString *text;
+    
+    NSMutableDictionary *pubFields;
+    NSMutableDictionary *authorParts;
+    NSMutableArray *authorNames;
+    NSMutableString *meshString;
+    NSMutableString *keywordString;
+    NSMutableString *abstractString;
+    NSString *abstractLabel;
+    NSString *articleIdType;
+    NSString *medlineTA;
+    BOOL hasKeywordList;
+    
+    // for debugging
+    NSMutableString *xmlString;
 }
-
+- (NSArray *)items;
 @end
 
+#pragma mark -
 
 @implementation BDSKPubMedXMLParser
 
 static bool _useTitlecase = false;
 static bool _addXMLStringToAnnote = false;
 
+// set up in +initialize rather than lazily, as the parser can be used on several threads at once
+static NSData *startTag = nil;
+static NSData *endTag = nil;
+
 + (void)initialize
 {
+    BDSKINITIALIZE;
+    startTag = [[@"<PubmedArticle" dataUsingEncoding:NSUTF8StringEncoding] retain];
+    endTag = [[@"</PubmedArticle>" dataUsingEncoding:NSUTF8StringEncoding] retain];
     // this is messy, but may be useful for debugging
     if ([[NSUserDefaults standardUserDefaults] boolForKey:BDSKAddPubMedXMLStringToAnnoteKey])
         _addXMLStringToAnnote = true;
@@ -85,80 +144,227 @@ static bool _addXMLStringToAnnote = false;
     return [string rangeOfString:@"<!DOCTYPE PubmedArticleSet" options:NSCaseInsensitiveSearch].length > 0;
 }
 
-// convenience to avoid creating a local variable and checking it each time
-static inline void addStringToDictionaryIfNotNil(NSString *value, NSString *key, NSMutableDictionary *dict)
++ (NSArray *)_itemsFromData:(NSData *)data error:(NSError **)outError;
 {
-    if (value) [dict setObject:[value stringByBackslashEscapingTeXSpecials] forKey:key];
+    BDSKPubMedXMLParserDelegate *delegate = [[BDSKPubMedXMLParserDelegate alloc] init];
+    NSXMLParser *parser = [[NSXMLParser alloc] initWithData:data];
+    NSArray *items = nil;
+    
+    [parser setDelegate:delegate];
+    if ([parser parse])
+        items = [[[delegate items] retain] autorelease];
+    else if (outError)
+        *outError = [parser parserError];
+    
+    [parser release];
+    [delegate release];
+    
+    return items;
 }
 
-// convenience to add the string value of a node; only adds if non-nil
-static inline void addStringValueOfNodeForField(NSXMLNode *child, NSString *field, NSMutableDictionary *pubFields)
++ (NSArray *)itemsFromString:(NSString *)itemString error:(NSError **)outError;
 {
-    addStringToDictionaryIfNotNil([child stringValue], field, pubFields);
+    return [self _itemsFromData:[itemString dataUsingEncoding:NSUTF8StringEncoding] error:outError];
 }
 
-+ (void)_addPubDateNode:(NSXMLNode *)dateNode toDictionary:(NSMutableDictionary *)pubFields
++ (NSArray *)itemsFromData:(NSData *)itemData error:(NSError **)outError;
 {
-    for (NSXMLNode *comp in [dateNode children]) {
-        
-        if ([[comp name] isEqualToString:@"Year"]) {
-            addStringValueOfNodeForField(comp, BDSKYearString, pubFields);
-        }
-        else if ([[comp name] isEqualToString:@"Month"]) {
-            addStringValueOfNodeForField(comp, BDSKMonthString, pubFields);
-        }
-        else if ([[comp name] isEqualToString:@"MedlineDate"]) {
-            // this is a fallback mechanism
-            addStringValueOfNodeForField(comp, BDSKDateString, pubFields);
-            
-            // first 4 digits should be a date
-            NSScanner *scanner = [[NSScanner alloc] initWithString:[comp stringValue]];
-            NSString *year;
-            if ([scanner scanCharactersFromSet:[NSCharacterSet decimalDigitCharacterSet] intoString:&year] && [year length] == 4)
-                addStringToDictionaryIfNotNil(year, BDSKYearString, pubFields);
-            [scanner release];
-        }
+    return [self _itemsFromData:itemData error:outError];
+}
+
+// finds the first PubmedArticle start tag, skipping PubmedArticleSet
+static NSUInteger startOfFirstArticle(NSData *data, NSRange range)
+{
+    const char *bytes = [data bytes];
+    NSRange startRange;
+    
+    while ((startRange = [data rangeOfData:startTag options:0 range:range]).location != NSNotFound) {
+        NSUInteger next = NSMaxRange(startRange);
+        if (next >= NSMaxRange(range))
+            break;
+        if (bytes[next] == '>' || bytes[next] == ' ' || bytes[next] == '\t' || bytes[next] == '\n' || bytes[next] == '\r')
+            return startRange.location;
+        range = NSMakeRange(next, NSMaxRange(range) - next);
     }
+    return NSNotFound;
 }
 
-+ (void)_addJournalNode:(NSXMLNode *)journalNode toDictionary:(NSMutableDictionary *)pubFields
++ (NSArray *)itemsFromPartialData:(NSData *)itemData location:(NSUInteger *)location error:(NSError **)outError;
 {
-    /*
-     <Journal>
-        <ISSN IssnType="Print">1821-6404</ISSN>
-        <JournalIssue CitedMedium="Print">
-            <Volume>10</Volume>
-            <Issue>4</Issue>
-            <PubDate>
-                <Year>2008</Year>
-                <Month>Oct</Month>
-            </PubDate>
-        </JournalIssue>
-        <Title>Tanzania journal of health research</Title>
-     </Journal>
-     */
+    NSUInteger length = [itemData length];
     
-    for (NSXMLNode *node in [journalNode children]) {
-        
-        NSString *nodeName = [node name];
+    if (*location >= length)
+        return [NSArray array];
+    
+    NSRange endRange = [itemData rangeOfData:endTag options:NSDataSearchBackwards range:NSMakeRange(*location, length - *location)];
+    if (endRange.location == NSNotFound)
+        return [NSArray array];
+    
+    NSUInteger start = startOfFirstArticle(itemData, NSMakeRange(*location, endRange.location - *location));
+    if (start == NSNotFound)
+        return [NSArray array];
+    
+    // wrap the complete articles in a root element, the prolog and DOCTYPE are only in the first part
+    NSRange articlesRange = NSMakeRange(start, NSMaxRange(endRange) - start);
+    NSMutableData *data = [[NSMutableData alloc] initWithCapacity:articlesRange.length + 40];
+    [data appendBytes:"<PubmedArticleSet>" length:18];
+    [data appendBytes:(const char *)[itemData bytes] + articlesRange.location length:articlesRange.length];
+    [data appendBytes:"</PubmedArticleSet>" length:19];
+    
+    NSArray *items = [self _itemsFromData:data error:outError];
+    [data release];
+    
+    if (items)
+        *location = NSMaxRange(endRange);
+    
+    return items;
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKPubMedXMLParserDelegate
+
+static NSDictionary *elementsForPaths = nil;
+
++ (void)initialize
+{
+    BDSKINITIALIZE;
+    elementsForPaths = [[NSDictionary alloc] initWithObjectsAndKeys:
+        [NSNumber numberWithInteger:BDSKPubMedAuthorElement],            @"MedlineCitation/Article/AuthorList/Author",
+        [NSNumber numberWithInteger:BDSKPubMedKeywordListElement],       @"MedlineCitation/KeywordList",
+        [NSNumber numberWithInteger:BDSKPubMedJournalTitleElement],      @"MedlineCitation/Article/Journal/Title",
+        [NSNumber numberWithInteger:BDSKPubMedVolumeElement],            @"MedlineCitation/Article/Journal/JournalIssue/Volume",
+        [NSNumber numberWithInteger:BDSKPubMedIssueElement],             @"MedlineCitation/Article/Journal/JournalIssue/Issue",
+        [NSNumber numberWithInteger:BDSKPubMedYearElement],              @"MedlineCitation/Article/Journal/JournalIssue/PubDate/Year",
+        [NSNumber numberWithInteger:BDSKPubMedMonthElement],             @"MedlineCitation/Article/Journal/JournalIssue/PubDate/Month",
+        [NSNumber numberWithInteger:BDSKPubMedMedlineDateElement],       @"MedlineCitation/Article/Journal/JournalIssue/PubDate/MedlineDate",
+        [NSNumber numberWithInteger:BDSKPubMedArticleTitleElement],      @"MedlineCitation/Article/ArticleTitle",
+        [NSNumber numberWithInteger:BDSKPubMedPaginationElement],        @"MedlineCitation/Article/Pagination/MedlinePgn",
+        [NSNumber numberWithInteger:BDSKPubMedPMIDElement],              @"MedlineCitation/PMID",
+        [NSNumber numberWithInteger:BDSKPubMedPublicationStatusElement], @"PubmedData/PublicationStatus",
+        [NSNumber numberWithInteger:BDSKPubMedMedlineTAElement],         @"MedlineCitation/MedlineJournalInfo/MedlineTA",
+        [NSNumber numberWithInteger:BDSKPubMedLastNameElement],          @"MedlineCitation/Article/AuthorList/Author/LastName",
+        [NSNumber numberWithInteger:BDSKPubMedFirstNameElement],         @"MedlineCitation/Article/AuthorList/Author/ForeName",
+        [NSNumber numberWithInteger:BDSKPubMedFirstNameElement],         @"MedlineCitation/Article/AuthorList/Author/FirstName",
+        [NSNumber numberWithInteger:BDSKPubMedMiddleNameElement],        @"MedlineCitation/Article/AuthorList/Author/MiddleName",
+        [NSNumber numberWithInteger:BDSKPubMedSuffixElement],            @"MedlineCitation/Article/AuthorList/Author/Suffix",
+        [NSNumber numberWithInteger:BDSKPubMedCollectiveNameElement],    @"MedlineCitation/Article/AuthorList/Author/CollectiveName",
+        [NSNumber numberWithInteger:BDSKPubMedMeshDescriptorElement],    @"MedlineCitation/MeshHeadingList/MeshHeading/DescriptorName",
+        [NSNumber numberWithInteger:BDSKPubMedKeywordElement],           @"MedlineCitation/KeywordList/Keyword",
+        [NSNumber numberWithInteger:BDSKPubMedAbstractTextElement],      @"MedlineCitation/Article/Abstract/AbstractText",
+        [NSNumber numberWithInteger:BDSKPubMedArticleIdElement],         @"PubmedData/ArticleIdList/ArticleId", nil];
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        items = [[NSMutableArray alloc] init];
+        elementPath = [[NSMutableString alloc] init];
+        pathCapacity = 16;
+        pathLengths = (NSUInteger *)NSZoneMalloc(NSDefaultMallocZone(), pathCapacity * sizeof(NSUInteger));
+        depth = 0;
+        articleDepth = 0;
+        textElement = BDSKPubMedNoElement;
+        textDepth = 0;
+        text = [[NSMutableString alloc] init];
+        authorParts = [[NSMutableDictionary alloc] init];
+        authorNames = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(items);
+    BDSKDESTROY(elementPath);
+    NSZoneFree(NSDefaultMallocZone(), pathLengths);
+    BDSKDESTROY(text);
+    BDSKDESTROY(pubFields);
+    BDSKDESTROY(authorParts);
+    BDSKDESTROY(authorNames);
+    BDSKDESTROY(meshString);
+    BDSKDESTROY(keywordString);
+    BDSKDESTROY(abstractString);
+    BDSKDESTROY(abstractLabel);
+    BDSKDESTROY(articleIdType);
+    BDSKDESTROY(medlineTA);
+    BDSKDESTROY(xmlString);
+    [super dealloc];
+}
+
+- (NSArray *)items { return items; }
+
+// convenience to avoid creating a local variable and checking it each time
+static inline void addStringToDictionaryIfNotNil(NSString *value, NSString *key, NSMutableDictionary *dict)
+{
+    if (value) [dict setObject:[value stringByBackslashEscapingTeXSpecials] forKey:key];
+}
+
+static inline void appendStringWithSeparator(NSMutableString **string, NSString *value, NSString *separator)
+{
+    if (*string == nil)
+        *string = [[NSMutableString alloc] init];
+    else if ([*string length])
+        [*string appendString:separator];
+    [*string appendString:value];
+}
+
+- (void)startArticle {
+    articleDepth = depth;
+    [elementPath setString:@""];
+    pubFields = [[NSMutableDictionary alloc] init];
+    hasKeywordList = NO;
+    if (_addXMLStringToAnnote)
+        xmlString = [[NSMutableString alloc] initWithString:@"<PubmedArticle>"];
+}
+
+- (void)finishArticle {
+    if ([authorNames count])
+        addStringToDictionaryIfNotNil([authorNames componentsJoinedByString:@" and "], BDSKAuthorString, pubFields);
+    
+    // ex. PMID 16187791
+    if (meshString)
+        [pubFields setObject:meshString forKey:@"Mesh"];
+    if (keywordString)
+        [pubFields setObject:keywordString forKey:BDSKKeywordsString];
+    if (abstractString)
+        [pubFields setObject:abstractString forKey:BDSKAbstractString];
+    
+    // use MedlineTA if available, since the full title evidently has too much information in some cases
+    if (medlineTA) {
+        // save the full title in another field
+        if ([pubFields objectForKey:BDSKJournalString])
+            [pubFields setObject:[pubFields objectForKey:BDSKJournalString] forKey:@"Journal-Full"];
         
-        if ([nodeName isEqualToString:@"Title"]) {
-            addStringToDictionaryIfNotNil(_useTitlecase ? [[node stringValue] titlecaseString] : [node stringValue], BDSKJournalString, pubFields);
-        }
-        else if ([nodeName isEqualToString:@"JournalIssue"]) {
-            
-            for (NSXMLNode *child in [node children]) {
-                NSString *childName = [child name];
-                if ([childName isEqualToString:@"Volume"]) addStringValueOfNodeForField(child, BDSKVolumeString, pubFields);
-                else if ([childName isEqualToString:@"Issue"]) addStringValueOfNodeForField(child, BDSKNumberString, pubFields);
-                else if ([childName isEqualToString:@"PubDate"]) [self _addPubDateNode:child toDictionary:pubFields];
-            }
-        }
+        // titlecasing this doesn't seem right, since it's already abbreviated
+        [pubFields setObject:medlineTA forKey:BDSKJournalString];
     }
+    
+    // for debugging
+    if (xmlString) {
+        [xmlString appendString:@"</PubmedArticle>"];
+        addStringToDictionaryIfNotNil(xmlString, BDSKAnnoteString, pubFields);
+    }
+    
+    BibItem *pub = [[BibItem alloc] initWithType:BDSKArticleString
+                                         citeKey:nil
+                                       pubFields:pubFields
+                                           isNew:YES];
+    [items addObject:pub];
+    [pub release];
+    
+    BDSKDESTROY(pubFields);
+    BDSKDESTROY(meshString);
+    BDSKDESTROY(keywordString);
+    BDSKDESTROY(abstractString);
+    BDSKDESTROY(medlineTA);
+    BDSKDESTROY(xmlString);
+    [authorNames removeAllObjects];
+    articleDepth = 0;
 }
 
-+ (void)_addAuthorListNode:(NSXMLNode *)authorListNode toDictionary:(NSMutableDictionary *)pubFields
-{    
+- (void)finishAuthor {
     /*
         <AuthorList CompleteYN="Y">
             <Author ValidYN="Y">
@@ -177,210 +383,225 @@ static inline void addStringValueOfNodeForField(NSXMLNode *child, NSString *fiel
      
      */
     
-    NSMutableArray *authorNames = [NSMutableArray new];
+    NSString *lastName = [authorParts objectForKey:LAST_NAME_KEY];
+    NSString *firstName = [authorParts objectForKey:FIRST_NAME_KEY];
+    NSString *middleName = [authorParts objectForKey:MIDDLE_NAME_KEY];
+    NSString *suffix = [authorParts objectForKey:SUFFIX_KEY];
     
-    for (NSXMLNode *authorNode in [authorListNode children]) {
-        
-        // this should always be true...
-        if ([[authorNode name] isEqualToString:@"Author"]) {
-            
-            NSString *lastName = nil;
-            NSString *firstName = nil;
-            NSString *middleName = nil;
-            NSString *suffix = nil;
-            
-            for (NSXMLNode *name in [authorNode children]) {
-                
-                NSString *nodeName = [name name];
-                
-                if ([nodeName isEqualToString:@"LastName"]) lastName = [name stringValue];
-                else if ([nodeName isEqualToString:@"ForeName"] || [nodeName isEqualToString:@"FirstName"]) firstName = [name stringValue];
-                else if ([nodeName isEqualToString:@"Suffix"]) suffix = [name stringValue];
-                else if ([nodeName isEqualToString:@"MiddleName"]) middleName = [name stringValue];
-                else if ([nodeName isEqualToString:@"CollectiveName"]) lastName = [NSString stringWithFormat:@"{%@}", [name stringValue]];
-            }
-            
-            // normalized form for btparse: von Last, Jr, First Middle
-            NSMutableString *fullName = [NSMutableString new];
-            if (lastName) {
-                [fullName appendString:lastName];
-            }
-            if (suffix) {
-                if ([fullName isEqualToString:@""] == NO)
-                    [fullName appendString:@", "];
-                [fullName appendString:suffix];
-            }
-            if (firstName) {
-                if ([fullName isEqualToString:@""] == NO)
-                    [fullName appendString:@", "];
-                [fullName appendString:firstName];
-            }
-            if (middleName) {
-                // no comma for a middle name
-                if ([fullName isEqualToString:@""] == NO)
-                    [fullName appendString:@" "];
-                // typically just an initial, but the .bst will handle any dot for abbreviationx
-                [fullName appendString:middleName];
-            }
-            [authorNames addObject:fullName];
-            [fullName release];
-        }
-        else {
-            NSLog(@"Unknown node name %@ in %@", [authorNode name], authorListNode);
-        }
+    // normalized form for btparse: von Last, Jr, First Middle
+    NSMutableString *fullName = [NSMutableString new];
+    if (lastName) {
+        [fullName appendString:lastName];
     }
-    
-    if ([authorNames count])
-        addStringToDictionaryIfNotNil([authorNames componentsJoinedByString:@" and "], BDSKAuthorString, pubFields);
-    [authorNames release];
+    if (suffix) {
+        if ([fullName isEqualToString:@""] == NO)
+            [fullName appendString:@", "];
+        [fullName appendString:suffix];
+    }
+    if (firstName) {
+        if ([fullName isEqualToString:@""] == NO)
+            [fullName appendString:@", "];
+        [fullName appendString:firstName];
+    }
+    if (middleName) {
+        // no comma for a middle name
+        if ([fullName isEqualToString:@""] == NO)
+            [fullName appendString:@" "];
+        // typically just an initial, but the .bst will handle any dot for abbreviationx
+        [fullName appendString:middleName];
+    }
+    [authorNames addObject:fullName];
+    [fullName release];
+    [authorParts removeAllObjects];
 }
 
-+ (void)_addMeshNode:(NSXMLNode *)listNode toDictionary:(NSMutableDictionary *)pubFields
-{
-    if ([[listNode children] count] == 0)
-        return;
-
-    NSMutableString *meshString = [NSMutableString new];
-    NSString *keywordSeparator = [[NSUserDefaults standardUserDefaults] objectForKey:BDSKDefaultGroupFieldSeparatorKey];
-    
-    for (NSXMLNode *meshNode in [listNode children]) {
-        if ([[meshNode name] isEqualToString:@"MeshHeading"]) {
-            for (NSXMLNode *headingNode in [meshNode children]) {
-                
-                // add descriptor name and ignore qualifier name
-                if ([[headingNode name] isEqualToString:@"DescriptorName"]) {
-                    if ([meshString length])
-                        [meshString appendString:keywordSeparator];
-                    [meshString appendString:[headingNode stringValue]];
-                }
-            }
+- (void)addText:(NSString *)string forElement:(BDSKPubMedElement)element {
+    switch (element) {
+        case BDSKPubMedJournalTitleElement:
+            addStringToDictionaryIfNotNil(_useTitlecase ? [string titlecaseString] : string, BDSKJournalString, pubFields);
+            break;
+        case BDSKPubMedVolumeElement:
+            addStringToDictionaryIfNotNil(string, BDSKVolumeString, pubFields);
+            break;
+        case BDSKPubMedIssueElement:
+            addStringToDictionaryIfNotNil(string, BDSKNumberString, pubFields);
+            break;
+        case BDSKPubMedYearElement:
+            addStringToDictionaryIfNotNil(string, BDSKYearString, pubFields);
+            break;
+        case BDSKPubMedMonthElement:
+            addStringToDictionaryIfNotNil(string, BDSKMonthString, pubFields);
+            break;
+        case BDSKPubMedMedlineDateElement:
+        {
+            // this is a fallback mechanism
+            addStringToDictionaryIfNotNil(string, BDSKDateString, pubFields);
+            
+            // first 4 digits should be a date
+            NSScanner *scanner = [[NSScanner alloc] initWithString:string];
+            NSString *year;
+            if ([scanner scanCharactersFromSet:[NSCharacterSet decimalDigitCharacterSet] intoString:&year] && [year length] == 4)
+                addStringToDictionaryIfNotNil(year, BDSKYearString, pubFields);
+            [scanner release];
+            break;
         }
+        case BDSKPubMedArticleTitleElement:
+            addStringToDictionaryIfNotNil([string stringByRemovingSuffix:@"."], BDSKTitleString, pubFields);
+            break;
+        case BDSKPubMedPaginationElement:
+            addStringToDictionaryIfNotNil(string, BDSKPagesString, pubFields);
+            break;
+        case BDSKPubMedPMIDElement:
+            addStringToDictionaryIfNotNil(string, @"Pmid", pubFields);
+            break;
+        case BDSKPubMedPublicationStatusElement:
+            // not a BibTeX field: http://www.mail-archive.com/bibdesk-users@lists.sourceforge.net/msg04650.html
+            addStringToDictionaryIfNotNil(string, @"Pst", pubFields);
+            break;
+        case BDSKPubMedMedlineTAElement:
+            [medlineTA release];
+            medlineTA = [string retain];
+            break;
+        case BDSKPubMedLastNameElement:
+            [authorParts setObject:string forKey:LAST_NAME_KEY];
+            break;
+        case BDSKPubMedFirstNameElement:
+            [authorParts setObject:string forKey:FIRST_NAME_KEY];
+            break;
+        case BDSKPubMedMiddleNameElement:
+            [authorParts setObject:string forKey:MIDDLE_NAME_KEY];
+            break;
+        case BDSKPubMedSuffixElement:
+            [authorParts setObject:string forKey:SUFFIX_KEY];
+            break;
+        case BDSKPubMedCollectiveNameElement:
+            [authorParts setObject:[NSString stringWithFormat:@"{%@}", string] forKey:LAST_NAME_KEY];
+            break;
+        case BDSKPubMedMeshDescriptorElement:
+            // add descriptor name and ignore qualifier name
+            appendStringWithSeparator(&meshString, string, [[NSUserDefaults standardUserDefaults] objectForKey:BDSKDefaultGroupFieldSeparatorKey]);
+            break;
+        case BDSKPubMedKeywordElement:
+            // only use the first keyword list
+            if (hasKeywordList == NO)
+                appendStringWithSeparator(&keywordString, string, [[NSUserDefaults standardUserDefaults] objectForKey:BDSKDefaultGroupFieldSeparatorKey]);
+            break;
+        case BDSKPubMedAbstractTextElement:
+            if ([abstractLabel length] > 0)
+                string = [NSString stringWithFormat:@"%@: %@", abstractLabel, string];
+            appendStringWithSeparator(&abstractString, string, @"\n");
+            BDSKDESTROY(abstractLabel);
+            break;
+        case BDSKPubMedArticleIdElement:
+            if ([articleIdType isEqualToString:@"doi"])
+                addStringToDictionaryIfNotNil(string, BDSKDoiString, pubFields);
+            else if ([articleIdType isEqualToString:@"pmc"]) /* e.g. PMID 19930638 */
+                addStringToDictionaryIfNotNil(string, @"Pmc", pubFields);
+            BDSKDESTROY(articleIdType);
+            break;
+        default:
+            break;
     }
-    [pubFields setObject:meshString forKey:@"Mesh"];
-    [meshString release];
 }
 
-+ (void)_addKeywordNode:(NSXMLNode *)listNode toDictionary:(NSMutableDictionary *)pubFields
-{
-    if ([[listNode children] count] == 0)
+#pragma mark NSXMLParser delegate
+
+- (void)parser:(NSXMLParser *)parser didStartElement:(NSString *)elementName namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName attributes:(NSDictionary *)attributeDict {
+    depth++;
+    
+    if (articleDepth == 0) {
+        if ([elementName isEqualToString:@"PubmedArticle"])
+            [self startArticle];
         return;
+    }
     
-    NSMutableString *keywordString = [NSMutableString new];
-    NSString *keywordSeparator = [[NSUserDefaults standardUserDefaults] objectForKey:BDSKDefaultGroupFieldSeparatorKey];
+    NSUInteger level = depth - articleDepth - 1;
+    if (level >= pathCapacity) {
+        pathCapacity *= 2;
+        pathLengths = (NSUInteger *)NSZoneRealloc(NSDefaultMallocZone(), pathLengths, pathCapacity * sizeof(NSUInteger));
+    }
+    pathLengths[level] = [elementPath length];
+    if ([elementPath length])
+        [elementPath appendString:@"/"];
+    [elementPath appendString:elementName];
     
-    for (NSXMLNode *keywordNode in [listNode children]) {
-        
-        if ([[keywordNode name] isEqualToString:@"Keyword"]) {
-            if ([keywordString length])
-                [keywordString appendString:keywordSeparator];
-            [keywordString appendString:[keywordNode stringValue]];
-        }
+    if (xmlString) {
+        [xmlString appendFormat:@"<%@", elementName];
+        for (NSString *attribute in attributeDict)
+            [xmlString appendFormat:@" %@=\"%@\"", attribute, [[attributeDict objectForKey:attribute] stringByEscapingBasicXMLEntitiesUsingUTF8]];
+        [xmlString appendString:@">"];
     }
-    [pubFields setObject:keywordString forKey:BDSKKeywordsString];
-    [keywordString release];
-}
-
-+ (void)_addAbstractNode:(NSXMLNode *)listNode toDictionary:(NSMutableDictionary *)pubFields
-{
-    if ([[listNode children] count] == 0)
+    
+    // nested markup inside the text we're collecting, e.g. <i> in an abstract
+    if (textElement != BDSKPubMedNoElement)
         return;
     
-    NSMutableString *abstractString = [NSMutableString new];
+    BDSKPubMedElement element = [[elementsForPaths objectForKey:elementPath] integerValue];
     
-    for (NSXMLElement *abstractNode in [listNode children]) {
-        
-        if ([[abstractNode name] isEqualToString:@"AbstractText"]) {
-            NSString *label = [[abstractNode attributeForName:@"Label"] stringValue];
-            if ([abstractString length] > 0)
-                [abstractString appendString:@"\n"];
-            if ([label length] > 0){
-                [abstractString appendString:label];
-                [abstractString appendString:@": "];
-            }
-            [abstractString appendString:[abstractNode stringValue]];
-        }
+    // author and keyword list elements only mark structure, the other elements have text
+    if (element == BDSKPubMedNoElement || element == BDSKPubMedAuthorElement || element == BDSKPubMedKeywordListElement)
+        return;
+    
+    if (element == BDSKPubMedAbstractTextElement) {
+        [abstractLabel release];
+        abstractLabel = [[attributeDict objectForKey:@"Label"] copy];
+    } else if (element == BDSKPubMedArticleIdElement) {
+        [articleIdType release];
+        articleIdType = [[attributeDict objectForKey:@"IdType"] copy];
     }
-    [pubFields setObject:abstractString forKey:BDSKAbstractString];
-    [abstractString release];
+    
+    textElement = element;
+    textDepth = depth;
+    [text setString:@""];
 }
 
-+ (NSArray *)_itemsFromDocument:(NSXMLDocument *)doc error:(NSError **)outError;
-{
-    NSArray *articles = [doc nodesForXPath:@"//PubmedArticle" error:outError];
-    NSMutableArray *pubs = [NSMutableArray array];
+- (void)parser:(NSXMLParser *)parser didEndElement:(NSString *)elementName namespaceURI:(NSString *)namespaceURI qualifiedName:(NSString *)qName {
+    if (articleDepth == 0) {
+        depth--;
+        return;
+    }
     
-    for (NSXMLNode *article in articles) {
-        
-        NSXMLNode *citation = [article firstNodeForXPath:@"./MedlineCitation"];        
-        NSMutableDictionary *pubFields = [NSMutableDictionary new];
-        
-        [self _addJournalNode:[citation firstNodeForXPath:@"./Article/Journal"] toDictionary:pubFields];
-        [self _addAuthorListNode:[citation firstNodeForXPath:@"./Article/AuthorList"] toDictionary:pubFields];
-        
-        // ex. PMID 16187791
-        [self _addMeshNode:[citation firstNodeForXPath:@"./MeshHeadingList"] toDictionary:pubFields];
-        [self _addKeywordNode:[citation firstNodeForXPath:@"./KeywordList"] toDictionary:pubFields];
-        
-        [self _addAbstractNode:[citation firstNodeForXPath:@"./Article/Abstract"] toDictionary:pubFields];
-        
-        NSString *title = [[citation firstNodeForXPath:@"./Article/ArticleTitle"] stringValue];
-        addStringToDictionaryIfNotNil([title stringByRemovingSuffix:@"."], BDSKTitleString, pubFields);        
-        addStringValueOfNodeForField([citation firstNodeForXPath:@"./Article/Pagination/MedlinePgn"], BDSKPagesString, pubFields);
-        addStringValueOfNodeForField([citation firstNodeForXPath:@"./PMID"], @"Pmid", pubFields);
-        
-        // not a BibTeX field: http://www.mail-archive.com/bibdesk-users@lists.sourceforge.net/msg04650.html
-        addStringValueOfNodeForField([article firstNodeForXPath:@"./PubmedData/PublicationStatus"], @"Pst", pubFields);
-        
-        // use MedlineTA if available, since the full title evidently has too much information in some cases
-        NSString *ta = [[citation firstNodeForXPath:@"./MedlineJournalInfo/MedlineTA"] stringValue];        
-        if (ta) {
-            // save the full title in another field
-            if ([pubFields objectForKey:BDSKJournalString])
-                [pubFields setObject:[pubFields objectForKey:BDSKJournalString] forKey:@"Journal-Full"];
-            
-            // titlecasing this doesn't seem right, since it's already abbreviated
-            [pubFields setObject:ta forKey:BDSKJournalString];
-        }
-        
-        // grab the DOI and PMC if available
-        NSArray *articleIDs = [article nodesForXPath:@"./PubmedData/ArticleIdList/ArticleId" error:NULL];
-        for (NSXMLElement *articleID in articleIDs) {
-            if ([articleID kind] == NSXMLElementKind) {
-                NSString *idType = [[articleID attributeForName:@"IdType"] stringValue];
-                if ([idType isEqualToString:@"doi"])
-                    addStringValueOfNodeForField(articleID, BDSKDoiString, pubFields);
-                else if ([idType isEqualToString:@"pmc"]) /* e.g. PMID 19930638 */
-                    addStringValueOfNodeForField(articleID, @"Pmc", pubFields);
-            }
+    if (depth == articleDepth) {
+        [self finishArticle];
+        depth--;
+        return;
+    }
+    
+    if (xmlString)
+        [xmlString appendFormat:@"</%@>", elementName];
+    
+    if (textElement != BDSKPubMedNoElement) {
+        if (depth == textDepth) {
+            NSString *string = [text copy];
+            [self addText:string forElement:textElement];
+            [string release];
+            textElement = BDSKPubMedNoElement;
         }
-        
-        // for debugging
-        if (_addXMLStringToAnnote) addStringToDictionaryIfNotNil([article XMLStringWithOptions:NSXMLNodePrettyPrint], BDSKAnnoteString, pubFields);
-        
-        BibItem *pub = [[BibItem allocWithZone:[self zone]] initWithType:BDSKArticleString
-                                                                 citeKey:nil
-                                                               pubFields:pubFields
-                                                                   isNew:YES];
-        [pubs addObject:pub];
-        [pub release];
-        [pubFields release];
+    } else {
+        BDSKPubMedElement element = [[elementsForPaths objectForKey:elementPath] integerValue];
+        if (element == BDSKPubMedAuthorElement)
+            [self finishAuthor];
+        else if (element == BDSKPubMedKeywordListElement)
+            hasKeywordList = YES;
     }
     
-    return pubs;    
+    NSUInteger level = depth - articleDepth - 1;
+    [elementPath deleteCharactersInRange:NSMakeRange(pathLengths[level], [elementPath length] - pathLengths[level])];
+    depth--;
 }
 
-+ (NSArray *)itemsFromString:(NSString *)itemString error:(NSError **)outError;
-{
-    NSXMLDocument *doc = [[NSXMLDocument allocWithZone:[self zone]] initWithXMLString:itemString options:NSXMLNodeOptionsNone error:outError];
-    doc = [doc autorelease];
-    return doc ? [self _itemsFromDocument:doc error:outError] : nil;
+- (void)parser:(NSXMLParser *)parser foundCharacters:(NSString *)string {
+    if (textElement != BDSKPubMedNoElement)
+        [text appendString:string];
+    if (xmlString)
+        [xmlString appendString:[string stringByEscapingBasicXMLEntitiesUsingUTF8]];
 }
 
-+ (NSArray *)itemsFromData:(NSData *)itemData error:(NSError **)outError;
-{
-    NSXMLDocument *doc = [[NSXMLDocument allocWithZone:[self zone]] initWithData:itemData options:NSXMLNodeOptionsNone error:outError];
-    doc = [doc autorelease];
-    return doc ? [self _itemsFromDocument:doc error:outError] : nil;
+- (void)parser:(NSXMLParser *)parser foundCDATA:(NSData *)CDATABlock {
+    NSString *string = [[NSString alloc] initWithData:CDATABlock encoding:NSUTF8StringEncoding];
+    if (string)
+        [self parser:parser foundCharacters:string];
+    [string release];
 }
 
 @end
@@ -46,12 +46,182 @@
 
 
 @interface BDSKRISParser (Private)
-+ (void)addString:(NSMutableString *)value toDictionary:(NSMutableDictionary *)pubDict forTag:(NSString *)tag;
++ (void)addString:(NSString *)value toDictionary:(NSMutableDictionary *)pubDict forField:(NSString *)key;
 + (NSString *)pubTypeFromDictionary:(NSDictionary *)pubDict;
-+ (NSString *)stringByFixingInputString:(NSString *)inputString;
 + (void)fixPublicationDictionary:(NSMutableDictionary *)pubDict;
 @end
 
+/*
+ We tokenize the UTF-8 bytes of the string in a single pass.  A tag line has the tag in the first four columns, followed by a dash and a space, so we accept the sloppy spacing some sources use.  Common tags of two characters from [A-Z0-9] are looked up in a table indexed by their two characters, other tags in a dictionary, and the value of a single line field is created directly from the bytes of the input.
+ */
+
+#define RIS_TAG_CHAR_COUNT 36
+#define RIS_TAG_COUNT (RIS_TAG_CHAR_COUNT * RIS_TAG_CHAR_COUNT)
+#define RIS_NO_TAG -1
+#define RIS_OTHER_TAG RIS_TAG_COUNT
+
+#define RIS_TAG_INDEX(c1, c2) (risTagCharIndex(c1) * RIS_TAG_CHAR_COUNT + risTagCharIndex(c2))
+
+static inline NSInteger risTagCharIndex(unsigned char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= '0' && c <= '9')
+        return 26 + c - '0';
+    return RIS_NO_TAG;
+}
+
+static inline unsigned char risTagChar(NSInteger i)
+{
+    return i < 26 ? 'A' + i : '0' + i - 26;
+}
+
+// length of the newline at p, see BDIsNewlineCharacter; \r\n is a single newline
+static inline NSUInteger newlineLength(const unsigned char *p, const unsigned char *end)
+{
+    switch (*p) {
+        case '\n': case '\v': case '\f':
+            return 1;
+        case '\r':
+            return (p + 1 < end && p[1] == '\n') ? 2 : 1;
+        case 0xC2: // U+0085
+            return (p + 1 < end && p[1] == 0x85) ? 2 : 0;
+        case 0xE2: // U+2028 and U+2029
+            return (p + 2 < end && p[1] == 0x80 && (p[2] == 0xA8 || p[2] == 0xA9)) ? 3 : 0;
+        default:
+            return 0;
+    }
+}
+
+// length of a space or tab at p, including a no-break space from HTML copy/paste
+static inline NSUInteger spaceLength(const unsigned char *p, const unsigned char *end)
+{
+    if (*p == ' ' || *p == '\t')
+        return 1;
+    if (*p == 0xC2 && p + 1 < end && p[1] == 0xA0)
+        return 2;
+    return 0;
+}
+
+static inline void trimSpaces(const unsigned char **start, const unsigned char **end)
+{
+    NSUInteger len;
+    while (*start < *end && (len = spaceLength(*start, *end)))
+        *start += len;
+    while (*start < *end) {
+        if ((*end)[-1] == ' ' || (*end)[-1] == '\t')
+            *end -= 1;
+        else if (*end - *start >= 2 && (*end)[-2] == 0xC2 && (*end)[-1] == 0xA0)
+            *end -= 2;
+        else
+            break;
+    }
+}
+
+// returns YES for a tag line, and sets the range of the tag and the start of the value; the tag is whatever is in the first four columns, followed by a dash and a space, and an ER line may end after the dash
+static inline BOOL getTagForLine(const unsigned char *p, const unsigned char *end, const unsigned char **tagStart, const unsigned char **tagEnd, const unsigned char **valueStart)
+{
+    const unsigned char *q = p;
+    NSUInteger column, len;
+    
+    for (column = 0; column < 4; column++) {
+        if (q >= end)
+            return NO;
+        if ((len = spaceLength(q, end)) == 0) {
+            // a column is a character, so skip the continuation bytes of a UTF-8 sequence
+            len = 1;
+            while (q + len < end && (q[len] & 0xC0) == 0x80)
+                len++;
+        }
+        q += len;
+    }
+    if (q >= end || *q != '-')
+        return NO;
+    *tagStart = p;
+    *tagEnd = q;
+    trimSpaces(tagStart, tagEnd);
+    if (*tagStart == *tagEnd)
+        return NO;
+    q++;
+    if (q < end) {
+        if ((len = spaceLength(q, end)) == 0)
+            return NO;
+        q += len;
+    } else if (*tagEnd - *tagStart != 2 || memcmp(*tagStart, "ER", 2) != 0) {
+        return NO;
+    }
+    *valueStart = q;
+    return YES;
+}
+
+static inline NSInteger tagIndexForTag(const unsigned char *tagStart, const unsigned char *tagEnd)
+{
+    NSInteger c1, c2;
+    if (tagEnd - tagStart != 2 || (c1 = risTagCharIndex(tagStart[0])) == RIS_NO_TAG || (c2 = risTagCharIndex(tagStart[1])) == RIS_NO_TAG)
+        return RIS_OTHER_TAG;
+    return c1 * RIS_TAG_CHAR_COUNT + c2;
+}
+
+// finds the end of the line starting at p, returns the start of the next line
+static inline const unsigned char *getLineEnd(const unsigned char *p, const unsigned char *end, const unsigned char **lineEnd, BOOL *hasNonASCII)
+{
+    NSUInteger nlLength = 0;
+    BOOL nonASCII = NO;
+    while (p < end && (nlLength = newlineLength(p, end)) == 0) {
+        if (*p >= 0x80)
+            nonASCII = YES;
+        p++;
+    }
+    *lineEnd = p;
+    if (hasNonASCII)
+        *hasNonASCII = nonASCII;
+    return p + nlLength;
+}
+
+// Some sources add extra lines with some context info before the entries, so we start at the first TY if there is one
+static const unsigned char *startOfEntries(const unsigned char *bytes, const unsigned char *end)
+{
+    const unsigned char *p = bytes;
+    while (p < end) {
+        const unsigned char *lineStart = p, *lineEnd, *tagStart, *tagEnd, *valueStart;
+        p = getLineEnd(p, end, &lineEnd, NULL);
+        if (getTagForLine(lineStart, lineEnd, &tagStart, &tagEnd, &valueStart) && tagEnd - tagStart == 2 && memcmp(tagStart, "TY", 2) == 0)
+            return lineStart;
+    }
+    return bytes;
+}
+
+// the value of the current field; the value of a multiline field is joined in the buffer
+typedef struct _BDSKRISValue {
+    const unsigned char *bytes;
+    NSUInteger length;
+    BOOL hasNonASCII;
+    BOOL isMultiline;
+    unsigned char *buffer;
+    NSUInteger capacity;
+} BDSKRISValue;
+
+static void appendContinuationLine(BDSKRISValue *value, const unsigned char *start, const unsigned char *end, BOOL hasNonASCII)
+{
+    trimSpaces(&start, &end);
+    if (start == end)
+        return;
+    
+    NSUInteger length = value->length + (end - start) + 1;
+    if (value->capacity < length) {
+        value->capacity = 2 * length;
+        value->buffer = (unsigned char *)NSZoneRealloc(NSDefaultMallocZone(), value->buffer, value->capacity);
+    }
+    if (value->isMultiline == NO) {
+        memcpy(value->buffer, value->bytes, value->length);
+        value->isMultiline = YES;
+    }
+    value->buffer[value->length++] = ' ';
+    memcpy(value->buffer + value->length, start, end - start);
+    value->length += end - start;
+    value->bytes = value->buffer;
+    value->hasNonASCII = value->hasNonASCII || hasNonASCII;
+}
 
 @implementation BDSKRISParser
 
@@ -65,102 +235,160 @@
 
 + (NSArray *)itemsFromString:(NSString *)itemString error:(NSError **)outError{
     
-    // make sure that we only have one type of space and line break to deal with, since HTML copy/paste can have odd whitespace characters
-    itemString = [itemString stringByNormalizingSpacesAndLineBreaks];
+    // get the length of the UTF-8 bytes explicitly, as the string may contain NUL characters
+    CFRange range = CFRangeMake(0, CFStringGetLength((CFStringRef)itemString));
+    CFIndex byteLength = 0;
+    CFStringGetBytes((CFStringRef)itemString, range, kCFStringEncodingUTF8, 0, false, NULL, 0, &byteLength);
+    
+    // only convert when we can't use the bytes of the string directly, and free the conversion as soon as we're done
+    unsigned char *buffer = NULL;
+    const unsigned char *bytes = (const unsigned char *)CFStringGetCStringPtr((CFStringRef)itemString, kCFStringEncodingUTF8);
+    if (bytes == NULL) {
+        buffer = (unsigned char *)NSZoneMalloc(NSDefaultMallocZone(), MAX(byteLength, 1));
+        CFStringGetBytes((CFStringRef)itemString, range, kCFStringEncodingUTF8, 0, false, buffer, byteLength, NULL);
+        bytes = buffer;
+    }
+    const unsigned char *end = bytes + byteLength;
+    const unsigned char *p = startOfEntries(bytes, end);
     
-    itemString = [self stringByFixingInputString:itemString];
-        
-    BibItem *newBI = nil;
     NSMutableArray *returnArray = [NSMutableArray arrayWithCapacity:10];
     
     //dictionary is the publication entry
     NSMutableDictionary *pubDict = [[NSMutableDictionary alloc] init];
     
-    NSArray *sourceLines = [itemString sourceLinesBySplittingString];
+    // field names for the tags we've seen, filled as we go
+    NSString **fieldNames = (NSString **)NSZoneCalloc(NSDefaultMallocZone(), RIS_TAG_COUNT, sizeof(NSString *));
+    NSMutableDictionary *otherFieldNames = nil;
     
-    NSString *tag = nil;
-    NSString *value = nil;
-    NSMutableString *mutableValue = [NSMutableString string];
-    NSCharacterSet *whitespaceAndNewlineCharacterSet = [NSCharacterSet whitespaceAndNewlineCharacterSet];
+    const NSInteger ERTag = RIS_TAG_INDEX('E', 'R');
+    const NSInteger URTag = RIS_TAG_INDEX('U', 'R'), L1Tag = RIS_TAG_INDEX('L', '1'), L4Tag = RIS_TAG_INDEX('L', '4');
     
-    NSSet *tagsNotToConvert = [NSSet setWithObjects:@"UR", @"L1", @"L2", @"L3", @"L4", nil];
+    // the current field
+    NSInteger tag = RIS_NO_TAG;
+    NSString *fieldName = nil;
+    BDSKRISValue value = {NULL, 0, NO, NO, NULL, 0};
     
-    for (NSString *sourceLine in sourceLines) {
-
-        if(([sourceLine length] > 5 && [[sourceLine substringWithRange:NSMakeRange(4,2)] isEqualToString:@"- "]) ||
-           [sourceLine isEqualToString:@"ER  -"]){
-			// this is a "key - value" line
-			
-			// first save the last key/value pair if necessary
-			if(tag && ![tag isEqualToString:@"ER"]){
-				[self addString:mutableValue toDictionary:pubDict forTag:tag];
-			}
-			
-			// get the tag...
-            tag = [[sourceLine substringWithRange:NSMakeRange(0,4)] 
-						stringByTrimmingCharactersInSet:whitespaceAndNewlineCharacterSet];
-			
-			if([tag isEqualToString:@"ER"]){
-				// we are done with this publication
-				
-				if([[pubDict allKeys] count] > 0){
-                    [self fixPublicationDictionary:pubDict];
-                    newBI = [[BibItem alloc] initWithType:[self pubTypeFromDictionary:pubDict]
-                                                  citeKey:nil
-                                                pubFields:pubDict
-                                                    isNew:YES];
-					[returnArray addObject:newBI];
-					[newBI release];
-				}
-				
-				// reset these for the next pub
-				[pubDict removeAllObjects];
-				
-				// we don't care about the rest, ER has no value
-				continue;
-			}
-			
-			// get the value...
-			value = [[sourceLine substringWithRange:NSMakeRange(6,[sourceLine length]-6)]
-						stringByTrimmingCharactersInSet:whitespaceAndNewlineCharacterSet];
-			
-			// don't convert specials in URL/link fields, bug #1244625
-			if(![tagsNotToConvert containsObject:tag])
-				value = [value stringByConvertingHTMLToTeX];
-		
-			[mutableValue setString:value];                
-			
-		} else {
-			// this is a continuation of a multiline value
-			[mutableValue appendString:@" "];
-			[mutableValue appendString:[sourceLine stringByTrimmingCharactersInSet:whitespaceAndNewlineCharacterSet]];
+    while (p < end) {
+        
+        // find the end of the line, and note whether we need to care about non-ASCII characters
+        const unsigned char *lineStart = p, *lineEnd;
+        BOOL lineHasNonASCII;
+        p = getLineEnd(p, end, &lineEnd, &lineHasNonASCII);
+        
+        // Scopus doesn't put the end tag ER on a separate line, so we read it as the next line
+        if (lineEnd - lineStart > 6 && memcmp(lineEnd - 6, "ER  - ", 6) == 0) {
+            lineEnd -= 6;
+            p = lineEnd;
+        }
+        
+        const unsigned char *tagStart = NULL, *tagEnd = NULL, *valueStart = NULL;
+        
+        if (getTagForLine(lineStart, lineEnd, &tagStart, &tagEnd, &valueStart) == NO) {
+            // this is a continuation of a multiline value
+            if (tag != RIS_NO_TAG && tag != ERTag)
+                appendContinuationLine(&value, lineStart, lineEnd, lineHasNonASCII);
+            continue;
+        }
+        
+        // this is a "key - value" line
+        
+        // first save the last key/value pair if necessary
+        if (tag != RIS_NO_TAG && tag != ERTag) {
+            NSString *string = (NSString *)CFStringCreateWithBytes(NULL, value.bytes, value.length, kCFStringEncodingUTF8, false);
+            if (string) {
+                // make sure that we only have one type of space and line break to deal with, since HTML copy/paste can have odd whitespace characters
+                if (value.hasNonASCII) {
+                    NSString *normalizedString = [[string stringByNormalizingSpacesAndLineBreaks] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+                    [string release];
+                    string = [normalizedString retain];
+                }
+                // don't convert specials in URL/link fields, bug #1244625
+                if (tag != URTag && (tag < L1Tag || tag > L4Tag))
+                    [self addString:[string stringByConvertingHTMLToTeX] toDictionary:pubDict forField:fieldName];
+                else
+                    [self addString:string toDictionary:pubDict forField:fieldName];
+                [string release];
+            }
+        }
+        
+        tag = tagIndexForTag(tagStart, tagEnd);
+        
+        if (tag == ERTag) {
+            // we are done with this publication
+            
+            if ([pubDict count] > 0) {
+                [self fixPublicationDictionary:pubDict];
+                BibItem *newBI = [[BibItem alloc] initWithType:[self pubTypeFromDictionary:pubDict]
+                                                       citeKey:nil
+                                                     pubFields:pubDict
+                                                         isNew:YES];
+                [returnArray addObject:newBI];
+                [newBI release];
+            }
+            
+            // reset these for the next pub
+            [pubDict removeAllObjects];
+            
+            // we don't care about the rest, ER has no value
+            continue;
         }
         
+        // get the field name for the tag...
+        if (tag == RIS_OTHER_TAG) {
+            NSString *tagString = (NSString *)CFStringCreateWithBytes(NULL, tagStart, tagEnd - tagStart, kCFStringEncodingUTF8, false);
+            if (otherFieldNames == nil)
+                otherFieldNames = [[NSMutableDictionary alloc] init];
+            fieldName = [otherFieldNames objectForKey:tagString];
+            if (fieldName == nil) {
+                fieldName = [[BDSKTypeManager sharedManager] fieldNameForRISTag:tagString] ?: [tagString fieldName];
+                [otherFieldNames setObject:fieldName forKey:tagString];
+            }
+            [tagString release];
+        } else {
+            if (fieldNames[tag] == nil) {
+                NSString *tagString = [[NSString alloc] initWithFormat:@"%c%c", risTagChar(tag / RIS_TAG_CHAR_COUNT), risTagChar(tag % RIS_TAG_CHAR_COUNT)];
+                fieldNames[tag] = [([[BDSKTypeManager sharedManager] fieldNameForRISTag:tagString] ?: [tagString fieldName]) copy];
+                [tagString release];
+            }
+            fieldName = fieldNames[tag];
+        }
+        
+        // get the value...
+        const unsigned char *valueEnd = lineEnd;
+        trimSpaces(&valueStart, &valueEnd);
+        value.bytes = valueStart;
+        value.length = valueEnd - valueStart;
+        value.hasNonASCII = lineHasNonASCII;
+        value.isMultiline = NO;
     }
     
     if(outError) *outError = nil;
     
+    NSUInteger i;
+    for (i = 0; i < RIS_TAG_COUNT; i++)
+        [fieldNames[i] release];
+    NSZoneFree(NSDefaultMallocZone(), fieldNames);
+    [otherFieldNames release];
+    if (buffer)
+        NSZoneFree(NSDefaultMallocZone(), buffer);
+    if (value.buffer)
+        NSZoneFree(NSDefaultMallocZone(), value.buffer);
     [pubDict release];
     return returnArray;
 }
 
-+ (void)addString:(NSMutableString *)value toDictionary:(NSMutableDictionary *)pubDict forTag:(NSString *)tag;
++ (void)addString:(NSString *)value toDictionary:(NSMutableDictionary *)pubDict forField:(NSString *)key;
 {
-	NSString *key = nil;
-	NSString *oldString = nil;
+	NSString *oldString = [pubDict objectForKey:key];
     NSString *newString = nil;
 	
-    key = [[BDSKTypeManager sharedManager] fieldNameForRISTag:tag] ?: [tag fieldName];
-	oldString = [pubDict objectForKey:key];
-	
 	BOOL isAuthor = [key isPersonField];
     
     // sometimes we have authors as "Feelgood, D.R.", but BibTeX and btparse need "Feelgood, D. R." for parsing
     // this leads to some unnecessary trailing space, though, in some cases (e.g. "Feelgood, D. R. ") so we can
     // either ignore it, be clever and not add it after the last ".", or add it everywhere and collapse it later
     if(isAuthor){
-		[value replaceOccurrencesOfString:@"." withString:@". " 
-			options:NSLiteralSearch range:NSMakeRange(0, [value length])];
+		value = [value stringByReplacingOccurrencesOfString:@"." withString:@". "];
     }
 	// concatenate authors and keywords, as they can appear multiple times
 	// other duplicates keys should have at least different tags, so we use the tag instead
@@ -262,17 +490,4 @@
     }
 }
 
-+ (NSString *)stringByFixingInputString:(NSString *)inputString;
-{
-    // Some sources add extra lines with some context info before the entries
-    AGRegex *risRegex = [AGRegex regexWithPattern:@"^TY  - [A-Z]+\n[A-Z0-9]{2}  - " options:AGRegexMultiline];
-    AGRegexMatch *match = [risRegex findInString:inputString];
-    if (match)
-        inputString = [inputString substringFromIndex:[match range].location];
-    
-    // Scopus doesn't put the end tag ER on a separate line.
-    AGRegex *endTag = [AGRegex regexWithPattern:@"([^\r\n])ER  - $" options:AGRegexMultiline];
-    return [endTag replaceWithString:@"$1\r\nER  - " inString:inputString];
-}
-
 @end
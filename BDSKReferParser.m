@@ -72,8 +72,20 @@
  
  */ 
 
+// set up in +initialize rather than lazily, as the parser can be used on several threads at once
+static NSCharacterSet *tagSet = nil;
+
 @implementation BDSKReferParser
 
++ (void)initialize{
+    BDSKINITIALIZE;
+    NSMutableCharacterSet *set = [[NSCharacterSet characterSetWithRange:NSMakeRange('A', 26)] mutableCopy];
+    [set addCharactersInRange:NSMakeRange('a', 26)];
+    [set addCharactersInString:@"0123456789"];
+    tagSet = [set copy];
+    [set release];
+}
+
 + (BOOL)canParseString:(NSString *)string{
     // remove leading newlines in case this originates from copy/paste
     return [[string stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]] hasPrefix:@"%"];
@@ -145,15 +157,6 @@ static inline BOOL isTagLine(NSString *sourceLine)
 {
     NSCParameterAssert(sourceLine && [sourceLine length] >= 3);
     
-    static NSCharacterSet *tagSet = nil;
-    if(tagSet == nil) {
-        NSMutableCharacterSet *set = [[NSCharacterSet characterSetWithRange:NSMakeRange('A', 26)] mutableCopy];
-        [set addCharactersInRange:NSMakeRange('a', 26)];
-        [set addCharactersInString:@"0123456789"];
-        tagSet = [set copy];
-        [set release];
-    }
-    
     unichar chars[3];
     [sourceLine getCharacters:chars range:NSMakeRange(0, 3)];
     return (chars[0] == '%' && [tagSet characterIsMember:chars[1]] && [[NSCharacterSet whitespaceCharacterSet] characterIsMember:chars[2]]);
@@ -43,9 +43,13 @@ extern NSString *BDSKSearchGroupEntrez;
 extern NSString *BDSKSearchGroupZoom;
 extern NSString *BDSKSearchGroupISI;
 extern NSString *BDSKSearchGroupDBLP;
+extern NSString *BDSKSearchGroupFederated;
 
 extern NSString *BDSKSearchGroupURLScheme;
 
+// the number of pages of results the servers get ahead of time, 0 when prefetching is disabled
+NSInteger BDSKSearchGroupPrefetchDepth(void);
+
 @class BDSKServerInfo;
 
 @protocol BDSKSearchGroup <BDSKOwner>
@@ -74,6 +78,8 @@ extern NSString *BDSKSearchGroupURLScheme;
     id<BDSKSearchGroupServer> server;
 }
 
++ (Class)serverClassForType:(NSString *)aType;
+
 - (id)initWithServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)string;
 - (id)initWithURL:(NSURL *)bdsksearchURL;
 
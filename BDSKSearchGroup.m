@@ -46,6 +46,7 @@
 #import "BDSKItemSearchIndexes.h"
 #import "BDSKISIGroupServer.h"
 #import "BDSKDBLPGroupServer.h"
+#import "BDSKFederatedGroupServer.h"
 #import "BDSKGroup+Scripting.h"
 #import "BibItem.h"
 #import "NSString_BDSKExtensions.h"
@@ -54,11 +55,38 @@ NSString *BDSKSearchGroupEntrez = @"entrez";
 NSString *BDSKSearchGroupZoom = @"zoom";
 NSString *BDSKSearchGroupISI = @"isi";
 NSString *BDSKSearchGroupDBLP = @"dblp";
+NSString *BDSKSearchGroupFederated = @"federated";
 
 NSString *BDSKSearchGroupURLScheme = @"x-bdsk-search";
 
+// set to 0 to disable prefetching
+#define BDSKSearchGroupPrefetchDepthKey @"BDSKSearchGroupPrefetchDepth"
+#define DEFAULT_PREFETCH_DEPTH 2
+
+NSInteger BDSKSearchGroupPrefetchDepth(void) {
+    NSUserDefaults *sud = [NSUserDefaults standardUserDefaults];
+    return [sud objectForKey:BDSKSearchGroupPrefetchDepthKey] ? [sud integerForKey:BDSKSearchGroupPrefetchDepthKey] : DEFAULT_PREFETCH_DEPTH;
+}
+
 @implementation BDSKSearchGroup
 
++ (Class)serverClassForType:(NSString *)aType {
+    Class serverClass = Nil;
+    if ([aType isEqualToString:BDSKSearchGroupEntrez])
+        serverClass = [BDSKEntrezGroupServer class];
+    else if ([aType isEqualToString:BDSKSearchGroupZoom])
+        serverClass = [BDSKZoomGroupServer class];
+    else if ([aType isEqualToString:BDSKSearchGroupISI])
+        serverClass = [BDSKISIGroupServer class];
+    else if ([aType isEqualToString:BDSKSearchGroupDBLP])
+        serverClass = [BDSKDBLPGroupServer class];
+    else if ([aType isEqualToString:BDSKSearchGroupFederated])
+        serverClass = [BDSKFederatedGroupServer class];
+    else
+        BDSKASSERT_NOT_REACHED("unknown search group type");
+    return serverClass;
+}
+
 // old designated initializer
 - (id)initWithName:(NSString *)aName;
 {
@@ -264,19 +292,7 @@ NSString *BDSKSearchGroupURLScheme = @"x-bdsk-search";
 - (void)resetServerWithInfo:(BDSKServerInfo *)info {
     [server terminate];
     [server release];
-    NSString *aType = [info type];
-    Class serverClass = Nil;
-    if ([aType isEqualToString:BDSKSearchGroupEntrez])
-        serverClass = [BDSKEntrezGroupServer class];
-    else if ([aType isEqualToString:BDSKSearchGroupZoom])
-        serverClass = [BDSKZoomGroupServer class];
-    else if ([aType isEqualToString:BDSKSearchGroupISI])
-        serverClass = [BDSKISIGroupServer class];
-    else if ([aType isEqualToString:BDSKSearchGroupDBLP])
-        serverClass = [BDSKDBLPGroupServer class];
-    else
-        BDSKASSERT_NOT_REACHED("unknown search group type");
-    server = [[serverClass alloc] initWithGroup:self serverInfo:info];
+    server = [[[[self class] serverClassForType:[info type]] alloc] initWithGroup:self serverInfo:info];
 }
 
 - (void)search;
@@ -347,8 +363,11 @@ NSString *BDSKSearchGroupURLScheme = @"x-bdsk-search";
 }
 
 - (NSURL *)bdsksearchURL {
-    NSMutableString *string = [NSMutableString stringWithFormat:@"%@://", BDSKSearchGroupURLScheme];
     BDSKServerInfo *serverInfo = [self serverInfo];
+    // a federated search cannot be described by a single server URL
+    if ([serverInfo isFederated])
+        return nil;
+    NSMutableString *string = [NSMutableString stringWithFormat:@"%@://", BDSKSearchGroupURLScheme];
     NSString *password = [serverInfo password];
     NSString *username = [serverInfo username];
     if ([serverInfo isZoom]) {
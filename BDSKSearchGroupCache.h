@@ -0,0 +1,61 @@
+//
+//  BDSKSearchGroupCache.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+@class BDSKServerInfo;
+
+// Keeps the raw results of search group servers on disk, so search groups can show their results again without asking the server.
+// Results are stored per page, keyed by the server info, the search term, and the index of the first result in the page.
+// The methods are thread safe, so servers can use them from their server thread.
+@interface BDSKSearchGroupCache : NSObject {
+    NSString *cacheFolder;
+    NSTimeInterval timeToLive;
+}
+
++ (id)sharedCache;
+
+// returns nil when there is no valid entry; expired entries are only returned when allowExpired is YES, e.g. when we cannot connect to the server
+- (id)resultsForServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)searchTerm startIndex:(NSInteger)startIndex count:(NSInteger *)count availableResults:(NSInteger *)availableResults allowExpired:(BOOL)allowExpired;
+// results should be a property list
+- (void)setResults:(id)results count:(NSInteger)count availableResults:(NSInteger)availableResults forServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)searchTerm startIndex:(NSInteger)startIndex;
+- (BOOL)hasResultsForServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)searchTerm startIndex:(NSInteger)startIndex;
+
+- (void)removeExpiredResults;
+
+@end
@@ -0,0 +1,166 @@
+//
+//  BDSKSearchGroupCache.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKSearchGroupCache.h"
+#import "BDSKServerInfo.h"
+#import "NSData_BDSKExtensions.h"
+#import "NSFileManager_BDSKExtensions.h"
+
+#define CACHE_VERSION @"1"
+
+// in seconds, results older than this are only used when the server is not available
+#define BDSKSearchGroupCacheTimeToLiveKey @"BDSKSearchGroupCacheTimeToLive"
+#define DEFAULT_TIME_TO_LIVE (24.0 * 60.0 * 60.0)
+// expired results are kept this much longer for offline use
+#define EXPIRED_RESULTS_LIFETIME (30.0 * 24.0 * 60.0 * 60.0)
+
+#define VERSION_KEY          @"version"
+#define KEY_KEY              @"key"
+#define DATE_KEY             @"date"
+#define COUNT_KEY            @"count"
+#define AVAILABLE_KEY        @"available"
+#define RESULTS_KEY          @"results"
+
+@implementation BDSKSearchGroupCache
+
++ (id)sharedCache {
+    static BDSKSearchGroupCache *sharedCache = nil;
+    @synchronized(self) {
+        if (sharedCache == nil) {
+            sharedCache = [[self alloc] init];
+            // clean up old results once per launch, without blocking whoever asked for the cache first
+            [sharedCache performSelectorInBackground:@selector(removeExpiredResults) withObject:nil];
+        }
+    }
+    return sharedCache;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        NSFileManager *fm = [[NSFileManager alloc] init];
+        cacheFolder = [[fm cachesFolderForClass:[self class] version:CACHE_VERSION] copy];
+        [fm release];
+        NSNumber *ttl = [[NSUserDefaults standardUserDefaults] objectForKey:BDSKSearchGroupCacheTimeToLiveKey];
+        timeToLive = ttl ? [ttl doubleValue] : DEFAULT_TIME_TO_LIVE;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(cacheFolder);
+    [super dealloc];
+}
+
+// the name is not part of the key, as it is just a label; the options are, so results are not shared between accounts
+// the options contain the password, so we only use a digest of the serialized server info, which is all that is written to disk
+static NSString *keyForServerInfo(BDSKServerInfo *info, NSString *searchTerm, NSInteger startIndex) {
+    NSMutableString *key = [NSMutableString stringWithFormat:@"%@\n%@\n%@\n%@", [info type], [info database] ?: @"", [info host] ?: @"", [info port] ?: @""];
+    NSDictionary *options = [info options];
+    for (NSString *option in [[options allKeys] sortedArrayUsingSelector:@selector(compare:)])
+        [key appendFormat:@"\n%@=%@", option, [options objectForKey:option]];
+    [key appendFormat:@"\n\n%@\n%ld", searchTerm, (long)startIndex];
+    return [[[key dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString];
+}
+
+- (NSString *)pathForKey:(NSString *)key {
+    return [cacheFolder stringByAppendingPathComponent:[key stringByAppendingPathExtension:@"plist"]];
+}
+
+- (NSDictionary *)entryForKey:(NSString *)key {
+    NSData *data = [NSData dataWithContentsOfFile:[self pathForKey:key]];
+    NSDictionary *entry = nil;
+    if (data) {
+        entry = [NSPropertyListSerialization propertyListFromData:data mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:NULL];
+        // make sure this is really our entry, and not a damaged or misplaced file
+        if ([entry isKindOfClass:[NSDictionary class]] == NO || [[entry objectForKey:VERSION_KEY] isEqualToString:CACHE_VERSION] == NO || [[entry objectForKey:KEY_KEY] isEqualToString:key] == NO || [entry objectForKey:RESULTS_KEY] == nil)
+            entry = nil;
+    }
+    return entry;
+}
+
+- (id)resultsForServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)searchTerm startIndex:(NSInteger)startIndex count:(NSInteger *)count availableResults:(NSInteger *)availableResults allowExpired:(BOOL)allowExpired {
+    if (info == nil || [NSString isEmptyString:searchTerm] || cacheFolder == nil)
+        return nil;
+    NSDictionary *entry = [self entryForKey:keyForServerInfo(info, searchTerm, startIndex)];
+    if (entry == nil)
+        return nil;
+    if (allowExpired == NO && -[[entry objectForKey:DATE_KEY] timeIntervalSinceNow] > timeToLive)
+        return nil;
+    if (count)
+        *count = [[entry objectForKey:COUNT_KEY] integerValue];
+    if (availableResults)
+        *availableResults = [[entry objectForKey:AVAILABLE_KEY] integerValue];
+    return [entry objectForKey:RESULTS_KEY];
+}
+
+- (BOOL)hasResultsForServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)searchTerm startIndex:(NSInteger)startIndex {
+    return nil != [self resultsForServerInfo:info searchTerm:searchTerm startIndex:startIndex count:NULL availableResults:NULL allowExpired:NO];
+}
+
+- (void)setResults:(id)results count:(NSInteger)count availableResults:(NSInteger)availableResults forServerInfo:(BDSKServerInfo *)info searchTerm:(NSString *)searchTerm startIndex:(NSInteger)startIndex {
+    if (results == nil || info == nil || [NSString isEmptyString:searchTerm] || cacheFolder == nil || timeToLive <= 0.0)
+        return;
+    NSString *key = keyForServerInfo(info, searchTerm, startIndex);
+    NSDictionary *entry = [NSDictionary dictionaryWithObjectsAndKeys:
+        CACHE_VERSION, VERSION_KEY,
+        key, KEY_KEY,
+        [NSDate date], DATE_KEY,
+        [NSNumber numberWithInteger:count], COUNT_KEY,
+        [NSNumber numberWithInteger:availableResults], AVAILABLE_KEY,
+        results, RESULTS_KEY, nil];
+    NSData *data = [NSPropertyListSerialization dataFromPropertyList:entry format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
+    // atomic writes, so readers on other threads never see a partial file
+    [data writeToFile:[self pathForKey:key] atomically:YES];
+}
+
+- (void)removeExpiredResults {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSFileManager *fm = [[NSFileManager alloc] init];
+    NSDate *limitDate = [NSDate dateWithTimeIntervalSinceNow:-(timeToLive + EXPIRED_RESULTS_LIFETIME)];
+    for (NSString *file in [fm contentsOfDirectoryAtPath:cacheFolder error:NULL]) {
+        NSString *path = [cacheFolder stringByAppendingPathComponent:file];
+        NSDate *modDate = [[fm attributesOfItemAtPath:path error:NULL] fileModificationDate];
+        if (modDate && [modDate compare:limitDate] == NSOrderedAscending)
+            [fm removeItemAtPath:path error:NULL];
+    }
+    [fm release];
+    [pool release];
+}
+
+@end
@@ -42,7 +42,8 @@ enum {
     BDSKServerTypeEntrez,
     BDSKServerTypeZoom,
     BDSKServerTypeISI,
-    BDSKServerTypeDBLP
+    BDSKServerTypeDBLP,
+    BDSKServerTypeFederated
 };
 typedef NSInteger BDSKServerType;
 
@@ -56,6 +57,7 @@ typedef NSInteger BDSKServerType;
 }
 
 + (id)defaultServerInfoWithType:(NSString *)aType;
++ (id)federatedServerInfoWithName:(NSString *)aName serverInfos:(NSArray *)infos;
 
 - (id)initWithType:(NSString *)aType name:(NSString *)aName database:(NSString *)aDbase host:(NSString *)aHost port:(NSString *)aPort options:(NSDictionary *)options;
 
@@ -75,10 +77,15 @@ typedef NSInteger BDSKServerType;
 - (BOOL)removeDiacritics;
 - (NSDictionary *)options;
 
+// only for federated searches, the servers that are searched together and how long we wait for each of them
+- (NSArray *)serverInfos;
+- (NSTimeInterval)timeout;
+
 - (BOOL)isEntrez;
 - (BOOL)isZoom;
 - (BOOL)isISI;
 - (BOOL)isDBLP;
+- (BOOL)isFederated;
 
 - (BDSKServerType)serverType;
 
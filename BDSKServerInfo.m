@@ -52,16 +52,20 @@
 #define RECORDSYNTAX_KEY     @"recordSyntax"
 #define RESULTENCODING_KEY   @"resultEncoding"
 #define REMOVEDIACRITICS_KEY @"removeDiacritics"
+#define SERVERS_KEY          @"servers"
+#define TIMEOUT_KEY          @"timeout"
 
 #define DEFAULT_NAME     NSLocalizedString(@"New Server", @"")
 #define DEFAULT_DATABASE DATABASE_KEY 
 #define DEFAULT_HOST     @"host.domain.com"
 #define DEFAULT_PORT     @"0"
+#define DEFAULT_TIMEOUT  30.0
 
 // IMPORTANT WARNING:
 // When anything changes about server infos, e.g. a new type is added, this should be carefully considered, as it has many consequences for data integrity and and the editing sheet.
 // Assumptions are made in BDSKSearchGroup and BDSKSearchGroupSheetController.
-// Currently, anything other than zoom is expected to have just a type, name, and database.
+// Currently, anything other than zoom and federated is expected to have just a type, name, and database.
+// Federated server infos only have options, containing the dictionary values of the server infos they search.
 // Also when other validations are necessary, changing the type must make sure that the data validates properly for the new type, if necessary adding missing values.
 
 @implementation BDSKServerInfo
@@ -78,6 +82,17 @@
                                        options:isZoom ? [NSDictionary dictionary] : nil] autorelease];
 }
 
++ (id)federatedServerInfoWithName:(NSString *)aName serverInfos:(NSArray *)infos;
+{
+    NSArray *servers = [infos valueForKey:@"dictionaryValue"];
+    return [[[[self class] alloc] initWithType:BDSKSearchGroupFederated
+                                          name:aName
+                                      database:nil
+                                          host:nil
+                                          port:nil
+                                       options:[NSDictionary dictionaryWithObjectsAndKeys:servers, SERVERS_KEY, nil]] autorelease];
+}
+
 - (id)initWithType:(NSString *)aType name:(NSString *)aName database:(NSString *)aDbase host:(NSString *)aHost port:(NSString *)aPort options:(NSDictionary *)opts;
 {
     self = [super init];
@@ -93,6 +108,10 @@
             host = [aHost copy];
             port = [aPort copy];
             options = [opts mutableCopy];
+        } else if ([self isFederated]) {
+            host = nil;
+            port = nil;
+            options = [opts mutableCopy];
         } else {
             [self release];
             self = nil;
@@ -169,6 +188,8 @@ static inline BOOL isEqualOrBothNil(id object1, id object2) {
         isEqual = isEqualOrBothNil([self host], [other host]) && 
                   isEqualOrBothNil([self port], [(BDSKServerInfo *)other port]) && 
                   (isEqualOrBothNil([self options], [(BDSKServerInfo *)other options]) || ([[self options] count] == 0 && [[(BDSKServerInfo *)other options] count] == 0));
+    else if ([self isFederated])
+        isEqual = isEqualOrBothNil([self options], [(BDSKServerInfo *)other options]);
     return isEqual;
 }
 
@@ -178,6 +199,8 @@ static inline BOOL isEqualOrBothNil(id object1, id object2) {
         hash += [[self host] hash] + [[self port] hash] + [[self password] hash];
         if ([options count])
             hash += [[self options] hash];
+    } else if ([self isFederated]) {
+        hash += [[self serverInfos] count];
     }
     return hash;
 }
@@ -191,6 +214,8 @@ static inline BOOL isEqualOrBothNil(id object1, id object2) {
         [info setValue:[self host] forKey:HOST_KEY];
         [info setValue:[self port] forKey:PORT_KEY];
         [info setValue:[self options] forKey:OPTIONS_KEY];
+    } else if ([self isFederated]) {
+        [info setValue:[self options] forKey:OPTIONS_KEY];
     }
     return info;
 }
@@ -215,12 +240,32 @@ static inline BOOL isEqualOrBothNil(id object1, id object2) {
 
 - (BOOL)removeDiacritics { return [[[self options] objectForKey:REMOVEDIACRITICS_KEY] boolValue]; }
 
-- (NSDictionary *)options { return [self isZoom] ? [[options copy] autorelease] : nil; }
+- (NSDictionary *)options { return ([self isZoom] || [self isFederated]) ? [[options copy] autorelease] : nil; }
+
+- (NSArray *)serverInfos {
+    if ([self isFederated] == NO)
+        return nil;
+    NSMutableArray *infos = [NSMutableArray array];
+    for (NSDictionary *dict in [options objectForKey:SERVERS_KEY]) {
+        BDSKServerInfo *info = [[BDSKServerInfo alloc] initWithDictionary:dict];
+        // we don't allow nesting federated searches
+        if (info && [info isFederated] == NO)
+            [infos addObject:info];
+        [info release];
+    }
+    return infos;
+}
+
+- (NSTimeInterval)timeout {
+    NSTimeInterval timeout = [[options objectForKey:TIMEOUT_KEY] doubleValue];
+    return timeout > 0.0 ? timeout : DEFAULT_TIMEOUT;
+}
 
 - (BOOL)isEntrez { return [[self type] isEqualToString:BDSKSearchGroupEntrez]; }
 - (BOOL)isZoom { return [[self type] isEqualToString:BDSKSearchGroupZoom]; }
 - (BOOL)isISI { return [[self type] isEqualToString:BDSKSearchGroupISI]; }
 - (BOOL)isDBLP { return [[self type] isEqualToString:BDSKSearchGroupDBLP]; }
+- (BOOL)isFederated { return [[self type] isEqualToString:BDSKSearchGroupFederated]; }
 
 - (BDSKServerType)serverType {
     if ([self isEntrez])
@@ -231,6 +276,8 @@ static inline BOOL isEqualOrBothNil(id object1, id object2) {
         return BDSKServerTypeISI;
     if ([self isDBLP])
         return BDSKServerTypeDBLP;
+    if ([self isFederated])
+        return BDSKServerTypeFederated;
     BDSKASSERT_NOT_REACHED("Unknown search type");
     return BDSKServerTypeEntrez;
 }
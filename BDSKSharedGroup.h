@@ -44,6 +44,11 @@
 @interface BDSKSharedGroup : BDSKExternalGroup
 {
     BDSKSharingClient *client;
+    NSMutableDictionary *publicationsByIdentifier;
+    NSString *generation;
+    NSInteger version;
+    NSInteger decodeToken;
+    NSInteger pendingDecodeCount;
 }
 
 + (NSImage *)icon;
@@ -43,6 +43,33 @@
 #import "BDSKPublicationsArray.h"
 #import "BDSKMacroResolver.h"
 #import "BibItem.h"
+#import "BDSKSharedRecordArchiver.h"
+
+// the first chunk is small so the first publications show up quickly, later chunks grow up to the maximum
+#define FIRST_DECODE_CHUNK_SIZE 100
+#define MAX_DECODE_CHUNK_SIZE 2000
+
+#define DECODE_TOKEN_KEY @"token"
+#define IDENTIFIERS_KEY  @"identifiers"
+#define PUBLICATIONS_KEY @"publications"
+#define REMOVED_KEY      @"removed"
+#define REPLACES_ALL_KEY @"replacesAll"
+#define IS_LAST_KEY      @"isLast"
+
+@interface BDSKSharedGroupDecodeOperation : NSOperation {
+    BDSKSharedGroup *group;
+    NSDictionary *archives;
+    NSArray *removedIdentifiers;
+    BDSKMacroResolver *macroResolver;
+    NSInteger token;
+    BOOL replacesAll;
+}
+- (id)initWithGroup:(BDSKSharedGroup *)aGroup archives:(NSDictionary *)anArchives removedIdentifiers:(NSArray *)identifiers macroResolver:(BDSKMacroResolver *)aMacroResolver token:(NSInteger)aToken replacesAll:(BOOL)flag;
+@end
+
+@interface BDSKSharedGroup (BDSKPrivate)
+- (void)applyDecodedChunk:(NSDictionary *)info;
+@end
 
 
 @implementation BDSKSharedGroup
@@ -118,6 +145,11 @@ static inline NSImage *createBadgedIcon(NSImage *icon, NSString *badgeName) {
     if (self) {
 
         client = [aClient retain];
+        publicationsByIdentifier = nil;
+        generation = nil;
+        version = -1;
+        decodeToken = 0;
+        pendingDecodeCount = 0;
         
         [self handleClientUpdatedNotification:nil];
         
@@ -140,6 +172,8 @@ static inline NSImage *createBadgedIcon(NSImage *icon, NSString *badgeName) {
 {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
     BDSKDESTROY(client);
+    BDSKDESTROY(publicationsByIdentifier);
+    BDSKDESTROY(generation);
     [super dealloc];
 }
 
@@ -156,8 +190,6 @@ static inline NSImage *createBadgedIcon(NSImage *icon, NSString *badgeName) {
 
 - (BDSKSharingClient *)client { return client; }
 
-- (void)addPublications:(NSArray *)newPublications { [self doesNotRecognizeSelector:_cmd]; }
-
 - (BOOL)shouldRetrievePublications {
     return [self needsUpdate] || [super shouldRetrievePublications];
 
@@ -176,7 +208,7 @@ static inline NSImage *createBadgedIcon(NSImage *icon, NSString *badgeName) {
         return [[self class] icon];
 }
 
-- (BOOL)isRetrieving { return [client isRetrieving]; }
+- (BOOL)isRetrieving { return [client isRetrieving] || pendingDecodeCount > 0; }
 
 - (BOOL)failedDownload { return [client failedDownload]; }
 
@@ -188,6 +220,134 @@ static inline NSImage *createBadgedIcon(NSImage *icon, NSString *badgeName) {
 
 #pragma mark notification handlers
 
+// servers with protocol version 2 or later send data in the record format
+static id unarchivePublicationOrMacros(NSData *data, BDSKMacroResolver *aMacroResolver) {
+    if ([BDSKSharedRecordUnarchiver canUnarchiveData:data])
+        return [BDSKSharedRecordUnarchiver unarchiveObjectWithData:data macroResolver:aMacroResolver];
+    else
+        return [NSKeyedUnarchiver unarchiveObjectWithData:data];
+}
+
+- (BOOL)canApplyClientChanges {
+    return publicationsByIdentifier && [client previousVersion] >= 0 && [client previousVersion] == version && [[client generation] isEqualToString:generation];
+}
+
+// applies the changes from the last update when we have the publications it was based on, otherwise unarchives all publications
+- (NSArray *)publicationsFromClientChanges {
+    NSDictionary *archives = nil;
+    
+    if ([self canApplyClientChanges]) {
+        archives = [client changedPublicationArchives];
+        [publicationsByIdentifier removeObjectsForKeys:[client removedPublicationIdentifiers]];
+    } else {
+        archives = [client publicationArchives];
+        [publicationsByIdentifier release];
+        publicationsByIdentifier = [[NSMutableDictionary alloc] initWithCapacity:[archives count]];
+    }
+    
+    [generation release];
+    generation = [[client generation] retain];
+    version = [client version];
+    
+    for (NSString *identifier in archives) {
+        BibItem *pub = unarchivePublicationOrMacros([archives objectForKey:identifier], macroResolver);
+        if (pub) {
+            // we set the macroResolver so we know the fields of this item may refer to it, so we can prevent scripting from adding this to the wrong document
+            [pub setMacroResolver:macroResolver];
+            [publicationsByIdentifier setObject:pub forKey:identifier];
+        }
+    }
+    
+    return [publicationsByIdentifier allValues];
+}
+
+// records are unarchived on a background queue; keyed archives need the global macro resolver for unarchiving, so they are unarchived on the main thread
+- (BOOL)canDecodeClientChangesInBackground {
+    for (NSData *data in [[client changedPublicationArchives] objectEnumerator]) {
+        if ([BDSKSharedRecordUnarchiver canUnarchiveData:data] == NO)
+            return NO;
+    }
+    return YES;
+}
+
+// the queue is serial, so the chunks arrive on the main thread in the order of the updates
++ (NSOperationQueue *)decodeQueue {
+    static NSOperationQueue *decodeQueue = nil;
+    if (decodeQueue == nil) {
+        decodeQueue = [[NSOperationQueue alloc] init];
+        [decodeQueue setMaxConcurrentOperationCount:1];
+    }
+    return decodeQueue;
+}
+
+- (void)decodeClientChangesInBackground {
+    NSDictionary *archives = nil;
+    NSArray *removedIdentifiers = nil;
+    BOOL replacesAll = NO;
+    
+    if ([self canApplyClientChanges]) {
+        archives = [client changedPublicationArchives];
+        removedIdentifiers = [client removedPublicationIdentifiers];
+    } else {
+        archives = [client publicationArchives];
+        replacesAll = YES;
+        // chunks from earlier updates are no longer relevant
+        decodeToken++;
+        [publicationsByIdentifier release];
+        publicationsByIdentifier = [[NSMutableDictionary alloc] initWithCapacity:[archives count]];
+    }
+    
+    [generation release];
+    generation = [[client generation] retain];
+    version = [client version];
+    
+    BDSKSharedGroupDecodeOperation *operation = [[BDSKSharedGroupDecodeOperation alloc] initWithGroup:self archives:archives removedIdentifiers:removedIdentifiers macroResolver:macroResolver token:decodeToken replacesAll:replacesAll];
+    pendingDecodeCount++;
+    [[[self class] decodeQueue] addOperation:operation];
+    [operation release];
+}
+
+- (void)applyDecodedChunk:(NSDictionary *)info {
+    BOOL isLast = [[info objectForKey:IS_LAST_KEY] boolValue];
+    
+    if (isLast)
+        pendingDecodeCount--;
+    
+    if ([[info objectForKey:DECODE_TOKEN_KEY] integerValue] != decodeToken) {
+        if (isLast && pendingDecodeCount == 0)
+            [self notifyUpdateForSuccess:YES];
+        return;
+    }
+    
+    NSArray *identifiers = [info objectForKey:IDENTIFIERS_KEY];
+    NSArray *pubs = [info objectForKey:PUBLICATIONS_KEY];
+    NSArray *removedIdentifiers = [info objectForKey:REMOVED_KEY];
+    
+    // we set the macroResolver so we know the fields of this item may refer to it, so we can prevent scripting from adding this to the wrong document
+    [pubs setValue:macroResolver forKey:@"macroResolver"];
+    
+    if ([[info objectForKey:REPLACES_ALL_KEY] boolValue]) {
+        [publicationsByIdentifier addEntriesFromDictionary:[NSDictionary dictionaryWithObjects:pubs forKeys:identifiers]];
+        [self setPublications:pubs];
+    } else {
+        BOOL onlyAdds = [self publicationsWithoutUpdating] != nil && [removedIdentifiers count] == 0;
+        if (onlyAdds) {
+            for (NSString *identifier in identifiers) {
+                if ([publicationsByIdentifier objectForKey:identifier]) {
+                    onlyAdds = NO;
+                    break;
+                }
+            }
+        }
+        [publicationsByIdentifier removeObjectsForKeys:removedIdentifiers];
+        [publicationsByIdentifier addEntriesFromDictionary:[NSDictionary dictionaryWithObjects:pubs forKeys:identifiers]];
+        if (onlyAdds)
+            [self addPublications:pubs];
+        else
+            [self setPublications:[publicationsByIdentifier allValues]];
+    }
+}
+
 - (void)handleClientUpdatedNotification:(NSNotification *)notification {
     NSData *pubsArchive = [client archivedPublications];
     NSData *macrosArchive = [client archivedMacros];
@@ -195,17 +355,114 @@ static inline NSImage *createBadgedIcon(NSImage *icon, NSString *badgeName) {
     NSDictionary *macros = nil;
     
     [NSString setMacroResolverForUnarchiving:[self macroResolver]];
-    if (pubsArchive)
-        pubs = [NSKeyedUnarchiver unarchiveObjectWithData:pubsArchive];
-    if (macrosArchive)
-        macros = [NSKeyedUnarchiver unarchiveObjectWithData:macrosArchive];
+    // later pages of the same changes have the same macros
+    if ([client isContinuation] == NO) {
+        if (macrosArchive)
+            macros = unarchivePublicationOrMacros(macrosArchive, macroResolver);
+        [[self macroResolver] setMacroDefinitions:macros];
+    }
+    if ([client publicationArchives] && [self canDecodeClientChangesInBackground]) {
+        [NSString setMacroResolverForUnarchiving:nil];
+        [self decodeClientChangesInBackground];
+        return;
+    }
+    // anything still decoding in the background is replaced
+    decodeToken++;
+    if ([client publicationArchives]) {
+        pubs = [self publicationsFromClientChanges];
+    } else {
+        BDSKDESTROY(publicationsByIdentifier);
+        BDSKDESTROY(generation);
+        version = -1;
+        if (pubsArchive)
+            pubs = [NSKeyedUnarchiver unarchiveObjectWithData:pubsArchive];
+        // we set the macroResolver so we know the fields of this item may refer to it, so we can prevent scripting from adding this to the wrong document
+        [pubs setValue:macroResolver forKey:@"macroResolver"];
+    }
     [NSString setMacroResolverForUnarchiving:nil];
     
-    // we set the macroResolver so we know the fields of this item may refer to it, so we can prevent scripting from adding this to the wrong document
-    [pubs setValue:macroResolver forKey:@"macroResolver"];
-    
-    [[self macroResolver] setMacroDefinitions:macros];
     [self setPublications:pubs];
 }
 
 @end
+
+#pragma mark -
+
+@implementation BDSKSharedGroupDecodeOperation
+
+- (id)initWithGroup:(BDSKSharedGroup *)aGroup archives:(NSDictionary *)anArchives removedIdentifiers:(NSArray *)identifiers macroResolver:(BDSKMacroResolver *)aMacroResolver token:(NSInteger)aToken replacesAll:(BOOL)flag {
+    self = [super init];
+    if (self) {
+        group = [aGroup retain];
+        archives = [anArchives copy];
+        removedIdentifiers = [identifiers copy];
+        macroResolver = [aMacroResolver retain];
+        token = aToken;
+        replacesAll = flag;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(group);
+    BDSKDESTROY(archives);
+    BDSKDESTROY(removedIdentifiers);
+    BDSKDESTROY(macroResolver);
+    [super dealloc];
+}
+
+- (void)sendChunkWithIdentifiers:(NSArray *)identifiers publications:(NSArray *)pubs isFirst:(BOOL)isFirst isLast:(BOOL)isLast {
+    NSDictionary *info = [[NSDictionary alloc] initWithObjectsAndKeys:
+        [NSNumber numberWithInteger:token], DECODE_TOKEN_KEY,
+        identifiers, IDENTIFIERS_KEY,
+        pubs, PUBLICATIONS_KEY,
+        (isFirst && removedIdentifiers ? removedIdentifiers : [NSArray array]), REMOVED_KEY,
+        [NSNumber numberWithBool:isFirst && replacesAll], REPLACES_ALL_KEY,
+        [NSNumber numberWithBool:isLast], IS_LAST_KEY, nil];
+    [group performSelectorOnMainThread:@selector(applyDecodedChunk:) withObject:info waitUntilDone:NO];
+    [info release];
+}
+
+- (void)main {
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    NSArray *allIdentifiers = [archives allKeys];
+    NSUInteger i = 0, iMax = [allIdentifiers count];
+    NSUInteger chunkSize = FIRST_DECODE_CHUNK_SIZE;
+    BOOL isFirst = YES;
+    
+    // we always send at least one chunk, the last one tells the group we're done
+    do {
+        NSAutoreleasePool *chunkPool = [[NSAutoreleasePool alloc] init];
+        NSUInteger chunkEnd = MIN(iMax, i + chunkSize);
+        NSMutableArray *identifiers = [NSMutableArray arrayWithCapacity:chunkEnd - i];
+        NSMutableArray *pubs = [NSMutableArray arrayWithCapacity:chunkEnd - i];
+        
+        if ([self isCancelled])
+            chunkEnd = iMax;
+        
+        for (; i < chunkEnd && [self isCancelled] == NO; i++) {
+            NSString *identifier = [allIdentifiers objectAtIndex:i];
+            BibItem *pub = nil;
+            @try {
+                pub = [BDSKSharedRecordUnarchiver unarchiveObjectWithData:[archives objectForKey:identifier] macroResolver:macroResolver];
+            }
+            @catch (id exception) {
+                NSLog(@"%@: discarding exception \"%@\" while unarchiving shared publication", [self class], exception);
+            }
+            if (pub) {
+                [identifiers addObject:identifier];
+                [pubs addObject:pub];
+            }
+        }
+        i = chunkEnd;
+        
+        [self sendChunkWithIdentifiers:identifiers publications:pubs isFirst:isFirst isLast:i >= iMax];
+        isFirst = NO;
+        chunkSize = MIN(MAX_DECODE_CHUNK_SIZE, 2 * chunkSize);
+        [chunkPool release];
+    } while (i < iMax);
+    
+    [pool release];
+}
+
+@end
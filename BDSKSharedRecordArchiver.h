@@ -0,0 +1,79 @@
+//
+//  BDSKSharedRecordArchiver.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+@class BDSKMacroResolver;
+
+/*
+ A compact binary archive format for sharing publications. The archive starts with a 4 byte magic "BDSR" and a format version byte, followed by a table of all strings in the archive and a single root value. Strings, keys and class names are referenced by their index in the string table, and integers are written as variable length numbers.
+ 
+ Supported values are strings (including complex strings), data, dates, numbers, URLs, arrays, dictionaries, and NSCoding objects using keyed coding. Only a few known classes are allowed when unarchiving.
+ 
+ Complex strings are recreated with the macro resolver passed to the unarchiver, so unlike NSKeyedUnarchiver this does not need +[NSString setMacroResolverForUnarchiving:] and can be used on any thread.
+*/
+
+@interface BDSKSharedRecordArchiver : NSCoder {
+    NSMutableData *body;
+    CFMutableDictionaryRef stringIndexes;
+    NSMutableArray *strings;
+}
+
++ (NSData *)archivedDataWithRootObject:(id)rootObject;
+
+@end
+
+#pragma mark -
+
+@interface BDSKSharedRecordUnarchiver : NSCoder {
+    NSData *archiveData;
+    const uint8_t *bytes;
+    NSUInteger length;
+    NSUInteger position;
+    NSArray *strings;
+    BDSKMacroResolver *macroResolver;
+    NSMutableArray *valuesStack;
+    NSUInteger depth;
+}
+
++ (BOOL)canUnarchiveData:(NSData *)data;
+
+// raises an NSInvalidUnarchiveOperationException for invalid data, including values that are nested too deeply
++ (id)unarchiveObjectWithData:(NSData *)data macroResolver:(BDSKMacroResolver *)aMacroResolver;
+
+@end
@@ -0,0 +1,512 @@
+//
+//  BDSKSharedRecordArchiver.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKSharedRecordArchiver.h"
+#import "BDSKStringNode.h"
+#import "BDSKMacroResolver.h"
+
+#define FORMAT_VERSION 1
+
+// a publication only needs a few levels
+#define MAX_NESTING_DEPTH 64
+
+enum {
+    BDSKRecordNilTag,
+    BDSKRecordStringTag,
+    BDSKRecordComplexStringTag,
+    BDSKRecordDataTag,
+    BDSKRecordDateTag,
+    BDSKRecordTrueTag,
+    BDSKRecordFalseTag,
+    BDSKRecordIntegerTag,
+    BDSKRecordDoubleTag,
+    BDSKRecordURLTag,
+    BDSKRecordArrayTag,
+    BDSKRecordDictionaryTag,
+    BDSKRecordObjectTag
+};
+
+static const uint8_t recordMagic[4] = {'B', 'D', 'S', 'R'};
+
+// zigzag encoding, so small negative numbers are also short
+static inline uint64_t encodeZigZag(int64_t value) { return (uint64_t)((value << 1) ^ (value >> 63)); }
+static inline int64_t decodeZigZag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+
+@implementation BDSKSharedRecordArchiver
+
++ (NSData *)archivedDataWithRootObject:(id)rootObject {
+    BDSKSharedRecordArchiver *archiver = [[self alloc] init];
+    [archiver encodeRootObject:rootObject];
+    NSData *data = [archiver encodedData];
+    [archiver release];
+    return data;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        body = [[NSMutableData alloc] init];
+        stringIndexes = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+        strings = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(body);
+    BDSKCFDESTROY(stringIndexes);
+    BDSKDESTROY(strings);
+    [super dealloc];
+}
+
+- (BOOL)allowsKeyedCoding { return YES; }
+
+- (void)appendByte:(uint8_t)byte {
+    [body appendBytes:&byte length:1];
+}
+
+static void appendVarInt(NSMutableData *data, uint64_t value) {
+    uint8_t buffer[10];
+    NSUInteger i = 0;
+    while (value >= 0x80) {
+        buffer[i++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[i++] = (uint8_t)value;
+    [data appendBytes:buffer length:i];
+}
+
+- (NSUInteger)indexForString:(NSString *)string {
+    NSUInteger idx;
+    if (CFDictionaryGetValueIfPresent(stringIndexes, string, (const void **)&idx) == FALSE) {
+        // copy, so a mutable string can't change the key
+        string = [string copy];
+        idx = [strings count];
+        [strings addObject:string];
+        CFDictionarySetValue(stringIndexes, string, (const void *)idx);
+        [string release];
+    }
+    return idx;
+}
+
+- (void)appendStringIndex:(NSString *)string {
+    appendVarInt(body, [self indexForString:string]);
+}
+
+- (void)appendValue:(id)value {
+    if (value == nil) {
+        [self appendByte:BDSKRecordNilTag];
+    } else if ([value isKindOfClass:[NSString class]]) {
+        if ([value isComplex]) {
+            NSArray *nodes = [value nodes];
+            [self appendByte:BDSKRecordComplexStringTag];
+            appendVarInt(body, [nodes count]);
+            for (BDSKStringNode *node in nodes) {
+                [self appendByte:(uint8_t)[node type]];
+                [self appendStringIndex:[node value]];
+            }
+        } else {
+            [self appendByte:BDSKRecordStringTag];
+            [self appendStringIndex:value];
+        }
+    } else if ([value isKindOfClass:[NSData class]]) {
+        [self appendByte:BDSKRecordDataTag];
+        appendVarInt(body, [value length]);
+        [body appendData:value];
+    } else if ([value isKindOfClass:[NSDate class]]) {
+        CFSwappedFloat64 swapped = CFConvertDoubleHostToSwapped([value timeIntervalSinceReferenceDate]);
+        [self appendByte:BDSKRecordDateTag];
+        [body appendBytes:&swapped length:sizeof(swapped)];
+    } else if ([value isKindOfClass:[NSNumber class]]) {
+        const char *type = [value objCType];
+        if ((CFBooleanRef)value == kCFBooleanTrue || (CFBooleanRef)value == kCFBooleanFalse) {
+            [self appendByte:[value boolValue] ? BDSKRecordTrueTag : BDSKRecordFalseTag];
+        } else if (strcmp(type, @encode(float)) == 0 || strcmp(type, @encode(double)) == 0) {
+            CFSwappedFloat64 swapped = CFConvertDoubleHostToSwapped([value doubleValue]);
+            [self appendByte:BDSKRecordDoubleTag];
+            [body appendBytes:&swapped length:sizeof(swapped)];
+        } else {
+            [self appendByte:BDSKRecordIntegerTag];
+            appendVarInt(body, encodeZigZag([value longLongValue]));
+        }
+    } else if ([value isKindOfClass:[NSURL class]]) {
+        [self appendByte:BDSKRecordURLTag];
+        [self appendStringIndex:[value absoluteString]];
+    } else if ([value isKindOfClass:[NSArray class]]) {
+        [self appendByte:BDSKRecordArrayTag];
+        appendVarInt(body, [value count]);
+        for (id obj in value)
+            [self appendValue:obj];
+    } else if ([value isKindOfClass:[NSDictionary class]]) {
+        [self appendByte:BDSKRecordDictionaryTag];
+        appendVarInt(body, [value count]);
+        for (id key in value) {
+            [self appendValue:key];
+            [self appendValue:[value objectForKey:key]];
+        }
+    } else if ([value conformsToProtocol:@protocol(NSCoding)]) {
+        [self appendByte:BDSKRecordObjectTag];
+        [self appendStringIndex:NSStringFromClass([value classForKeyedArchiver])];
+        // the keys are written as string index + 1, 0 ends the object
+        [value encodeWithCoder:self];
+        appendVarInt(body, 0);
+    } else {
+        [NSException raise:NSInvalidArchiveOperationException format:@"%@ cannot archive object of class %@", [self class], [value class]];
+    }
+}
+
+- (void)appendKey:(NSString *)key {
+    // write the index shifted by one, as 0 ends an object
+    appendVarInt(body, [self indexForString:key] + 1);
+}
+
+- (void)encodeRootObject:(id)rootObject {
+    [self appendValue:rootObject];
+}
+
+- (NSData *)encodedData {
+    NSMutableData *data = [NSMutableData dataWithCapacity:[body length] + 16 * [strings count]];
+    uint8_t version = FORMAT_VERSION;
+    [data appendBytes:recordMagic length:4];
+    [data appendBytes:&version length:1];
+    appendVarInt(data, [strings count]);
+    for (NSString *string in strings) {
+        NSData *stringData = [string dataUsingEncoding:NSUTF8StringEncoding];
+        appendVarInt(data, [stringData length]);
+        [data appendData:stringData];
+    }
+    [data appendData:body];
+    return data;
+}
+
+#pragma mark NSCoder
+
+- (void)encodeObject:(id)object forKey:(NSString *)key {
+    [self appendKey:key];
+    [self appendValue:object];
+}
+
+- (void)encodeConditionalObject:(id)object forKey:(NSString *)key {
+    [self encodeObject:object forKey:key];
+}
+
+- (void)encodeBool:(BOOL)boolv forKey:(NSString *)key {
+    [self appendKey:key];
+    [self appendByte:boolv ? BDSKRecordTrueTag : BDSKRecordFalseTag];
+}
+
+- (void)encodeInt64:(int64_t)intv forKey:(NSString *)key {
+    [self appendKey:key];
+    [self appendByte:BDSKRecordIntegerTag];
+    appendVarInt(body, encodeZigZag(intv));
+}
+
+- (void)encodeInt:(int)intv forKey:(NSString *)key { [self encodeInt64:intv forKey:key]; }
+
+- (void)encodeInt32:(int32_t)intv forKey:(NSString *)key { [self encodeInt64:intv forKey:key]; }
+
+- (void)encodeInteger:(NSInteger)intv forKey:(NSString *)key { [self encodeInt64:intv forKey:key]; }
+
+- (void)encodeDouble:(double)realv forKey:(NSString *)key {
+    CFSwappedFloat64 swapped = CFConvertDoubleHostToSwapped(realv);
+    [self appendKey:key];
+    [self appendByte:BDSKRecordDoubleTag];
+    [body appendBytes:&swapped length:sizeof(swapped)];
+}
+
+- (void)encodeFloat:(float)realv forKey:(NSString *)key { [self encodeDouble:realv forKey:key]; }
+
+@end
+
+#pragma mark -
+
+@implementation BDSKSharedRecordUnarchiver
+
+static NSSet *allowedClassNames = nil;
+
++ (void)initialize {
+    BDSKINITIALIZE;
+    allowedClassNames = [[NSSet alloc] initWithObjects:@"BibItem", @"BDSKLinkedAliasFile", @"BDSKLinkedURL", nil];
+}
+
++ (BOOL)canUnarchiveData:(NSData *)data {
+    return [data length] > 4 && memcmp([data bytes], recordMagic, 4) == 0;
+}
+
++ (id)unarchiveObjectWithData:(NSData *)data macroResolver:(BDSKMacroResolver *)aMacroResolver {
+    BDSKSharedRecordUnarchiver *unarchiver = [[self alloc] initForReadingWithData:data macroResolver:aMacroResolver];
+    id object = nil;
+    @try {
+        object = [[unarchiver decodeRootObject] retain];
+    }
+    @finally {
+        [unarchiver release];
+    }
+    return [object autorelease];
+}
+
+- (id)initForReadingWithData:(NSData *)data macroResolver:(BDSKMacroResolver *)aMacroResolver {
+    self = [super init];
+    if (self) {
+        archiveData = [data retain];
+        bytes = (const uint8_t *)[data bytes];
+        length = [data length];
+        position = 0;
+        strings = nil;
+        macroResolver = [aMacroResolver retain];
+        valuesStack = [[NSMutableArray alloc] init];
+        depth = 0;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(archiveData);
+    BDSKDESTROY(strings);
+    BDSKDESTROY(macroResolver);
+    BDSKDESTROY(valuesStack);
+    [super dealloc];
+}
+
+- (BOOL)allowsKeyedCoding { return YES; }
+
+static inline void checkLength(BDSKSharedRecordUnarchiver *unarchiver, NSUInteger position, NSUInteger length, NSUInteger needed) {
+    if (needed > length || position > length - needed)
+        [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: unexpected end of data", [unarchiver class]];
+}
+
+- (uint8_t)readByte {
+    checkLength(self, position, length, 1);
+    return bytes[position++];
+}
+
+- (uint64_t)readVarInt {
+    uint64_t value = 0;
+    NSUInteger shift = 0;
+    uint8_t byte;
+    do {
+        if (shift > 63)
+            [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: invalid number", [self class]];
+        byte = [self readByte];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+- (double)readDouble {
+    CFSwappedFloat64 swapped;
+    checkLength(self, position, length, sizeof(swapped));
+    memcpy(&swapped, bytes + position, sizeof(swapped));
+    position += sizeof(swapped);
+    return CFConvertDoubleSwappedToHost(swapped);
+}
+
+- (NSString *)readString {
+    uint64_t idx = [self readVarInt];
+    if (idx >= [strings count])
+        [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: invalid string index", [self class]];
+    return [strings objectAtIndex:(NSUInteger)idx];
+}
+
+- (void)readHeader {
+    checkLength(self, position, length, 5);
+    if (memcmp(bytes, recordMagic, 4) != 0 || bytes[4] > FORMAT_VERSION)
+        [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: unsupported data", [self class]];
+    position = 5;
+    uint64_t i, count = [self readVarInt];
+    NSMutableArray *array = [[NSMutableArray alloc] initWithCapacity:(NSUInteger)MIN(count, (uint64_t)length)];
+    for (i = 0; i < count; i++) {
+        uint64_t len = [self readVarInt];
+        checkLength(self, position, length, (NSUInteger)len);
+        NSString *string = [[NSString alloc] initWithBytes:bytes + position length:(NSUInteger)len encoding:NSUTF8StringEncoding];
+        position += (NSUInteger)len;
+        [array addObject:string ?: @""];
+        [string release];
+    }
+    strings = array;
+}
+
+// returns a retained object
+// the data comes from the network, so we limit the nesting to avoid running out of stack; the unarchiver is not used after an exception, so we don't need to restore the depth
+- (id)copyValue {
+    if (++depth > MAX_NESTING_DEPTH)
+        [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: values nested too deeply", [self class]];
+    
+    uint8_t tag = [self readByte];
+    id value = nil;
+    uint64_t i, count;
+    
+    switch (tag) {
+        case BDSKRecordNilTag:
+            break;
+        case BDSKRecordStringTag:
+            value = [[self readString] retain];
+            break;
+        case BDSKRecordComplexStringTag:
+        {
+            count = [self readVarInt];
+            NSMutableArray *nodes = [[NSMutableArray alloc] init];
+            for (i = 0; i < count; i++) {
+                BDSKStringNodeType type = [self readByte];
+                if (type > BDSKStringNodeMacro)
+                    [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: invalid string node", [self class]];
+                BDSKStringNode *node = [[BDSKStringNode alloc] initWithType:type value:[self readString]];
+                [nodes addObject:node];
+                [node release];
+            }
+            value = [[NSString alloc] initWithNodes:nodes macroResolver:macroResolver];
+            [nodes release];
+            break;
+        }
+        case BDSKRecordDataTag:
+            count = [self readVarInt];
+            checkLength(self, position, length, (NSUInteger)count);
+            value = [[NSData alloc] initWithBytes:bytes + position length:(NSUInteger)count];
+            position += (NSUInteger)count;
+            break;
+        case BDSKRecordDateTag:
+            value = [[NSDate alloc] initWithTimeIntervalSinceReferenceDate:[self readDouble]];
+            break;
+        case BDSKRecordTrueTag:
+        case BDSKRecordFalseTag:
+            value = [[NSNumber alloc] initWithBool:tag == BDSKRecordTrueTag];
+            break;
+        case BDSKRecordIntegerTag:
+            value = [[NSNumber alloc] initWithLongLong:decodeZigZag([self readVarInt])];
+            break;
+        case BDSKRecordDoubleTag:
+            value = [[NSNumber alloc] initWithDouble:[self readDouble]];
+            break;
+        case BDSKRecordURLTag:
+            value = [[NSURL alloc] initWithString:[self readString]];
+            break;
+        case BDSKRecordArrayTag:
+        {
+            count = [self readVarInt];
+            NSMutableArray *array = [[NSMutableArray alloc] initWithCapacity:(NSUInteger)MIN(count, (uint64_t)length)];
+            for (i = 0; i < count; i++) {
+                id obj = [self copyValue];
+                if (obj) [array addObject:obj];
+                [obj release];
+            }
+            value = array;
+            break;
+        }
+        case BDSKRecordDictionaryTag:
+        {
+            count = [self readVarInt];
+            NSMutableDictionary *dict = [[NSMutableDictionary alloc] initWithCapacity:(NSUInteger)MIN(count, (uint64_t)length)];
+            for (i = 0; i < count; i++) {
+                id key = [self copyValue];
+                id obj = [self copyValue];
+                if (key && obj) [dict setObject:obj forKey:key];
+                [key release];
+                [obj release];
+            }
+            value = dict;
+            break;
+        }
+        case BDSKRecordObjectTag:
+        {
+            NSString *className = [self readString];
+            Class objectClass = [allowedClassNames containsObject:className] ? NSClassFromString(className) : Nil;
+            if (objectClass == Nil)
+                [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: cannot unarchive object of class %@", [self class], className];
+            NSMutableDictionary *values = [[NSMutableDictionary alloc] init];
+            while ((i = [self readVarInt])) {
+                if (i > [strings count])
+                    [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: invalid key index", [self class]];
+                id obj = [self copyValue];
+                if (obj) [values setObject:obj forKey:[strings objectAtIndex:(NSUInteger)i - 1]];
+                [obj release];
+            }
+            [valuesStack addObject:values];
+            [values release];
+            @try {
+                value = [[objectClass alloc] initWithCoder:self];
+            }
+            @finally {
+                [valuesStack removeLastObject];
+            }
+            break;
+        }
+        default:
+            [NSException raise:NSInvalidUnarchiveOperationException format:@"%@: invalid tag %d", [self class], tag];
+    }
+    depth--;
+    return value;
+}
+
+- (id)decodeRootObject {
+    if (strings == nil)
+        [self readHeader];
+    return [[self copyValue] autorelease];
+}
+
+#pragma mark NSCoder
+
+- (BOOL)containsValueForKey:(NSString *)key {
+    return [[valuesStack lastObject] objectForKey:key] != nil;
+}
+
+- (id)decodeObjectForKey:(NSString *)key {
+    return [[valuesStack lastObject] objectForKey:key];
+}
+
+- (BOOL)decodeBoolForKey:(NSString *)key {
+    return [[[valuesStack lastObject] objectForKey:key] boolValue];
+}
+
+- (int64_t)decodeInt64ForKey:(NSString *)key {
+    return [[[valuesStack lastObject] objectForKey:key] longLongValue];
+}
+
+- (int)decodeIntForKey:(NSString *)key { return (int)[self decodeInt64ForKey:key]; }
+
+- (int32_t)decodeInt32ForKey:(NSString *)key { return (int32_t)[self decodeInt64ForKey:key]; }
+
+- (NSInteger)decodeIntegerForKey:(NSString *)key { return (NSInteger)[self decodeInt64ForKey:key]; }
+
+- (double)decodeDoubleForKey:(NSString *)key {
+    return [[[valuesStack lastObject] objectForKey:key] doubleValue];
+}
+
+- (float)decodeFloatForKey:(NSString *)key { return (float)[self decodeDoubleForKey:key]; }
+
+@end
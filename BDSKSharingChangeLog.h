@@ -0,0 +1,60 @@
+//
+//  BDSKSharingChangeLog.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+// keeps track of the version at which each shared item was last changed, only used on the server thread
+@interface BDSKSharingChangeLog : NSObject {
+    NSString *generation;
+    NSInteger currentVersion;
+    NSInteger oldestVersion;
+    NSMutableDictionary *itemSignatures;
+    NSMutableDictionary *itemVersions;
+    NSMutableDictionary *removedVersions;
+    NSDictionary *currentData;
+    NSDictionary *currentMacros;
+    int32_t dataGeneration;
+    NSArray *changedIdentifiers;
+    NSInteger changedIdentifiersVersion;
+}
+- (BOOL)isUpToDateForDataGeneration:(int32_t)aDataGeneration;
+- (void)updateWithPublications:(NSDictionary *)publications macros:(NSDictionary *)macros dataGeneration:(int32_t)aDataGeneration;
+// only the items in publications are archived, items not in identifiers are removed
+- (void)updateWithChangedPublications:(NSDictionary *)publications identifiers:(NSSet *)identifiers macros:(NSDictionary *)macros dataGeneration:(int32_t)aDataGeneration;
+- (NSDictionary *)changesSinceVersion:(NSInteger)version generation:(NSString *)aGeneration range:(NSRange)range;
+@end
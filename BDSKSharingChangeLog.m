@@ -0,0 +1,198 @@
+//
+//  BDSKSharingChangeLog.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKSharingChangeLog.h"
+#import "BDSKSharingServer.h"
+#import "BDSKSharedRecordArchiver.h"
+#import "NSData_BDSKExtensions.h"
+#import "CFString_BDSKExtensions.h"
+
+// maximum number of removed items we remember, older clients get a full update
+#define MAX_REMOVED_COUNT 1000
+
+
+@implementation BDSKSharingChangeLog
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        // a new generation for every run of the server, so clients can't mix up versions from an earlier run
+        generation = (NSString *)BDCreateUniqueString();
+        currentVersion = 0;
+        oldestVersion = 0;
+        itemSignatures = [[NSMutableDictionary alloc] init];
+        itemVersions = [[NSMutableDictionary alloc] init];
+        removedVersions = [[NSMutableDictionary alloc] init];
+        currentData = nil;
+        currentMacros = nil;
+        dataGeneration = 0;
+        changedIdentifiers = nil;
+        changedIdentifiersVersion = -1;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(generation);
+    BDSKDESTROY(itemSignatures);
+    BDSKDESTROY(itemVersions);
+    BDSKDESTROY(removedVersions);
+    BDSKDESTROY(currentData);
+    BDSKDESTROY(currentMacros);
+    BDSKDESTROY(changedIdentifiers);
+    [super dealloc];
+}
+
+- (BOOL)isUpToDateForDataGeneration:(int32_t)aDataGeneration {
+    return currentData != nil && dataGeneration == aDataGeneration;
+}
+
+- (void)updateWithPublications:(NSDictionary *)publications macros:(NSDictionary *)macros dataGeneration:(int32_t)aDataGeneration {
+    [self updateWithChangedPublications:publications identifiers:[NSSet setWithArray:[publications allKeys]] macros:macros dataGeneration:aDataGeneration];
+}
+
+- (void)updateWithChangedPublications:(NSDictionary *)publications identifiers:(NSSet *)identifiers macros:(NSDictionary *)macros dataGeneration:(int32_t)aDataGeneration {
+    // archive the items separately, so we can find out which ones changed and send only those
+    // we use the record format for this, because it is much faster than keyed archiving
+    NSMutableDictionary *newData = [[NSMutableDictionary alloc] initWithDictionary:currentData];
+    NSMutableArray *newChangedIdentifiers = [[NSMutableArray alloc] init];
+    
+    for (NSString *identifier in publications) {
+        NSData *data = [BDSKSharedRecordArchiver archivedDataWithRootObject:[publications objectForKey:identifier]];
+        NSData *signature = [data sha1Signature];
+        if ([signature isEqual:[itemSignatures objectForKey:identifier]] == NO) {
+            [itemSignatures setObject:signature forKey:identifier];
+            [newChangedIdentifiers addObject:identifier];
+        }
+        [newData setObject:data forKey:identifier];
+    }
+    
+    for (NSString *identifier in [itemSignatures allKeys]) {
+        if ([identifiers containsObject:identifier] == NO) {
+            [itemSignatures removeObjectForKey:identifier];
+            [itemVersions removeObjectForKey:identifier];
+            [newData removeObjectForKey:identifier];
+            [newChangedIdentifiers addObject:identifier];
+        }
+    }
+    
+    if ([newChangedIdentifiers count]) {
+        NSNumber *versionNumber = [NSNumber numberWithInteger:++currentVersion];
+        for (NSString *identifier in newChangedIdentifiers) {
+            if ([newData objectForKey:identifier]) {
+                [itemVersions setObject:versionNumber forKey:identifier];
+                [removedVersions removeObjectForKey:identifier];
+            } else {
+                [removedVersions setObject:versionNumber forKey:identifier];
+            }
+        }
+        if ([removedVersions count] > MAX_REMOVED_COUNT) {
+            // forget the removed items, clients older than this version will need a full update
+            [removedVersions removeAllObjects];
+            oldestVersion = currentVersion;
+        }
+    }
+    
+    [currentData release];
+    currentData = newData;
+    [currentMacros release];
+    currentMacros = [macros copy];
+    dataGeneration = aDataGeneration;
+    // the cached identifiers are invalid, even for a full update, as the items may have been removed
+    BDSKDESTROY(changedIdentifiers);
+    changedIdentifiersVersion = -1;
+    
+    [newChangedIdentifiers release];
+}
+
+// the identifiers changed since version in a fixed order, so clients can ask for them in pages; the last one is cached, as clients ask for all pages with the same version
+- (NSArray *)changedIdentifiersSinceVersion:(NSInteger)version isFullUpdate:(BOOL)isFullUpdate {
+    if (isFullUpdate)
+        version = -1;
+    if (changedIdentifiers == nil || changedIdentifiersVersion != version) {
+        NSMutableArray *identifiers = [NSMutableArray array];
+        for (NSString *identifier in currentData) {
+            if (version < 0 || [[itemVersions objectForKey:identifier] integerValue] > version)
+                [identifiers addObject:identifier];
+        }
+        [identifiers sortUsingSelector:@selector(compare:)];
+        [changedIdentifiers release];
+        changedIdentifiers = [identifiers copy];
+        changedIdentifiersVersion = version;
+    }
+    return changedIdentifiers;
+}
+
+- (NSDictionary *)changesSinceVersion:(NSInteger)version generation:(NSString *)aGeneration range:(NSRange)range {
+    BOOL isFullUpdate = [generation isEqualToString:aGeneration] == NO || version < oldestVersion || version > currentVersion;
+    NSMutableDictionary *changedData = [NSMutableDictionary dictionary];
+    NSMutableArray *removedIdentifiers = [NSMutableArray array];
+    NSArray *identifiers = [self changedIdentifiersSinceVersion:version isFullUpdate:isFullUpdate];
+    NSUInteger i, iMax = [identifiers count];
+    
+    if (range.location < iMax)
+        iMax = range.location + MIN(range.length, iMax - range.location);
+    else
+        range.location = iMax;
+    
+    for (i = range.location; i < iMax; i++) {
+        NSString *identifier = [identifiers objectAtIndex:i];
+        [changedData setObject:[currentData objectForKey:identifier] forKey:identifier];
+    }
+    if (isFullUpdate == NO && range.location == 0) {
+        for (NSString *identifier in removedVersions) {
+            if ([[removedVersions objectForKey:identifier] integerValue] > version)
+                [removedIdentifiers addObject:identifier];
+        }
+    }
+    
+    NSMutableDictionary *changes = [NSMutableDictionary dictionary];
+    [changes setObject:generation forKey:BDSKSharedGenerationKey];
+    [changes setObject:[NSNumber numberWithInteger:currentVersion] forKey:BDSKSharedVersionKey];
+    [changes setObject:[NSNumber numberWithBool:isFullUpdate] forKey:BDSKSharedIsFullUpdateKey];
+    [changes setObject:changedData forKey:BDSKSharedChangedDataKey];
+    [changes setObject:removedIdentifiers forKey:BDSKSharedRemovedIdentifiersKey];
+    [changes setObject:[NSNumber numberWithUnsignedInteger:range.location] forKey:BDSKSharedStartIndexKey];
+    [changes setObject:[NSNumber numberWithUnsignedInteger:[identifiers count]] forKey:BDSKSharedTotalCountKey];
+    NSData *macroData = [BDSKSharedRecordArchiver archivedDataWithRootObject:currentMacros];
+    if ([macroData length])
+        [changes setObject:macroData forKey:BDSKSharedArchivedMacroDataKey];
+    return changes;
+}
+
+@end
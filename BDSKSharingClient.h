@@ -43,6 +43,13 @@
 @interface BDSKSharingClient : NSObject {
     NSData *archivedPublications;
     NSData *archivedMacros;
+    NSMutableDictionary *publicationArchives;
+    NSDictionary *changedPublicationArchives;
+    NSArray *removedPublicationIdentifiers;
+    NSString *generation;
+    NSInteger version;
+    NSInteger previousVersion;
+    BOOL isContinuation;
     BOOL needsUpdate;
     NSString *name;
     BDSKSharingClientServer *server;
@@ -53,6 +60,19 @@
 - (NSData *)archivedPublications;
 - (NSData *)archivedMacros;
 
+// for servers that support sending changes, archivedPublications is nil and these are used instead
+// all archived publications keyed by their identifier on the server
+- (NSDictionary *)publicationArchives;
+// the publications added or changed and the identifiers removed by the last update
+- (NSDictionary *)changedPublicationArchives;
+- (NSArray *)removedPublicationIdentifiers;
+- (NSString *)generation;
+- (NSInteger)version;
+// the version the last update was based on, or -1 when it was a full update
+- (NSInteger)previousVersion;
+// whether the last update only added the next page of the changes of the update before it
+- (BOOL)isContinuation;
+
 - (BOOL)needsUpdate;
 - (void)setNeedsUpdate:(BOOL)flag;
 
@@ -49,9 +49,13 @@ typedef struct _BDSKSharingClientFlags {
     volatile int32_t canceledAuthentication;
     volatile int32_t needsAuthentication;
     volatile int32_t failedDownload;
+    volatile int32_t serverProtocolVersion;
 } BDSKSharingClientFlags;    
 
 // private protocols for inter-thread messaging
+// the number of publications we ask for at once from servers that send their changes in pages
+#define SHARING_PAGE_SIZE 1000
+
 @protocol BDSKSharingClientServerLocalThread <BDSKAsyncDOServerThread>
 
 - (oneway void)retrievePublications;
@@ -77,6 +81,8 @@ typedef struct _BDSKSharingClientFlags {
     BDSKSharingClientFlags flags;   // state variables
     NSString *uniqueIdentifier;     // used by the remote server
     NSString *errorMessage;
+    NSString *lastGeneration;       // generation and version of the last changes we received, only used on the server thread
+    NSInteger lastVersion;
 }
 
 + (NSString *)supportedProtocolVersion;
@@ -109,6 +115,13 @@ typedef struct _BDSKSharingClientFlags {
         name = [[aService name] copy];
         archivedPublications = nil;
         archivedMacros = nil;
+        publicationArchives = nil;
+        changedPublicationArchives = nil;
+        removedPublicationIdentifiers = nil;
+        generation = nil;
+        version = -1;
+        previousVersion = -1;
+        isContinuation = NO;
         needsUpdate = YES;
         server = [[BDSKSharingClientServer alloc] initWithClient:self andService:aService];
     }
@@ -119,6 +132,10 @@ typedef struct _BDSKSharingClientFlags {
     [self terminate];
     BDSKDESTROY(archivedPublications);
     BDSKDESTROY(archivedMacros);
+    BDSKDESTROY(publicationArchives);
+    BDSKDESTROY(changedPublicationArchives);
+    BDSKDESTROY(removedPublicationIdentifiers);
+    BDSKDESTROY(generation);
     BDSKDESTROY(name);
     [super dealloc];
 }
@@ -140,9 +157,56 @@ typedef struct _BDSKSharingClientFlags {
     return archivedPublications;
 }
 
+// returns NO when the server has more pages of changes to send
+- (BOOL)applyChanges:(NSDictionary *)dictionary {
+    NSString *newGeneration = [dictionary objectForKey:BDSKSharedGenerationKey];
+    NSDictionary *changedData = [dictionary objectForKey:BDSKSharedChangedDataKey];
+    NSArray *removedIdentifiers = [dictionary objectForKey:BDSKSharedRemovedIdentifiersKey];
+    NSNumber *startIndex = [dictionary objectForKey:BDSKSharedStartIndexKey];
+    NSNumber *totalCount = [dictionary objectForKey:BDSKSharedTotalCountKey];
+    
+    isContinuation = NO;
+    if ([startIndex unsignedIntegerValue] > 0 && publicationArchives && [generation isEqualToString:newGeneration]) {
+        // the next page of the same changes, these can only add publications
+        [publicationArchives addEntriesFromDictionary:changedData];
+        previousVersion = version;
+        isContinuation = YES;
+    } else if ([[dictionary objectForKey:BDSKSharedIsFullUpdateKey] boolValue] || publicationArchives == nil || [generation isEqualToString:newGeneration] == NO) {
+        [publicationArchives release];
+        publicationArchives = [changedData mutableCopy];
+        previousVersion = -1;
+    } else {
+        [publicationArchives removeObjectsForKeys:removedIdentifiers];
+        [publicationArchives addEntriesFromDictionary:changedData];
+        previousVersion = version;
+    }
+    
+    [changedPublicationArchives release];
+    changedPublicationArchives = [changedData copy];
+    [removedPublicationIdentifiers release];
+    removedPublicationIdentifiers = [removedIdentifiers copy];
+    [generation release];
+    generation = [newGeneration copy];
+    version = [[dictionary objectForKey:BDSKSharedVersionKey] integerValue];
+    
+    return totalCount == nil || [changedData count] == 0 || [startIndex unsignedIntegerValue] + [changedData count] >= [totalCount unsignedIntegerValue];
+}
+
 - (void)setArchivedPublicationsAndMacros:(NSDictionary *)dictionary {
     NSData *newArchivedPublications = [dictionary objectForKey:BDSKSharedArchivedDataKey];
     NSData *newArchivedMacros = [dictionary objectForKey:BDSKSharedArchivedMacroDataKey];
+    BOOL isComplete = YES;
+    
+    if ([dictionary objectForKey:BDSKSharedGenerationKey]) {
+        isComplete = [self applyChanges:dictionary];
+    } else {
+        BDSKDESTROY(publicationArchives);
+        BDSKDESTROY(changedPublicationArchives);
+        BDSKDESTROY(removedPublicationIdentifiers);
+        BDSKDESTROY(generation);
+        version = previousVersion = -1;
+        isContinuation = NO;
+    }
     
     if (archivedPublications != newArchivedPublications) {
         [archivedPublications release];
@@ -153,10 +217,13 @@ typedef struct _BDSKSharingClientFlags {
         archivedMacros = [newArchivedMacros retain];
     }
     
-    [self setNeedsUpdate:NO];
-    
-    // we need to do this after setting the archivedPublications but before sending the notification
-    [server setRetrieving:NO];
+    // we keep retrieving until we got the last page of the changes
+    if (isComplete) {
+        [self setNeedsUpdate:NO];
+        
+        // we need to do this after setting the archivedPublications but before sending the notification
+        [server setRetrieving:NO];
+    }
     
     [[NSNotificationCenter defaultCenter] postNotificationName:BDSKSharingClientUpdatedNotification object:self];
 }
@@ -165,6 +232,34 @@ typedef struct _BDSKSharingClientFlags {
     return archivedMacros;
 }
 
+- (NSDictionary *)publicationArchives {
+    return publicationArchives;
+}
+
+- (NSDictionary *)changedPublicationArchives {
+    return changedPublicationArchives;
+}
+
+- (NSArray *)removedPublicationIdentifiers {
+    return removedPublicationIdentifiers;
+}
+
+- (NSString *)generation {
+    return generation;
+}
+
+- (NSInteger)version {
+    return version;
+}
+
+- (NSInteger)previousVersion {
+    return previousVersion;
+}
+
+- (BOOL)isContinuation {
+    return isContinuation;
+}
+
 - (BOOL)needsUpdate {
     return needsUpdate;
 }
@@ -200,7 +295,8 @@ typedef struct _BDSKSharingClientFlags {
 @implementation BDSKSharingClientServer
 
 // If we introduce incompatible changes in future, bump this to avoid sharing breakage
-+ (NSString *)supportedProtocolVersion { return @"0"; }
+// version 1 asks for the changes in pages in the BDSKSharedRecordArchiver format
++ (NSString *)supportedProtocolVersion { return @"1"; }
 
 + (NSString *)keychainServiceNameWithComputerName:(NSString *)computerName {
     return [NSString stringWithFormat:@"%@ - %@", computerName, BDSKServiceNameForKeychain];
@@ -231,6 +327,9 @@ typedef struct _BDSKSharingClientFlags {
         
         errorMessage = nil;
         
+        lastGeneration = nil;
+        lastVersion = -1;
+        
         [self startDOServerAsync];
     }
     return self;
@@ -242,6 +341,7 @@ typedef struct _BDSKSharingClientFlags {
     BDSKDESTROY(service);
     BDSKDESTROY(uniqueIdentifier);
     BDSKDESTROY(errorMessage);
+    BDSKDESTROY(lastGeneration);
     [super dealloc];
 }
 
@@ -426,6 +526,10 @@ typedef struct _BDSKSharingClientFlags {
         OSMemoryBarrier();
         int32_t oldVal = flags.needsAuthentication;
         OSAtomicCompareAndSwap32Barrier(oldVal, val, &flags.needsAuthentication);
+        // servers with protocol version 1 or later can send only the changes, in pages
+        val = [[[[NSString alloc] initWithData:[dict objectForKey:BDSKTXTVersionKey] encoding:NSUTF8StringEncoding] autorelease] integerValue];
+        oldVal = flags.serverProtocolVersion;
+        OSAtomicCompareAndSwap32Barrier(oldVal, val, &flags.serverProtocolVersion);
     }
 }
 
@@ -441,6 +545,64 @@ typedef struct _BDSKSharingClientFlags {
 
 - (void)retrievePublicationsInBackground{ [[self serverOnServerThread] retrievePublications]; }
 
+- (NSDictionary *)propertyListFromData:(NSData *)proxyData {
+    NSDictionary *archive = nil;
+    if([proxyData length] != 0){
+        if([proxyData mightBeCompressed])
+            proxyData = [proxyData decompressedData];
+        NSString *errorString = nil;
+        archive = [NSPropertyListSerialization propertyListFromData:proxyData mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:&errorString];
+        if(errorString != nil){
+            NSString *errorStr = [NSString stringWithFormat:@"Error reading shared data: %@", errorString];
+            [errorString release];
+            @throw errorStr;
+        }
+    }
+    return archive;
+}
+
+// gets the changes in pages and passes each page to the client, so it can show the first publications while the rest is still loading
+- (void)retrievePagesOfChanges {
+    NSString *pageGeneration = nil;
+    NSInteger pageVersion = -1;
+    NSUInteger startIndex = 0;
+    BOOL isLast = NO;
+    
+    @try {
+        while (isLast == NO && [self shouldKeepRunning]) {
+            NSAutoreleasePool *pool = [NSAutoreleasePool new];
+            NSDictionary *archive = [self propertyListFromData:[[self remoteServer] recordChangesOfPublicationsSinceVersion:lastVersion generation:lastGeneration startIndex:startIndex count:SHARING_PAGE_SIZE]];
+            NSString *newGeneration = [archive objectForKey:BDSKSharedGenerationKey];
+            NSInteger newVersion = [[archive objectForKey:BDSKSharedVersionKey] integerValue];
+            NSUInteger changedCount = [[archive objectForKey:BDSKSharedChangedDataKey] count];
+            
+            if (startIndex > 0 && (newVersion != pageVersion || [newGeneration isEqualToString:pageGeneration] == NO)) {
+                // the shared data changed while we were loading, start again; the first page of the new changes includes everything that changed since the last complete update
+                startIndex = 0;
+            } else {
+                if (startIndex == 0) {
+                    [pageGeneration release];
+                    pageGeneration = [newGeneration copy];
+                    pageVersion = newVersion;
+                }
+                startIndex += changedCount;
+                isLast = newGeneration == nil || changedCount == 0 || startIndex >= [[archive objectForKey:BDSKSharedTotalCountKey] unsignedIntegerValue];
+                if (isLast) {
+                    // remember where we are, so next time we only get the changes after this
+                    [lastGeneration release];
+                    lastGeneration = [newGeneration copy];
+                    lastVersion = lastGeneration ? newVersion : -1;
+                }
+                [[self serverOnMainThread] setArchivedPublicationsAndMacros:archive];
+            }
+            [pool release];
+        }
+    }
+    @finally {
+        [pageGeneration release];
+    }
+}
+
 - (oneway void)retrievePublications;
 {
     // set so we don't try calling this multiple times
@@ -450,28 +612,23 @@ typedef struct _BDSKSharingClientFlags {
     NSAutoreleasePool *pool = [NSAutoreleasePool new];
     
     @try {
-        NSDictionary *archive = nil;
-        NSData *proxyData = [[self remoteServer] archivedSnapshotOfPublications];
-        
-        if([proxyData length] != 0){
-            if([proxyData mightBeCompressed])
-                proxyData = [proxyData decompressedData];
-            NSString *errorString = nil;
-            archive = [NSPropertyListSerialization propertyListFromData:proxyData mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:&errorString];
-            if(errorString != nil){
-                NSString *errorStr = [NSString stringWithFormat:@"Error reading shared data: %@", errorString];
-                [errorString release];
-                @throw errorStr;
-            }
+        OSMemoryBarrier();
+        if (flags.serverProtocolVersion >= 1) {
+            [self retrievePagesOfChanges];
+        } else {
+            NSDictionary *archive = [self propertyListFromData:[[self remoteServer] archivedSnapshotOfPublications]];
+            // use the main thread; this avoids an extra (un)archiving between threads and it ends up posting notifications for UI updates
+            [[self serverOnMainThread] setArchivedPublicationsAndMacros:archive];
         }
-        // use the main thread; this avoids an extra (un)archiving between threads and it ends up posting notifications for UI updates
-        [[self serverOnMainThread] setArchivedPublicationsAndMacros:archive];
         // the client will reset the isRetriving flag when the data is set
     }
     @catch(id exception){
         NSLog(@"%@: discarding exception \"%@\" while retrieving publications", [self class], exception);
         OSAtomicCompareAndSwap32Barrier(0, 1, &flags.failedDownload);
         [self setErrorMessage:NSLocalizedString(@"Failed to retrieve publications", @"")];
+        // the client forgets its publications, so we need a full update next time
+        BDSKDESTROY(lastGeneration);
+        lastVersion = -1;
         
         // this posts a notification that the publications of the client changed, forcing a redisplay of the table cell
         [client performSelectorOnMainThread:@selector(setArchivedPublicationsAndMacros:) withObject:nil waitUntilDone:NO];
@@ -44,6 +44,15 @@ extern NSString *BDSKTXTVersionKey;
 extern NSString *BDSKSharedArchivedDataKey;
 extern NSString *BDSKSharedArchivedMacroDataKey;
 
+// keys for the changes returned by recordChangesOfPublicationsSinceVersion:generation:startIndex:count:, protocol version 1 and later
+extern NSString *BDSKSharedGenerationKey;
+extern NSString *BDSKSharedVersionKey;
+extern NSString *BDSKSharedIsFullUpdateKey;
+extern NSString *BDSKSharedChangedDataKey;
+extern NSString *BDSKSharedRemovedIdentifiersKey;
+extern NSString *BDSKSharedStartIndexKey;
+extern NSString *BDSKSharedTotalCountKey;
+
 extern NSString *BDSKComputerNameChangedNotification;
 
 extern NSString *BDSKServiceNameForKeychain;
@@ -61,6 +70,10 @@ extern NSString *BDSKServiceNameForKeychain;
 @protocol BDSKSharingServer
 
 - (bycopy NSData *)archivedSnapshotOfPublications;
+// returns the publications added, changed or removed after version, keyed by identifier and archived using BDSKSharedRecordArchiver; returns all publications when the changes since version are not known, e.g. when generation is not the current generation of the server
+// returns only count of the changed publications starting at startIndex, so clients can show the first publications while loading the rest; the removed identifiers are only included for startIndex 0
+// protocol version 1 and later
+- (bycopy NSData *)recordChangesOfPublicationsSinceVersion:(NSInteger)version generation:(bycopy NSString *)generation startIndex:(NSUInteger)startIndex count:(NSUInteger)count;
 - (oneway void)registerClient:(byref id)clientObject forIdentifier:(bycopy NSString *)identifier version:(bycopy NSString *)version;
 - (oneway void)removeClientForIdentifier:(bycopy NSString *)identifier;
 
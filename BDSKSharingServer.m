@@ -50,6 +50,9 @@
 #import "BDSKReadWriteLock.h"
 #import "BDSKPublicationsArray.h"
 #import "BDSKMacroResolver.h"
+#import "CFString_BDSKExtensions.h"
+#import "BDSKSharedRecordArchiver.h"
+#import "BDSKSharingChangeLog.h"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -62,6 +65,9 @@
 
 static id sharedInstance = nil;
 
+// bumped on the main thread whenever shared publications or macros may have changed
+static volatile int32_t sharedDataGeneration = 0;
+
 // TXT record keys
 NSString *BDSKTXTAuthenticateKey = @"authenticate";
 NSString *BDSKTXTVersionKey = @"txtvers";
@@ -69,6 +75,14 @@ NSString *BDSKTXTVersionKey = @"txtvers";
 NSString *BDSKSharedArchivedDataKey = @"publications_v1";
 NSString *BDSKSharedArchivedMacroDataKey = @"macros_v1";
 
+NSString *BDSKSharedGenerationKey = @"generation_v1";
+NSString *BDSKSharedVersionKey = @"version_v1";
+NSString *BDSKSharedIsFullUpdateKey = @"full_v1";
+NSString *BDSKSharedChangedDataKey = @"changed_v1";
+NSString *BDSKSharedRemovedIdentifiersKey = @"removed_v1";
+NSString *BDSKSharedStartIndexKey = @"start_v3";
+NSString *BDSKSharedTotalCountKey = @"total_v3";
+
 NSString *BDSKComputerNameChangedNotification = nil;
 
 NSString *BDSKServiceNameForKeychain = @"BibDesk Sharing";
@@ -109,6 +123,11 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
     NSMutableDictionary *remoteClients;
     NSUInteger numberOfConnections;
     BDSKReadWriteLock *rwLock;
+    BDSKSharingChangeLog *changeLog;
+    NSData *cachedSnapshot;
+    int32_t cachedSnapshotGeneration;
+    NSMutableSet *changedIdentifiers;
+    NSMutableSet *loggedIdentifiers;
 }
 
 + (NSString *)requiredProtocolVersion;
@@ -119,6 +138,7 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
 - (void)setNumberOfConnections:(NSUInteger)count;
 
 - (void)notifyClientConnectionsChanged;
+- (void)noteChangedPublication:(BibItem *)pub;
 
 @end
 
@@ -185,7 +205,8 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
 }
 
 // If we introduce incompatible changes in future, bump this to avoid sharing breakage
-+ (NSString *)supportedProtocolVersion { return @"0"; }
+// version 1 adds recordChangesOfPublicationsSinceVersion:generation:startIndex:count:
++ (NSString *)supportedProtocolVersion { return @"1"; }
 
 + (id)defaultServer;
 {
@@ -223,9 +244,18 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
     }    
 }
 
+// invalidates the cached snapshot on the server thread
+- (void)handleSharedDataChangedNotification:(NSNotification *)note;
+{
+    if ([[note name] isEqualToString:BDSKBibItemChangedNotification])
+        [server noteChangedPublication:[note object]];
+    OSAtomicIncrement32Barrier(&sharedDataGeneration);
+}
+
 // we'll get these notifications on the main thread, and pass off to our secondary thread to handle; they're queued to reduce network traffic
 - (void)queueDataChangedNotification:(NSNotification *)note;
 {
+    OSAtomicIncrement32Barrier(&sharedDataGeneration);
     SEL theSEL = @selector(handleQueuedDataChanged);
     [[self class] cancelPreviousPerformRequestsWithTarget:self selector:theSEL object:nil];
     [self performSelector:theSEL withObject:nil afterDelay:5.0];
@@ -346,6 +376,8 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
         [nc removeObserver:self name:BDSKDocumentControllerRemoveDocumentNotification object:nil];                                                       
         [nc removeObserver:self name:BDSKDocAddItemNotification object:nil];
         [nc removeObserver:self name:BDSKDocDelItemNotification object:nil];
+        [nc removeObserver:self name:BDSKBibItemChangedNotification object:nil];
+        [nc removeObserver:self name:BDSKMacroDefinitionChangedNotification object:nil];
         [nc removeObserver:self name:NSApplicationWillTerminateNotification object:nil];
         
         [self setSharingName:nil];
@@ -419,6 +451,16 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
                        name:BDSKDocDelItemNotification
                      object:nil];
             
+            [nc addObserver:self
+                   selector:@selector(handleSharedDataChangedNotification:)
+                       name:BDSKBibItemChangedNotification
+                     object:nil];
+            
+            [nc addObserver:self
+                   selector:@selector(handleSharedDataChangedNotification:)
+                       name:BDSKMacroDefinitionChangedNotification
+                     object:nil];
+            
             [nc addObserver:self
                    selector:@selector(handleApplicationWillTerminate:)
                        name:NSApplicationWillTerminateNotification
@@ -542,6 +584,10 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
         remoteClients = [[NSMutableDictionary alloc] init];
         numberOfConnections = 0;
         rwLock = [[BDSKReadWriteLock alloc] init];
+        changeLog = [[BDSKSharingChangeLog alloc] init];
+        cachedSnapshot = nil;
+        changedIdentifiers = [[NSMutableSet alloc] init];
+        loggedIdentifiers = [[NSMutableSet alloc] init];
         [self startDOServerAsync];
     }   
     return self;
@@ -553,6 +599,10 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
     BDSKDESTROY(sharingName);
     BDSKDESTROY(remoteClients);
     BDSKDESTROY(rwLock);
+    BDSKDESTROY(changeLog);
+    BDSKDESTROY(cachedSnapshot);
+    BDSKDESTROY(changedIdentifiers);
+    BDSKDESTROY(loggedIdentifiers);
     [super dealloc];
 }
 
@@ -589,6 +639,58 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
     [sharingServer server:(BDSKSharingDOServer *)self didSetup:success];
 }
 
+// the identifiers are only accessed on the main thread, so the change log only needs to archive the items that changed since its last update
+- (void)noteChangedPublication:(BibItem *)pub {
+    NSString *identifier = [[pub identifierURL] absoluteString];
+    if (identifier && [loggedIdentifiers containsObject:identifier])
+        [changedIdentifiers addObject:identifier];
+}
+
+// we only copy the data here, archiving is done on the server thread
+- (void)getPublicationsAndMacros:(NSMutableDictionary *)pubsAndMacros {
+    NSMutableSet *allPubs = (NSMutableSet *)CFSetCreateMutable(CFAllocatorGetDefault(), 0, &kBDSKBibItemEqualitySetCallBacks);
+    NSMutableDictionary *allMacros = [[NSMutableDictionary alloc] init];
+    for (BibDocument *doc in [NSApp orderedDocuments]) {
+        [allPubs addObjectsFromArray:[doc publications]];
+        [allMacros addEntriesFromDictionary:[[doc macroResolver] macroDefinitions]];
+    }
+    NSMutableDictionary *snapshots = [[NSMutableDictionary alloc] initWithCapacity:[allPubs count]];
+    for (BibItem *pub in allPubs)
+        [snapshots setObject:[pub archivableSnapshot] forKey:[[pub identifierURL] absoluteString]];
+    [pubsAndMacros setObject:snapshots forKey:@"publications"];
+    [pubsAndMacros setObject:allMacros forKey:@"macros"];
+    [snapshots release];
+    [allPubs release];
+    [allMacros release];
+}
+
+// like getPublicationsAndMacros:, but only copies the items that were changed or added since the last call, the change log will get all the current identifiers
+- (void)getChangedPublicationsAndMacros:(NSMutableDictionary *)pubsAndMacros {
+    NSMutableSet *allPubs = (NSMutableSet *)CFSetCreateMutable(CFAllocatorGetDefault(), 0, &kBDSKBibItemEqualitySetCallBacks);
+    NSMutableDictionary *allMacros = [[NSMutableDictionary alloc] init];
+    for (BibDocument *doc in [NSApp orderedDocuments]) {
+        [allPubs addObjectsFromArray:[doc publications]];
+        [allMacros addEntriesFromDictionary:[[doc macroResolver] macroDefinitions]];
+    }
+    NSMutableSet *identifiers = [[NSMutableSet alloc] initWithCapacity:[allPubs count]];
+    NSMutableDictionary *snapshots = [[NSMutableDictionary alloc] init];
+    for (BibItem *pub in allPubs) {
+        NSString *identifier = [[pub identifierURL] absoluteString];
+        [identifiers addObject:identifier];
+        if ([loggedIdentifiers containsObject:identifier] == NO || [changedIdentifiers containsObject:identifier])
+            [snapshots setObject:[pub archivableSnapshot] forKey:identifier];
+    }
+    [loggedIdentifiers setSet:identifiers];
+    [changedIdentifiers removeAllObjects];
+    [pubsAndMacros setObject:snapshots forKey:@"publications"];
+    [pubsAndMacros setObject:identifiers forKey:@"identifiers"];
+    [pubsAndMacros setObject:allMacros forKey:@"macros"];
+    [snapshots release];
+    [identifiers release];
+    [allPubs release];
+    [allMacros release];
+}
+
 #pragma mark Server Thread
 
 #pragma mark | DO Server
@@ -734,29 +836,27 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
     }
 }
 
-- (void)getPublicationsAndMacros:(NSMutableDictionary *)pubsAndMacros {
-    NSMutableSet *allPubs = (NSMutableSet *)CFSetCreateMutable(CFAllocatorGetDefault(), 0, &kBDSKBibItemEqualitySetCallBacks);
-    NSMutableDictionary *allMacros = [[NSMutableDictionary alloc] init];
-    for (BibDocument *doc in [NSApp orderedDocuments]) {
-        [allPubs addObjectsFromArray:[doc publications]];
-        [allMacros addEntriesFromDictionary:[[doc macroResolver] macroDefinitions]];
-    }
-    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:[allPubs allObjects]];
-    if ([data length])
-        [pubsAndMacros setObject:data forKey:@"publications"];
-    data = [NSKeyedArchiver archivedDataWithRootObject:allMacros];
-    if ([data length])
-        [pubsAndMacros setObject:data forKey:@"macros"];
-    [allPubs release];
-    [allMacros release];
+- (NSDictionary *)copyPublicationsAndMacrosForDataGeneration:(int32_t *)generation onlyChanged:(BOOL)onlyChanged {
+    NSMutableDictionary *pubsAndMacros = [[NSMutableDictionary alloc] init];
+    // get the generation first, so changes made while we copy will invalidate the result
+    OSMemoryBarrier();
+    *generation = sharedDataGeneration;
+    [self performSelectorOnMainThread:onlyChanged ? @selector(getChangedPublicationsAndMacros:) : @selector(getPublicationsAndMacros:) withObject:pubsAndMacros waitUntilDone:YES];
+    return pubsAndMacros;
 }
 
 - (bycopy NSData *)archivedSnapshotOfPublications
 {
-    NSMutableDictionary *pubsAndMacros = [[NSMutableDictionary alloc] init];
-    [self performSelectorOnMainThread:@selector(getPublicationsAndMacros:) withObject:pubsAndMacros waitUntilDone:YES];
-    NSData *dataToSend = [pubsAndMacros objectForKey:@"publications"];
-    NSData *macroDataToSend = [pubsAndMacros objectForKey:@"macros"];
+    // all clients are served from the server thread, so they share the same cached data until the documents change
+    OSMemoryBarrier();
+    if (cachedSnapshot && cachedSnapshotGeneration == sharedDataGeneration)
+        return cachedSnapshot;
+    
+    int32_t generation;
+    NSDictionary *pubsAndMacros = [self copyPublicationsAndMacrosForDataGeneration:&generation onlyChanged:NO];
+    NSArray *pubs = [[pubsAndMacros objectForKey:@"publications"] allValues];
+    NSData *dataToSend = [pubs count] ? [NSKeyedArchiver archivedDataWithRootObject:pubs] : nil;
+    NSData *macroDataToSend = [NSKeyedArchiver archivedDataWithRootObject:[pubsAndMacros objectForKey:@"macros"]];
     
     if(dataToSend != nil){
         NSDictionary *dictionary = [NSDictionary dictionaryWithObjectsAndKeys:dataToSend, BDSKSharedArchivedDataKey, macroDataToSend, BDSKSharedArchivedMacroDataKey, nil];
@@ -773,6 +873,35 @@ static void SCDynamicStoreChanged(SCDynamicStoreRef store, CFArrayRef changedKey
     }
     [pubsAndMacros release];
     
+    [cachedSnapshot release];
+    cachedSnapshot = [dataToSend retain];
+    cachedSnapshotGeneration = generation;
+    
+    return dataToSend;
+}
+
+- (bycopy NSData *)recordChangesOfPublicationsSinceVersion:(NSInteger)version generation:(bycopy NSString *)generation startIndex:(NSUInteger)startIndex count:(NSUInteger)count
+{
+    OSMemoryBarrier();
+    if ([changeLog isUpToDateForDataGeneration:sharedDataGeneration] == NO) {
+        int32_t dataGeneration;
+        // archiving and hashing the changed items is done here on the server thread
+        NSDictionary *pubsAndMacros = [self copyPublicationsAndMacrosForDataGeneration:&dataGeneration onlyChanged:YES];
+        [changeLog updateWithChangedPublications:[pubsAndMacros objectForKey:@"publications"] identifiers:[pubsAndMacros objectForKey:@"identifiers"] macros:[pubsAndMacros objectForKey:@"macros"] dataGeneration:dataGeneration];
+        [pubsAndMacros release];
+    }
+    
+    NSString *errorString = nil;
+    NSData *dataToSend = [NSPropertyListSerialization dataFromPropertyList:[changeLog changesSinceVersion:version generation:generation range:NSMakeRange(startIndex, count)] format:NSPropertyListBinaryFormat_v1_0 errorDescription:&errorString];
+    if(errorString != nil){
+        NSLog(@"Error serializing publication changes for sharing: %@", errorString);
+        [errorString release];
+        dataToSend = nil;
+    } else {
+        @try{ dataToSend = [dataToSend compressedData]; }
+        @catch(id exception){ NSLog(@"Ignoring exception %@ raised while compressing data to share.", exception); }
+    }
+    
     return dataToSend;
 }
 
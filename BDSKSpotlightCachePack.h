@@ -0,0 +1,70 @@
+//
+//  BDSKSpotlightCachePack.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+
+// A single memory mapped file with the Spotlight metadata of all items of a document, as an alternative to a cache file per item.
+// The file starts with a header and an index sorted by cite key, followed by the document info and a binary plist record per item, so items can be read one at a time.
+// This class is also compiled into the BibImporter Spotlight plugin, so it should only depend on Foundation.
+@interface BDSKSpotlightCachePack : NSObject {
+    NSData *data;
+    NSUInteger count;
+}
+
+// citeKeys and itemData are parallel arrays, itemData contains the binary plist data for the items
++ (NSData *)dataWithDocumentInfo:(NSDictionary *)docInfo citeKeys:(NSArray *)citeKeys itemData:(NSArray *)itemData;
+
+// returns nil when the data is not a valid pack
+- (id)initWithData:(NSData *)aData;
+- (id)initWithContentsOfFile:(NSString *)path;
+
+- (NSData *)data;
+
+- (NSDictionary *)documentInfo;
+
+- (NSUInteger)count;
+- (NSString *)citeKeyAtIndex:(NSUInteger)anIndex;
+- (NSData *)itemDataAtIndex:(NSUInteger)anIndex;
+- (NSDictionary *)itemAtIndex:(NSUInteger)anIndex;
+
+// binary search in the index, returns NSNotFound when there is no item with this cite key
+- (NSUInteger)indexOfCiteKey:(NSString *)citeKey;
+- (NSDictionary *)itemForCiteKey:(NSString *)citeKey;
+
+@end
@@ -0,0 +1,258 @@
+//
+//  BDSKSpotlightCachePack.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKSpotlightCachePack.h"
+
+#define PACK_MAGIC      "BDSKPACK"
+#define PACK_VERSION    1
+
+// magic, version, count, document info offset and length
+#define HEADER_LENGTH   24
+// cite key offset and length, record offset and length
+#define ENTRY_LENGTH    16
+
+typedef struct _BDSKPackEntry {
+    NSData *key;
+    NSData *record;
+} BDSKPackEntry;
+
+static int compareEntries(const void *p1, const void *p2) {
+    NSData *key1 = ((BDSKPackEntry *)p1)->key, *key2 = ((BDSKPackEntry *)p2)->key;
+    NSUInteger length1 = [key1 length], length2 = [key2 length];
+    int cmp = memcmp([key1 bytes], [key2 bytes], MIN(length1, length2));
+    return cmp != 0 ? cmp : length1 < length2 ? -1 : length1 > length2 ? 1 : 0;
+}
+
+static inline void appendUInt32(NSMutableData *data, uint32_t value) {
+    value = CFSwapInt32HostToBig(value);
+    [data appendBytes:&value length:sizeof(uint32_t)];
+}
+
+static inline uint32_t readUInt32(const uint8_t *bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(uint32_t));
+    return CFSwapInt32BigToHost(value);
+}
+
+@implementation BDSKSpotlightCachePack
+
++ (NSData *)dataWithDocumentInfo:(NSDictionary *)docInfo citeKeys:(NSArray *)citeKeys itemData:(NSArray *)itemData {
+    NSUInteger i, iMax = [citeKeys count];
+    if (iMax != [itemData count])
+        return nil;
+    
+    NSData *docData = docInfo ? [NSPropertyListSerialization dataFromPropertyList:docInfo format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL] : [NSData data];
+    if (docData == nil)
+        return nil;
+    
+    BDSKPackEntry *entries = (BDSKPackEntry *)NSZoneMalloc(NULL, MAX(iMax, 1U) * sizeof(BDSKPackEntry));
+    unsigned long long length = HEADER_LENGTH + (unsigned long long)iMax * ENTRY_LENGTH + [docData length];
+    
+    for (i = 0; i < iMax; i++) {
+        entries[i].key = [[citeKeys objectAtIndex:i] dataUsingEncoding:NSUTF8StringEncoding];
+        entries[i].record = [itemData objectAtIndex:i];
+        length += [entries[i].key length] + [entries[i].record length];
+    }
+    
+    NSMutableData *packData = nil;
+    
+    // all offsets are 32 bit
+    if (length <= UINT32_MAX) {
+        // sort by the UTF-8 bytes of the cite keys, so we can use a binary search when reading; mergesort keeps duplicate keys in order
+        mergesort(entries, iMax, sizeof(BDSKPackEntry), compareEntries);
+        
+        packData = [NSMutableData dataWithCapacity:(NSUInteger)length];
+        
+        uint32_t offset = HEADER_LENGTH + iMax * ENTRY_LENGTH;
+        
+        [packData appendBytes:PACK_MAGIC length:8];
+        appendUInt32(packData, PACK_VERSION);
+        appendUInt32(packData, iMax);
+        appendUInt32(packData, offset);
+        appendUInt32(packData, [docData length]);
+        offset += [docData length];
+        
+        for (i = 0; i < iMax; i++) {
+            appendUInt32(packData, offset);
+            appendUInt32(packData, [entries[i].key length]);
+            offset += [entries[i].key length];
+            appendUInt32(packData, offset);
+            appendUInt32(packData, [entries[i].record length]);
+            offset += [entries[i].record length];
+        }
+        
+        [packData appendData:docData];
+        for (i = 0; i < iMax; i++) {
+            [packData appendData:entries[i].key];
+            [packData appendData:entries[i].record];
+        }
+    }
+    
+    NSZoneFree(NULL, entries);
+    
+    return packData;
+}
+
+- (id)initWithData:(NSData *)aData {
+    self = [super init];
+    if (self) {
+        const uint8_t *bytes = [aData bytes];
+        NSUInteger length = [aData length];
+        if (length < HEADER_LENGTH || memcmp(bytes, PACK_MAGIC, 8) != 0 || readUInt32(bytes + 8) != PACK_VERSION) {
+            [self release];
+            self = nil;
+        } else {
+            count = readUInt32(bytes + 12);
+            uint32_t docOffset = readUInt32(bytes + 16), docLength = readUInt32(bytes + 20);
+            if (count > (length - HEADER_LENGTH) / ENTRY_LENGTH || (unsigned long long)docOffset + docLength > length) {
+                [self release];
+                self = nil;
+            } else {
+                data = [aData retain];
+            }
+        }
+    }
+    return self;
+}
+
+- (id)initWithContentsOfFile:(NSString *)path {
+    // map the file, we generally only read a small part of it
+    NSData *aData = [[NSData alloc] initWithContentsOfFile:path options:NSDataReadingMapped error:NULL];
+    if (aData == nil) {
+        [self release];
+        return nil;
+    }
+    self = [self initWithData:aData];
+    [aData release];
+    return self;
+}
+
+- (void)dealloc {
+    [data release];
+    data = nil;
+    [super dealloc];
+}
+
+- (NSData *)data {
+    return data;
+}
+
+- (NSUInteger)count {
+    return count;
+}
+
+// returns NO when the range does not fit in the data, which means the file is corrupt
+- (BOOL)getRange:(NSRangePointer)range atOffset:(NSUInteger)offset {
+    const uint8_t *bytes = (const uint8_t *)[data bytes] + offset;
+    uint32_t location = readUInt32(bytes), length = readUInt32(bytes + 4);
+    if ((unsigned long long)location + length > [data length])
+        return NO;
+    *range = NSMakeRange(location, length);
+    return YES;
+}
+
+- (id)propertyListInRange:(NSRange)range {
+    // the plist is parsed into new objects, so we don't need to copy the bytes
+    NSData *plistData = [[NSData alloc] initWithBytesNoCopy:(void *)((const uint8_t *)[data bytes] + range.location) length:range.length freeWhenDone:NO];
+    id plist = [NSPropertyListSerialization propertyListFromData:plistData mutabilityOption:NSPropertyListImmutable format:NULL errorDescription:NULL];
+    [plistData release];
+    return [plist isKindOfClass:[NSDictionary class]] ? plist : nil;
+}
+
+- (NSDictionary *)documentInfo {
+    NSRange range;
+    if ([self getRange:&range atOffset:16] == NO || range.length == 0)
+        return nil;
+    return [self propertyListInRange:range];
+}
+
+- (NSString *)citeKeyAtIndex:(NSUInteger)anIndex {
+    NSRange range;
+    if (anIndex >= count || [self getRange:&range atOffset:HEADER_LENGTH + anIndex * ENTRY_LENGTH] == NO)
+        return nil;
+    return [[[NSString alloc] initWithBytes:(const uint8_t *)[data bytes] + range.location length:range.length encoding:NSUTF8StringEncoding] autorelease];
+}
+
+- (NSData *)itemDataAtIndex:(NSUInteger)anIndex {
+    NSRange range;
+    if (anIndex >= count || [self getRange:&range atOffset:HEADER_LENGTH + anIndex * ENTRY_LENGTH + 8] == NO)
+        return nil;
+    return [data subdataWithRange:range];
+}
+
+- (NSDictionary *)itemAtIndex:(NSUInteger)anIndex {
+    NSRange range;
+    if (anIndex >= count || [self getRange:&range atOffset:HEADER_LENGTH + anIndex * ENTRY_LENGTH + 8] == NO)
+        return nil;
+    return [self propertyListInRange:range];
+}
+
+- (NSUInteger)indexOfCiteKey:(NSString *)citeKey {
+    NSData *key = [citeKey dataUsingEncoding:NSUTF8StringEncoding];
+    if (key == nil)
+        return NSNotFound;
+    
+    const uint8_t *bytes = [data bytes];
+    const void *keyBytes = [key bytes];
+    NSUInteger keyLength = [key length];
+    NSUInteger low = 0, high = count;
+    NSRange range;
+    
+    // find the first entry that is not smaller than the key
+    while (low < high) {
+        NSUInteger mid = low + (high - low) / 2;
+        if ([self getRange:&range atOffset:HEADER_LENGTH + mid * ENTRY_LENGTH] == NO)
+            return NSNotFound;
+        int cmp = memcmp(bytes + range.location, keyBytes, MIN(range.length, keyLength));
+        if (cmp < 0 || (cmp == 0 && range.length < keyLength))
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    if (low < count && [self getRange:&range atOffset:HEADER_LENGTH + low * ENTRY_LENGTH] && range.length == keyLength && memcmp(bytes + range.location, keyBytes, keyLength) == 0)
+        return low;
+    return NSNotFound;
+}
+
+- (NSDictionary *)itemForCiteKey:(NSString *)citeKey {
+    NSUInteger anIndex = [self indexOfCiteKey:citeKey];
+    return anIndex == NSNotFound ? nil : [self itemAtIndex:anIndex];
+}
+
+@end
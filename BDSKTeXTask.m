@@ -48,8 +48,13 @@
 #import "NSInvocation_BDSKExtensions.h"
 #import "BDSKTask.h"
 #import "BDSKReadWriteLock.h"
+#import "NSData_BDSKExtensions.h"
 
 #define BDSKTeXTaskRunLoopTimeoutKey @"BDSKTeXTaskRunLoopTimeout"
+#define BDSKTeXTaskResultCacheSizeKey @"BDSKTeXTaskResultCacheSize"
+
+#define DEFAULT_RESULT_CACHE_SIZE 32
+#define MAX_WARM_DIRECTORIES 4
 
 @interface BDSKTeXPath : NSObject
 {
@@ -68,11 +73,32 @@
 - (NSString *)auxFilePath;
 @end
 
+// Caches the output files of finished TeX runs, keyed by a digest of everything that goes into the run, so repeating a preview for the same entries does not run TeX again
+@interface BDSKTeXResultCache : NSObject
+{
+    NSString *cacheDirectory;
+    NSMutableDictionary *generatedTypes;
+    NSMutableArray *keys;
+    NSUInteger countLimit;
+    NSLock *lock;
+}
++ (id)sharedCache;
+- (BOOL)copyResultsForKey:(NSString *)key generatedTypes:(NSInteger)flag toTeXPath:(BDSKTeXPath *)texPath;
+- (void)addResultsFromTeXPath:(BDSKTeXPath *)texPath generatedTypes:(NSInteger)flag forKey:(NSString *)key;
+@end
+
 @interface BDSKTeXTask (Private) 
 
 - (NSArray *)helperFilePaths;
 
 - (void)writeHelperFiles;
+- (void)syncHelperFiles;
+
+- (NSString *)resultCacheKeyForBibTeXString:(NSString *)bibStr citeKeys:(NSArray *)citeKeys isLTB:(BOOL)ltb;
+
+- (BOOL)restoreCachedResultsForKey:(NSString *)key generatedTypes:(NSInteger)flag;
+
+- (void)removeFilesFromPreviousRun;
 
 - (BOOL)writeTeXFileForCiteKeys:(NSArray *)citeKeys isLTB:(BOOL)ltb;
 
@@ -118,6 +144,39 @@ static void upgradeTemplate()
 
 static double runLoopTimeout = 30;
 
+// working directories of deallocated tasks, keyed by file name, which still contain the helper files
+static NSMutableDictionary *warmDirectories = nil;
+
+static NSString *copyWarmDirectoryWithFileName(NSString *fileName)
+{
+    NSString *dirPath = nil;
+    @synchronized(warmDirectories) {
+        NSMutableArray *dirs = [warmDirectories objectForKey:fileName];
+        if ([dirs count]) {
+            dirPath = [[dirs lastObject] retain];
+            [dirs removeLastObject];
+        }
+    }
+    return dirPath;
+}
+
+static BOOL addWarmDirectoryWithFileName(NSString *dirPath, NSString *fileName)
+{
+    BOOL didAdd = NO;
+    @synchronized(warmDirectories) {
+        NSMutableArray *dirs = [warmDirectories objectForKey:fileName];
+        if (dirs == nil) {
+            dirs = [NSMutableArray array];
+            [warmDirectories setObject:dirs forKey:fileName];
+        }
+        if ([dirs count] < MAX_WARM_DIRECTORIES) {
+            [dirs addObject:dirPath];
+            didAdd = YES;
+        }
+    }
+    return didAdd;
+}
+
 @implementation BDSKTeXTask
 
 + (void)initialize
@@ -127,7 +186,9 @@ static double runLoopTimeout = 30;
     // returns 0 if the key doesn't exist
     if ([[NSUserDefaults standardUserDefaults] doubleForKey:BDSKTeXTaskRunLoopTimeoutKey] > 1)
         runLoopTimeout = [[NSUserDefaults standardUserDefaults] doubleForKey:BDSKTeXTaskRunLoopTimeoutKey];
-        
+    
+    warmDirectories = [[NSMutableDictionary alloc] init];
+    
     upgradeTemplate();
     
 }
@@ -141,7 +202,11 @@ static double runLoopTimeout = 30;
     if (self) {
 		
 		NSFileManager *fm = [NSFileManager defaultManager];
-        NSString *dirPath = [fm makeTemporaryDirectoryWithBasename:newFileName];
+        // reuse the working directory of a previous task when possible, it already has most of the helper files
+        NSString *dirPath = [copyWarmDirectoryWithFileName(newFileName) autorelease];
+        BOOL isWarm = dirPath != nil;
+        if (isWarm == NO)
+            dirPath = [fm makeTemporaryDirectoryWithBasename:newFileName];
         NSParameterAssert([fm fileExistsAtPath:dirPath]);
 		texTemplatePath = [[[fm applicationSupportDirectory] stringByAppendingPathComponent:@"previewtemplate.tex"] copy];
         
@@ -160,7 +225,10 @@ static double runLoopTimeout = 30;
             }
         }        
 		
-		[self writeHelperFiles];
+		if (isWarm)
+            [self syncHelperFiles];
+        else
+            [self writeHelperFiles];
 		
 		delegate = nil;
         currentTask = nil;
@@ -173,7 +241,9 @@ static double runLoopTimeout = 30;
 }
 
 - (void)dealloc{
-    [[NSFileManager defaultManager] removeItemAtPath:[texPath workingDirectory] error:NULL];
+    // keep the working directory around for the next task with the same file name, or remove it when we have enough of them
+    if (addWarmDirectoryWithFileName([texPath workingDirectory], [texPath baseNameWithoutExtension]) == NO)
+        [[NSFileManager defaultManager] removeItemAtPath:[texPath workingDirectory] error:NULL];
     BDSKDESTROY(texTemplatePath);
     BDSKDESTROY(texPath);
     BDSKDESTROY(taskShouldStartInvocation);
@@ -280,6 +350,19 @@ static double runLoopTimeout = 30;
         setenv("PATH", [new_path fileSystemRepresentation], 1);
     }
     
+    // when we have cached results for the same input we don't need to run TeX at all
+    NSString *cacheKey = [self resultCacheKeyForBibTeXString:bibStr citeKeys:citeKeys isLTB:(flag == BDSKGenerateLTB)];
+    if (cacheKey && [self restoreCachedResultsForKey:cacheKey generatedTypes:flag]) {
+        BOOL success = YES;
+        if (nil != taskFinishedInvocation) {
+            [taskFinishedInvocation setArgument:&success atIndex:3];
+            [taskFinishedInvocation performSelectorOnMainThread:@selector(invoke) withObject:nil waitUntilDone:NO];
+        }
+        [processingLock unlock];
+        [pool release];
+        return success;
+    }
+    
     BOOL success = [self writeTeXFileForCiteKeys:citeKeys isLTB:(flag == BDSKGenerateLTB)] && [self writeBibTeXFile:bibStr];
     
     if (success) {
@@ -303,6 +386,12 @@ static double runLoopTimeout = 30;
                 }
             }
         }
+        
+        if (success && cacheKey) {
+            [dataFileLock lockForReading];
+            [[BDSKTeXResultCache sharedCache] addResultsFromTeXPath:texPath generatedTypes:flag forKey:cacheKey];
+            [dataFileLock unlock];
+        }
 	}
     
 	if (nil != taskFinishedInvocation) {
@@ -470,6 +559,83 @@ static double runLoopTimeout = 30;
     }
 }
 
+static NSString *modificationDateStringForPath(NSString *path) {
+    NSFileManager *fm = [[NSFileManager alloc] init];
+    NSDate *date = [[fm attributesOfItemAtPath:path error:NULL] fileModificationDate];
+    [fm release];
+    return [date description] ?: @"";
+}
+
+// a warm directory may have helper files the user has since changed or removed, so replace those and copy the new ones
+- (void)syncHelperFiles{
+    NSFileManager *fm = [NSFileManager defaultManager];
+    NSString *dirPath = [texPath workingDirectory];
+    NSURL *dstURL = [NSURL fileURLWithPath:dirPath];
+    NSSet *helperTypes = [NSSet setForCaseInsensitiveStringsWithObjects:@"cfg", @"sty", @"bst", nil];
+    NSMutableDictionary *helperFiles = [NSMutableDictionary dictionary];
+    NSError *error;
+    
+    for (NSString *srcPath in [self helperFilePaths])
+        [helperFiles setObject:srcPath forKey:[srcPath lastPathComponent]];
+    
+    for (NSString *file in [fm contentsOfDirectoryAtPath:dirPath error:NULL]) {
+        if ([helperTypes containsObject:[file pathExtension]] == NO)
+            continue;
+        NSString *path = [dirPath stringByAppendingPathComponent:file];
+        NSString *srcPath = [helperFiles objectForKey:file];
+        // FSCopyObject keeps the modification date, so an unchanged helper file has the same date as the original
+        if (srcPath && [modificationDateStringForPath(srcPath) isEqualToString:modificationDateStringForPath(path)])
+            [helperFiles removeObjectForKey:file];
+        else
+            [fm removeItemAtPath:path error:NULL];
+    }
+    
+    for (NSString *srcPath in [helperFiles allValues]) {
+        if (![fm copyObjectAtURL:[NSURL fileURLWithPath:srcPath] toDirectoryAtURL:dstURL error:&error])
+            NSLog(@"unable to copy helper file %@ to %@; error %@", srcPath, [dstURL path], [error localizedDescription]);
+    }
+}
+
+// the key contains everything that determines the output of a run, so a changed entry, style, template, helper file or encoding gives a new key
+- (NSString *)resultCacheKeyForBibTeXString:(NSString *)bibStr citeKeys:(NSArray *)citeKeys isLTB:(BOOL)ltb{
+    if ([[NSUserDefaults standardUserDefaults] integerForKey:BDSKTeXTaskResultCacheSizeKey] < 0)
+        return nil;
+    
+    NSUserDefaults *sud = [NSUserDefaults standardUserDefaults];
+    NSString *bibTemplatePath = [[sud stringForKey:BDSKOutputTemplateFileKey] stringByStandardizingPath];
+    NSMutableString *keyString = [NSMutableString string];
+    
+    [keyString appendFormat:@"%d\n%@\n%ld\n", ltb, [sud objectForKey:BDSKBTStyleKey], (long)[sud integerForKey:BDSKTeXPreviewFileEncodingKey]];
+    [keyString appendFormat:@"%@\n%@\n", [sud objectForKey:BDSKTeXBinPathKey], [sud objectForKey:BDSKBibTeXBinPathKey]];
+    [keyString appendFormat:@"%@\n%@\n", modificationDateStringForPath(texTemplatePath), modificationDateStringForPath(bibTemplatePath)];
+    for (NSString *helperPath in [[self helperFilePaths] sortedArrayUsingSelector:@selector(compare:)])
+        [keyString appendFormat:@"%@ %@\n", helperPath, modificationDateStringForPath(helperPath)];
+    [keyString appendFormat:@"%@\n", citeKeys ? [citeKeys componentsJoinedByString:@","] : @"*"];
+    [keyString appendString:bibStr ?: @""];
+    
+    return [[[keyString dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString];
+}
+
+- (BOOL)restoreCachedResultsForKey:(NSString *)key generatedTypes:(NSInteger)flag{
+    [dataFileLock lockForWriting];
+    [self removeFilesFromPreviousRun];
+    BOOL success = [[BDSKTeXResultCache sharedCache] copyResultsForKey:key generatedTypes:flag toTeXPath:texPath];
+    [dataFileLock unlock];
+    
+    if (success) {
+        // the cached run generated at least the requested types
+        if (flag == BDSKGenerateLTB)
+            OSAtomicCompareAndSwap32Barrier(0, 1, &flags.hasLTB);
+        else
+            OSAtomicCompareAndSwap32Barrier(0, 1, &flags.hasLaTeX);
+        if (flag > BDSKGenerateLaTeX)
+            OSAtomicCompareAndSwap32Barrier(0, 1, &flags.hasPDFData);
+        if (flag > BDSKGeneratePDF)
+            OSAtomicCompareAndSwap32Barrier(0, 1, &flags.hasRTFData);
+    }
+    return success;
+}
+
 - (BOOL)writeTeXFileForCiteKeys:(NSArray *)citeKeys isLTB:(BOOL)ltb{
     
     NSMutableString *texFile = nil;
@@ -687,3 +853,114 @@ static double runLoopTimeout = 30;
 - (NSString *)auxFilePath { return [fullPathWithoutExtension stringByAppendingPathExtension:@"aux"]; }
 
 @end
+
+
+#pragma mark -
+
+@implementation BDSKTeXResultCache
+
++ (id)sharedCache {
+    static BDSKTeXResultCache *sharedCache = nil;
+    @synchronized(self) {
+        if (sharedCache == nil)
+            sharedCache = [[self alloc] init];
+    }
+    return sharedCache;
+}
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        NSInteger limit = [[NSUserDefaults standardUserDefaults] integerForKey:BDSKTeXTaskResultCacheSizeKey];
+        countLimit = limit > 0 ? (NSUInteger)limit : DEFAULT_RESULT_CACHE_SIZE;
+        cacheDirectory = [[[NSFileManager defaultManager] makeTemporaryDirectoryWithBasename:@"texcache"] copy];
+        generatedTypes = [[NSMutableDictionary alloc] init];
+        keys = [[NSMutableArray alloc] init];
+        lock = [[NSLock alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(cacheDirectory);
+    BDSKDESTROY(generatedTypes);
+    BDSKDESTROY(keys);
+    BDSKDESTROY(lock);
+    [super dealloc];
+}
+
+static NSArray *cachedResultExtensions() {
+    static NSArray *extensions = nil;
+    if (extensions == nil)
+        extensions = [[NSArray alloc] initWithObjects:@"bbl", @"pdf", @"rtf", @"log", @"blg", nil];
+    return extensions;
+}
+
+// copies all existing output files between the directories, replacing existing files
+static BOOL copyResultFiles(NSFileManager *fm, NSString *fromBasePath, NSString *toBasePath) {
+    BOOL didCopy = NO;
+    for (NSString *extension in cachedResultExtensions()) {
+        NSString *fromPath = [fromBasePath stringByAppendingPathExtension:extension];
+        NSString *toPath = [toBasePath stringByAppendingPathExtension:extension];
+        if ([fm fileExistsAtPath:fromPath]) {
+            [fm removeItemAtPath:toPath error:NULL];
+            if ([fm copyItemAtPath:fromPath toPath:toPath error:NULL])
+                didCopy = YES;
+        }
+    }
+    return didCopy;
+}
+
+- (BOOL)copyResultsForKey:(NSString *)key generatedTypes:(NSInteger)flag toTeXPath:(BDSKTeXPath *)texPath {
+    BOOL success = NO;
+    [lock lock];
+    NSNumber *cachedFlag = [generatedTypes objectForKey:key];
+    // LTB and LaTeX runs have different keys, and the other types are cumulative
+    if (cachedFlag && [cachedFlag integerValue] >= flag) {
+        NSFileManager *fm = [[NSFileManager alloc] init];
+        success = copyResultFiles(fm, [[cacheDirectory stringByAppendingPathComponent:key] stringByAppendingPathComponent:@"result"], [[texPath workingDirectory] stringByAppendingPathComponent:[texPath baseNameWithoutExtension]]);
+        [fm release];
+        if (success) {
+            // move to the end, as the most recently used
+            [key retain];
+            [keys removeObject:key];
+            [keys addObject:key];
+            [key release];
+        }
+    }
+    [lock unlock];
+    return success;
+}
+
+- (void)addResultsFromTeXPath:(BDSKTeXPath *)texPath generatedTypes:(NSInteger)flag forKey:(NSString *)key {
+    if (cacheDirectory == nil)
+        return;
+    
+    [lock lock];
+    NSNumber *cachedFlag = [generatedTypes objectForKey:key];
+    if (cachedFlag == nil || [cachedFlag integerValue] < flag) {
+        NSFileManager *fm = [[NSFileManager alloc] init];
+        NSString *dirPath = [cacheDirectory stringByAppendingPathComponent:key];
+        
+        [fm createDirectoryAtPath:dirPath withIntermediateDirectories:NO attributes:nil error:NULL];
+        if (copyResultFiles(fm, [[texPath workingDirectory] stringByAppendingPathComponent:[texPath baseNameWithoutExtension]], [dirPath stringByAppendingPathComponent:@"result"])) {
+            [generatedTypes setObject:[NSNumber numberWithInteger:flag] forKey:key];
+            [keys removeObject:key];
+            [keys addObject:key];
+            
+            // evict the least recently used results
+            while ([keys count] > countLimit) {
+                NSString *oldKey = [keys objectAtIndex:0];
+                [fm removeItemAtPath:[cacheDirectory stringByAppendingPathComponent:oldKey] error:NULL];
+                [generatedTypes removeObjectForKey:oldKey];
+                [keys removeObjectAtIndex:0];
+            }
+        } else {
+            [fm removeItemAtPath:dirPath error:NULL];
+        }
+        [fm release];
+    }
+    [lock unlock];
+}
+
+@end
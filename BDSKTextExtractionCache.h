@@ -0,0 +1,69 @@
+//
+//  BDSKTextExtractionCache.h
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Cocoa/Cocoa.h>
+
+
+// Keeps the text extracted from linked files on disk, so the file search index, the file matcher and the notes search index extract it at most once per version of a file.
+// Text is keyed by the SHA-1 of the file contents, Skim notes by the path and change date of the file, as they are stored in extended attributes.
+// The SHA-1 of a file is itself cached by its device, inode, size and modification date, so an unchanged file is not read again, also after a relaunch.
+// Least recently used entries are removed when the cache grows too large. The methods are thread safe.
+@interface BDSKTextExtractionCache : NSObject {
+    NSString *cacheFolder;
+    unsigned long long maxSize;
+    unsigned long long currentSize;
+    BOOL hasCurrentSize;
+    NSMutableDictionary *signatures;
+}
+
++ (id)sharedCache;
+
+// the shared cache uses a folder in the user's caches folder and a maximum size from the user defaults
+- (id)initWithFolder:(NSString *)folder maximumSize:(unsigned long long)size;
+
+// the SHA-1 of the file contents, only computed when the file changed since we last saw it; nil for folders and missing files
+- (NSData *)signatureForFileURL:(NSURL *)aURL;
+
+// returns nil for files we cannot extract text from ourselves, SearchKit should be used for those; signature can be nil
+- (NSString *)textForFileURL:(NSURL *)aURL signature:(NSData *)signature;
+- (NSString *)textForFileURL:(NSURL *)aURL;
+
+// the text of the Skim notes, or nil when there are none
+- (NSString *)notesForFileURL:(NSURL *)aURL;
+
+@end
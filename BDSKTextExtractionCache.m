@@ -0,0 +1,334 @@
+//
+//  BDSKTextExtractionCache.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "BDSKTextExtractionCache.h"
+#import "NSData_BDSKExtensions.h"
+#import "NSFileManager_BDSKExtensions.h"
+#import <Quartz/Quartz.h>
+#import <SkimNotesBase/SkimNotesBase.h>
+#import <sys/stat.h>
+
+#define CACHE_VERSION @"2"
+
+// in MB
+#define BDSKTextExtractionCacheSizeKey @"BDSKTextExtractionCacheSize"
+#define DEFAULT_CACHE_SIZE 512
+// when the cache is too large, we remove the oldest entries until it is this fraction of the maximum size
+#define EVICTION_FRACTION 0.75
+// the number of file signatures we keep in memory, all of them are also cached on disk
+#define MAX_SIGNATURES 10000
+
+#define TEXT_FOLDER         @"Text"
+#define NOTES_FOLDER        @"Notes"
+#define SIGNATURES_FOLDER   @"Signatures"
+
+@interface BDSKTextExtractionCache (Private)
+- (NSString *)pathForKey:(NSString *)key inFolder:(NSString *)folder;
+- (NSData *)cachedDataAtPath:(NSString *)path;
+- (void)setCachedData:(NSData *)data atPath:(NSString *)path;
+- (NSString *)cachedStringAtPath:(NSString *)path;
+- (void)setCachedString:(NSString *)string atPath:(NSString *)path;
+- (void)removeLeastRecentlyUsedEntries;
+@end
+
+@implementation BDSKTextExtractionCache
+
++ (id)sharedCache {
+    static BDSKTextExtractionCache *sharedCache = nil;
+    @synchronized(self) {
+        if (sharedCache == nil)
+            sharedCache = [[self alloc] init];
+    }
+    return sharedCache;
+}
+
+- (id)init {
+    NSFileManager *fm = [[NSFileManager alloc] init];
+    NSString *folder = [fm cachesFolderForClass:[self class] version:CACHE_VERSION];
+    [fm release];
+    NSInteger size = [[NSUserDefaults standardUserDefaults] integerForKey:BDSKTextExtractionCacheSizeKey];
+    return [self initWithFolder:folder maximumSize:(unsigned long long)(size > 0 ? size : DEFAULT_CACHE_SIZE) * 1024 * 1024];
+}
+
+- (id)initWithFolder:(NSString *)folder maximumSize:(unsigned long long)size {
+    self = [super init];
+    if (self) {
+        NSFileManager *fm = [[NSFileManager alloc] init];
+        if (folder && [fm fileExistsAtPath:folder] == NO)
+            [fm createDirectoryAtPath:folder withIntermediateDirectories:YES attributes:nil error:NULL];
+        [fm release];
+        cacheFolder = [folder copy];
+        maxSize = size;
+        currentSize = 0;
+        hasCurrentSize = NO;
+        signatures = [[NSMutableDictionary alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(cacheFolder);
+    BDSKDESTROY(signatures);
+    [super dealloc];
+}
+
+static NSString *keyForFileAtPath(NSString *path, BOOL useChangeDate, BOOL *isDirectory) {
+    struct stat sb;
+    if (stat([path fileSystemRepresentation], &sb) != 0)
+        return nil;
+    if (isDirectory)
+        *isDirectory = S_ISDIR(sb.st_mode);
+    // the change date is also updated when extended attributes change
+    struct timespec date = useChangeDate ? sb.st_ctimespec : sb.st_mtimespec;
+    return [NSString stringWithFormat:@"%@\n%ld.%09ld\n%llu\n%llu", path, (long)date.tv_sec, (long)date.tv_nsec, (unsigned long long)sb.st_size, (unsigned long long)sb.st_ino];
+}
+
+// identifies a version of the contents of a file without reading it; the path is not used, so a moved or renamed file is still found
+static NSString *signatureKeyForFileAtPath(NSString *path, BOOL *isDirectory) {
+    struct stat sb;
+    if (stat([path fileSystemRepresentation], &sb) != 0)
+        return nil;
+    if (isDirectory)
+        *isDirectory = S_ISDIR(sb.st_mode);
+    return [NSString stringWithFormat:@"%llu-%llu-%llu-%ld.%09ld", (unsigned long long)sb.st_dev, (unsigned long long)sb.st_ino, (unsigned long long)sb.st_size, (long)sb.st_mtimespec.tv_sec, (long)sb.st_mtimespec.tv_nsec];
+}
+
+static CFStringRef copyTypeOfFileAtURL(NSURL *aURL) {
+    FSRef fileRef;
+    CFStringRef theUTI = NULL;
+    if (CFURLGetFSRef((CFURLRef)aURL, &fileRef))
+        LSCopyItemAttribute(&fileRef, kLSRolesAll, kLSItemContentType, (CFTypeRef *)&theUTI);
+    return theUTI;
+}
+
+// we only extract text from the types that dominate our linked files, SearchKit's importers handle the rest
+static NSString *extractTextFromFileAtURL(NSURL *aURL) {
+    CFStringRef theUTI = copyTypeOfFileAtURL(aURL);
+    NSString *text = nil;
+    if (theUTI && UTTypeConformsTo(theUTI, kUTTypePDF)) {
+        PDFDocument *pdfDoc = [[PDFDocument alloc] initWithURL:aURL];
+        if (pdfDoc)
+            text = [[pdfDoc string] copy] ?: @"";
+        [pdfDoc release];
+        [text autorelease];
+    } else if (theUTI && UTTypeConformsTo(theUTI, kUTTypePlainText)) {
+        text = [NSString stringWithContentsOfURL:aURL usedEncoding:NULL error:NULL];
+    }
+    if (theUTI)
+        CFRelease(theUTI);
+    return text;
+}
+
+- (NSData *)signatureForFileURL:(NSURL *)aURL {
+    NSString *path = [aURL path];
+    BOOL isDir = NO;
+    NSString *signatureKey = signatureKeyForFileAtPath(path, &isDir);
+    NSData *signature = nil;
+    
+    if (signatureKey == nil || isDir)
+        return nil;
+    
+    @synchronized(self) {
+        signature = [[[signatures objectForKey:signatureKey] retain] autorelease];
+    }
+    if (signature)
+        return signature;
+    
+    // computing the signature means reading the whole file, so we only do that when we have not seen this version of the file before
+    NSString *cachePath = [self pathForKey:[[[signatureKey dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString] inFolder:SIGNATURES_FOLDER];
+    signature = [self cachedDataAtPath:cachePath];
+    if ([signature length] == 0) {
+        if ((signature = [NSData sha1SignatureForFile:path]) == nil)
+            return nil;
+        [self setCachedData:signature atPath:cachePath];
+    }
+    @synchronized(self) {
+        if ([signatures count] >= MAX_SIGNATURES)
+            [signatures removeAllObjects];
+        [signatures setObject:signature forKey:signatureKey];
+    }
+    return signature;
+}
+
+- (NSString *)textForFileURL:(NSURL *)aURL signature:(NSData *)signature {
+    if (signature == nil && (signature = [self signatureForFileURL:aURL]) == nil)
+        return nil;
+    
+    NSString *cachePath = [self pathForKey:[signature hexString] inFolder:TEXT_FOLDER];
+    NSString *text = [self cachedStringAtPath:cachePath];
+    if (text == nil) {
+        text = extractTextFromFileAtURL(aURL);
+        if (text)
+            [self setCachedString:text atPath:cachePath];
+    }
+    return text;
+}
+
+- (NSString *)textForFileURL:(NSURL *)aURL {
+    return [self textForFileURL:aURL signature:nil];
+}
+
+- (NSString *)notesForFileURL:(NSURL *)aURL {
+    NSString *path = [aURL path];
+    BOOL isDir = NO;
+    NSString *fileKey = keyForFileAtPath(path, YES, &isDir);
+    
+    if (fileKey == nil)
+        return nil;
+    
+    // the dates of a PDF bundle do not change when the notes inside it change, so we do not cache those
+    NSString *cachePath = isDir ? nil : [self pathForKey:[[[fileKey dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString] inFolder:NOTES_FOLDER];
+    NSString *notesString = cachePath ? [self cachedStringAtPath:cachePath] : nil;
+    
+    if (notesString == nil) {
+        NSFileManager *fm = [[NSFileManager alloc] init];
+        CFStringRef theUTI = copyTypeOfFileAtURL(aURL);
+        if (theUTI && UTTypeConformsTo(theUTI, CFSTR("net.sourceforge.skim-app.pdfd")))
+            notesString = [fm readSkimTextNotesFromPDFBundleAtURL:aURL error:NULL];
+        else
+            notesString = [fm readSkimTextNotesFromExtendedAttributesAtURL:aURL error:NULL];
+        if (notesString == nil) {
+            NSArray *notes = nil;
+            if (theUTI && UTTypeConformsTo(theUTI, CFSTR("net.sourceforge.skim-app.pdfd")))
+                notes = [fm readSkimNotesFromPDFBundleAtURL:aURL error:NULL];
+            else if (theUTI && UTTypeConformsTo(theUTI, CFSTR("net.sourceforge.skim-app.skimnotes")))
+                notes = [fm readSkimNotesFromSkimFileAtURL:aURL error:NULL];
+            else
+                notes = [fm readSkimNotesFromExtendedAttributesAtURL:aURL error:NULL];
+            if (notes)
+                notesString = SKNSkimTextNotes(notes);
+        }
+        if (theUTI)
+            CFRelease(theUTI);
+        [fm release];
+        // also cache files without notes, as most files have none
+        if (cachePath)
+            [self setCachedString:notesString ?: @"" atPath:cachePath];
+    }
+    
+    return [notesString length] ? notesString : nil;
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKTextExtractionCache (Private)
+
+- (NSString *)pathForKey:(NSString *)key inFolder:(NSString *)folder {
+    // spread the entries over subfolders, so no single folder gets too large
+    return [[[cacheFolder stringByAppendingPathComponent:folder] stringByAppendingPathComponent:[key substringToIndex:2]] stringByAppendingPathComponent:[key stringByAppendingPathExtension:@"txt"]];
+}
+
+- (NSData *)cachedDataAtPath:(NSString *)path {
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMapped error:NULL];
+    // mark the entry as recently used
+    if (data)
+        utimes([path fileSystemRepresentation], NULL);
+    return data;
+}
+
+- (NSString *)cachedStringAtPath:(NSString *)path {
+    NSData *data = [self cachedDataAtPath:path];
+    return data ? [[[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding] autorelease] : nil;
+}
+
+- (void)setCachedString:(NSString *)string atPath:(NSString *)path {
+    [self setCachedData:[string dataUsingEncoding:NSUTF8StringEncoding] atPath:path];
+}
+
+- (void)setCachedData:(NSData *)data atPath:(NSString *)path {
+    NSFileManager *fm = [[NSFileManager alloc] init];
+    NSString *folder = [path stringByDeletingLastPathComponent];
+    if ([fm fileExistsAtPath:folder] == NO)
+        [fm createDirectoryAtPath:folder withIntermediateDirectories:YES attributes:nil error:NULL];
+    [fm release];
+    
+    if ([data writeToFile:path atomically:YES] == NO)
+        return;
+    
+    BOOL shouldEvict = NO;
+    @synchronized(self) {
+        if (hasCurrentSize) {
+            currentSize += [data length];
+            shouldEvict = currentSize > maxSize;
+        } else {
+            // we only find the size of the cache when we first write to it, and then check it right away
+            shouldEvict = YES;
+        }
+    }
+    if (shouldEvict)
+        [self removeLeastRecentlyUsedEntries];
+}
+
+- (void)removeLeastRecentlyUsedEntries {
+    @synchronized(self) {
+        NSFileManager *fm = [[NSFileManager alloc] init];
+        NSMutableArray *entries = [NSMutableArray array];
+        NSDirectoryEnumerator *dirEnum = [fm enumeratorAtPath:cacheFolder];
+        NSString *file;
+        unsigned long long size = 0;
+        
+        while ((file = [dirEnum nextObject])) {
+            NSDictionary *attrs = [dirEnum fileAttributes];
+            if ([[attrs fileType] isEqualToString:NSFileTypeRegular]) {
+                [entries addObject:[NSDictionary dictionaryWithObjectsAndKeys:[cacheFolder stringByAppendingPathComponent:file], @"path", [attrs fileModificationDate], @"date", [NSNumber numberWithUnsignedLongLong:[attrs fileSize]], @"size", nil]];
+                size += [attrs fileSize];
+            }
+        }
+        
+        if (size > maxSize) {
+            unsigned long long targetSize = (unsigned long long)(EVICTION_FRACTION * maxSize);
+            NSSortDescriptor *sort = [[NSSortDescriptor alloc] initWithKey:@"date" ascending:YES];
+            [entries sortUsingDescriptors:[NSArray arrayWithObjects:sort, nil]];
+            [sort release];
+            for (NSDictionary *entry in entries) {
+                if (size <= targetSize)
+                    break;
+                if ([fm removeItemAtPath:[entry objectForKey:@"path"] error:NULL])
+                    size -= [[entry objectForKey:@"size"] unsignedLongLongValue];
+            }
+        }
+        
+        [fm release];
+        currentSize = size;
+        hasCurrentSize = YES;
+    }
+}
+
+@end
@@ -96,6 +96,13 @@
 
 + (BDSKTypeManager *)sharedManager;
 
+// Field IDs; these are thread safe, only adding a new field name takes a lock
++ (NSUInteger)fieldIDForFieldName:(NSString *)name;
+// does not add the field name, returns NSNotFound when the field name has not been seen before
++ (NSUInteger)existingFieldIDForFieldName:(NSString *)name;
++ (NSString *)fieldNameForFieldID:(NSUInteger)fieldID;
++ (NSString *)internedFieldName:(NSString *)name;
+
 // Updating
 - (void)updateUserTypes:(NSArray *)newTypes andFields:(NSDictionary *)newFieldsForTypes;
 - (void)updateCustomFields;
@@ -40,6 +40,8 @@
 #import "NSFileManager_BDSKExtensions.h"
 #import "NSCharacterSet_BDSKExtensions.h"
 #import "BDSKStringConstants.h"
+#import <pthread.h>
+#import <libkern/OSAtomic.h>
 
 // The filename and keys used in the plist
 #define TYPE_INFO_FILENAME                    @"TypeInfo"
@@ -97,13 +99,168 @@
 static BDSKTypeManager *sharedManager = nil;
 
 + (BDSKTypeManager *)sharedManager{
-    // this class is not thread safe
-    BDSKASSERT([NSThread isMainThread]);
+    // this class is not thread safe, except for the tables for the import tags, which never change, and the field IDs
+    // the parsers use those on other threads, so the shared manager should be created on the main thread before that
+    BDSKASSERT([NSThread isMainThread] || sharedManager != nil);
     if (sharedManager == nil)
         sharedManager = [[self alloc] init];
     return sharedManager;
 }
 
+#pragma mark Field IDs
+
+// field names get a unique ID the first time they are stored; the interned name is the canonical string for the ID
+// the tables are append-only and new entries are published with a memory barrier, so lookups don't need a lock
+// only adding a name takes the lock; when a table grows, the old one is leaked, because a reader may still use it
+
+typedef struct _BDSKFieldIDTable {
+    NSUInteger capacity;
+    NSUInteger count;
+    NSString **names;
+    NSString **internedNames;
+    NSUInteger *fieldIDs;
+    NSUInteger *internedFieldIDs;
+} BDSKFieldIDTable;
+
+typedef struct _BDSKFieldNameList {
+    NSUInteger capacity;
+    NSString **names;
+} BDSKFieldNameList;
+
+static BDSKFieldIDTable * volatile fieldIDTable = NULL;
+static BDSKFieldNameList * volatile fieldNameList = NULL;
+static NSUInteger fieldIDCount = 0;
+static pthread_mutex_t fieldIDLock = PTHREAD_MUTEX_INITIALIZER;
+
+#define FIELD_ID_TABLE_MIN_CAPACITY 256
+
+static inline NSUInteger pointerHash(const void *ptr) {
+    return (NSUInteger)ptr >> 4;
+}
+
+static inline BOOL getFieldIDForFieldName(BDSKFieldIDTable *table, NSString *name, NSUInteger *fieldID) {
+    if (table == NULL)
+        return NO;
+    
+    NSUInteger mask = table->capacity - 1, i;
+    NSString *slotName;
+    
+    // interned names are found by pointer, so we don't need to hash the string
+    for (i = pointerHash(name) & mask; (slotName = table->internedNames[i]); i = (i + 1) & mask) {
+        if (slotName == name) {
+            OSMemoryBarrier();
+            *fieldID = table->internedFieldIDs[i];
+            return YES;
+        }
+    }
+    for (i = [name hash] & mask; (slotName = table->names[i]); i = (i + 1) & mask) {
+        if (slotName == name || [slotName isEqualToString:name]) {
+            OSMemoryBarrier();
+            *fieldID = table->fieldIDs[i];
+            return YES;
+        }
+    }
+    return NO;
+}
+
+// the ID is written before the name, which publishes the slot for readers
+static void addFieldIDToTable(BDSKFieldIDTable *table, NSString *name, NSUInteger fieldID) {
+    NSUInteger mask = table->capacity - 1, i;
+    
+    for (i = pointerHash(name) & mask; table->internedNames[i]; i = (i + 1) & mask) {}
+    table->internedFieldIDs[i] = fieldID;
+    OSMemoryBarrier();
+    table->internedNames[i] = name;
+    
+    for (i = [name hash] & mask; table->names[i]; i = (i + 1) & mask) {}
+    table->fieldIDs[i] = fieldID;
+    OSMemoryBarrier();
+    table->names[i] = name;
+    
+    table->count++;
+}
+
+static BDSKFieldIDTable *createFieldIDTable(NSUInteger capacity) {
+    BDSKFieldIDTable *table = (BDSKFieldIDTable *)NSZoneMalloc(NULL, sizeof(BDSKFieldIDTable));
+    table->capacity = capacity;
+    table->count = 0;
+    table->names = (NSString **)NSZoneCalloc(NULL, capacity, sizeof(NSString *));
+    table->internedNames = (NSString **)NSZoneCalloc(NULL, capacity, sizeof(NSString *));
+    table->fieldIDs = (NSUInteger *)NSZoneCalloc(NULL, capacity, sizeof(NSUInteger));
+    table->internedFieldIDs = (NSUInteger *)NSZoneCalloc(NULL, capacity, sizeof(NSUInteger));
+    return table;
+}
+
+static BDSKFieldNameList *createFieldNameList(NSUInteger capacity) {
+    BDSKFieldNameList *list = (BDSKFieldNameList *)NSZoneMalloc(NULL, sizeof(BDSKFieldNameList));
+    list->capacity = capacity;
+    list->names = (NSString **)NSZoneCalloc(NULL, capacity, sizeof(NSString *));
+    return list;
+}
+
+// should be called with the lock held
+static NSUInteger addFieldName(NSString *name) {
+    BDSKFieldIDTable *table = fieldIDTable;
+    BDSKFieldNameList *list = fieldNameList;
+    NSString *internedName = [name copy];
+    NSUInteger fieldID = fieldIDCount, i;
+    
+    // keep the table at most half full, so probing stays short
+    if (table == NULL || 2 * (table->count + 1) > table->capacity) {
+        BDSKFieldIDTable *newTable = createFieldIDTable(table ? 2 * table->capacity : FIELD_ID_TABLE_MIN_CAPACITY);
+        for (i = 0; i < fieldIDCount; i++)
+            addFieldIDToTable(newTable, list->names[i], i);
+        OSMemoryBarrier();
+        fieldIDTable = table = newTable;
+    }
+    if (list == NULL || fieldID >= list->capacity) {
+        BDSKFieldNameList *newList = createFieldNameList(list ? 2 * list->capacity : FIELD_ID_TABLE_MIN_CAPACITY);
+        if (list)
+            memcpy(newList->names, list->names, fieldIDCount * sizeof(NSString *));
+        OSMemoryBarrier();
+        fieldNameList = list = newList;
+    }
+    
+    // the name must be available before its ID can be found
+    list->names[fieldID] = internedName;
+    OSMemoryBarrier();
+    addFieldIDToTable(table, internedName, fieldID);
+    fieldIDCount++;
+    
+    return fieldID;
+}
+
++ (NSUInteger)fieldIDForFieldName:(NSString *)name {
+    NSUInteger fieldID = NSNotFound;
+    
+    if (name && getFieldIDForFieldName(fieldIDTable, name, &fieldID) == NO) {
+        pthread_mutex_lock(&fieldIDLock);
+        // another thread may have added it in the mean time
+        if (getFieldIDForFieldName(fieldIDTable, name, &fieldID) == NO)
+            fieldID = addFieldName(name);
+        pthread_mutex_unlock(&fieldIDLock);
+    }
+    
+    return fieldID;
+}
+
++ (NSUInteger)existingFieldIDForFieldName:(NSString *)name {
+    NSUInteger fieldID = NSNotFound;
+    if (name)
+        getFieldIDForFieldName(fieldIDTable, name, &fieldID);
+    return fieldID;
+}
+
++ (NSString *)fieldNameForFieldID:(NSUInteger)fieldID {
+    BDSKFieldNameList *list = fieldNameList;
+    // interned names are never removed, so we don't need to retain/autorelease
+    return (list && fieldID < list->capacity) ? list->names[fieldID] : nil;
+}
+
++ (NSString *)internedFieldName:(NSString *)name {
+    return name ? [self fieldNameForFieldID:[self fieldIDForFieldName:name]] : nil;
+}
+
 static NSString *BDSKUserTypeInfoPath() {
     return [[[[NSFileManager defaultManager] applicationSupportDirectory] stringByAppendingPathComponent:TYPE_INFO_FILENAME] stringByAppendingPathExtension:@"plist"];
 }
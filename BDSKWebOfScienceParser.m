@@ -42,18 +42,19 @@
 #import "BDSKTypeManager.h"
 #import "NSError_BDSKExtensions.h"
 
+// set up in +initialize rather than lazily, as the parser can be used on several threads at once
+static NSCharacterSet *uppercaseASCIICharacterSet = nil;
+static NSCharacterSet *removeSet = nil;
+
 static void mergePageNumbers(NSMutableDictionary *dict)
 {
     NSArray *keys = [dict allKeys];
     NSString *merge;
     
     // need translated key names
-    static NSString *bpName = nil;
-    static NSString *epName = nil;
-    if(bpName == nil){
-        bpName = [[[BDSKTypeManager sharedManager] fieldNameForWebOfScienceTag:@"BP"] copy];
-        epName = [[[BDSKTypeManager sharedManager] fieldNameForWebOfScienceTag:@"EP"] copy];
-    }
+    BDSKTypeManager *typeManager = [BDSKTypeManager sharedManager];
+    NSString *bpName = [typeManager fieldNameForWebOfScienceTag:@"BP"];
+    NSString *epName = [typeManager fieldNameForWebOfScienceTag:@"EP"];
     
     if([keys containsObject:bpName] && [keys containsObject:epName]){
         merge = [[[dict objectForKey:bpName] stringByAppendingString:@"--"] stringByAppendingString:[dict objectForKey:epName]];
@@ -101,10 +102,6 @@ isTagLine(NSString *sourceLine)
 {
     NSCParameterAssert(sourceLine && [sourceLine length] >= 2);
     
-    static NSCharacterSet *uppercaseASCIICharacterSet = nil;
-    if(uppercaseASCIICharacterSet == nil)
-        uppercaseASCIICharacterSet = [[NSCharacterSet characterSetWithRange:NSMakeRange('A', 26)] retain];        
-
     unichar ch1 = [sourceLine characterAtIndex:0];
     unichar ch2 = [sourceLine characterAtIndex:1];
     return ([uppercaseASCIICharacterSet characterIsMember:ch1] && ([uppercaseASCIICharacterSet characterIsMember:ch2] || [[NSCharacterSet decimalDigitCharacterSet] characterIsMember:ch2]));
@@ -112,12 +109,6 @@ isTagLine(NSString *sourceLine)
 
 static void fixDateBySplittingString(NSMutableDictionary *pubDict)
 {
-    static NSMutableCharacterSet *removeSet = nil;
-    if(removeSet == nil){
-        removeSet = [[NSCharacterSet decimalDigitCharacterSet] mutableCopy];
-        [removeSet formUnionWithCharacterSet:[NSCharacterSet whitespaceCharacterSet]];
-    }
-        
     // sometimes the date is just the month, sometimes it's Month + numeric day
     NSString *dateString = [pubDict objectForKey:@"Date"];
     if(dateString != nil){
@@ -142,6 +133,15 @@ static void fixDateBySplittingString(NSMutableDictionary *pubDict)
 
 @implementation BDSKWebOfScienceParser
 
++ (void)initialize{
+    BDSKINITIALIZE;
+    uppercaseASCIICharacterSet = [[NSCharacterSet characterSetWithRange:NSMakeRange('A', 26)] retain];
+    NSMutableCharacterSet *set = [[NSCharacterSet decimalDigitCharacterSet] mutableCopy];
+    [set formUnionWithCharacterSet:[NSCharacterSet whitespaceCharacterSet]];
+    removeSet = [set copy];
+    [set release];
+}
+
 + (BOOL)canParseString:(NSString *)string{
     // remove leading newlines in case this originates from copy/paste
     string = [string stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]];
@@ -61,6 +61,8 @@ typedef struct _BDSKZoomGroupFlags {
     BDSKZoomGroupFlags flags;
     BDSKReadWriteLock *infoLock;
     NSString *errorMessage;
+    NSString *prefetchSearchTerm;       // only used on the server thread
+    NSMutableArray *prefetchedResults;  // only used on the server thread
 }
 + (NSArray *)supportedRecordSyntaxes;
 + (ZOOMSyntaxType)zoomRecordSyntaxForRecordSyntaxString:(NSString *)syntax;
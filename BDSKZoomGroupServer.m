@@ -44,6 +44,7 @@
 #import "CFString_BDSKExtensions.h"
 #import <SystemConfiguration/SystemConfiguration.h>
 #import "BDSKReadWriteLock.h"
+#import "BDSKSearchGroupCache.h"
 
 #define MAX_RESULTS 100
 
@@ -102,6 +103,8 @@
         fetchedResults = 0;
         errorMessage = nil;
         infoLock = [[BDSKReadWriteLock alloc] init];
+        prefetchSearchTerm = nil;
+        prefetchedResults = [[NSMutableArray alloc] init];
         [self startDOServerSync];
     }
     return self;
@@ -114,6 +117,8 @@
     BDSKDESTROY(connection);
     BDSKDESTROY(serverInfo);
     BDSKDESTROY(errorMessage);
+    BDSKDESTROY(prefetchSearchTerm);
+    BDSKDESTROY(prefetchedResults);
     [super dealloc];
 }
 
@@ -260,12 +265,20 @@
 
 #pragma mark Server thread 
 
+- (void)clearPrefetchedResults;
+{
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(prefetchResults) object:nil];
+    [prefetchedResults removeAllObjects];
+    BDSKDESTROY(prefetchSearchTerm);
+}
+
 - (void)resetConnection;
 {
     BDSKServerInfo *info = [self serverInfo];
     
     BDSKASSERT([info host] != nil);
     
+    [self clearPrefetchedResults];
     BDSKDESTROY(connection);
     if ([info host] != nil) {
         connection = [[ZOOMConnection alloc] initWithHost:[info host] port:[[info port] integerValue] database:[info database]];
@@ -293,68 +306,141 @@
 
 - (oneway void)terminateConnection;
 {
+    [self clearPrefetchedResults];
     BDSKDESTROY(connection);
     OSAtomicCompareAndSwap32Barrier(0, 1, &flags.needsReset);
     OSAtomicCompareAndSwap32Barrier(1, 0, &flags.isRetrieving);
 } 
 
+// the resultSet is cached for each searchTerm, so we have no overhead calling it for retrieving more results
+- (ZOOMResultSet *)resultSetForSearchTerm:(NSString *)searchTerm;
+{
+    BDSKServerInfo *info = [self serverInfo];
+    
+    if ([info removeDiacritics]) {
+        CFMutableStringRef mutableCopy = (CFMutableStringRef)[[searchTerm mutableCopy] autorelease];
+        CFStringNormalize(mutableCopy, kCFStringNormalizationFormD);
+        BDDeleteCharactersInCharacterSet(mutableCopy, CFCharacterSetGetPredefined(kCFCharacterSetNonBase));
+        searchTerm = (NSString *)mutableCopy;
+    }
+    
+    ZOOMQuery *query = [ZOOMQuery queryWithCCLString:searchTerm config:[[info options] objectForKey:@"queryConfig"]];
+    
+    return query ? [connection resultsForQuery:query] : nil;
+}
+
+- (NSArray *)resultsInRange:(NSRange)range ofResultSet:(ZOOMResultSet *)resultSet;
+{
+    BOOL isOPAC = [[[self serverInfo] recordSyntax] isEqualToString:OPAC_STRING];
+    NSArray *records = [resultSet recordsInRange:range];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:[records count]];
+    for (id result in records) {
+        NSString *rawString = isOPAC ? [result opacString] : [result rawString];
+        NSString *renderedString = [result renderedString];
+        NSDictionary *resultDict = [[NSDictionary alloc] initWithObjectsAndKeys:rawString, @"rawString", renderedString, @"renderedString", nil];
+        [results addObject:resultDict];
+        [resultDict release];
+    }
+    return results;
+}
+
+// gets the next page ahead of time, one page per run loop cycle so new requests from the main thread are handled in between
+- (void)prefetchResults;
+{
+    NSInteger depth = BDSKSearchGroupPrefetchDepth();
+    NSInteger start = [self numberOfFetchedResults] + [prefetchedResults count];
+    NSInteger numResults = MIN([self numberOfAvailableResults] - start, MAX_RESULTS);
+    
+    if (numResults <= 0 || (NSInteger)[prefetchedResults count] >= depth * MAX_RESULTS || connection == nil || prefetchSearchTerm == nil || [self shouldKeepRunning] == NO)
+        return;
+    
+    NSArray *results = [self resultsInRange:NSMakeRange(start, numResults) ofResultSet:[self resultSetForSearchTerm:prefetchSearchTerm]];
+    if ([results count] == 0)
+        return;
+    [prefetchedResults addObjectsFromArray:results];
+    
+    [self performSelector:@selector(prefetchResults) withObject:nil afterDelay:0.0];
+}
+
 - (oneway void)downloadWithSearchTerm:(NSString *)searchTerm;
 {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(prefetchResults) object:nil];
+    
     // only reset the connection when we're actually going to use it, since a mixed host/database/port won't work
     OSMemoryBarrier();
     if (flags.needsReset)
         [self resetConnection];
     
+    // results we got ahead of time are only valid for the same search
+    if ([searchTerm isEqualToString:prefetchSearchTerm] == NO) {
+        [prefetchedResults removeAllObjects];
+        [prefetchSearchTerm release];
+        prefetchSearchTerm = [searchTerm copy];
+    }
+    
     NSMutableArray *results = nil;
     
+    BOOL isCached = NO;
+    
     if (NO == [NSString isEmptyString:searchTerm]){
         
+        BDSKSearchGroupCache *cache = [BDSKSearchGroupCache sharedCache];
         BDSKServerInfo *info = [self serverInfo];
+        NSInteger startIndex = [self numberOfFetchedResults];
+        NSInteger cachedCount = 0, cachedAvailableResults = 0;
+        NSArray *cachedResults = [cache resultsForServerInfo:info searchTerm:searchTerm startIndex:startIndex count:&cachedCount availableResults:&cachedAvailableResults allowExpired:NO];
+        ZOOMResultSet *resultSet = nil;
         
-        if ([info removeDiacritics]) {
-            CFMutableStringRef mutableCopy = (CFMutableStringRef)[[searchTerm mutableCopy] autorelease];
-            CFStringNormalize(mutableCopy, kCFStringNormalizationFormD);
-            BDDeleteCharactersInCharacterSet(mutableCopy, CFCharacterSetGetPredefined(kCFCharacterSetNonBase));
-            searchTerm = (NSString *)mutableCopy;
-        }
-        
-        BOOL isOPAC = [[info recordSyntax] isEqualToString:OPAC_STRING];
-        
-        // the resultSet is cached for each searchTerm, so we have no overhead calling it for retrieving more results
-        ZOOMQuery *query = [ZOOMQuery queryWithCCLString:searchTerm config:[[info options] objectForKey:@"queryConfig"]];
-        
-        ZOOMResultSet *resultSet = query ? [connection resultsForQuery:query] : nil;
-        
-        if (nil == resultSet) {
-            OSAtomicCompareAndSwap32Barrier(0, 1, &flags.failedDownload);
-            [self setErrorMessage:NSLocalizedString(@"Could not retrieve results", @"")];
+        if (cachedResults == nil) {
+            resultSet = [self resultSetForSearchTerm:searchTerm];
+            // use old results when the server is not available
+            if (nil == resultSet)
+                cachedResults = [cache resultsForServerInfo:info searchTerm:searchTerm startIndex:startIndex count:&cachedCount availableResults:&cachedAvailableResults allowExpired:YES];
         }
         
-        int32_t newAvailableResults = [resultSet countOfRecords];
-        OSAtomicCompareAndSwap32Barrier(availableResults, newAvailableResults, &availableResults);
-        
-        NSInteger numResults = MIN([self numberOfAvailableResults] - [self numberOfFetchedResults], MAX_RESULTS);
-        //NSAssert(numResults >= 0, @"number of results to get must be non-negative");
-        
-        if(numResults > 0){
-            NSArray *records = [resultSet recordsInRange:NSMakeRange([self numberOfFetchedResults], numResults)];
-            int32_t newNumberOfFetchedResults = [self numberOfFetchedResults] + numResults;
+        if (cachedResults) {
+            
+            isCached = YES;
+            results = [NSMutableArray arrayWithArray:cachedResults];
+            [prefetchedResults removeAllObjects];
+            OSAtomicCompareAndSwap32Barrier(availableResults, (int32_t)cachedAvailableResults, &availableResults);
+            OSAtomicCompareAndSwap32Barrier(fetchedResults, (int32_t)(startIndex + cachedCount), &fetchedResults);
             
-            OSAtomicCompareAndSwap32Barrier(fetchedResults, newNumberOfFetchedResults, &fetchedResults);
+        } else {
             
-            results = [NSMutableArray array];
-            for (id result in records) {
-                NSString *rawString = isOPAC ? [result opacString] : [result rawString];
-                NSString *renderedString = [result renderedString];
-                NSDictionary *resultDict = [[NSDictionary alloc] initWithObjectsAndKeys:rawString, @"rawString", renderedString, @"renderedString", nil];
-                [results addObject:resultDict];
-                [resultDict release];
+            if (nil == resultSet) {
+                OSAtomicCompareAndSwap32Barrier(0, 1, &flags.failedDownload);
+                [self setErrorMessage:NSLocalizedString(@"Could not retrieve results", @"")];
+            }
+            
+            int32_t newAvailableResults = [resultSet countOfRecords];
+            OSAtomicCompareAndSwap32Barrier(availableResults, newAvailableResults, &availableResults);
+            
+            NSInteger numResults = MIN([self numberOfAvailableResults] - [self numberOfFetchedResults], MAX_RESULTS);
+            //NSAssert(numResults >= 0, @"number of results to get must be non-negative");
+            
+            if(numResults > 0){
+                NSInteger numPrefetched = MIN(numResults, (NSInteger)[prefetchedResults count]);
+                NSRange prefetchedRange = NSMakeRange(0, numPrefetched);
+                
+                results = [NSMutableArray arrayWithArray:[prefetchedResults subarrayWithRange:prefetchedRange]];
+                [prefetchedResults removeObjectsInRange:prefetchedRange];
+                if (numPrefetched < numResults)
+                    [results addObjectsFromArray:[self resultsInRange:NSMakeRange([self numberOfFetchedResults] + numPrefetched, numResults - numPrefetched) ofResultSet:resultSet]];
+                
+                int32_t newNumberOfFetchedResults = [self numberOfFetchedResults] + numResults;
+                
+                OSAtomicCompareAndSwap32Barrier(fetchedResults, newNumberOfFetchedResults, &fetchedResults);
+                
+                [cache setResults:results count:numResults availableResults:newAvailableResults forServerInfo:info searchTerm:searchTerm startIndex:startIndex];
             }
         }
-        
     }
     
     [[self serverOnMainThread] addPublicationsFromResults:results];
+    
+    if ([results count] > 0 && isCached == NO)
+        [self performSelector:@selector(prefetchResults) withObject:nil afterDelay:0.0];
 }
 
 - (void)serverDidFinish{
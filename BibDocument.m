@@ -71,6 +71,7 @@
 #import "BDSKConverter.h"
 #import "BDSKBibTeXParser.h"
 #import "BDSKStringParser.h"
+#import "BDSKMARCParser.h"
 
 #import <ApplicationServices/ApplicationServices.h>
 #import "BDSKImagePopUpButton.h"
@@ -158,6 +159,8 @@ NSString *BDSKDocumentPublicationsKey = @"publications";
 #define BDSKRemoveExtendedAttributesFromDocumentsKey @"BDSKRemoveExtendedAttributesFromDocuments"
 #define BDSKDisableDocumentExtendedAttributesKey @"BDSKDisableDocumentExtendedAttributes"
 #define BDSKDisableExportAttributesKey @"BDSKDisableExportAttributes"
+// large catalog dumps import much faster without the formatted record as annote
+#define BDSKOmitMARCAnnoteKey @"BDSKOmitMARCAnnote"
 
 #pragma mark -
 
@@ -169,6 +172,7 @@ NSString *BDSKDocumentPublicationsKey = @"publications";
 @implementation BibDocument
 
 static NSOperationQueue *metadataCacheQueue = nil;
+static NSOperationQueue *importQueue = nil;
 
 + (void)handleApplicationWillTerminate:(NSNotification *)note {
     [metadataCacheQueue cancelAllOperations];
@@ -180,6 +184,9 @@ static NSOperationQueue *metadataCacheQueue = nil;
     metadataCacheQueue = [[NSOperationQueue alloc] init];
     [metadataCacheQueue setMaxConcurrentOperationCount:1];
     
+    importQueue = [[NSOperationQueue alloc] init];
+    [importQueue setMaxConcurrentOperationCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+    
     [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(handleApplicationWillTerminate:) name:NSApplicationWillTerminateNotification object:NSApp];
     
     [NSImage makePreviewDisplayImages];
@@ -1087,7 +1094,13 @@ static NSPopUpButton *popUpButtonSubview(NSView *view)
                 @finally { [pool release]; }
             }
             
-            BDSKMetadataCacheOperation *operation = [[[BDSKMetadataCacheOperation alloc] initWithPublicationInfos:pubsInfo forDocumentURL:saveTargetURL] autorelease];
+            BDSKMetadataCacheOperation *operation = [[[BDSKMetadataCacheOperation alloc] initWithPublicationInfos:pubsInfo citeKeys:[[self publications] valueForKey:@"citeKey"] forDocumentURL:saveTargetURL] autorelease];
+            // a burst of saves is written in a single operation, by taking over the items of an earlier save that is still waiting
+            // the earlier operation then finishes without doing anything
+            for (BDSKMetadataCacheOperation *waitingOperation in [metadataCacheQueue operations]) {
+                if ([waitingOperation isKindOfClass:[BDSKMetadataCacheOperation class]])
+                    [operation coalesceWithOperation:waitingOperation];
+            }
             [metadataCacheQueue addOperation:operation];
             [pubsInfo release];
             
@@ -2103,43 +2116,142 @@ static NSPopUpButton *popUpButtonSubview(NSView *view)
 #pragma mark -
 #pragma mark New publications from pasteboard
 
+// we read and parse dropped files on the importQueue in batches of this many files, so we don't keep the contents of all files in memory
+#define IMPORT_BATCH_SIZE 64
+
+#define IMPORT_FILENAME_KEY      @"fileName"
+#define IMPORT_UTI_KEY           @"UTI"
+#define IMPORT_ENCODING_KEY      @"encoding"
+#define IMPORT_TYPE_KEY          @"type"
+#define IMPORT_STRING_KEY        @"string"
+#define IMPORT_ITEMS_KEY         @"items"
+#define IMPORT_ERROR_KEY         @"error"
+#define IMPORT_PARTIAL_DATA_KEY  @"partialData"
+#define IMPORT_BIBTEX_DATA_KEY   @"bibTeXData"
+#define IMPORT_ITEM_KEY          @"item"
+
+// runs the class methods for the file infos on the importQueue and returns their results in the same order; a result is NSNull when the operation returned nil
+// we don't block the main thread while we wait, so the status bar shows progress and the operations can message the main thread
+- (NSArray *)importResultsForFileInfos:(NSArray *)fileInfos selector:(SEL)selector {
+    BDSKASSERT([NSThread isMainThread]);
+    
+    if ([fileInfos count] == 0)
+        return [NSArray array];
+    
+    NSMutableArray *operations = [[NSMutableArray alloc] initWithCapacity:[fileInfos count]];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:[fileInfos count]];
+    
+    for (NSDictionary *fileInfo in fileInfos) {
+        NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:[self class] selector:selector object:fileInfo];
+        [operations addObject:operation];
+        [operation release];
+    }
+    
+    [importQueue addOperations:operations waitUntilFinished:NO];
+    
+	[self setStatus:[NSLocalizedString(@"Importing files. Please wait", @"Status message when importing dropped files") stringByAppendingEllipsis]];
+    [statusBar setProgressIndicatorStyle:BDSKProgressIndicatorSpinningStyle];
+	[statusBar startAnimation:nil];
+    
+    // this only handles timers, input sources and messages from other threads, user events wait until we're done
+    for (NSInvocationOperation *operation in operations) {
+        while ([operation isFinished] == NO)
+            [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+    }
+    
+	[statusBar stopAnimation:nil];
+    [statusBar setProgressIndicatorStyle:BDSKProgressIndicatorNone];
+	[self updateStatus];
+    
+    for (NSInvocationOperation *operation in operations)
+        [results addObject:[operation result] ?: [NSNull null]];
+    [operations release];
+    
+    return results;
+}
+
+// called on the importQueue, this should not touch any document
++ (NSDictionary *)importInfoForLinkedFile:(NSDictionary *)fileInfo {
+    NSString *fnStr = [fileInfo objectForKey:IMPORT_FILENAME_KEY];
+    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    NSData *btData = nil;
+    
+    // most reliable metadata should be our private EA
+    if ([[NSUserDefaults standardUserDefaults] boolForKey:BDSKReadExtendedAttributesKey]) {
+        btData = [[SKNExtendedAttributeManager sharedNoSplitManager] extendedAttributeNamed:BDSK_BUNDLE_IDENTIFIER @".bibtexstring" atPath:fnStr traverseLink:NO error:NULL];
+        if (btData)
+            [info setObject:btData forKey:IMPORT_BIBTEX_DATA_KEY];
+    }
+    
+    // GJ try parsing pdf to extract info that is then used to get a PubMed record; this can access the network, so it is the main reason to do this in parallel
+    if (btData == nil && [[fileInfo objectForKey:IMPORT_UTI_KEY] isEqualToUTI:(NSString *)kUTTypePDF] && [[NSUserDefaults standardUserDefaults] boolForKey:BDSKShouldParsePDFToGeneratePubMedSearchTermKey]) {
+        BibItem *item = [BibItem itemByParsingPDFFile:fnStr];
+        if (item)
+            [info setObject:item forKey:IMPORT_ITEM_KEY];
+    }
+    
+    return info;
+}
+
 - (NSArray *)publicationsForFiles:(NSArray *)filenames {
     NSMutableArray *newPubs = [NSMutableArray arrayWithCapacity:[filenames count]];
-	NSURL *url = nil;
-    	
-	for (NSString *fnStr in filenames) {
-        fnStr = [fnStr stringByStandardizingPath];
-		if(url = [NSURL fileURLWithPath:fnStr]){
-            NSError *xerror = nil;
+    NSUInteger i, iMax = [filenames count];
+    
+    for (i = 0; i < iMax; i += IMPORT_BATCH_SIZE) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSArray *batch = [filenames subarrayWithRange:NSMakeRange(i, MIN(IMPORT_BATCH_SIZE, iMax - i))];
+        NSMutableArray *fileInfos = [NSMutableArray arrayWithCapacity:[batch count]];
+        
+        for (NSString *fnStr in batch) {
+            fnStr = [fnStr stringByStandardizingPath];
+            NSString *theUTI = [[NSWorkspace sharedWorkspace] typeOfFile:[fnStr stringByResolvingSymlinksInPath] error:NULL];
+            [fileInfos addObject:[NSDictionary dictionaryWithObjectsAndKeys:fnStr, IMPORT_FILENAME_KEY, theUTI, IMPORT_UTI_KEY, nil]];
+        }
+        
+        NSArray *results = [self importResultsForFileInfos:fileInfos selector:@selector(importInfoForLinkedFile:)];
+        NSUInteger j, jMax = [fileInfos count];
+        
+        // the BibTeX parser and the PDF metadata are used on the main thread, in the original order
+        for (j = 0; j < jMax; j++) {
+            NSDictionary *fileInfo = [fileInfos objectAtIndex:j];
+            NSDictionary *result = [results objectAtIndex:j];
+            NSString *fnStr = [fileInfo objectForKey:IMPORT_FILENAME_KEY];
+            NSURL *url = [NSURL fileURLWithPath:fnStr];
             BibItem *newBI = nil;
             
-            // most reliable metadata should be our private EA
-            if([[NSUserDefaults standardUserDefaults] boolForKey:BDSKReadExtendedAttributesKey]){
-                NSData *btData = [[SKNExtendedAttributeManager sharedNoSplitManager] extendedAttributeNamed:BDSK_BUNDLE_IDENTIFIER @".bibtexstring" atPath:fnStr traverseLink:NO error:&xerror];
-                if(btData){
-                    NSString *btString = [[NSString alloc] initWithData:btData encoding:NSUTF8StringEncoding];
-                    BOOL isPartialData;
-                    NSArray *items = [BDSKBibTeXParser itemsFromString:btString owner:self isPartialData:&isPartialData error:&xerror];
-                    newBI = isPartialData ? nil : [items firstObject];
-                    [btString release];
-                }
+            if (url == nil)
+                continue;
+            
+            if ([result isEqual:[NSNull null]])
+                result = nil;
+            
+            NSData *btData = [result objectForKey:IMPORT_BIBTEX_DATA_KEY];
+            if (btData) {
+                NSString *btString = [[NSString alloc] initWithData:btData encoding:NSUTF8StringEncoding];
+                BOOL isPartialData;
+                NSArray *items = [BDSKBibTeXParser itemsFromString:btString owner:self isPartialData:&isPartialData error:NULL];
+                newBI = isPartialData ? nil : [items firstObject];
+                [btString release];
             }
             
-			// GJ try parsing pdf to extract info that is then used to get a PubMed record
-			if(newBI == nil && [[[NSWorkspace sharedWorkspace] typeOfFile:[[fnStr stringByStandardizingPath] stringByResolvingSymlinksInPath] error:NULL] isEqualToUTI:(NSString *)kUTTypePDF]){
-                if([[NSUserDefaults standardUserDefaults] boolForKey:BDSKShouldParsePDFToGeneratePubMedSearchTermKey])
-                    newBI = [BibItem itemByParsingPDFFile:fnStr];			
+            if (newBI == nil && [[fileInfo objectForKey:IMPORT_UTI_KEY] isEqualToUTI:(NSString *)kUTTypePDF]) {
+                newBI = [result objectForKey:IMPORT_ITEM_KEY];
+                // we only parsed the PDF when there was no EA
+                if (newBI == nil && btData && [[NSUserDefaults standardUserDefaults] boolForKey:BDSKShouldParsePDFToGeneratePubMedSearchTermKey])
+                    newBI = [BibItem itemByParsingPDFFile:fnStr];
                 // fall back on the least reliable metadata source (hidden pref)
-                if(newBI == nil && [[NSUserDefaults standardUserDefaults] boolForKey:BDSKShouldUsePDFMetadataKey])
+                if (newBI == nil && [[NSUserDefaults standardUserDefaults] boolForKey:BDSKShouldUsePDFMetadataKey])
                     newBI = [BibItem itemWithPDFMetadataFromURL:url];
-			}
-            if(newBI == nil)
+            }
+            if (newBI == nil)
                 newBI = [[[BibItem alloc] init] autorelease];
             
             [newBI addFileForURL:url autoFile:NO runScriptHook:NO];
-			[newPubs addObject:newBI];
-		}
-	}
+            [newPubs addObject:newBI];
+        }
+        
+        [pool release];
+    }
 	
 	return newPubs;
 }
@@ -2154,77 +2266,160 @@ static NSPopUpButton *popUpButtonSubview(NSView *view)
 	return pubs;
 }
 
+// called on the importQueue, this should not touch any document; BibTeX is parsed later on the main thread, as it needs the document
++ (NSDictionary *)importInfoForFile:(NSDictionary *)fileInfo {
+    NSString *fileName = [fileInfo objectForKey:IMPORT_FILENAME_KEY];
+    NSString *theUTI = [fileInfo objectForKey:IMPORT_UTI_KEY];
+    NSStringEncoding encoding = [[fileInfo objectForKey:IMPORT_ENCODING_KEY] unsignedIntegerValue];
+    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    
+    // binary MARC is parsed from the bytes, as the records specify their own encoding
+    NSData *contentData = [[NSData alloc] initWithContentsOfFile:fileName options:NSDataReadingMapped error:NULL];
+    if (contentData && [BDSKMARCParser canParseMARCData:contentData]) {
+        BOOL includeAnnote = NO == [[NSUserDefaults standardUserDefaults] boolForKey:BDSKOmitMARCAnnoteKey];
+        NSArray *contentArray = [BDSKMARCParser itemsFromMARCData:contentData includeAnnote:includeAnnote error:NULL];
+        [contentData release];
+        [info setObject:[NSNumber numberWithInteger:BDSKMARCStringType] forKey:IMPORT_TYPE_KEY];
+        if (contentArray)
+            [info setObject:contentArray forKey:IMPORT_ITEMS_KEY];
+        [info setObject:[NSNumber numberWithBool:NO] forKey:IMPORT_PARTIAL_DATA_KEY];
+        return info;
+    }
+    [contentData release];
+    
+    // try to create a string
+    NSString *contentString = [[NSString alloc] initWithContentsOfFile:fileName guessedEncoding:encoding];
+    
+    if (contentString != nil) {
+        BDSKStringType type = BDSKUnknownStringType;
+        
+        if ([theUTI isEqualToUTI:@"org.tug.tex.bibtex"])
+            type = BDSKBibTeXStringType;
+        else if([theUTI isEqualToUTI:@"net.sourceforge.bibdesk.ris"])
+            type = BDSKRISStringType;
+        else
+            type = [contentString contentStringType];
+        
+        [info setObject:[NSNumber numberWithInteger:type] forKey:IMPORT_TYPE_KEY];
+        
+        if (type == BDSKBibTeXStringType || type == BDSKNoKeyBibTeXStringType) {
+            [info setObject:contentString forKey:IMPORT_STRING_KEY];
+        } else if (type != BDSKUnknownStringType) {
+            NSError *parseError = nil;
+            BOOL isPartialData = NO;
+            NSArray *contentArray = [BDSKStringParser itemsFromString:contentString ofType:type owner:nil isPartialData:&isPartialData error:&parseError];
+            if (contentArray)
+                [info setObject:contentArray forKey:IMPORT_ITEMS_KEY];
+            if (parseError)
+                [info setObject:parseError forKey:IMPORT_ERROR_KEY];
+            [info setObject:[NSNumber numberWithBool:isPartialData] forKey:IMPORT_PARTIAL_DATA_KEY];
+        }
+        
+        [contentString release];
+    }
+    
+    return info;
+}
+
 // sniff the contents of each file, returning them in an array of BibItems, while unparseable files are added to the mutable array passed as a parameter
+// the files are read and parsed in parallel, but the results and errors are handled in the order of the files
 - (NSArray *)extractPublicationsFromFiles:(NSArray *)filenames unparseableFiles:(NSArray **)unparseableFiles verbose:(BOOL)verbose error:(NSError **)outError {
     NSMutableArray *array = [NSMutableArray array];
     NSMutableArray *unparseableFilesArray = nil;
-    BDSKStringType type = BDSKUnknownStringType;
+    NSError *lastError = nil;
+    NSNumber *encoding = [NSNumber numberWithUnsignedInteger:[self documentStringEncoding]];
+    NSUInteger i, iMax = [filenames count];
     
     // some common types that people might use as attachments; we don't need to sniff these
     NSSet *unreadableTypes = [NSSet setForCaseInsensitiveStringsWithObjects:@"pdf", @"ps", @"eps", @"doc", @"htm", @"textClipping", @"webloc", @"html", @"rtf", @"tiff", @"tif", @"png", @"jpg", @"jpeg", nil];
     
-    for (NSString *fileName in filenames) {
-        type = BDSKUnknownStringType;
+    for (i = 0; i < iMax; i += IMPORT_BATCH_SIZE) {
+        NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+        NSArray *batch = [filenames subarrayWithRange:NSMakeRange(i, MIN(IMPORT_BATCH_SIZE, iMax - i))];
+        NSMutableArray *fileInfos = [NSMutableArray arrayWithCapacity:[batch count]];
+        NSMutableArray *readableFileInfos = [NSMutableArray arrayWithCapacity:[batch count]];
+        
+        for (NSString *fileName in batch) {
+            NSString *theUTI = [[NSWorkspace sharedWorkspace] typeOfFile:[[fileName stringByStandardizingPath] stringByResolvingSymlinksInPath] error:NULL];
+            NSDictionary *fileInfo = [NSDictionary dictionaryWithObjectsAndKeys:fileName, IMPORT_FILENAME_KEY, encoding, IMPORT_ENCODING_KEY, theUTI, IMPORT_UTI_KEY, nil];
+            [fileInfos addObject:fileInfo];
+            // we /can/ create a string from these (usually), but there's no point in wasting the memory
+            if ([theUTI isEqualToUTI:@"net.sourceforge.bibdesk.bdsksearch"] == NO && [unreadableTypes containsObject:[fileName pathExtension]] == NO)
+                [readableFileInfos addObject:fileInfo];
+        }
         
-        // we /can/ create a string from these (usually), but there's no point in wasting the memory
+        NSArray *results = [self importResultsForFileInfos:readableFileInfos selector:@selector(importInfoForFile:)];
+        NSUInteger j = 0;
         
-        NSString *theUTI = [[NSWorkspace sharedWorkspace] typeOfFile:[[fileName stringByStandardizingPath] stringByResolvingSymlinksInPath] error:NULL];
-        if ([theUTI isEqualToUTI:@"net.sourceforge.bibdesk.bdsksearch"]) {
-            NSDictionary *dictionary = [NSDictionary dictionaryWithContentsOfFile:fileName];
-            Class aClass = NSClassFromString([dictionary objectForKey:@"class"]);
-            BDSKSearchGroup *group = [[[(aClass ?: [BDSKSearchGroup class]) alloc] initWithDictionary:dictionary] autorelease];
-            if(group)
-                [groups addSearchGroup:group];
-        } else {
-            NSError *parseError = nil;
-            BOOL isPartialData = NO;
-            NSArray *contentArray = nil;
+        for (NSDictionary *fileInfo in fileInfos) {
+            NSString *fileName = [fileInfo objectForKey:IMPORT_FILENAME_KEY];
             
-            if ([unreadableTypes containsObject:[fileName pathExtension]] == NO) {
-        
-                // try to create a string
-                NSString *contentString = [[NSString alloc] initWithContentsOfFile:fileName guessedEncoding:[self documentStringEncoding]];
+            if ([[fileInfo objectForKey:IMPORT_UTI_KEY] isEqualToUTI:@"net.sourceforge.bibdesk.bdsksearch"]) {
+                NSDictionary *dictionary = [NSDictionary dictionaryWithContentsOfFile:fileName];
+                Class aClass = NSClassFromString([dictionary objectForKey:@"class"]);
+                BDSKSearchGroup *group = [[[(aClass ?: [BDSKSearchGroup class]) alloc] initWithDictionary:dictionary] autorelease];
+                if(group)
+                    [groups addSearchGroup:group];
+            } else {
+                NSDictionary *result = nil;
+                NSError *parseError = nil;
+                BOOL isPartialData = NO;
+                NSArray *contentArray = nil;
                 
-                if (contentString != nil) {
-                    if ([theUTI isEqualToUTI:@"org.tug.tex.bibtex"])
-                        type = BDSKBibTeXStringType;
-                    else if([theUTI isEqualToUTI:@"net.sourceforge.bibdesk.ris"])
-                        type = BDSKRISStringType;
-                    else
-                        type = [contentString contentStringType];
+                if (j < [readableFileInfos count] && [readableFileInfos objectAtIndex:j] == fileInfo) {
+                    result = [results objectAtIndex:j++];
+                    if ([result isEqual:[NSNull null]])
+                        result = nil;
+                }
+                
+                if ([result objectForKey:IMPORT_TYPE_KEY]) {
+                    BDSKStringType type = [[result objectForKey:IMPORT_TYPE_KEY] integerValue];
+                    NSString *contentString = [result objectForKey:IMPORT_STRING_KEY];
                     
-                    if (type != BDSKUnknownStringType) {
+                    if (contentString) {
                         contentArray = [BDSKStringParser itemsFromString:contentString ofType:type owner:self isPartialData:&isPartialData error:&parseError];
-                        
-                        if (isPartialData) {
-                            if ([parseError isLocalErrorWithCode:kBDSKParserIgnoredFrontMatter]) {
-                                if (verbose) [self presentError:parseError];
-                                parseError = nil;
-                            } else if([parseError isLocalErrorWithCode:kBDSKBibTeXParserFailed]) {
-                                if (verbose == NO || [self presentError:parseError] == NO)
-                                    contentArray = nil;
-                            }
-                        }
+                    } else {
+                        contentArray = [result objectForKey:IMPORT_ITEMS_KEY];
+                        parseError = [result objectForKey:IMPORT_ERROR_KEY];
+                        isPartialData = [[result objectForKey:IMPORT_PARTIAL_DATA_KEY] boolValue];
                     }
                     
-                    [contentString release];
+                    if (isPartialData) {
+                        if ([parseError isLocalErrorWithCode:kBDSKParserIgnoredFrontMatter]) {
+                            if (verbose) [self presentError:parseError];
+                            parseError = nil;
+                        } else if([parseError isLocalErrorWithCode:kBDSKBibTeXParserFailed]) {
+                            if (verbose == NO || [self presentError:parseError] == NO)
+                                contentArray = nil;
+                        }
+                    }
+                }
+                if (contentArray) {
+                    // forward any temporaryCiteKey warning
+                    if (parseError && outError) {
+                        [lastError release];
+                        lastError = [parseError retain];
+                    }
+                    [array addObjectsFromArray:contentArray];
+                } else if (unparseableFiles) {
+                    // unable to parse or find valid type, we link the file and can ignore the error
+                    if (unparseableFilesArray == nil)
+                        unparseableFilesArray = [[NSMutableArray alloc] init];
+                    [unparseableFilesArray addObject:fileName];
                 }
-            }
-            if (contentArray) {
-                // forward any temporaryCiteKey warning
-                if (parseError && outError) *outError = parseError;
-                [array addObjectsFromArray:contentArray];
-            } else if (unparseableFiles) {
-                // unable to parse or find valid type, we link the file and can ignore the error
-                if (unparseableFilesArray == nil)
-                    unparseableFilesArray = [NSMutableArray array];
-                [unparseableFilesArray addObject:fileName];
             }
         }
+        
+        [pool release];
     }
     
+    if (lastError)
+        *outError = [lastError autorelease];
+    
     if (unparseableFiles)
-        *unparseableFiles = unparseableFilesArray;
+        *unparseableFiles = [unparseableFilesArray autorelease];
+    else
+        [unparseableFilesArray release];
     
     return array;
 }
@@ -1044,6 +1044,11 @@ static void addObjectToSetAndBag(const void *value, void *context) {
         [sheetController beginSheetModalForWindow:documentWindow];
         [sheetController release];
 	} else if ([group isSearch]) {
+        // the sheet can only edit a single server
+        if ([[(BDSKSearchGroup *)group serverInfo] isFederated]) {
+            NSBeep();
+            return;
+        }
         BDSKSearchGroupSheetController *sheetController = [(BDSKSearchGroupSheetController *)[BDSKSearchGroupSheetController alloc] initWithGroup:(BDSKSearchGroup *)group];
         [sheetController beginSheetModalForWindow:documentWindow];
         [sheetController release];
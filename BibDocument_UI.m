@@ -75,6 +75,7 @@
 #import "BDSKMacroResolver.h"
 #import "NSString_BDSKExtensions.h"
 #import "BDSKServerInfo.h"
+#import "BDSKFileStatusCache.h"
 
 #define BDSKDisableMigrationWarningKey @"BDSKDisableMigrationWarning"
 
@@ -1098,6 +1099,18 @@ static void applyChangesToCiteFieldsWithInfo(const void *citeField, void *contex
     [self selectedFileURLs];
 }
 
+- (void)handleFileStatusDidChangeNotification:(NSNotification *)notification{
+    // linked files in a changed directory are resolved again in the background, and notify their item when their URL changed
+    NSArray *directories = [[notification userInfo] objectForKey:BDSKFileStatusDirectoriesKey];
+    for (BDSKLinkedFile *file in [BDSKLinkedFile linkedFilesInDirectories:directories]) {
+        id item = [file delegate];
+        if ([item isKindOfClass:[BibItem class]] && [item owner] == self)
+            [file URL];
+    }
+    // icons for the URL fields may have changed
+    [tableView setNeedsDisplay:YES];
+}
+
 - (void)handleCustomFieldsDidChangeNotification:(NSNotification *)notification{
     [publications makeObjectsPerformSelector:@selector(customFieldsDidChange:) withObject:notification];
     [tableView setupTableColumnsWithIdentifiers:[tableView tableColumnIdentifiers]];
@@ -1186,6 +1199,10 @@ static void applyChangesToCiteFieldsWithInfo(const void *citeField, void *contex
            selector:@selector(handleApplicationDidBecomeActiveNotification:)
                name:NSApplicationDidBecomeActiveNotification
              object:nil];
+    [nc addObserver:self
+           selector:@selector(handleFileStatusDidChangeNotification:)
+               name:BDSKFileStatusDidChangeNotification
+             object:[BDSKFileStatusCache sharedCache]];
     [nc addObserver:self
            selector:@selector(handleTemporaryFileMigrationNotification:)
                name:BDSKTemporaryFileMigrationNotification
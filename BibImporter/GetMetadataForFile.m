@@ -34,6 +34,20 @@
  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE
 */
 
+#import "BDSKSpotlightCachePack.h"
+
+static void addUniqueObjects(NSMutableArray *array, NSMutableSet *set, NSArray *objects)
+{
+    if ([objects isKindOfClass:[NSArray class]] == NO)
+        return;
+    for (id object in objects) {
+        if ([set containsObject:object] == NO) {
+            [set addObject:object];
+            [array addObject:object];
+        }
+    }
+}
+
 Boolean GetMetadataForFile(void* thisInterface, 
 			   CFMutableDictionaryRef attributes, 
 			   CFStringRef contentTypeUTI,
@@ -48,6 +62,7 @@ Boolean GetMetadataForFile(void* thisInterface,
     
     CFStringRef cacheUTI = CFSTR("net.sourceforge.bibdesk.bdskcache");
     CFStringRef searchUTI = CFSTR("net.sourceforge.bibdesk.bdsksearch");
+    CFStringRef packUTI = CFSTR("net.sourceforge.bibdesk.bdskcachepack");
     
     if(UTTypeEqual(contentTypeUTI, cacheUTI)){
         
@@ -88,6 +103,66 @@ Boolean GetMetadataForFile(void* thisInterface,
         // rest of the information (port, type, options) doesn't seem as useful        
         [dictionary release];
         
+    } else if (UTTypeEqual(contentTypeUTI, packUTI)) {
+        
+        // a packed cache has the items of a whole document, the file is mapped and we only parse one item at a time
+        BDSKSpotlightCachePack *pack = [[BDSKSpotlightCachePack alloc] initWithContentsOfFile:(NSString *)pathToFile];
+        success = (pack != nil);
+        
+        NSString *value = [[pack documentInfo] objectForKey:@"net_sourceforge_bibdesk_owningfilepath"];
+        if (value) {
+            [(NSMutableDictionary *)attributes setObject:value forKey:@"net_sourceforge_bibdesk_owningfilepath"];
+            value = [[value lastPathComponent] stringByDeletingPathExtension];
+            [(NSMutableDictionary *)attributes setObject:value forKey:(NSString *)kMDItemTitle];
+            [(NSMutableDictionary *)attributes setObject:value forKey:(NSString *)kMDItemDisplayName];
+        }
+        
+        // Spotlight gives a single result per file, so we combine the items: the lists are merged and the text is used as content
+        NSMutableArray *citeKeys = [NSMutableArray new];
+        NSMutableArray *authors = [NSMutableArray new];
+        NSMutableArray *keywords = [NSMutableArray new];
+        NSMutableSet *uniqueAuthors = [NSMutableSet new];
+        NSMutableSet *uniqueKeywords = [NSMutableSet new];
+        NSMutableString *textContent = [NSMutableString new];
+        NSArray *textKeys = [NSArray arrayWithObjects:(NSString *)kMDItemTitle, (NSString *)kMDItemDescription, @"net_sourceforge_bibdesk_container", nil];
+        NSUInteger i, iMax = [pack count];
+        
+        for (i = 0; i < iMax; i++) {
+            NSAutoreleasePool *itemPool = [[NSAutoreleasePool alloc] init];
+            NSDictionary *item = [pack itemAtIndex:i];
+            
+            if (value = [item objectForKey:@"net_sourceforge_bibdesk_citekey"])
+                [citeKeys addObject:value];
+            addUniqueObjects(authors, uniqueAuthors, [item objectForKey:(NSString *)kMDItemAuthors]);
+            addUniqueObjects(keywords, uniqueKeywords, [item objectForKey:(NSString *)kMDItemKeywords]);
+            for (NSString *key in textKeys) {
+                if ((value = [item objectForKey:key]) && [value isKindOfClass:[NSString class]]) {
+                    [textContent appendString:value];
+                    [textContent appendString:@"\n"];
+                }
+            }
+            
+            [itemPool release];
+        }
+        
+        if ([citeKeys count])
+            [(NSMutableDictionary *)attributes setObject:citeKeys forKey:@"net_sourceforge_bibdesk_citekeys"];
+        if ([authors count])
+            [(NSMutableDictionary *)attributes setObject:authors forKey:(NSString *)kMDItemAuthors];
+        if ([keywords count])
+            [(NSMutableDictionary *)attributes setObject:keywords forKey:(NSString *)kMDItemKeywords];
+        if ([textContent length])
+            [(NSMutableDictionary *)attributes setObject:textContent forKey:(NSString *)kMDItemTextContent];
+        [(NSMutableDictionary *)attributes setObject:@"BibDesk" forKey:(NSString *)kMDItemCreator];
+        
+        [citeKeys release];
+        [authors release];
+        [keywords release];
+        [uniqueAuthors release];
+        [uniqueKeywords release];
+        [textContent release];
+        [pack release];
+        
     } 
     
     // add the entire file as kMDItemTextContent for plain text file types
@@ -81,7 +81,7 @@ enum {
     NSString *citeKey;
 	NSString *pubType;
     NSMutableDictionary *pubFields;
-    NSMutableDictionary *people;
+    NSMutableDictionary *peopleRanges;
     NSDate *pubDate;
 	NSDate *dateAdded;
 	NSDate *dateModified;
@@ -118,6 +118,8 @@ enum {
 - (void)noteFilesChanged:(BOOL)isFile;
 
 - (BOOL)migrateFilesWithRemoveOptions:(NSInteger)removeMask numberOfAddedFiles:(NSInteger *)numberOfAddedFiles numberOfRemovedFields:(NSInteger *)numberOfRemovedFields error:(NSError **)outError;
+// migrates a batch of publications at once, the error messages contain the publication for each failure
++ (BOOL)migrateFilesForPublications:(NSArray *)pubs withRemoveOptions:(NSInteger)removeMask numberOfAddedFiles:(NSInteger *)numberOfAddedFiles numberOfRemovedFields:(NSInteger *)numberOfRemovedFields error:(NSError **)outError;
 
 - (NSString *)basePath;
 
@@ -193,6 +195,7 @@ enum {
 - (NSSet *)allPeople;
 - (NSArray *)peopleArrayForField:(NSString *)field;
 - (NSArray *)peopleArrayForField:(NSString *)field inherit:(BOOL)inherit;    
+- (NSUInteger)numberOfPeopleForField:(NSString *)field inherit:(BOOL)inherit;
 - (NSDictionary *)people;
 - (NSDictionary *)peopleInheriting:(BOOL)inherit;
 
@@ -819,6 +822,8 @@ enum {
 - (void)setImported:(BOOL)flag;
 
 - (NSURL *)identifierURL;
+// an immutable object that archives like the receiver, so it can be archived on another thread
+- (id<NSCoding>)archivableSnapshot;
 - (void)setSearchScore:(CGFloat)val;
 - (CGFloat)searchScore;
 - (NSString *)skimNotesForLocalURL;
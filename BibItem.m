@@ -68,6 +68,7 @@
 #import "BDSKScriptHook.h"
 #import "BDSKScriptHookManager.h"
 #import "BDSKCompletionManager.h"
+#import "BDSKFieldDictionary.h"
 #import "BDSKMacroResolver.h"
 #import "BDSKMacro.h"
 #import "NSColor_BDSKExtensions.h"
@@ -76,6 +77,7 @@
 #import "BDSKCFCallBacks.h"
 #import "NSCharacterSet_BDSKExtensions.h"
 #import <Quartz/Quartz.h>
+#import "BDSKFileStatusCache.h"
 
 NSString *BDSKBibItemKeyKey = @"key";
 NSString *BDSKBibItemOldValueKey = @"oldValue";
@@ -100,6 +102,54 @@ static NSSet *fieldsToWriteIfEmpty = nil;
 
 - (void)createFilesArray;
 
+- (NSURL *)unresolvedLocalFileURLForField:(NSString *)field;
+
++ (void)resolveMigrationCandidates:(NSArray *)candidates;
+- (void)applyMigratedFiles:(NSArray *)newFiles removingFields:(NSArray *)fields;
+- (void)noteMigratedFiles:(NSArray *)newFiles removedFields:(NSArray *)fields;
+
+- (void)invalidatePeople;
+- (NSArray *)realizedPeopleArrayForField:(NSString *)field;
+
+@end
+
+// Private class holding a copy of the archived state of a BibItem
+
+@interface BDSKArchivedBibItem : NSObject <NSCoding> {
+    NSString *citeKey;
+    NSString *pubType;
+    NSDictionary *pubFields;
+    NSArray *files;
+    NSDate *pubDate;
+    NSDate *dateAdded;
+    NSDate *dateModified;
+    BOOL hasBeenEdited;
+}
+- (id)initWithCiteKey:(NSString *)aCiteKey pubType:(NSString *)aType pubFields:(NSDictionary *)fields files:(NSArray *)fileSnapshots pubDate:(NSDate *)aPubDate dateAdded:(NSDate *)aDateAdded dateModified:(NSDate *)aDateModified hasBeenEdited:(BOOL)edited;
+@end
+
+// Private class holding a URL field to migrate, the linked file for it is created on a background thread
+
+@interface BDSKFileMigrationCandidate : NSObject <BDSKLinkedFileDelegate> {
+    BibItem *publication;
+    NSString *field;
+    NSURL *URL;
+    NSString *basePath;
+    NSArray *currentURLs;
+    BOOL removeField;
+    BOOL resolveAliases;
+    BDSKLinkedFile *file;
+    NSURL *fileURL;
+}
+- (id)initWithPublication:(BibItem *)aPub field:(NSString *)aField URL:(NSURL *)aURL currentURLs:(NSArray *)URLs removeField:(BOOL)remove;
+- (BibItem *)publication;
+- (NSString *)field;
+- (NSURL *)URL;
+- (NSArray *)currentURLs;
+- (BOOL)removeField;
+- (BDSKLinkedFile *)file;
+- (NSURL *)fileURL;
+- (void)resolve;
 @end
 
 
@@ -176,6 +226,9 @@ static NSParagraphStyle* bodyParagraphStyle = nil;
 
 static NSMapTable *selectorTable = NULL;
 
+// realized BibAuthor arrays keyed by identifierURL; these are recreated from the name ranges when the cache was purged
+static NSCache *peopleCache = nil;
+
 #pragma mark -
 
 @implementation BibItem
@@ -186,6 +239,8 @@ static NSMapTable *selectorTable = NULL;
     
     defaultCiteKey = @"cite-key";
     
+    peopleCache = [[NSCache alloc] init];
+    
     NSMutableParagraphStyle *defaultStyle = [[NSMutableParagraphStyle alloc] init];
     [defaultStyle setParagraphStyle:[NSParagraphStyle defaultParagraphStyle]];
     keyParagraphStyle = [defaultStyle copy];
@@ -244,9 +299,9 @@ static NSMapTable *selectorTable = NULL;
     self = [super init];
     if (self){
 		if(fieldsDict){
-			pubFields = [fieldsDict mutableCopy];
+			pubFields = [[BDSKFieldDictionary alloc] initWithDictionary:fieldsDict];
 		}else{
-			pubFields = [[NSMutableDictionary alloc] initWithCapacity:7];
+			pubFields = [[BDSKFieldDictionary alloc] initWithCapacity:7];
 		}
         if (filesArray) {
             files = [filesArray mutableCopy];
@@ -260,7 +315,7 @@ static NSMapTable *selectorTable = NULL;
 			[pubFields setObject:nowStr forKey:BDSKDateModifiedString];
         }
         
-        people = nil;
+        peopleRanges = nil;
         
         owner = nil;
         macroResolver = nil;
@@ -320,7 +375,7 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 - (id)initWithCoder:(NSCoder *)coder{
     if([coder allowsKeyedCoding]){
         if(self = [super init]){
-            pubFields = [[NSMutableDictionary alloc] initWithDictionary:[coder decodeObjectForKey:@"pubFields"]];
+            pubFields = [[BDSKFieldDictionary alloc] initWithDictionary:[coder decodeObjectForKey:@"pubFields"]];
             [self setCiteKeyString:[coder decodeObjectForKey:@"citeKey"]];
             [self setPubTypeString:[coder decodeObjectForKey:@"pubType"]];
             groups = [[NSMutableDictionary alloc] initWithCapacity:5];
@@ -352,18 +407,22 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 
 // If we ever want to drop legacy, i.e. no fileType and no NSCalendarDate, we must increase [BDSKSharingClientServer supportedProtocolVersion] and [BDSKSharingDOServer requiredProtocolVersion]
 
+static void encodeItemWithKeyedCoder(NSCoder *coder, NSString *citeKey, NSString *pubType, NSDictionary *pubFields, NSArray *files, NSDate *pubDate, NSDate *dateAdded, NSDate *dateModified, BOOL hasBeenEdited) {
+    [coder encodeObject:citeKey forKey:@"citeKey"];
+    [coder encodeObject:pubType forKey:@"pubType"];
+    [coder encodeObject:pubFields forKey:@"pubFields"];
+    [coder encodeObject:files forKey:@"files"];
+    // Legacy, these are necessary for sharing with older versions of BibDesk
+    [coder encodeObject:BDSKBibtexString forKey:@"fileType"];
+    [coder encodeObject:ensureCalendarDate(pubDate) forKey:@"pubDate"];
+    [coder encodeObject:ensureCalendarDate(dateAdded) forKey:@"dateAdded"];
+    [coder encodeObject:ensureCalendarDate(dateModified) forKey:@"dateModified"];
+    [coder encodeBool:hasBeenEdited forKey:@"hasBeenEdited"];
+}
+
 - (void)encodeWithCoder:(NSCoder *)coder{
     if([coder allowsKeyedCoding]){
-        [coder encodeObject:citeKey forKey:@"citeKey"];
-        [coder encodeObject:pubType forKey:@"pubType"];
-        [coder encodeObject:pubFields forKey:@"pubFields"];
-        [coder encodeObject:files forKey:@"files"];
-        // Legacy, these are necessary for sharing with older versions of BibDesk
-        [coder encodeObject:BDSKBibtexString forKey:@"fileType"];
-        [coder encodeObject:ensureCalendarDate(pubDate) forKey:@"pubDate"];
-        [coder encodeObject:ensureCalendarDate(dateAdded) forKey:@"dateAdded"];
-        [coder encodeObject:ensureCalendarDate(dateModified) forKey:@"dateModified"];
-        [coder encodeBool:hasBeenEdited forKey:@"hasBeenEdited"];
+        encodeItemWithKeyedCoder(coder, citeKey, pubType, pubFields, files, pubDate, dateAdded, dateModified, hasBeenEdited);
     } else {
         [coder encodeDataObject:[NSKeyedArchiver archivedDataWithRootObject:self]];
     }        
@@ -374,9 +433,24 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
     return [encoder isByref] ? (id)[NSDistantObject proxyWithLocal:self connection:[encoder connection]] : self;
 }
 
+- (id<NSCoding>)archivableSnapshot {
+    NSMutableArray *fileSnapshots = [[NSMutableArray alloc] initWithCapacity:[files count]];
+    id snapshot;
+    for (BDSKLinkedFile *file in files) {
+        if ((snapshot = [file archivableSnapshot]))
+            [fileSnapshots addObject:snapshot];
+    }
+    NSDictionary *fieldsCopy = [[NSDictionary alloc] initWithDictionary:pubFields];
+    snapshot = [[[BDSKArchivedBibItem alloc] initWithCiteKey:citeKey pubType:pubType pubFields:fieldsCopy files:fileSnapshots pubDate:pubDate dateAdded:dateAdded dateModified:dateModified hasBeenEdited:hasBeenEdited] autorelease];
+    [fieldsCopy release];
+    [fileSnapshots release];
+    return snapshot;
+}
+
 - (void)dealloc{
+    [peopleCache removeObjectForKey:identifierURL];
     BDSKDESTROY(pubFields);
-    BDSKDESTROY(people);
+    BDSKDESTROY(peopleRanges);
 	BDSKDESTROY(groups);
 
     BDSKDESTROY(pubType);
@@ -566,8 +640,7 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 - (void)resetGroupsAndPeople{
 	[groups removeAllObjects];
     // these fields may change type, so our cached values should be discarded
-    [people release];
-    people = nil;
+    [self invalidatePeople];
 }
 
 #pragma mark Document
@@ -624,24 +697,68 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 #pragma mark -
 #pragma mark Generic person handling code
 
+// People fields are kept as compact arrays of name ranges into the field values. BibAuthor objects are only created when a field is accessed, and live in a cache that can be purged under memory pressure, after which they are recreated from the ranges.
+
+- (void)invalidatePeople{
+    [peopleRanges release];
+    peopleRanges = nil;
+    [peopleCache removeObjectForKey:identifierURL];
+}
+
 - (void)rebuildPeopleIfNeeded{
     
-    if (people == nil) {
-        people = [[NSMutableDictionary alloc] initWithCapacity:2];
+    if (peopleRanges == nil) {
+        peopleRanges = [[NSMutableDictionary alloc] initWithCapacity:2];
         
         for (NSString *personType in [[BDSKTypeManager sharedManager] personFieldsSet]) {
             // get the string representation from pubFields
             NSString *personStr = [pubFields objectForKey:personType];
             
-            // parse into an array of BibAuthor objects
-            NSArray *tmpPeople = [BDSKBibTeXParser authorsFromBibtexString:personStr withPublication:self forField:personType];
-            if ([tmpPeople count])
-                [people setObject:tmpPeople forKey:personType];
+            if ([NSString isEmptyString:personStr])
+                continue;
+            
+            // only find the ranges of the names, parsing into BibAuthor objects is done on demand
+            NSData *ranges = [BDSKBibTeXParser nameRangesFromBibtexString:personStr];
+            
+            if (ranges == nil) {
+                // unbalanced braces, let the full parser report the error
+                [BDSKBibTeXParser authorsFromBibtexString:personStr withPublication:self forField:personType];
+            } else if ([ranges length]) {
+                [peopleRanges setObject:ranges forKey:personType];
+                
+                NSUInteger i, iMax = [ranges length] / sizeof(BDSKNameRange);
+                const BDSKNameRange *nameRanges = (const BDSKNameRange *)[ranges bytes];
+                NSMutableArray *names = [[NSMutableArray alloc] initWithCapacity:iMax];
+                for (i = 0; i < iMax; i++)
+                    [names addObject:[personStr substringWithRange:NSMakeRange(nameRanges[i].location, nameRanges[i].length)]];
+                [[BDSKCompletionManager sharedManager] addNamesForCompletion:names];
+                [names release];
+            }
         }
         
     }    
 }
 
+- (NSArray *)realizedPeopleArrayForField:(NSString *)field{
+    NSData *ranges = [peopleRanges objectForKey:field];
+    if (ranges == nil)
+        return nil;
+    
+    NSMutableDictionary *realizedPeople = [[[peopleCache objectForKey:identifierURL] retain] autorelease];
+    NSArray *peopleArray = [realizedPeople objectForKey:field];
+    
+    if (peopleArray == nil) {
+        peopleArray = [BDSKBibTeXParser authorsFromBibtexString:[pubFields objectForKey:field] nameRanges:ranges withPublication:self forField:field];
+        if (realizedPeople == nil) {
+            realizedPeople = [NSMutableDictionary dictionaryWithObjectsAndKeys:peopleArray, field, nil];
+            [peopleCache setObject:realizedPeople forKey:identifierURL];
+        } else {
+            [realizedPeople setObject:peopleArray forKey:field];
+        }
+    }
+    return peopleArray;
+}
+
 // this returns a set so it's clear that the objects are unordered
 - (NSSet *)allPeople{
     NSMutableSet *set = [NSMutableSet set];
@@ -657,7 +774,7 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 - (NSArray *)peopleArrayForField:(NSString *)field inherit:(BOOL)inherit{
     [self rebuildPeopleIfNeeded];
     
-    NSArray *peopleArray = [people objectForKey:field];
+    NSArray *peopleArray = [self realizedPeopleArrayForField:field];
     if([peopleArray count] == 0 && inherit){
         BibItem *parent = [self crossrefParent];
         peopleArray = [parent peopleArrayForField:field inherit:NO];
@@ -665,6 +782,16 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
     return (peopleArray != nil) ? peopleArray : [NSArray array];
 }
 
+// this does not create any BibAuthor objects
+- (NSUInteger)numberOfPeopleForField:(NSString *)field inherit:(BOOL)inherit{
+    [self rebuildPeopleIfNeeded];
+    
+    NSUInteger count = [[peopleRanges objectForKey:field] length] / sizeof(BDSKNameRange);
+    if(count == 0 && inherit)
+        count = [[self crossrefParent] numberOfPeopleForField:field inherit:NO];
+    return count;
+}
+
 - (NSDictionary *)people{
     return [self peopleInheriting:YES];
 }
@@ -674,13 +801,16 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
     
     [self rebuildPeopleIfNeeded];
     
+    NSMutableDictionary *dict = [NSMutableDictionary dictionaryWithCapacity:[peopleRanges count]];
+    for (NSString *field in peopleRanges)
+        [dict setObject:[self realizedPeopleArrayForField:field] forKey:field];
+    
     if(inherit && (parent = [self crossrefParent])){
         NSMutableDictionary *parentCopy = [[[parent peopleInheriting:NO] mutableCopy] autorelease];
-        [parentCopy addEntriesFromDictionary:people]; // replace keys in parent with our keys, but inherit keys we don't have
+        [parentCopy addEntriesFromDictionary:dict]; // replace keys in parent with our keys, but inherit keys we don't have
         return parentCopy;
     } else {
-        NSDictionary *copy = [[people copy] autorelease];
-        return copy;
+        return dict;
     }
 }
 
@@ -806,7 +936,8 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 }
 
 - (NSInteger)numberOfAuthorsOrEditorsInheriting:(BOOL)inherit{
-    return [[self pubAuthorsOrEditorsInheriting:inherit] count];
+    NSUInteger count = [self numberOfPeopleForField:BDSKAuthorString inherit:inherit];
+    return count > 0 ? count : [self numberOfPeopleForField:BDSKEditorString inherit:inherit];
 }
 
 - (BibAuthor *)firstAuthorOrEditor{ 
@@ -839,7 +970,7 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 
 // returns a string similar to bibtexAuthorString, but removes the "and" separator and can optionally abbreviate first names
 - (NSString *)pubAuthorsOrEditorsForDisplay{
-    return [self peopleStringForDisplayFromField:([[self peopleArrayForField:BDSKAuthorString] count] ? BDSKAuthorString : BDSKEditorString)];
+    return [self peopleStringForDisplayFromField:([self numberOfPeopleForField:BDSKAuthorString inherit:YES] ? BDSKAuthorString : BDSKEditorString)];
 }
 
 - (BibAuthor *)authorOrEditorAtIndex:(NSUInteger)idx{ 
@@ -1149,7 +1280,7 @@ static inline NSCalendarDate *ensureCalendarDate(NSDate *date) {
 - (void)setPubFields: (NSDictionary *)newFields{
     if(newFields != pubFields){
         [pubFields release];
-        pubFields = [newFields mutableCopy];
+        pubFields = [[BDSKFieldDictionary alloc] initWithDictionary:newFields];
         [self updateMetadataForKey:BDSKAllFieldsString];
     }
 }
@@ -2570,6 +2701,13 @@ static void addFilesToArray(const void *value, void *context)
     if(nil == url)
         return nil;
     
+    if([NSThread isMainThread]){
+        // this is used for drawing, so use the cached status and icon
+        if([field isLocalFileField] && (url = [[BDSKFileStatusCache sharedCache] resolvedURLForURL:url]) == nil)
+            return [NSImage missingFileImage];
+        return [[BDSKFileStatusCache sharedCache] iconForURL:url];
+    }
+    
     if([field isLocalFileField] && (url = [url fileURLByResolvingAliases]) == nil)
         return [NSImage missingFileImage];
     
@@ -2622,7 +2760,20 @@ static void addFilesToArray(const void *value, void *context)
 
 - (NSURL *)localFileURLForField:(NSString *)field{
     
-    NSURL *localURL = nil, *resolvedURL = nil;
+    NSURL *localURL = [self unresolvedLocalFileURLForField:field], *resolvedURL = nil;
+    
+    // resolve aliases in the containing dir, as most NSFileManager methods do not follow them, and NSWorkspace can't open aliases
+	// we don't resolve the last path component if it's an alias, as this is used in auto file, which should move the alias rather than the target file 
+    // if the path to the file does not exist resolvedURL is nil, so we return the unresolved path
+    if (localURL && (resolvedURL = [localURL fileURLByResolvingAliasesBeforeLastPathComponent]))
+        localURL = resolvedURL;
+    
+    return localURL;
+}
+
+- (NSURL *)unresolvedLocalFileURLForField:(NSString *)field{
+    
+    NSURL *localURL = nil;
     NSString *localURLFieldValue = [self valueOfField:field inherit:NO];
     
     if ([NSString isEmptyString:localURLFieldValue]) return nil;
@@ -2644,13 +2795,6 @@ static void addFilesToArray(const void *value, void *context)
 
         localURL = [NSURL fileURLWithPath:[localURLFieldValue stringByStandardizingPath]];
     }
-	
-    
-    // resolve aliases in the containing dir, as most NSFileManager methods do not follow them, and NSWorkspace can't open aliases
-	// we don't resolve the last path component if it's an alias, as this is used in auto file, which should move the alias rather than the target file 
-    // if the path to the file does not exist resolvedURL is nil, so we return the unresolved path
-    if ((resolvedURL = [localURL fileURLByResolvingAliasesBeforeLastPathComponent]))
-        localURL = resolvedURL;
     
     return localURL;
 }
@@ -2771,6 +2915,178 @@ static void addURLForFieldToArrayIfNotNil(const void *key, void *context)
     return 0 == failureCount;
 }
 
+#define MIGRATION_BATCH_SIZE 32
+
+static void addMigrationCandidates(NSMutableArray *candidates, BibItem *pub, NSArray *fields, NSArray *currentURLs, BOOL removeField)
+{
+    for (NSString *field in fields) {
+        // local paths are resolved on the migration queue
+        NSURL *urlValue = [field isLocalFileField] ? [pub unresolvedLocalFileURLForField:field] : [pub remoteURLForField:field];
+        // invalid URLs are kept for the error messages
+        if (urlValue || NO == [NSString isEmptyString:[pub valueOfField:field inherit:NO]]) {
+            BDSKFileMigrationCandidate *candidate = [[BDSKFileMigrationCandidate alloc] initWithPublication:pub field:field URL:urlValue currentURLs:currentURLs removeField:removeField];
+            [candidates addObject:candidate];
+            [candidate release];
+        }
+    }
+}
+
++ (BOOL)migrateFilesForPublications:(NSArray *)pubs withRemoveOptions:(NSInteger)removeMask numberOfAddedFiles:(NSInteger *)numberOfAddedFiles numberOfRemovedFields:(NSInteger *)numberOfRemovedFields error:(NSError **)outError
+{
+    BDSKASSERT([NSThread isMainThread]);
+    
+    NSUserDefaults *sud = [NSUserDefaults standardUserDefaults];
+    NSArray *localFields = [sud stringArrayForKey:BDSKLocalFileFieldsKey];
+    NSArray *remoteFields = [sud stringArrayForKey:BDSKRemoteURLFieldsKey];
+    NSMutableArray *candidates = [NSMutableArray array];
+    NSMutableArray *pubCandidates = [NSMutableArray array];
+    NSUInteger i, iMax, start;
+    
+    // the field values and the document location are only accessed on the main thread
+    for (BibItem *pub in pubs) {
+        NSArray *currentURLs = [pub valueForKeyPath:@"files.URL"];
+        start = [candidates count];
+        addMigrationCandidates(candidates, pub, localFields, currentURLs, (removeMask & BDSKRemoveLocalFileFieldsMask) != 0);
+        addMigrationCandidates(candidates, pub, remoteFields, currentURLs, (removeMask & BDSKRemoveRemoteURLFieldsMask) != 0);
+        if ([candidates count] > start)
+            [pubCandidates addObject:[candidates subarrayWithRange:NSMakeRange(start, [candidates count] - start)]];
+    }
+    
+    // resolving the paths and creating the aliases hits the file system, so this is done concurrently
+    NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+    iMax = [candidates count];
+    for (i = 0; i < iMax; i += MIGRATION_BATCH_SIZE) {
+        NSArray *batch = [candidates subarrayWithRange:NSMakeRange(i, MIN(MIGRATION_BATCH_SIZE, iMax - i))];
+        NSInvocationOperation *operation = [[NSInvocationOperation alloc] initWithTarget:self selector:@selector(resolveMigrationCandidates:) object:batch];
+        [queue addOperation:operation];
+        [operation release];
+    }
+    [queue waitUntilAllOperationsAreFinished];
+    [queue release];
+    
+    // apply all changes in a single undo group, and notify only when all publications have been changed
+    NSMutableArray *messages = [NSMutableArray array];
+    NSMutableArray *changes = [NSMutableArray array];
+    NSMutableArray *undoManagers = [NSMutableArray array];
+    NSInteger addedFiles = 0, removedFields = 0;
+    
+    for (NSArray *candidatesForPub in pubCandidates) {
+        BibItem *pub = [[candidatesForPub objectAtIndex:0] publication];
+        NSMutableArray *currentURLs = [[[candidatesForPub objectAtIndex:0] currentURLs] mutableCopy];
+        NSMutableArray *newFiles = [NSMutableArray array];
+        NSMutableArray *fields = [NSMutableArray array];
+        
+        for (BDSKFileMigrationCandidate *candidate in candidatesForPub) {
+            NSURL *urlValue = [candidate URL];
+            NSDictionary *message = nil;
+            if (urlValue == nil) {
+                message = [NSDictionary dictionaryWithObjectsAndKeys:[NSString stringWithFormat:NSLocalizedString(@"URL \"%@\" is invalid", @""), [pub valueOfField:[candidate field] inherit:NO]], @"error", pub, @"publication", nil];
+                [messages addObject:message];
+                continue;
+            }
+            // see if this file was converted previously to avoid duplication
+            BOOL converted = [currentURLs containsObject:urlValue];
+            if (converted == NO) {
+                NSURL *fileURL = [candidate fileURL];
+                if (fileURL == nil) {
+                    message = [NSDictionary dictionaryWithObjectsAndKeys:urlValue, @"URL", NSLocalizedString(@"File or URL not found", @""), @"error", pub, @"publication", nil];
+                    [messages addObject:message];
+                } else if ([currentURLs containsObject:fileURL] == NO) {
+                    // checked again for containment, as fileURL may not be exactly the same as urlValue, e.g. an extra slash at the end for a folder
+                    [newFiles addObject:[candidate file]];
+                    [currentURLs addObject:fileURL];
+                    converted = YES;
+                }
+            }
+            // clear the old URL field if the file was converted (now or previously)
+            if (converted && [candidate removeField])
+                [fields addObject:[candidate field]];
+        }
+        [currentURLs release];
+        
+        if ([newFiles count] > 0 || [fields count] > 0) {
+            NSUndoManager *undoManager = [pub undoManager];
+            if (undoManager && [undoManagers containsObject:undoManager] == NO) {
+                [undoManager beginUndoGrouping];
+                [undoManagers addObject:undoManager];
+            }
+            [pub applyMigratedFiles:newFiles removingFields:fields];
+            [changes addObject:[NSArray arrayWithObjects:pub, newFiles, fields, nil]];
+            addedFiles += [newFiles count];
+            removedFields += [fields count];
+        }
+    }
+    
+    for (NSArray *change in changes)
+        [[change objectAtIndex:0] noteMigratedFiles:[change objectAtIndex:1] removedFields:[change objectAtIndex:2]];
+    
+    for (NSUndoManager *undoManager in undoManagers) {
+        [undoManager setActionName:NSLocalizedString(@"Convert Files and URLs", @"Undo action name")];
+        [undoManager endUndoGrouping];
+    }
+    
+    if ([messages count] > 0 && outError) {
+        *outError = [NSError mutableLocalErrorWithCode:kBDSKFileNotFound localizedDescription:NSLocalizedString(@"Unable to migrate files completely", @"")];
+        [*outError setValue:messages forKey:@"messages"];
+    }
+    
+    if (numberOfAddedFiles)
+        *numberOfAddedFiles = addedFiles;
+    if (numberOfRemovedFields)
+        *numberOfRemovedFields = removedFields;
+    
+    return 0 == [messages count];
+}
+
+// runs on the migration queue
++ (void)resolveMigrationCandidates:(NSArray *)candidates
+{
+    NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+    [candidates makeObjectsPerformSelector:@selector(resolve)];
+    [pool release];
+}
+
+// this changes the publication without posting notifications, the caller should call noteMigratedFiles:removedFields: when the whole batch is applied
+- (void)applyMigratedFiles:(NSArray *)newFiles removingFields:(NSArray *)fields
+{
+    NSUndoManager *undoManager = [self undoManager];
+    
+    for (BDSKLinkedFile *file in newFiles) {
+        [[undoManager prepareWithInvocationTarget:self] removeObjectFromFilesAtIndex:[files count]];
+        [file setDelegate:self];
+        [files addObject:file];
+    }
+    
+    if ([fields count] > 0) {
+        [[undoManager prepareWithInvocationTarget:self] setFields:[[pubFields copy] autorelease]];
+        for (NSString *field in fields) {
+            [pubFields removeObjectForKey:field];
+            [self updateMetadataForKey:field];
+        }
+        [pubFields setValue:[[NSDate date] description] forKey:BDSKDateModifiedString];
+        [self updateMetadataForKey:BDSKDateModifiedString];
+    }
+}
+
+- (void)noteMigratedFiles:(NSArray *)newFiles removedFields:(NSArray *)fields
+{
+    BOOL addedLocalFiles = NO, addedRemoteURLs = NO;
+    for (BDSKLinkedFile *file in newFiles) {
+        if ([file isFile])
+            addedLocalFiles = YES;
+        else
+            addedRemoteURLs = YES;
+    }
+    // several fields changed, so as in setFields: we post without a key, which observers such as the document and the editor handle as a change of all fields
+    if ([fields count] > 0)
+        [[NSNotificationCenter defaultCenter] postNotificationName:BDSKBibItemChangedNotification object:self userInfo:[NSDictionary dictionary]];
+    // this also updates the file content search index, as the files were not inserted through the normal mechanism
+    if (addedLocalFiles)
+        [self noteFilesChanged:YES];
+    if (addedRemoteURLs)
+        [self noteFilesChanged:NO];
+}
+
 #pragma mark AutoFile support
 
 - (BOOL)isValidLocalFilePath:(NSString *)proposedPath{
@@ -3355,10 +3671,8 @@ static void addURLForFieldToArrayIfNotNil(const void *key, void *context)
     BOOL allFieldsChanged = [BDSKAllFieldsString isEqualToString:key];
     
     // invalidate people (authors, editors, etc.) if necessary
-    if (allFieldsChanged || [key isPersonField]) {
-        [people release];
-        people = nil;
-    }
+    if (allFieldsChanged || [key isPersonField])
+        [self invalidatePeople];
 	
     // see if we need to use the crossref workaround (BibTeX bug)
 	if([BDSKTitleString isEqualToString:key] &&
@@ -3506,3 +3820,122 @@ static void addURLForFieldToArrayIfNotNil(const void *key, void *context)
 }
 
 @end
+
+#pragma mark -
+
+@implementation BDSKArchivedBibItem
+
+- (id)initWithCiteKey:(NSString *)aCiteKey pubType:(NSString *)aType pubFields:(NSDictionary *)fields files:(NSArray *)fileSnapshots pubDate:(NSDate *)aPubDate dateAdded:(NSDate *)aDateAdded dateModified:(NSDate *)aDateModified hasBeenEdited:(BOOL)edited {
+    self = [super init];
+    if (self) {
+        citeKey = [aCiteKey copy];
+        pubType = [aType copy];
+        pubFields = [fields copy];
+        files = [fileSnapshots copy];
+        pubDate = [aPubDate retain];
+        dateAdded = [aDateAdded retain];
+        dateModified = [aDateModified retain];
+        hasBeenEdited = edited;
+    }
+    return self;
+}
+
+// this is never unarchived itself, it decodes as a BibItem
+- (id)initWithCoder:(NSCoder *)coder {
+    [self release];
+    return [[BibItem alloc] initWithCoder:coder];
+}
+
+- (void)dealloc {
+    BDSKDESTROY(citeKey);
+    BDSKDESTROY(pubType);
+    BDSKDESTROY(pubFields);
+    BDSKDESTROY(files);
+    BDSKDESTROY(pubDate);
+    BDSKDESTROY(dateAdded);
+    BDSKDESTROY(dateModified);
+    [super dealloc];
+}
+
+- (Class)classForCoder { return [BibItem class]; }
+- (Class)classForKeyedArchiver { return [BibItem class]; }
+
+- (void)encodeWithCoder:(NSCoder *)coder {
+    if ([coder allowsKeyedCoding])
+        encodeItemWithKeyedCoder(coder, citeKey, pubType, pubFields, files, pubDate, dateAdded, dateModified, hasBeenEdited);
+    else
+        [coder encodeDataObject:[NSKeyedArchiver archivedDataWithRootObject:self]];
+}
+
+@end
+
+#pragma mark -
+
+@implementation BDSKFileMigrationCandidate
+
+- (id)initWithPublication:(BibItem *)aPub field:(NSString *)aField URL:(NSURL *)aURL currentURLs:(NSArray *)URLs removeField:(BOOL)remove {
+    self = [super init];
+    if (self) {
+        publication = [aPub retain];
+        field = [aField copy];
+        URL = [aURL retain];
+        // the base path depends on the document, so we get it on the main thread
+        basePath = [[aPub basePath] copy];
+        currentURLs = [URLs retain];
+        removeField = remove;
+        // local file fields are resolved as in -[BibItem localFileURLForField:]
+        resolveAliases = [aField isLocalFileField];
+        file = nil;
+        fileURL = nil;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    BDSKDESTROY(publication);
+    BDSKDESTROY(field);
+    BDSKDESTROY(URL);
+    BDSKDESTROY(basePath);
+    BDSKDESTROY(currentURLs);
+    BDSKDESTROY(file);
+    BDSKDESTROY(fileURL);
+    [super dealloc];
+}
+
+- (BibItem *)publication { return publication; }
+
+- (NSString *)field { return field; }
+
+- (NSURL *)URL { return URL; }
+
+- (NSArray *)currentURLs { return currentURLs; }
+
+- (BOOL)removeField { return removeField; }
+
+- (BDSKLinkedFile *)file { return file; }
+
+- (NSURL *)fileURL { return fileURL; }
+
+// runs on the migration queue, this does the file system work of -[BibItem localFileURLForField:] and creating the linked file
+- (void)resolve {
+    if (URL == nil)
+        return;
+    if (resolveAliases) {
+        NSURL *resolvedURL = [URL fileURLByResolvingAliasesBeforeLastPathComponent];
+        if (resolvedURL) {
+            [URL release];
+            URL = [resolvedURL retain];
+        }
+    }
+    if ([currentURLs containsObject:URL] == NO) {
+        // we are the delegate until the file is added, so the alias is relative to the right base path
+        file = [[BDSKLinkedFile alloc] initWithURL:URL delegate:self];
+        fileURL = [[file URL] retain];
+    }
+}
+
+- (NSString *)basePathForLinkedFile:(BDSKLinkedFile *)aFile { return basePath; }
+
+- (void)linkedFileURLChanged:(BDSKLinkedFile *)aFile {}
+
+@end
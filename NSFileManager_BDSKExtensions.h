@@ -70,6 +70,8 @@
 @interface NSFileManager (BDSKExtensions)
 
 - (NSString *)applicationSupportDirectory;
+// Caches/<bundle identifier>/<class>-v<version>, created when needed; this is thread safe when used with a file manager of the calling thread
+- (NSString *)cachesFolderForClass:(Class)aClass version:(NSString *)version;
 - (NSString *)applicationsDirectory;
 - (NSString *)desktopDirectory;
 - (NSURL *)downloadFolderURL;
@@ -98,6 +100,7 @@
 - (BOOL)removeSpotlightCacheFilesForCiteKeys:(NSArray *)itemNames;
 - (BOOL)removeSpotlightCacheFileForCiteKey:(NSString *)citeKey;
 - (NSString *)spotlightCacheFilePathWithCiteKey:(NSString *)citeKey;
+- (NSString *)spotlightCachePackPathWithDocumentPath:(NSString *)docPath;
 
 // methods to get/set com.apple.TextEncoding attribute for 10.5 compatibility
 // apparently only used by NSString methods with the usedEncoding: parameter
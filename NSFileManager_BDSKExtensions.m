@@ -75,6 +75,7 @@
 #import "NSError_BDSKExtensions.h"
 #import "CFString_BDSKExtensions.h"
 #import "NSArray_BDSKExtensions.h"
+#import "NSData_BDSKExtensions.h"
 #import <SkimNotesBase/SkimNotesBase.h>
 #import <CoreServices/CoreServices.h>
 
@@ -159,6 +160,15 @@ static void destroyTemporaryDirectory()
     return path;
 }
 
+- (NSString *)cachesFolderForClass:(Class)aClass version:(NSString *)version{
+    NSString *folder = [NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject];
+    folder = [folder stringByAppendingPathComponent:[[NSBundle mainBundle] bundleIdentifier]];
+    folder = [folder stringByAppendingPathComponent:[NSString stringWithFormat:@"%@-v%@", NSStringFromClass(aClass), version]];
+    if (folder && [self fileExistsAtPath:folder] == NO)
+        [self createDirectoryAtPath:folder withIntermediateDirectories:YES attributes:nil error:NULL];
+    return folder;
+}
+
 - (NSString *)applicationsDirectory{
     NSString *path = [NSSearchPathForDirectoriesInDomains(NSApplicationDirectory, NSLocalDomainMask, YES) firstObject];
     
@@ -763,6 +773,13 @@ FSOpenIterator:
     return path;
 }
 
+- (NSString *)spotlightCachePackPathWithDocumentPath:(NSString *)docPath;
+{
+    // one packed cache file per document, named by a hash of the document path as the name of the document need not be unique
+    NSString *name = [[[docPath dataUsingEncoding:NSUTF8StringEncoding] sha1Signature] hexString];
+    return name == nil ? nil : [[self spotlightCacheFolderPathByCreating:NULL] stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"bdskcachepack"]];
+}
+
 - (BOOL)removeSpotlightCacheFileForCiteKey:(NSString *)citeKey;
 {
     NSString *path = [self spotlightCacheFilePathWithCiteKey:citeKey];
@@ -81,7 +81,48 @@
 #import "BDSKTypeManager.h"
 #import "NSFileManager_BDSKExtensions.h"
 #import "NSAttributedString_BDSKExtensions.h"
-
+#import <pthread.h>
+
+// these are used by the parsers, which can run on several threads at once, so they are set up before any thread can use them
+static NSMutableDictionary *entryDictionary = nil;
+static NSMutableDictionary *fieldDictionary = nil;
+static pthread_mutex_t nameDictionaryLock = PTHREAD_MUTEX_INITIALIZER;
+
+static NSCharacterSet *TeXSpecialsCharacterSet = nil;
+static NSCharacterSet *asciiSet = nil;
+static AGRegex *findSubscriptLeadingTag = nil;
+static AGRegex *findSubscriptOrSuperscriptTrailingTag = nil;
+static AGRegex *findSuperscriptLeadingTag = nil;
+static AGRegex *findNestedDollar = nil;
+
+// we can't use +initialize in a category, and +load is too dangerous
+__attribute__((constructor))
+static void initializeParserObjects()
+{
+    NSAutoreleasePool *pool = [NSAutoreleasePool new];
+    
+    // we could save a little memory by using case-insensitive dictionaries, but this is faster (and these strings are small)
+    entryDictionary = [[NSMutableDictionary alloc] initWithCapacity:100];
+    fieldDictionary = [[NSMutableDictionary alloc] initWithCapacity:100];
+    
+    TeXSpecialsCharacterSet = [[NSCharacterSet characterSetWithCharactersInString:@"%&"] copy];
+    asciiSet = [[NSCharacterSet characterSetWithRange:NSMakeRange(0, 127)] retain];
+    
+    // Some entries from Compendex have spaces in the tags, which is why we match 0-1 spaces between each character.
+    findSubscriptLeadingTag = [[AGRegex alloc] initWithPattern:@"< ?s ?u ?b ?>"];
+    findSubscriptOrSuperscriptTrailingTag = [[AGRegex alloc] initWithPattern:@"< ?/ ?s ?u ?[bp] ?>"];
+    findSuperscriptLeadingTag = [[AGRegex alloc] initWithPattern:@"< ?s ?u ?p ?>"];
+    
+    // This one might require some explanation.  An entry with TI of "Flapping flight as a bifurcation in Re<sub>&omega;</sub>"
+    // was run through the html conversion to give "...Re<sub>$\omega$</sub>", then the find sub/super regex replaced the sub tags to give
+    // "...Re$_$omega$$", which LaTeX barfed on.  So, we now search for <sub></sub> tags with matching dollar signs inside, and remove the inner
+    // dollar signs, since we'll use the dollar signs from our subsequent regex search and replace; however, we have to
+    // reject the case where there is a <sub><\sub> by matching [^<]+ (at least one character which is not <), or else it goes to the next </sub> tag
+    // and deletes dollar signs that it shouldn't touch.  Yuck.
+    findNestedDollar = [[AGRegex alloc] initWithPattern:@"(< ?s ?u ?[bp] ?>[^<]+)(\\$)(.*)(\\$)(.*< ?/ ?s ?u ?[bp] ?>)"];
+    
+    [pool release];
+}
 
 @implementation NSString (BDSKExtensions)
 
@@ -372,32 +413,26 @@ static inline BOOL dataHasUnicodeByteOrderMark(NSData *data)
 
 - (NSString *)entryType;
 {
-    // we could save a little memory by using a case-insensitive dictionary, but this is faster (and these strings are small)
-    static NSMutableDictionary *entryDictionary = nil;
-    if (nil == entryDictionary)
-        entryDictionary = [[NSMutableDictionary alloc] initWithCapacity:100];
-    
-    NSString *entryType = [entryDictionary objectForKey:self];
+    pthread_mutex_lock(&nameDictionaryLock);
+    NSString *entryType = [[entryDictionary objectForKey:self] retain];
     if (nil == entryType) {
-        entryType = [self lowercaseString];
+        entryType = [[self lowercaseString] retain];
         [entryDictionary setObject:entryType forKey:self];
     }
-    return entryType;
+    pthread_mutex_unlock(&nameDictionaryLock);
+    return [entryType autorelease];
 }
 
 - (NSString *)fieldName;
 {
-    // we could save a little memory by using a case-insensitive dictionary, but this is faster (and these strings are small)
-    static NSMutableDictionary *fieldDictionary = nil;
-    if (nil == fieldDictionary)
-        fieldDictionary = [[NSMutableDictionary alloc] initWithCapacity:100];
-    
-    NSString *fieldName = [fieldDictionary objectForKey:self];
+    pthread_mutex_lock(&nameDictionaryLock);
+    NSString *fieldName = [[fieldDictionary objectForKey:self] retain];
     if (nil == fieldName) {
-        fieldName = [self capitalizedString];
+        fieldName = [[self capitalizedString] retain];
         [fieldDictionary setObject:fieldName forKey:self];
     }
-    return fieldName;
+    pthread_mutex_unlock(&nameDictionaryLock);
+    return [fieldName autorelease];
 }
 
 - (NSString *)localizedFieldName;
@@ -566,11 +601,8 @@ static inline BOOL dataHasUnicodeByteOrderMark(NSData *data)
 
 - (NSString *)stringByBackslashEscapingTeXSpecials;
 {
-    static NSCharacterSet *charSet = nil;
     // We could really go crazy with this, but the main need is to escape characters that commonly appear in titles and journal names when importing from z39.50 and other non-RIS/non-BibTeX search group sources.  Those sources aren't processed by the HTML->TeX path that's used for RIS, since they generally don't have embedded HTML.
-    if (nil == charSet)
-        charSet = [[NSCharacterSet characterSetWithCharactersInString:@"%&"] copy];
-    return [self stringByBackslashEscapingCharactersInSet:charSet];
+    return [self stringByBackslashEscapingCharactersInSet:TeXSpecialsCharacterSet];
 }
 
 - (NSString *)stringByBackslashEscapingCharactersInSet:(NSCharacterSet *)charSet;
@@ -586,32 +618,6 @@ static inline BOOL dataHasUnicodeByteOrderMark(NSData *data)
 
 - (NSString *)stringByConvertingHTMLToTeX;
 {
-    static NSCharacterSet *asciiSet = nil;
-    if(asciiSet == nil)
-        asciiSet = [[NSCharacterSet characterSetWithRange:NSMakeRange(0, 127)] retain];
-    
-    // set these up here, so we don't autorelease them every time we parse an entry
-    // Some entries from Compendex have spaces in the tags, which is why we match 0-1 spaces between each character.
-    static AGRegex *findSubscriptLeadingTag = nil;
-    if(findSubscriptLeadingTag == nil)
-        findSubscriptLeadingTag = [[AGRegex alloc] initWithPattern:@"< ?s ?u ?b ?>"];
-    static AGRegex *findSubscriptOrSuperscriptTrailingTag = nil;
-    if(findSubscriptOrSuperscriptTrailingTag == nil)
-        findSubscriptOrSuperscriptTrailingTag = [[AGRegex alloc] initWithPattern:@"< ?/ ?s ?u ?[bp] ?>"];
-    static AGRegex *findSuperscriptLeadingTag = nil;
-    if(findSuperscriptLeadingTag == nil)
-        findSuperscriptLeadingTag = [[AGRegex alloc] initWithPattern:@"< ?s ?u ?p ?>"];
-    
-    // This one might require some explanation.  An entry with TI of "Flapping flight as a bifurcation in Re<sub>&omega;</sub>"
-    // was run through the html conversion to give "...Re<sub>$\omega$</sub>", then the find sub/super regex replaced the sub tags to give
-    // "...Re$_$omega$$", which LaTeX barfed on.  So, we now search for <sub></sub> tags with matching dollar signs inside, and remove the inner
-    // dollar signs, since we'll use the dollar signs from our subsequent regex search and replace; however, we have to
-    // reject the case where there is a <sub><\sub> by matching [^<]+ (at least one character which is not <), or else it goes to the next </sub> tag
-    // and deletes dollar signs that it shouldn't touch.  Yuck.
-    static AGRegex *findNestedDollar = nil;
-    if(findNestedDollar == nil)
-        findNestedDollar = [[AGRegex alloc] initWithPattern:@"(< ?s ?u ?[bp] ?>[^<]+)(\\$)(.*)(\\$)(.*< ?/ ?s ?u ?[bp] ?>)"];
-    
     // Run the value string through the HTML2LaTeX conversion, to clean up &theta; and friends.
     // NB: do this before the regex find/replace on <sub> and <sup> tags, or else your LaTeX math
     // stuff will get munged.  Unfortunately, the C code for HTML2LaTeX will destroy accented characters, so we only send it ASCII, and just keep
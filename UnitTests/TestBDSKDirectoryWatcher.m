@@ -0,0 +1,142 @@
+//
+//  TestBDSKDirectoryWatcher.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKDirectoryWatcher.h"
+#import "BDSKDirectoryWatcher.h"
+#import "BDSKLinkedFile.h"
+
+// FSEvents delivers events asynchronously, this is how long we wait for them
+#define EVENT_TIMEOUT 10.0
+// the watcher restarts its stream after a delay when a directory is added
+#define STREAM_START_DELAY 2.0
+
+static void runMainRunLoop(NSTimeInterval interval) {
+    NSDate *limitDate = [NSDate dateWithTimeIntervalSinceNow:interval];
+    while ([limitDate timeIntervalSinceNow] > 0.0)
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:limitDate];
+}
+
+@interface TestBDSKLinkedFileOwner : NSObject <BDSKLinkedFileDelegate> {
+    NSString *basePath;
+}
+- (id)initWithBasePath:(NSString *)aPath;
+@end
+
+@implementation TestBDSKLinkedFileOwner
+
+- (id)initWithBasePath:(NSString *)aPath {
+    self = [super init];
+    if (self)
+        basePath = [aPath copy];
+    return self;
+}
+
+- (void)dealloc {
+    [basePath release];
+    [super dealloc];
+}
+
+- (NSString *)basePathForLinkedFile:(BDSKLinkedFile *)file { return basePath; }
+
+- (void)linkedFileURLChanged:(BDSKLinkedFile *)file {}
+
+@end
+
+@implementation TestBDSKDirectoryWatcher
+
+- (void)setUp{
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:@"Parent/Papers"] withIntermediateDirectories:YES attributes:nil error:NULL];
+	[[NSData data] writeToFile:[path stringByAppendingPathComponent:@"Parent/Papers/paper.pdf"] atomically:NO];
+	rootPath = [path retain];
+}
+
+- (void)tearDown{
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+	[rootPath release];
+	rootPath = nil;
+}
+
+- (void)testRenameParentFolder{
+	BDSKDirectoryWatcher *watcher = [BDSKDirectoryWatcher sharedWatcher];
+	NSString *directory = [watcher watchDirectory:[rootPath stringByAppendingPathComponent:@"Parent/Papers"]];
+	NSUInteger generation = [watcher generation];
+	NSDate *limitDate;
+	
+	// let the stream start before we change anything
+	runMainRunLoop(STREAM_START_DELAY);
+	STAssertFalse([watcher directory:directory hasChangedSinceGeneration:generation], @"Check that the directory has not changed yet");
+	
+	[[NSFileManager defaultManager] moveItemAtPath:[rootPath stringByAppendingPathComponent:@"Parent"] toPath:[rootPath stringByAppendingPathComponent:@"Renamed"] error:NULL];
+	
+	limitDate = [NSDate dateWithTimeIntervalSinceNow:EVENT_TIMEOUT];
+	while ([watcher directory:directory hasChangedSinceGeneration:generation] == NO && [limitDate timeIntervalSinceNow] > 0.0)
+		runMainRunLoop(0.1);
+	STAssertTrue([watcher directory:directory hasChangedSinceGeneration:generation], @"Check that renaming a parent folder invalidates the directory");
+}
+
+- (void)testUnwatchBalancesWatches{
+	BDSKDirectoryWatcher *watcher = [BDSKDirectoryWatcher sharedWatcher];
+	NSString *directory = [watcher watchDirectory:[rootPath stringByAppendingPathComponent:@"Parent/Papers"]];
+	NSUInteger generation = [watcher generation];
+	
+	STAssertEqualObjects([watcher watchDirectory:[rootPath stringByAppendingPathComponent:@"Parent/Papers"]], directory, nil);
+	[watcher unwatchDirectory:directory];
+	STAssertFalse([watcher directory:directory hasChangedSinceGeneration:generation], @"Check that the directory is watched until the last watch is balanced");
+	[watcher unwatchDirectory:directory];
+	STAssertTrue([watcher directory:directory hasChangedSinceGeneration:generation], @"Check that a directory that is no longer watched is reported as changed");
+}
+
+- (void)testLinkedFileFollowsRenamedParentFolder{
+	TestBDSKLinkedFileOwner *owner = [[[TestBDSKLinkedFileOwner alloc] initWithBasePath:rootPath] autorelease];
+	BDSKLinkedFile *file = [BDSKLinkedFile linkedFileWithURL:[NSURL fileURLWithPath:[rootPath stringByAppendingPathComponent:@"Parent/Papers/paper.pdf"]] delegate:owner];
+	NSDate *limitDate;
+	
+	STAssertNotNil([file URL], @"Check that the file is resolved");
+	runMainRunLoop(STREAM_START_DELAY);
+	
+	[[NSFileManager defaultManager] moveItemAtPath:[rootPath stringByAppendingPathComponent:@"Parent"] toPath:[rootPath stringByAppendingPathComponent:@"Renamed"] error:NULL];
+	
+	// the cached URL is returned until the file is resolved again in the background
+	limitDate = [NSDate dateWithTimeIntervalSinceNow:EVENT_TIMEOUT];
+	while ([[[file URL] path] hasSuffix:@"/Renamed/Papers/paper.pdf"] == NO && [limitDate timeIntervalSinceNow] > 0.0)
+		runMainRunLoop(0.1);
+	STAssertTrue([[[file URL] path] hasSuffix:@"/Renamed/Papers/paper.pdf"], @"Check that the cached URL follows the renamed parent folder");
+}
+
+@end
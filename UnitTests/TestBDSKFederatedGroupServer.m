@@ -0,0 +1,191 @@
+//
+//  TestBDSKFederatedGroupServer.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKFederatedGroupServer.h"
+#import "BDSKFederatedGroupServer.h"
+#import "BDSKServerInfo.h"
+#import "BDSKBibTeXParser.h"
+#import "BibItem.h"
+
+#define fastItems @"@article{a,\nTitle = {Federated Search},\nYear = {2001},\nDoi = {10.1000/ABC}}\n@article{b,\nTitle = {Optimizing {ML} with Run-Time Code Generation},\nYear = {1996}}"
+#define slowItems @"@inproceedings{c,\nTitle = {Optimizing ML with run-time code generation},\nYear = {1996},\nBooktitle = {PLDI}}\n@article{d,\nTitle = {Something Else},\nYear = {2001},\nDoi = {doi:10.1000/xyz}}\n@article{e,\nTitle = {Federated search, revisited},\nYear = {2003},\nDoi = {10.1000/abc}}"
+
+// stand-in for a search server, the database is the delay before it answers, a negative delay means it never answers
+@interface TestStandInSearchServer : NSObject <BDSKSearchGroupServer> {
+    id<BDSKSearchGroup> group;
+    BDSKServerInfo *serverInfo;
+    NSInteger fetchedResults;
+    BOOL isRetrieving;
+}
+@end
+
+@implementation TestStandInSearchServer
+
+- (id)initWithGroup:(id<BDSKSearchGroup>)aGroup serverInfo:(BDSKServerInfo *)info {
+    self = [super init];
+    if (self) {
+        group = aGroup;
+        serverInfo = [info copy];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+    [serverInfo release];
+    [super dealloc];
+}
+
+- (NSString *)type { return [serverInfo type]; }
+- (BDSKServerInfo *)serverInfo { return serverInfo; }
+- (void)setServerInfo:(BDSKServerInfo *)info {}
+- (NSInteger)numberOfAvailableResults { return fetchedResults; }
+- (NSInteger)numberOfFetchedResults { return fetchedResults; }
+- (BOOL)failedDownload { return NO; }
+- (NSString *)errorMessage { return nil; }
+- (BOOL)isRetrieving { return isRetrieving; }
+- (NSFormatter *)searchStringFormatter { return nil; }
+- (void)terminate { [self reset]; }
+
+- (void)reset {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+    isRetrieving = NO;
+}
+
+- (void)answer {
+    NSString *string = [[serverInfo name] isEqualToString:@"fast"] ? fastItems : slowItems;
+    NSArray *pubs = [BDSKBibTeXParser itemsFromString:string owner:nil isPartialData:NULL error:NULL];
+    fetchedResults += [pubs count];
+    isRetrieving = NO;
+    [group addPublications:pubs];
+}
+
+- (void)retrieveWithSearchTerm:(NSString *)aSearchTerm {
+    NSTimeInterval delay = [[serverInfo database] doubleValue];
+    isRetrieving = YES;
+    if (delay >= 0.0)
+        [self performSelector:@selector(answer) withObject:nil afterDelay:delay];
+}
+
+@end
+
+@interface TestFederatedGroupServer : BDSKFederatedGroupServer
+@end
+
+@implementation TestFederatedGroupServer
+- (id<BDSKSearchGroupServer>)newServerWithGroup:(id<BDSKSearchGroup>)aGroup serverInfo:(BDSKServerInfo *)info {
+    return [[TestStandInSearchServer alloc] initWithGroup:aGroup serverInfo:info];
+}
+@end
+
+// collects what the federated server passes on
+@interface TestFederatedSearchGroup : NSObject <BDSKSearchGroup> {
+    NSMutableArray *publications;
+    NSUInteger updateCount;
+}
+- (NSArray *)foundPublications;
+- (NSUInteger)updateCount;
+@end
+
+@implementation TestFederatedSearchGroup
+
+- (id)init {
+    self = [super init];
+    if (self)
+        publications = [[NSMutableArray alloc] init];
+    return self;
+}
+
+- (void)dealloc {
+    [publications release];
+    [super dealloc];
+}
+
+- (void)addPublications:(NSArray *)pubs {
+    [publications addObjectsFromArray:pubs];
+    updateCount++;
+}
+
+- (NSArray *)foundPublications { return publications; }
+- (NSUInteger)updateCount { return updateCount; }
+- (BOOL)isDocument { return NO; }
+- (BDSKPublicationsArray *)publications { return nil; }
+- (BDSKMacroResolver *)macroResolver { return nil; }
+- (NSUndoManager *)undoManager { return nil; }
+- (NSURL *)fileURL { return nil; }
+- (NSString *)documentInfoForKey:(NSString *)key { return nil; }
+- (BDSKItemSearchIndexes *)searchIndexes { return nil; }
+
+@end
+
+
+@implementation TestBDSKFederatedGroupServer
+
+static BDSKServerInfo *standInServerInfo(NSString *name, NSString *delay) {
+    return [[[BDSKServerInfo alloc] initWithType:BDSKSearchGroupEntrez name:name database:delay host:nil port:nil options:nil] autorelease];
+}
+
+- (void)testMergedResultsWithTimeout{
+	NSArray *infos = [NSArray arrayWithObjects:standInServerInfo(@"fast", @"0.05"), standInServerInfo(@"slow", @"0.3"), standInServerInfo(@"dead", @"-1"), nil];
+	NSDictionary *options = [NSDictionary dictionaryWithObjectsAndKeys:[infos valueForKey:@"dictionaryValue"], @"servers", @"1", @"timeout", nil];
+	BDSKServerInfo *info = [[[BDSKServerInfo alloc] initWithType:BDSKSearchGroupFederated name:@"All" database:nil host:nil port:nil options:options] autorelease];
+	TestFederatedSearchGroup *group = [[[TestFederatedSearchGroup alloc] init] autorelease];
+	TestFederatedGroupServer *server = [[[TestFederatedGroupServer alloc] initWithGroup:group serverInfo:info] autorelease];
+	
+	STAssertTrue([[info serverInfos] count] == 3, @"Check that the federated server info has all servers");
+	
+	NSDate *start = [NSDate date];
+	[server retrieveWithSearchTerm:@"ml"];
+	STAssertTrue([server isRetrieving], @"Check that the servers are searched asynchronously");
+	
+	while ([group updateCount] == 0 && [start timeIntervalSinceNow] > -5.0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+	STAssertTrue([[group foundPublications] count] == 2, @"Check that the fast results come in first");
+	STAssertTrue([server isRetrieving], @"Check that the other servers are still searched");
+	
+	while ([server isRetrieving] && [start timeIntervalSinceNow] > -5.0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+	STAssertFalse([server isRetrieving], @"Check that the dead server times out");
+	STAssertTrue([start timeIntervalSinceNow] > -3.0, @"Check that the timeout is respected");
+	STAssertTrue([group updateCount] == 3, @"Check that every server was reported separately");
+	STAssertTrue([[group foundPublications] count] == 3, @"Check that duplicates by DOI and by title and year are removed");
+	STAssertFalse([server failedDownload], @"Check that a single timeout does not fail the search");
+	STAssertNotNil([server errorMessage], @"Check that the timeout is reported");
+}
+
+@end
@@ -0,0 +1,125 @@
+//
+//  TestBDSKFileMatchScorer.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKFileMatchScorer.h"
+#import "BDSKFileMatchScorer.h"
+#import "BDSKTreeNode.h"
+
+// with these files "paper" is in more than half of them and is ignored, while "optimizing" is in exactly half of them and still counts
+// "most" has all weighted title terms but "optimizing", which is just over the title coverage of 0.75, and "half" is well below it
+#define fileTexts [NSDictionary dictionaryWithObjectsAndKeys:\
+	@"optimizing compilers runtime generation smith", @"full.pdf",\
+	@"compilers runtime generation paper smith", @"most.pdf",\
+	@"compilers generation paper smith", @"half.pdf",\
+	@"optimizing compilers runtime generation paper", @"anonymous.pdf",\
+	@"optimizing weather paper", @"other1.pdf",\
+	@"optimizing sunny weather paper", @"other2.pdf",\
+	@"rainy weather paper", @"other3.pdf",\
+	@"cloudy weather", @"other4.pdf", nil]
+
+static BDSKTreeNode *publicationNode(NSString *title, NSString *name) {
+	BDSKTreeNode *node = [[[BDSKTreeNode alloc] init] autorelease];
+	[node setValue:[title componentsSeparatedByString:@" "] forKey:BDSKFileMatchTitleTermsKey];
+	[node setValue:[NSArray arrayWithObject:name] forKey:BDSKFileMatchNameTermsKey];
+	[node setValue:[NSString stringWithFormat:@"%@ AND %@", title, name] forKey:@"searchString"];
+	return node;
+}
+
+// file name -> relative score of the files matched to a publication
+static NSDictionary *matchedFiles(BDSKTreeNode *node) {
+	NSMutableDictionary *files = [NSMutableDictionary dictionary];
+	NSUInteger i, iMax = [node countOfChildren];
+	for (i = 0; i < iMax; i++) {
+		BDSKTreeNode *child = [node objectInChildrenAtIndex:i];
+		[files setObject:[child valueForKey:@"score"] forKey:[[[child valueForKey:@"fileURL"] path] lastPathComponent]];
+	}
+	return files;
+}
+
+@implementation TestBDSKFileMatchScorer
+
+- (void)setUp{
+	CFMutableDataRef indexData = CFDataCreateMutable(NULL, 0);
+	searchIndex = SKIndexCreateWithMutableData(indexData, NULL, kSKIndexInverted, NULL);
+	CFRelease(indexData);
+	NSDictionary *texts = fileTexts;
+	for (NSString *name in texts) {
+		SKDocumentRef doc = SKDocumentCreateWithURL((CFURLRef)[NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:name]]);
+		SKIndexAddDocumentWithText(searchIndex, doc, (CFStringRef)[texts objectForKey:name], TRUE);
+		CFRelease(doc);
+	}
+	SKIndexFlush(searchIndex);
+}
+
+- (void)tearDown{
+	if (searchIndex)
+		CFRelease(searchIndex);
+	searchIndex = NULL;
+}
+
+- (void)testTitleCoverageThreshold{
+	BDSKTreeNode *node = publicationNode(@"optimizing compilers runtime generation paper", @"smith");
+	NSSet *terms = [NSSet setWithArray:[[node valueForKey:BDSKFileMatchTitleTermsKey] arrayByAddingObjectsFromArray:[node valueForKey:BDSKFileMatchNameTermsKey]]];
+	BDSKFileMatchScorer *scorer = [[[BDSKFileMatchScorer alloc] initWithIndex:searchIndex terms:terms] autorelease];
+	[scorer scoreTreeNodes:[NSArray arrayWithObject:node]];
+	
+	NSDictionary *files = matchedFiles(node);
+	STAssertEqualObjects([[files allKeys] sortedArrayUsingSelector:@selector(compare:)], ([NSArray arrayWithObjects:@"full.pdf", @"most.pdf", nil]), @"Check that only files covering enough of the title and containing the author match");
+	STAssertEqualsWithAccuracy([[files objectForKey:@"full.pdf"] doubleValue], 1.0, 0.0001, @"Check that a file with all title terms but a very common one gets the full score");
+	STAssertTrue([[files objectForKey:@"most.pdf"] doubleValue] >= 0.75 && [[files objectForKey:@"most.pdf"] doubleValue] < 1.0, @"Check that a file missing a title term gets a lower score");
+	STAssertEqualObjects([[node objectInChildrenAtIndex:[node countOfChildren] - 1] valueForKey:@"searchString"], [node valueForKey:@"searchString"], @"Check that the matches get the search string of the publication");
+}
+
+- (void)testUnknownTermsAndAuthors{
+	BDSKTreeNode *otherAuthorNode = publicationNode(@"optimizing compilers runtime generation", @"jones");
+	BDSKTreeNode *unknownTitleNode = publicationNode(@"compilers runtime generation unheard", @"smith");
+	BDSKTreeNode *node = publicationNode(@"compilers runtime generation", @"smith");
+	NSMutableSet *terms = [NSMutableSet set];
+	for (BDSKTreeNode *aNode in [NSArray arrayWithObjects:otherAuthorNode, unknownTitleNode, node, nil]) {
+		[terms addObjectsFromArray:[aNode valueForKey:BDSKFileMatchTitleTermsKey]];
+		[terms addObjectsFromArray:[aNode valueForKey:BDSKFileMatchNameTermsKey]];
+	}
+	BDSKFileMatchScorer *scorer = [[[BDSKFileMatchScorer alloc] initWithIndex:searchIndex terms:terms] autorelease];
+	[scorer scoreTreeNodes:[NSArray arrayWithObjects:otherAuthorNode, unknownTitleNode, node, nil]];
+	
+	STAssertTrue([otherAuthorNode countOfChildren] == 0, @"Check that files without the author do not match");
+	STAssertTrue([unknownTitleNode countOfChildren] == 0, @"Check that a title term in no file counts against every file");
+	STAssertEqualObjects([[matchedFiles(node) allKeys] sortedArrayUsingSelector:@selector(compare:)], ([NSArray arrayWithObjects:@"full.pdf", @"most.pdf", nil]), @"Check that the accumulated scores of the previous publications do not leak");
+}
+
+@end
@@ -0,0 +1,113 @@
+//
+//  TestBDSKFileStatusCache.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKFileStatusCache.h"
+#import "BDSKFileStatusCache.h"
+#import "BDSKDirectoryWatcher.h"
+
+// longer than the coalescing delay of the cache, but shorter than the time the watcher needs to start and deliver real events
+#define COALESCE_TIMEOUT 0.3
+
+static void runMainRunLoop(NSTimeInterval interval) {
+    NSDate *limitDate = [NSDate dateWithTimeIntervalSinceNow:interval];
+    while ([limitDate timeIntervalSinceNow] > 0.0)
+        [[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:limitDate];
+}
+
+// the watcher reports real paths, e.g. /private/var rather than /var
+static NSString *realPathForDirectory(NSString *path) {
+    char realPath[PATH_MAX];
+    if (realpath([path fileSystemRepresentation], realPath) == NULL)
+        return path;
+    return [[NSFileManager defaultManager] stringWithFileSystemRepresentation:realPath length:strlen(realPath)];
+}
+
+@implementation TestBDSKFileStatusCache
+
+- (void)setUp{
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:@"Changed"] withIntermediateDirectories:YES attributes:nil error:NULL];
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:@"Unchanged"] withIntermediateDirectories:YES attributes:nil error:NULL];
+	[@"a" writeToFile:[path stringByAppendingPathComponent:@"Changed/paper.pdf"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	[@"b" writeToFile:[path stringByAppendingPathComponent:@"Unchanged/paper.pdf"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	rootPath = [path retain];
+	notifications = [[NSMutableArray alloc] init];
+}
+
+- (void)tearDown{
+	[[NSNotificationCenter defaultCenter] removeObserver:self];
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+	[rootPath release];
+	rootPath = nil;
+	[notifications release];
+	notifications = nil;
+}
+
+- (void)handleFileStatusDidChangeNotification:(NSNotification *)notification{
+	[notifications addObject:notification];
+}
+
+- (void)testChangedDirectoryIsCoalescedAndClearsOnlyItsEntries{
+	BDSKFileStatusCache *cache = [[[BDSKFileStatusCache alloc] init] autorelease];
+	NSURL *changedURL = [NSURL fileURLWithPath:[rootPath stringByAppendingPathComponent:@"Changed/paper.pdf"]];
+	NSURL *unchangedURL = [NSURL fileURLWithPath:[rootPath stringByAppendingPathComponent:@"Unchanged/paper.pdf"]];
+	NSString *changedDirectory = realPathForDirectory([rootPath stringByAppendingPathComponent:@"Changed"]);
+	NSDictionary *userInfo = [NSDictionary dictionaryWithObjectsAndKeys:[NSArray arrayWithObject:changedDirectory], BDSKDirectoryWatcherDirectoriesKey, nil];
+	
+	[[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(handleFileStatusDidChangeNotification:) name:BDSKFileStatusDidChangeNotification object:cache];
+	
+	STAssertEquals([cache fileSizeForURL:changedURL], 1ULL, nil);
+	STAssertEquals([cache fileSizeForURL:unchangedURL], 1ULL, nil);
+	
+	// change both files, but only report the first directory as changed, as the watcher would do several times for a burst of events
+	[@"aa" writeToFile:[changedURL path] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	[@"bb" writeToFile:[unchangedURL path] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	[[NSNotificationCenter defaultCenter] postNotificationName:BDSKDirectoryWatcherDirectoriesDidChangeNotification object:[BDSKDirectoryWatcher sharedWatcher] userInfo:userInfo];
+	[[NSNotificationCenter defaultCenter] postNotificationName:BDSKDirectoryWatcherDirectoriesDidChangeNotification object:[BDSKDirectoryWatcher sharedWatcher] userInfo:userInfo];
+	
+	STAssertEquals([cache fileSizeForURL:changedURL], 2ULL, @"Check that the entries of the changed directory are cleared");
+	STAssertEquals([cache fileSizeForURL:unchangedURL], 1ULL, @"Check that the entries of other directories are kept");
+	STAssertEquals([notifications count], (NSUInteger)0, @"Check that the notification is not posted right away");
+	
+	runMainRunLoop(COALESCE_TIMEOUT);
+	
+	STAssertEquals([notifications count], (NSUInteger)1, @"Check that the changes are coalesced in a single notification");
+	STAssertEqualObjects([[[notifications lastObject] userInfo] objectForKey:BDSKFileStatusDirectoriesKey], [NSArray arrayWithObject:changedDirectory], @"Check that only the changed directory is reported");
+}
+
+@end
@@ -0,0 +1,169 @@
+//
+//  TestBDSKFiler.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKFiler.h"
+#import "BDSKFiler.h"
+#include <sys/stat.h>
+
+#define DECOMPOSED_NAME @"Cafe\u0301.pdf"
+#define PRECOMPOSED_NAME @"Caf\u00e9.pdf"
+
+
+@implementation TestBDSKFiler
+
+- (void)setUp{
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	[[NSFileManager defaultManager] createDirectoryAtPath:path withIntermediateDirectories:YES attributes:nil error:NULL];
+	rootPath = [path retain];
+}
+
+- (void)tearDown{
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+	[rootPath release];
+	rootPath = nil;
+}
+
+- (NSString *)pathForName:(NSString *)name{
+	return [rootPath stringByAppendingPathComponent:name];
+}
+
+- (NSString *)writeFile:(NSString *)name contents:(NSString *)contents{
+	NSString *path = [self pathForName:name];
+	[contents writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	return path;
+}
+
+- (NSString *)contentsOfFile:(NSString *)name{
+	return [NSString stringWithContentsOfFile:[self pathForName:name] encoding:NSUTF8StringEncoding error:NULL];
+}
+
+- (void)testIndependentMoves{
+	NSArray *oldPaths = [NSArray arrayWithObjects:@"/a/1.pdf", @"/a/2.pdf", @"/a/3.pdf", nil];
+	NSArray *newPaths = [NSArray arrayWithObjects:@"/b/1.pdf", @"/b/2.pdf", @"/b/3.pdf", nil];
+	NSIndexSet *indexes = [BDSKFiler indexesOfIndependentMovesFromPaths:oldPaths toPaths:newPaths];
+	STAssertEquals([indexes count], (NSUInteger)3, @"Check that moves to distinct targets are independent");
+}
+
+- (void)testCollidingMovesAreSerial{
+	NSArray *oldPaths = [NSArray arrayWithObjects:@"/a/1.pdf", @"/a/2.pdf", @"/a/3.pdf", @"/a/4.pdf", @"/a/5.pdf", @"/a/6.pdf", nil];
+	NSArray *newPaths = [NSArray arrayWithObjects:@"/b/Paper.pdf", @"/b/paper.PDF", [@"/b" stringByAppendingPathComponent:PRECOMPOSED_NAME], [@"/b" stringByAppendingPathComponent:DECOMPOSED_NAME], @"/A/1.PDF", @"/b/other.pdf", nil];
+	NSIndexSet *indexes = [BDSKFiler indexesOfIndependentMovesFromPaths:oldPaths toPaths:newPaths];
+	STAssertTrue([indexes containsIndex:0], @"Check that the first claim of a target is independent");
+	STAssertFalse([indexes containsIndex:1], @"Check that a target differing only in case is done in order");
+	STAssertTrue([indexes containsIndex:2], @"Check that the first claim of a target is independent");
+	STAssertFalse([indexes containsIndex:3], @"Check that a target differing only in normalization is done in order");
+	STAssertFalse([indexes containsIndex:4], @"Check that a target that is the source of another move is done in order");
+	STAssertTrue([indexes containsIndex:5], @"Check that an unrelated move stays independent");
+}
+
+- (void)testRefuseToOverwriteTarget{
+	NSString *path = [self writeFile:@"source.pdf" contents:@"source"];
+	NSString *newPath = [self writeFile:@"target.pdf" contents:@"target"];
+	NSError *error = nil;
+	
+	STAssertFalse([[NSFileManager defaultManager] movePath:path toPath:newPath force:NO error:&error], @"Check that we don't move onto an existing file");
+	STAssertTrue(([error code] & BDSKTargetFileExistsErrorMask) != 0, @"Check that the error is about the existing target");
+	STAssertEqualObjects([self contentsOfFile:@"source.pdf"], @"source", @"Check that the original is left alone");
+	STAssertEqualObjects([self contentsOfFile:@"target.pdf"], @"target", @"Check that the existing file is not replaced");
+}
+
+- (void)testMoveDoesNotFollowSymlinkedNotes{
+	NSString *path = [self writeFile:@"paper.pdf" contents:@"paper"];
+	NSString *newPath = [self pathForName:@"moved.pdf"];
+	[self writeFile:@"notes.skim" contents:@"notes"];
+	[[NSFileManager defaultManager] createSymbolicLinkAtPath:[self pathForName:@"paper.skim"] withDestinationPath:[self pathForName:@"notes.skim"] error:NULL];
+	struct stat sb;
+	
+	STAssertTrue([[NSFileManager defaultManager] movePath:path toPath:newPath force:NO error:NULL], @"Check that the file is moved");
+	STAssertEqualObjects([self contentsOfFile:@"moved.pdf"], @"paper", nil);
+	STAssertTrue(0 == lstat([[self pathForName:@"paper.skim"] fileSystemRepresentation], &sb) && S_ISLNK(sb.st_mode), @"Check that the symlinked notes are left alone");
+	STAssertTrue(0 != lstat([[self pathForName:@"moved.skim"] fileSystemRepresentation], &sb), @"Check that the symlink target is not hard linked at the new location");
+	STAssertTrue(0 == lstat([[self pathForName:@"notes.skim"] fileSystemRepresentation], &sb) && sb.st_nlink == 1, @"Check that the symlink target is not linked");
+}
+
+- (void)testRecoverPartlyDoneMoves{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSString *journalPath = [self pathForName:@"journal.plist"];
+	NSArray *names = [NSArray arrayWithObjects:@"moved", @"notMoved", @"reused", @"replaced", nil];
+	NSMutableArray *oldPaths = [NSMutableArray array];
+	NSMutableArray *newPaths = [NSMutableArray array];
+	
+	for (NSString *name in names) {
+		[oldPaths addObject:[self writeFile:[name stringByAppendingPathExtension:@"pdf"] contents:name]];
+		[newPaths addObject:[self pathForName:[name stringByAppendingString:@"-new.pdf"]]];
+	}
+	[BDSKFiler writeJournalForMovesFromPaths:oldPaths toPaths:newPaths atPath:journalPath];
+	
+	// the batch was interrupted after some of the moves
+	[fm moveItemAtPath:[oldPaths objectAtIndex:0] toPath:[newPaths objectAtIndex:0] error:NULL];
+	[fm moveItemAtPath:[oldPaths objectAtIndex:2] toPath:[newPaths objectAtIndex:2] error:NULL];
+	[self writeFile:@"reused.pdf" contents:@"new reused"];
+	[fm moveItemAtPath:[oldPaths objectAtIndex:3] toPath:[newPaths objectAtIndex:3] error:NULL];
+	[fm removeItemAtPath:[newPaths objectAtIndex:3] error:NULL];
+	[self writeFile:@"replaced-new.pdf" contents:@"other file"];
+	
+	[BDSKFiler recoverMovesFromJournalAtPath:journalPath];
+	
+	STAssertEqualObjects([self contentsOfFile:@"moved.pdf"], @"moved", @"Check that a moved file is moved back");
+	STAssertFalse([fm fileExistsAtPath:[newPaths objectAtIndex:0]], nil);
+	STAssertEqualObjects([self contentsOfFile:@"notMoved.pdf"], @"notMoved", @"Check that a file that was not moved is left alone");
+	STAssertEqualObjects([self contentsOfFile:@"reused.pdf"], @"new reused", @"Check that a new file at the old location is not replaced");
+	STAssertEqualObjects([self contentsOfFile:@"reused-new.pdf"], @"reused", @"Check that the moved file stays when its old location was taken");
+	STAssertFalse([fm fileExistsAtPath:[oldPaths objectAtIndex:3]], @"Check that a different file at the target is not moved back");
+	STAssertEqualObjects([self contentsOfFile:@"replaced-new.pdf"], @"other file", nil);
+	STAssertFalse([fm fileExistsAtPath:journalPath], @"Check that the journal is removed");
+}
+
+- (void)testRecoverTruncatedJournal{
+	NSFileManager *fm = [NSFileManager defaultManager];
+	NSString *journalPath = [self pathForName:@"journal.plist"];
+	NSString *path = [self writeFile:@"paper.pdf" contents:@"paper"];
+	NSString *newPath = [self pathForName:@"moved.pdf"];
+	
+	[BDSKFiler writeJournalForMovesFromPaths:[NSArray arrayWithObject:path] toPaths:[NSArray arrayWithObject:newPath] atPath:journalPath];
+	[fm moveItemAtPath:path toPath:newPath error:NULL];
+	NSData *data = [NSData dataWithContentsOfFile:journalPath];
+	[[data subdataWithRange:NSMakeRange(0, [data length] / 2)] writeToFile:journalPath atomically:NO];
+	
+	[BDSKFiler recoverMovesFromJournalAtPath:journalPath];
+	
+	STAssertEqualObjects([self contentsOfFile:@"moved.pdf"], @"paper", @"Check that nothing is moved for an unreadable journal");
+	STAssertFalse([fm fileExistsAtPath:journalPath], @"Check that an unreadable journal is removed");
+}
+
+@end
@@ -0,0 +1,122 @@
+//
+//  TestBDSKImport.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKImport.h"
+#import "BibDocument.h"
+#import "BibItem.h"
+#import "BDSKStringConstants.h"
+#import "NSError_BDSKExtensions.h"
+
+// enough files for several files of each format to be parsed at the same time
+#define IMPORT_REPEAT_COUNT 8
+
+@implementation TestBDSKImport
+
+- (void)setUp{
+	rootPath = [[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]] retain];
+	[[NSFileManager defaultManager] createDirectoryAtPath:rootPath withIntermediateDirectories:YES attributes:nil error:NULL];
+}
+
+- (void)tearDown{
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+	[rootPath release];
+	rootPath = nil;
+}
+
+- (NSString *)writeString:(NSString *)string toFile:(NSString *)fileName{
+	NSString *path = [rootPath stringByAppendingPathComponent:fileName];
+	[string writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	return path;
+}
+
+- (void)testImportSeveralFormatsAtOnce{
+	NSMutableArray *files = [NSMutableArray array];
+	NSMutableArray *expectedTitles = [NSMutableArray array];
+	NSMutableArray *expectedUnparseableFiles = [NSMutableArray array];
+	NSUInteger i;
+	
+	for (i = 0; i < IMPORT_REPEAT_COUNT; i++) {
+		NSString *title;
+		
+		title = [NSString stringWithFormat:@"RIS Title %lu", (unsigned long)i];
+		[files addObject:[self writeString:[NSString stringWithFormat:@"TY  - JOUR\nTI  - %@\nAU  - Smith, John\nER  - \n", title] toFile:[NSString stringWithFormat:@"%lu-ris.txt", (unsigned long)i]]];
+		[expectedTitles addObject:title];
+		
+		[files addObject:[self writeString:@"Nothing to import here." toFile:[NSString stringWithFormat:@"%lu-junk.txt", (unsigned long)i]]];
+		[expectedUnparseableFiles addObject:[files lastObject]];
+		
+		title = [NSString stringWithFormat:@"PubMed Title %lu", (unsigned long)i];
+		[files addObject:[self writeString:[NSString stringWithFormat:@"PMID- %lu\nOWN - NLM\nTI  - %@\nAU  - Smith J\n", (unsigned long)(1000 + i), title] toFile:[NSString stringWithFormat:@"%lu-pubmed.txt", (unsigned long)i]]];
+		[expectedTitles addObject:title];
+		
+		title = [NSString stringWithFormat:@"Refer Title %lu", (unsigned long)i];
+		[files addObject:[self writeString:[NSString stringWithFormat:@"%%0 Journal Article\n%%T %@\n%%A John Smith\n", title] toFile:[NSString stringWithFormat:@"%lu-refer.txt", (unsigned long)i]]];
+		[expectedTitles addObject:title];
+		
+		[files addObject:[self writeString:@"%PDF-1.4" toFile:[NSString stringWithFormat:@"%lu-paper.pdf", (unsigned long)i]]];
+		[expectedUnparseableFiles addObject:[files lastObject]];
+	}
+	
+	// BibTeX without a cite key is parsed on the main thread and returns a warning
+	[files addObject:[self writeString:@"@article{,\n  title = {BibTeX Title}\n}\n" toFile:@"nokey.txt"]];
+	[expectedTitles addObject:@"BibTeX Title"];
+	
+	BibDocument *document = [[[BibDocument alloc] init] autorelease];
+	NSArray *unparseableFiles = nil;
+	NSError *error = nil;
+	NSArray *pubs = [document extractPublicationsFromFiles:files unparseableFiles:&unparseableFiles verbose:NO error:&error];
+	
+	STAssertEquals([pubs count], [expectedTitles count], @"Check that every parseable file is imported");
+	STAssertEqualObjects([pubs valueForKey:@"title"], expectedTitles, @"Check that the publications are in the order of the files");
+	STAssertEqualObjects(unparseableFiles, expectedUnparseableFiles, @"Check that the unparseable files are returned in their original order");
+	STAssertTrue([error isLocalErrorWithCode:kBDSKHadMissingCiteKeys], @"Check that the missing cite key warning is returned");
+}
+
+- (void)testImportOnlyUnparseableFiles{
+	NSArray *files = [NSArray arrayWithObjects:[self writeString:@"Nothing to import here." toFile:@"junk.txt"], [self writeString:@"%PDF-1.4" toFile:@"paper.pdf"], nil];
+	BibDocument *document = [[[BibDocument alloc] init] autorelease];
+	NSArray *unparseableFiles = nil;
+	NSError *error = nil;
+	NSArray *pubs = [document extractPublicationsFromFiles:files unparseableFiles:&unparseableFiles verbose:NO error:&error];
+	
+	STAssertEquals([pubs count], (NSUInteger)0, @"Check that nothing is imported");
+	STAssertEqualObjects(unparseableFiles, files, @"Check that all files are returned as unparseable");
+	STAssertNil(error, @"Check that no error is returned for unparseable files");
+}
+
+@end
@@ -0,0 +1,124 @@
+//
+//  TestBDSKMARCParser.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKMARCParser.h"
+#import "BibItem.h"
+#import "BDSKStringConstants.h"
+#import "BDSKMARCParser.h"
+
+#define FIELD_TERMINATOR    "\x1E"
+#define SUBFIELD_INDICATOR  "\x1F"
+
+// builds an ISO 2709 record from tags and field values, the values include the indicators and subfields
+static NSData *recordWithFields(NSArray *tags, NSArray *values, char encoding) {
+    NSMutableData *directory = [NSMutableData data];
+    NSMutableData *fields = [NSMutableData data];
+    NSUInteger i;
+    
+    for (i = 0; i < [tags count]; i++) {
+        NSData *value = [values objectAtIndex:i];
+        NSString *entry = [NSString stringWithFormat:@"%@%04lu%05lu", [tags objectAtIndex:i], (unsigned long)[value length] + 1, (unsigned long)[fields length]];
+        [directory appendData:[entry dataUsingEncoding:NSASCIIStringEncoding]];
+        [fields appendData:value];
+        [fields appendBytes:FIELD_TERMINATOR length:1];
+    }
+    [directory appendBytes:FIELD_TERMINATOR length:1];
+    
+    NSUInteger base = 24 + [directory length];
+    NSUInteger length = base + [fields length] + 1;
+    NSString *leader = [NSString stringWithFormat:@"%05luna %c a22%05lu   4500", (unsigned long)length, encoding, (unsigned long)base];
+    NSMutableData *record = [NSMutableData dataWithData:[leader dataUsingEncoding:NSASCIIStringEncoding]];
+    [record appendData:directory];
+    [record appendData:fields];
+    [record appendBytes:"\x1D" length:1];
+    return record;
+}
+
+static NSData *fieldData(const char *bytes) {
+    return [NSData dataWithBytes:bytes length:strlen(bytes)];
+}
+
+@implementation TestBDSKMARCParser
+
+- (void)testMARC8Record{
+	// MARC-8 puts the combining diacritic (E2 acute, E8 umlaut) before the base character
+	NSArray *tags = [NSArray arrayWithObjects:@"001", @"100", @"245", nil];
+	NSArray *values = [NSArray arrayWithObjects:fieldData("12345"), fieldData("1 " SUBFIELD_INDICATOR "aM\xE8uller, Hans"), fieldData("10" SUBFIELD_INDICATOR "aCaf\xE2" "e society"), nil];
+	NSData *data = recordWithFields(tags, values, ' ');
+	
+	STAssertTrue([BDSKMARCParser canParseMARCData:data], @"Check that the record is recognized");
+	NSArray *items = [BDSKMARCParser itemsFromMARCData:data includeAnnote:NO error:NULL];
+	STAssertTrue([items count]==1 ,@"Check the number of items");
+	BibItem *item = [items lastObject];
+	STAssertEqualObjects([item valueOfField:BDSKTitleString], ([NSString stringWithFormat:@"Caf%C society", (unichar)0x00E9]), @"Check a decoded MARC-8 title");
+	STAssertEqualObjects([item valueOfField:BDSKAuthorString], ([NSString stringWithFormat:@"M%Cller, Hans", (unichar)0x00FC]), @"Check a decoded MARC-8 author");
+}
+
+- (void)testUTF8Record{
+	NSArray *tags = [NSArray arrayWithObjects:@"245", @"260", nil];
+	NSArray *values = [NSArray arrayWithObjects:fieldData("10" SUBFIELD_INDICATOR "aCaf\xC3\xA9 society"), fieldData("  " SUBFIELD_INDICATOR "bPublisher" SUBFIELD_INDICATOR "cc1999"), nil];
+	NSData *data = recordWithFields(tags, values, 'a');
+	
+	BibItem *item = [[BDSKMARCParser itemsFromMARCData:data includeAnnote:NO error:NULL] lastObject];
+	STAssertEqualObjects([item valueOfField:BDSKTitleString], ([NSString stringWithFormat:@"Caf%C society", (unichar)0x00E9]), @"Check a UTF-8 title");
+	STAssertEqualObjects([item valueOfField:BDSKYearString], @"1999", @"Check the year");
+}
+
+- (void)testBadDirectory{
+	// the directory lengths count the bytes of the original encoding, so they can be off after conversion; we should fall back to the field terminators
+	NSArray *tags = [NSArray arrayWithObjects:@"100", @"245", nil];
+	NSArray *values = [NSArray arrayWithObjects:fieldData("1 " SUBFIELD_INDICATOR "aLee, Peter"), fieldData("10" SUBFIELD_INDICATOR "aA title"), nil];
+	NSMutableData *data = [[recordWithFields(tags, values, ' ') mutableCopy] autorelease];
+	[data replaceBytesInRange:NSMakeRange(24 + 3, 4) withBytes:"0003"];
+	
+	BibItem *item = [[BDSKMARCParser itemsFromMARCData:data includeAnnote:NO error:NULL] lastObject];
+	STAssertEqualObjects([item valueOfField:BDSKAuthorString], @"Lee, Peter", @"Check the first field");
+	STAssertEqualObjects([item valueOfField:BDSKTitleString], @"A title", @"Check the field after the bad directory entry");
+}
+
+- (void)testTruncatedData{
+	NSArray *tags = [NSArray arrayWithObjects:@"245", nil];
+	NSArray *values = [NSArray arrayWithObjects:fieldData("10" SUBFIELD_INDICATOR "aA title"), nil];
+	NSData *data = recordWithFields(tags, values, ' ');
+	NSUInteger i;
+	
+	for (i = 0; i < [data length]; i++)
+		STAssertNoThrow([BDSKMARCParser itemsFromMARCData:[data subdataWithRange:NSMakeRange(0, i)] includeAnnote:YES error:NULL], @"Check that truncated data does not raise");
+}
+
+@end
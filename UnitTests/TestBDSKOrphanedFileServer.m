@@ -0,0 +1,148 @@
+//
+//  TestBDSKOrphanedFileServer.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKOrphanedFileServer.h"
+#import "BDSKOrphanedFileServer.h"
+#import <sys/stat.h>
+
+// the server only trusts directories that were scanned more than a second after they last changed
+#define SETTLE_INTERVAL 1.5
+#define SCAN_TIMEOUT 10.0
+
+@interface TestBDSKOrphanedFileServer (Private) <BDSKOrphanedFileServerDelegate>
+@end
+
+@implementation TestBDSKOrphanedFileServer
+
+- (void)setUp{
+	NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:@"Papers/Sub"] withIntermediateDirectories:YES attributes:nil error:NULL];
+	[[NSFileManager defaultManager] createDirectoryAtPath:[path stringByAppendingPathComponent:@"Snapshots"] withIntermediateDirectories:YES attributes:nil error:NULL];
+	[@"a" writeToFile:[path stringByAppendingPathComponent:@"Papers/a.pdf"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	[@"b" writeToFile:[path stringByAppendingPathComponent:@"Papers/b.pdf"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	[@"c" writeToFile:[path stringByAppendingPathComponent:@"Papers/Sub/c.pdf"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	rootPath = [[path stringByAppendingPathComponent:@"Papers"] retain];
+	snapshotFolder = [[path stringByAppendingPathComponent:@"Snapshots"] retain];
+	foundFiles = [[NSMutableArray alloc] init];
+	[NSThread sleepForTimeInterval:SETTLE_INTERVAL];
+}
+
+- (void)tearDown{
+	[[NSFileManager defaultManager] removeItemAtPath:[rootPath stringByDeletingLastPathComponent] error:NULL];
+	[rootPath release];
+	rootPath = nil;
+	[snapshotFolder release];
+	snapshotFolder = nil;
+	[foundFiles release];
+	foundFiles = nil;
+}
+
+- (void)orphanedFileServer:(BDSKOrphanedFileServer *)server foundFiles:(NSArray *)newFiles{
+	[foundFiles addObjectsFromArray:newFiles];
+}
+
+- (void)orphanedFileServerDidFinish:(BDSKOrphanedFileServer *)server{
+	finished = YES;
+}
+
+// scans with a new server each time, so the snapshot has to come from disk
+- (NSArray *)orphanedFileNames{
+	BDSKOrphanedFileServer *server = [[BDSKOrphanedFileServer alloc] initWithSnapshotFolder:snapshotFolder];
+	[server setDelegate:self];
+	[foundFiles removeAllObjects];
+	finished = NO;
+	
+	[[server serverOnServerThread] checkForOrphansWithKnownFiles:[NSSet set] baseURL:[NSURL fileURLWithPath:rootPath]];
+	NSDate *limitDate = [NSDate dateWithTimeIntervalSinceNow:SCAN_TIMEOUT];
+	while (finished == NO && [limitDate timeIntervalSinceNow] > 0.0)
+		[[NSRunLoop currentRunLoop] runMode:NSDefaultRunLoopMode beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+	STAssertTrue(finished, @"Check that the scan finishes");
+	STAssertTrue([server allFilesEnumerated], @"Check that all files were enumerated");
+	
+	[server setDelegate:nil];
+	[server stopDOServer];
+	[server release];
+	
+	return [[foundFiles valueForKeyPath:@"path.lastPathComponent"] sortedArrayUsingSelector:@selector(compare:)];
+}
+
+// directory name -> date when the snapshot entry of that directory was read from disk
+- (NSDictionary *)scanDates{
+	NSArray *names = [[NSFileManager defaultManager] contentsOfDirectoryAtPath:snapshotFolder error:NULL];
+	STAssertTrue([names count] == 1, @"Check that the scan saved a single snapshot");
+	NSDictionary *snapshot = [NSDictionary dictionaryWithContentsOfFile:[snapshotFolder stringByAppendingPathComponent:[names lastObject]]];
+	NSDictionary *directories = [snapshot objectForKey:@"directories"];
+	NSMutableDictionary *dates = [NSMutableDictionary dictionary];
+	for (NSString *path in directories)
+		[dates setObject:[[directories objectForKey:path] objectForKey:@"scanned"] forKey:[path lastPathComponent]];
+	return dates;
+}
+
+- (void)testUnchangedDirectoriesUseSnapshot{
+	NSArray *allFiles = [NSArray arrayWithObjects:@"a.pdf", @"b.pdf", @"c.pdf", nil];
+	
+	STAssertEqualObjects([self orphanedFileNames], allFiles, @"Check that the first scan finds all files");
+	NSDictionary *dates = [self scanDates];
+	STAssertTrue([dates count] == 2, @"Check that both directories are in the snapshot");
+	
+	STAssertEqualObjects([self orphanedFileNames], allFiles, @"Check that a scan from the snapshot finds all files");
+	STAssertEqualObjects([self scanDates], dates, @"Check that unchanged directories are not read again");
+	
+	[@"d" writeToFile:[rootPath stringByAppendingPathComponent:@"Sub/d.pdf"] atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	STAssertEqualObjects([self orphanedFileNames], ([NSArray arrayWithObjects:@"a.pdf", @"b.pdf", @"c.pdf", @"d.pdf", nil]), @"Check that an added file is found");
+	NSDictionary *newDates = [self scanDates];
+	STAssertEqualObjects([newDates objectForKey:@"Papers"], [dates objectForKey:@"Papers"], @"Check that the unchanged directory is not read again");
+	STAssertFalse([[newDates objectForKey:@"Sub"] isEqual:[dates objectForKey:@"Sub"]], @"Check that the changed directory is read again");
+}
+
+- (void)testVisibilityChangeInvalidatesSnapshot{
+	STAssertEqualObjects([self orphanedFileNames], ([NSArray arrayWithObjects:@"a.pdf", @"b.pdf", @"c.pdf", nil]), @"Check that the first scan finds all files");
+	NSDictionary *dates = [self scanDates];
+	
+	// hiding a file does not change the date of its directory
+	NSString *hiddenPath = [rootPath stringByAppendingPathComponent:@"b.pdf"];
+	struct stat sb;
+	STAssertTrue(stat([hiddenPath fileSystemRepresentation], &sb) == 0 && chflags([hiddenPath fileSystemRepresentation], sb.st_flags | UF_HIDDEN) == 0, @"Check that the file can be hidden");
+	
+	STAssertEqualObjects([self orphanedFileNames], ([NSArray arrayWithObjects:@"a.pdf", @"c.pdf", nil]), @"Check that a hidden file is no longer found");
+	NSDictionary *newDates = [self scanDates];
+	STAssertFalse([[newDates objectForKey:@"Papers"] isEqual:[dates objectForKey:@"Papers"]], @"Check that the directory with the hidden file is read again");
+	STAssertEqualObjects([newDates objectForKey:@"Sub"], [dates objectForKey:@"Sub"], @"Check that the other directory is not read again");
+}
+
+@end
@@ -43,8 +43,18 @@
 
 #define goodRIS @"TY  - JOUR\nT1  - Julian Steward, American Anthropology, and Colonialism\nA1  - Marc Pinkoski\nJF  - Histories of Anthropology Annual\nVL  - 4\nSP  - 172\nEP  - 204\nY1  - 2008\nPB  - University of Nebraska Press\nSN  - 1940-5138\nUR  - http://muse.jhu.edu/journals/histories_of_anthropology_annual/v004/4.pinkoski.html\nN1  - Volume 4, 2008\nER  - \n"
 #define goodRISNoFinalReturnOrSpace @"TY  - JOUR\nT1  - Julian Steward, American Anthropology, and Colonialism\nA1  - Marc Pinkoski\nJF  - Histories of Anthropology Annual\nVL  - 4\nSP  - 172\nEP  - 204\nY1  - 2008\nPB  - University of Nebraska Press\nSN  - 1940-5138\nUR  - http://muse.jhu.edu/journals/histories_of_anthropology_annual/v004/4.pinkoski.html\nN1  - Volume 4, 2008\nER  -"
+#define scopusRIS @"Scopus\r\nEXPORT DATE: 10 May 2010\r\n\r\nTY  - JOUR\r\nT1  - Julian Steward, American Anthropology,\r\n      and Colonialism\r\nA1  - Pinkoski, M.\r\nA1  - Steward, J.H.\r\nUR  - http://example.com/?a=1&b=2\r\nSP  - 172\r\nY1  - 2008/05//ER  - \r\nTY  - BOOK\r\nT1  - Second\r\nER  - \r\n"
+#define looseRIS @"DB  - Some Database\nTY  - JOUR\nT1  - Loose Title\nN2\t - Tab spaced abstract\nkw  - lowercase\nA   - Single\nER  -\n"
+#define noTypeRIS @"T1  - No Type\nA1  - Pinkoski, M.\nER  - \n"
+#define NULRISFormat @"TY  - JOUR\nT1  - Before%CAfter\nER  - \nTY  - BOOK\nT1  - Second\nER  - \n"
 #define badRISSingleSpace @"TY - JOUR\nT1 - Julian Steward, American Anthropology, and Colonialism\nA1 - Marc Pinkoski\nJF - Histories of Anthropology Annual\nVL - 4\nSP - 172\nEP - 204\nY1 - 2008\nPB - University of Nebraska Press\nSN - 1940-5138\nUR - http://muse.jhu.edu/journals/histories_of_anthropology_annual/v004/4.pinkoski.html\nN1 - Volume 4, 2008\nER -\n"
 
+// the size of the generated RIS dump for the benchmark
+#define BENCHMARK_SIZE (100 * 1024 * 1024)
+
+// benchmarks are slow and only log their timings, so they only run when this environment variable is set
+#define BENCHMARK_ENVIRONMENT_KEY "BDSK_RUN_BENCHMARKS"
+
 
 @implementation TestBDSKRISParser
 - (void)testCanParseString{
@@ -79,4 +89,67 @@
 	STAssertEqualObjects([b2 bibTeXStringWithOptions:BDSKBibTeXOptionDropInternalMask],[b bibTeXStringWithOptions:BDSKBibTeXOptionDropInternalMask],@"final return should not affect RIS parsing");
 }
 
+- (void)testScopusRIS{
+	NSArray *items = [BDSKStringParser itemsFromString:scopusRIS ofType:BDSKRISStringType error:NULL];
+	STAssertTrue(2 == [items count], @"Check that the context lines and the ER tag at the end of a line are handled");
+	
+	BibItem *b = [items objectAtIndex:0];
+	STAssertEqualObjects([b valueOfField:BDSKTitleString],@"Julian Steward, American Anthropology, and Colonialism",@"Check that multiline values are joined");
+	STAssertEqualObjects([b bibTeXAuthorStringNormalized:YES],@"Pinkoski, M. and Steward, J. H.",nil);
+	STAssertEqualObjects([b valueOfField:BDSKUrlString],@"http://example.com/?a=1&b=2",@"Check that URLs are not converted");
+	STAssertEqualObjects([b valueOfField:BDSKPagesString],@"172",nil);
+	STAssertEqualObjects([b valueOfField:BDSKYearString],@"2008",nil);
+	STAssertEqualObjects([b valueOfField:BDSKMonthString],@"05",nil);
+	STAssertEqualObjects([[items objectAtIndex:1] valueOfField:BDSKTitleString],@"Second",nil);
+}
+
+- (void)testLooseRIS{
+	NSArray *items = [BDSKStringParser itemsFromString:looseRIS ofType:BDSKRISStringType error:NULL];
+	STAssertTrue(1 == [items count], @"Check that tag lines before the first TY are ignored");
+	
+	BibItem *b = [items lastObject];
+	STAssertEqualObjects([b valueOfField:BDSKTitleString],@"Loose Title",nil);
+	STAssertEqualObjects([b valueOfField:BDSKAbstractString],@"Tab spaced abstract",@"Check that any spacing in the tag columns is accepted");
+	STAssertEqualObjects([b valueOfField:@"Kw"],@"lowercase",@"Check that lowercase tags are accepted");
+	STAssertEqualObjects([b valueOfField:@"A"],@"Single",@"Check that single character tags are accepted");
+	STAssertNil([b valueOfField:@"Db"],@"Check that the context before the first TY is ignored");
+}
+
+- (void)testRISWithoutType{
+	NSArray *items = [BDSKStringParser itemsFromString:noTypeRIS ofType:BDSKRISStringType error:NULL];
+	STAssertTrue(1 == [items count], @"Check that we parse RIS without a TY line from the start");
+	STAssertEqualObjects([[items lastObject] valueOfField:BDSKTitleString],@"No Type",nil);
+}
+
+- (void)testRISWithNULCharacter{
+	NSString *string = [NSString stringWithFormat:NULRISFormat, (unichar)0];
+	NSArray *items = [BDSKStringParser itemsFromString:string ofType:BDSKRISStringType error:NULL];
+	STAssertTrue(2 == [items count], @"Check that a NUL character does not truncate the input");
+	STAssertEqualObjects([[items lastObject] valueOfField:BDSKTitleString],@"Second",nil);
+}
+
+// RIS is our main format for bulk imports, so time a large dump
+- (void)testImportBenchmark{
+	if (getenv(BENCHMARK_ENVIRONMENT_KEY) == NULL)
+		return;
+	
+	NSMutableString *dump = [NSMutableString stringWithCapacity:BENCHMARK_SIZE + [goodRIS length]];
+	NSUInteger count = 0;
+	while ([dump length] < BENCHMARK_SIZE) {
+		[dump appendString:goodRIS];
+		[dump appendString:@"\n"];
+		count++;
+	}
+	
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	NSDate *start = [NSDate date];
+	NSUInteger itemCount = [[BDSKStringParser itemsFromString:dump ofType:BDSKRISStringType error:NULL] count];
+	NSTimeInterval time = -[start timeIntervalSinceNow];
+	[pool release];
+	
+	NSLog(@"Parsed %lu RIS items (%.1f MB) in %.3fs, %.1f MB/s", (unsigned long)itemCount, [dump length] / 1048576.0, time, [dump length] / 1048576.0 / time);
+	
+	STAssertTrue(itemCount == count, @"Check that all items were parsed");
+}
+
 @end
@@ -0,0 +1,121 @@
+//
+//  TestBDSKSharedRecordArchiver.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKSharedRecordArchiver.h"
+#import "BibItem.h"
+#import "BDSKBibTeXParser.h"
+#import "BDSKSharedRecordArchiver.h"
+#import "BDSKStringConstants.h"
+#import "NSData_BDSKExtensions.h"
+
+#define oneItem @"@inproceedings{Lee96RTOptML,\nYear = {1996},\nUrl = {http://citeseer.nj.nec.com/70627.html},\nTitle = {Optimizing ML with Run-Time Code Generation},\nBooktitle = PLDI,\nAuthor = {Peter Lee and Mark Leone}}"
+
+#define BENCHMARK_COUNT 2000
+
+// benchmarks are slow and only log their timings, so they only run when this environment variable is set
+#define BENCHMARK_ENVIRONMENT_KEY "BDSK_RUN_BENCHMARKS"
+
+
+@implementation TestBDSKSharedRecordArchiver
+
+- (void)testRoundTrip{
+	BOOL isPartialData = NO;
+	NSError *parseError = nil;
+	BibItem *item = [[BDSKBibTeXParser itemsFromString:oneItem owner:nil isPartialData:&isPartialData error:&parseError] lastObject];
+	
+	NSData *data = [BDSKSharedRecordArchiver archivedDataWithRootObject:[NSArray arrayWithObject:[item archivableSnapshot]]];
+	STAssertTrue([BDSKSharedRecordUnarchiver canUnarchiveData:data], @"Check that the data is recognized as a record archive");
+	STAssertFalse([BDSKSharedRecordUnarchiver canUnarchiveData:[NSKeyedArchiver archivedDataWithRootObject:item]], @"Check that a keyed archive is not recognized");
+	
+	BibItem *copy = [[BDSKSharedRecordUnarchiver unarchiveObjectWithData:data macroResolver:nil] lastObject];
+	STAssertNotNil(copy, @"Check that the item was unarchived");
+	STAssertEqualObjects([copy citeKey], [item citeKey], @"Check the cite key");
+	STAssertEqualObjects([copy pubType], [item pubType], @"Check the type");
+	STAssertEqualObjects([copy valueOfField:BDSKTitleString], [item valueOfField:BDSKTitleString], @"Check a field");
+	STAssertTrue([[copy valueOfField:BDSKBooktitleString] isComplex], @"Check that macros are kept");
+	STAssertTrue([copy isEqualToItem:item], @"Check that the items are equal");
+}
+
+- (void)testInvalidData{
+	NSData *data = [BDSKSharedRecordArchiver archivedDataWithRootObject:[NSArray arrayWithObjects:@"a", @"b", nil]];
+	NSData *truncated = [data subdataWithRange:NSMakeRange(0, [data length] - 1)];
+	STAssertThrows([BDSKSharedRecordUnarchiver unarchiveObjectWithData:truncated macroResolver:nil], @"Check that truncated data raises");
+}
+
+- (void)testNestingDepth{
+	NSArray *shallow = [NSArray array], *deep = [NSArray array];
+	NSUInteger i;
+	for (i = 0; i < 10; i++)
+		shallow = [NSArray arrayWithObject:shallow];
+	for (i = 0; i < 1000; i++)
+		deep = [NSArray arrayWithObject:deep];
+	
+	STAssertNoThrow([BDSKSharedRecordUnarchiver unarchiveObjectWithData:[BDSKSharedRecordArchiver archivedDataWithRootObject:shallow] macroResolver:nil], @"Check that nested values can be unarchived");
+	STAssertThrows([BDSKSharedRecordUnarchiver unarchiveObjectWithData:[BDSKSharedRecordArchiver archivedDataWithRootObject:deep] macroResolver:nil], @"Check that too deeply nested values raise");
+}
+
+// compares the record format with keyed archiving as currently used for sharing, by archiving and unarchiving in process
+- (void)testLoopbackBenchmark{
+	if (getenv(BENCHMARK_ENVIRONMENT_KEY) == NULL)
+		return;
+	
+	BOOL isPartialData = NO;
+	NSError *parseError = nil;
+	BibItem *item = [[BDSKBibTeXParser itemsFromString:oneItem owner:nil isPartialData:&isPartialData error:&parseError] lastObject];
+	NSMutableArray *snapshots = [NSMutableArray arrayWithCapacity:BENCHMARK_COUNT];
+	NSUInteger i;
+	for (i = 0; i < BENCHMARK_COUNT; i++)
+		[snapshots addObject:[item archivableSnapshot]];
+	
+	NSDate *start = [NSDate date];
+	NSData *keyedData = [NSKeyedArchiver archivedDataWithRootObject:snapshots];
+	NSArray *keyedItems = [NSKeyedUnarchiver unarchiveObjectWithData:keyedData];
+	NSTimeInterval keyedTime = -[start timeIntervalSinceNow];
+	
+	start = [NSDate date];
+	NSData *recordData = [BDSKSharedRecordArchiver archivedDataWithRootObject:snapshots];
+	NSArray *recordItems = [BDSKSharedRecordUnarchiver unarchiveObjectWithData:recordData macroResolver:nil];
+	NSTimeInterval recordTime = -[start timeIntervalSinceNow];
+	
+	NSLog(@"%lu items: keyed archive %lu bytes (%lu compressed) in %.3fs, record archive %lu bytes (%lu compressed) in %.3fs", (unsigned long)BENCHMARK_COUNT, (unsigned long)[keyedData length], (unsigned long)[[keyedData compressedData] length], keyedTime, (unsigned long)[recordData length], (unsigned long)[[recordData compressedData] length], recordTime);
+	
+	STAssertTrue([keyedItems count] == BENCHMARK_COUNT && [recordItems count] == BENCHMARK_COUNT, @"Check that all items were unarchived");
+	STAssertTrue([recordData length] < [keyedData length], @"Check that the record archive is smaller");
+}
+
+@end
@@ -0,0 +1,85 @@
+//
+//  TestBDSKSharingChangeLog.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKSharingChangeLog.h"
+#import "BDSKSharingChangeLog.h"
+#import "BDSKSharingServer.h"
+
+
+@implementation TestBDSKSharingChangeLog
+
+- (void)testFullUpdateAfterDeletion{
+	BDSKSharingChangeLog *changeLog = [[[BDSKSharingChangeLog alloc] init] autorelease];
+	NSDictionary *macros = [NSDictionary dictionary];
+	
+	[changeLog updateWithPublications:[NSDictionary dictionaryWithObjectsAndKeys:@"first", @"a", @"second", @"b", nil] macros:macros dataGeneration:1];
+	NSDictionary *changes = [changeLog changesSinceVersion:-1 generation:nil range:NSMakeRange(0, NSUIntegerMax)];
+	STAssertEquals([[changes objectForKey:BDSKSharedChangedDataKey] count], (NSUInteger)2, @"Check that a full update contains all items");
+	NSString *generation = [changes objectForKey:BDSKSharedGenerationKey];
+	NSInteger version = [[changes objectForKey:BDSKSharedVersionKey] integerValue];
+	
+	[changeLog updateWithPublications:[NSDictionary dictionaryWithObjectsAndKeys:@"first", @"a", nil] macros:macros dataGeneration:2];
+	STAssertNoThrow(changes = [changeLog changesSinceVersion:-1 generation:nil range:NSMakeRange(0, NSUIntegerMax)], @"Check that a full update after a deletion does not raise");
+	STAssertEqualObjects([[changes objectForKey:BDSKSharedChangedDataKey] allKeys], [NSArray arrayWithObject:@"a"], @"Check that a full update does not contain the deleted item");
+	STAssertEquals([[changes objectForKey:BDSKSharedTotalCountKey] unsignedIntegerValue], (NSUInteger)1, @"Check the total count of a full update");
+	
+	changes = [changeLog changesSinceVersion:version generation:generation range:NSMakeRange(0, NSUIntegerMax)];
+	STAssertFalse([[changes objectForKey:BDSKSharedIsFullUpdateKey] boolValue], @"Check that a current client gets an incremental update");
+	STAssertEquals([[changes objectForKey:BDSKSharedChangedDataKey] count], (NSUInteger)0, @"Check that unchanged items are not sent");
+	STAssertEqualObjects([changes objectForKey:BDSKSharedRemovedIdentifiersKey], [NSArray arrayWithObject:@"b"], @"Check that the deleted item is reported");
+}
+
+- (void)testUpdateWithChangedPublications{
+	BDSKSharingChangeLog *changeLog = [[[BDSKSharingChangeLog alloc] init] autorelease];
+	NSDictionary *macros = [NSDictionary dictionary];
+	NSSet *identifiers = [NSSet setWithObjects:@"a", @"b", nil];
+	
+	[changeLog updateWithChangedPublications:[NSDictionary dictionaryWithObjectsAndKeys:@"first", @"a", @"second", @"b", nil] identifiers:identifiers macros:macros dataGeneration:1];
+	NSDictionary *changes = [changeLog changesSinceVersion:-1 generation:nil range:NSMakeRange(0, NSUIntegerMax)];
+	NSString *generation = [changes objectForKey:BDSKSharedGenerationKey];
+	NSInteger version = [[changes objectForKey:BDSKSharedVersionKey] integerValue];
+	
+	// only the changed item is passed, the other one should be kept
+	[changeLog updateWithChangedPublications:[NSDictionary dictionaryWithObjectsAndKeys:@"changed", @"b", nil] identifiers:identifiers macros:macros dataGeneration:2];
+	changes = [changeLog changesSinceVersion:version generation:generation range:NSMakeRange(0, NSUIntegerMax)];
+	STAssertEqualObjects([[changes objectForKey:BDSKSharedChangedDataKey] allKeys], [NSArray arrayWithObject:@"b"], @"Check that only the changed item is sent");
+	changes = [changeLog changesSinceVersion:-1 generation:nil range:NSMakeRange(0, NSUIntegerMax)];
+	STAssertEquals([[changes objectForKey:BDSKSharedChangedDataKey] count], (NSUInteger)2, @"Check that a full update still contains the unchanged item");
+}
+
+@end
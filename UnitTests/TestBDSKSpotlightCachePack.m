@@ -0,0 +1,133 @@
+//
+//  TestBDSKSpotlightCachePack.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKSpotlightCachePack.h"
+#import "BDSKSpotlightCachePack.h"
+
+// the layout of the header and the index entries, see BDSKSpotlightCachePack.m
+#define HEADER_LENGTH   24
+#define ENTRY_LENGTH    16
+
+static NSData *itemDataWithTitle(NSString *title) {
+    NSDictionary *item = [NSDictionary dictionaryWithObjectsAndKeys:title, @"title", nil];
+    return [NSPropertyListSerialization dataFromPropertyList:item format:NSPropertyListBinaryFormat_v1_0 errorDescription:NULL];
+}
+
+static NSData *packData() {
+    NSDictionary *docInfo = [NSDictionary dictionaryWithObjectsAndKeys:@"Document", @"title", nil];
+    NSArray *citeKeys = [NSArray arrayWithObjects:@"smith2001", @"doe1999", @"lee1996", nil];
+    NSArray *itemData = [NSArray arrayWithObjects:itemDataWithTitle(@"Smith"), itemDataWithTitle(@"Doe"), itemDataWithTitle(@"Lee"), nil];
+    return [BDSKSpotlightCachePack dataWithDocumentInfo:docInfo citeKeys:citeKeys itemData:itemData];
+}
+
+static void setUInt32(NSMutableData *data, NSUInteger offset, uint32_t value) {
+    value = CFSwapInt32HostToBig(value);
+    [data replaceBytesInRange:NSMakeRange(offset, sizeof(uint32_t)) withBytes:&value];
+}
+
+@implementation TestBDSKSpotlightCachePack
+
+- (void)testRoundTrip{
+	BDSKSpotlightCachePack *pack = [[[BDSKSpotlightCachePack alloc] initWithData:packData()] autorelease];
+	
+	STAssertNotNil(pack, @"Check that the pack can be read");
+	STAssertTrue([pack count]==3 ,@"Check the number of items");
+	STAssertEqualObjects([[pack documentInfo] objectForKey:@"title"], @"Document", @"Check the document info");
+	STAssertEqualObjects([pack citeKeyAtIndex:0], @"doe1999", @"Check that the items are sorted by cite key");
+	STAssertEqualObjects([[pack itemForCiteKey:@"smith2001"] objectForKey:@"title"], @"Smith", @"Check an item for a cite key");
+	STAssertEqualObjects([[pack itemForCiteKey:@"doe1999"] objectForKey:@"title"], @"Doe", @"Check the first item for a cite key");
+	STAssertTrue([pack indexOfCiteKey:@"jones2000"]==NSNotFound ,@"Check a missing cite key");
+	STAssertTrue([pack indexOfCiteKey:@"lee"]==NSNotFound ,@"Check a prefix of a cite key");
+	STAssertEqualObjects([pack itemDataAtIndex:[pack indexOfCiteKey:@"lee1996"]], itemDataWithTitle(@"Lee"), @"Check the item data");
+}
+
+- (void)testEmptyPack{
+	NSData *data = [BDSKSpotlightCachePack dataWithDocumentInfo:nil citeKeys:[NSArray array] itemData:[NSArray array]];
+	BDSKSpotlightCachePack *pack = [[[BDSKSpotlightCachePack alloc] initWithData:data] autorelease];
+	
+	STAssertNotNil(pack, @"Check that an empty pack can be read");
+	STAssertTrue([pack count]==0 ,@"Check the number of items");
+	STAssertNil([pack documentInfo], @"Check the missing document info");
+	STAssertTrue([pack indexOfCiteKey:@"doe1999"]==NSNotFound ,@"Check a lookup in an empty pack");
+	STAssertNil([BDSKSpotlightCachePack dataWithDocumentInfo:nil citeKeys:[NSArray arrayWithObject:@"doe1999"] itemData:[NSArray array]], @"Check that the arrays must be parallel");
+}
+
+- (void)testCorruptHeader{
+	NSData *data = packData();
+	NSMutableData *corrupt;
+	
+	STAssertNil([[[BDSKSpotlightCachePack alloc] initWithData:[data subdataWithRange:NSMakeRange(0, HEADER_LENGTH - 1)]] autorelease], @"Check a truncated header");
+	
+	corrupt = [[data mutableCopy] autorelease];
+	[corrupt replaceBytesInRange:NSMakeRange(0, 1) withBytes:"X"];
+	STAssertNil([[[BDSKSpotlightCachePack alloc] initWithData:corrupt] autorelease], @"Check a bad magic");
+	
+	corrupt = [[data mutableCopy] autorelease];
+	setUInt32(corrupt, 8, 2);
+	STAssertNil([[[BDSKSpotlightCachePack alloc] initWithData:corrupt] autorelease], @"Check an unknown version");
+	
+	corrupt = [[data mutableCopy] autorelease];
+	setUInt32(corrupt, 12, UINT32_MAX);
+	STAssertNil([[[BDSKSpotlightCachePack alloc] initWithData:corrupt] autorelease], @"Check a count that does not fit in the data");
+	
+	corrupt = [[data mutableCopy] autorelease];
+	setUInt32(corrupt, 20, UINT32_MAX);
+	STAssertNil([[[BDSKSpotlightCachePack alloc] initWithData:corrupt] autorelease], @"Check document info that does not fit in the data");
+}
+
+- (void)testOutOfRange{
+	NSMutableData *corrupt = [[packData() mutableCopy] autorelease];
+	BDSKSpotlightCachePack *pack;
+	
+	// point the record of the second item past the end of the data
+	setUInt32(corrupt, HEADER_LENGTH + ENTRY_LENGTH + 8, (uint32_t)[corrupt length]);
+	// point the cite key of the third item past the end of the data
+	setUInt32(corrupt, HEADER_LENGTH + 2 * ENTRY_LENGTH, UINT32_MAX);
+	pack = [[[BDSKSpotlightCachePack alloc] initWithData:corrupt] autorelease];
+	
+	STAssertNotNil(pack, @"Check that the header is still valid");
+	STAssertNil([pack citeKeyAtIndex:3], @"Check an index past the count");
+	STAssertNil([pack itemAtIndex:3], @"Check an item past the count");
+	STAssertNil([pack itemDataAtIndex:1], @"Check a record past the end of the data");
+	STAssertNil([pack itemAtIndex:1], @"Check an item past the end of the data");
+	STAssertNil([pack citeKeyAtIndex:2], @"Check a cite key past the end of the data");
+	STAssertNoThrow([pack indexOfCiteKey:@"smith2001"], @"Check a lookup with a corrupt index");
+	STAssertEqualObjects([pack citeKeyAtIndex:0], @"doe1999", @"Check that the valid entries can still be read");
+}
+
+@end
@@ -0,0 +1,152 @@
+//
+//  TestBDSKTextExtractionCache.m
+//  Bibdesk
+//
+//  Created by agent on 10/19/26.
+/*
+ This software is Copyright (c) 2026
+ agent. All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions
+ are met:
+
+ - Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+ - Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in
+    the documentation and/or other materials provided with the
+    distribution.
+
+ - Neither the name of the copyright holder nor the names of any
+    contributors may be used to endorse or promote products derived
+    from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "TestBDSKTextExtractionCache.h"
+#import "BDSKTextExtractionCache.h"
+#import "NSData_BDSKExtensions.h"
+#include <sys/stat.h>
+
+// cache entries are ordered by their modification date, which may only have a resolution of a second
+#define ENTRY_DATE_RESOLUTION 1.1
+
+#define CACHE_SIZE 2900
+
+
+@implementation TestBDSKTextExtractionCache
+
+- (void)setUp{
+	rootPath = [[NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]] retain];
+	[[NSFileManager defaultManager] createDirectoryAtPath:[rootPath stringByAppendingPathComponent:@"Files"] withIntermediateDirectories:YES attributes:nil error:NULL];
+}
+
+- (void)tearDown{
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+	[rootPath release];
+	rootPath = nil;
+}
+
+- (BDSKTextExtractionCache *)cacheWithMaximumSize:(unsigned long long)size{
+	return [[[BDSKTextExtractionCache alloc] initWithFolder:[rootPath stringByAppendingPathComponent:@"Cache"] maximumSize:size] autorelease];
+}
+
+- (NSURL *)writeText:(NSString *)text toFile:(NSString *)name{
+	NSString *path = [[rootPath stringByAppendingPathComponent:@"Files"] stringByAppendingPathComponent:name];
+	[text writeToFile:path atomically:NO encoding:NSUTF8StringEncoding error:NULL];
+	return [NSURL fileURLWithPath:path];
+}
+
+// changes the contents in place, keeping the inode, size and modification date, so only reading the file shows the change
+- (void)overwriteText:(NSString *)text atURL:(NSURL *)aURL{
+	struct stat sb;
+	const char *path = [[aURL path] fileSystemRepresentation];
+	stat(path, &sb);
+	NSFileHandle *fh = [NSFileHandle fileHandleForWritingAtPath:[aURL path]];
+	[fh writeData:[text dataUsingEncoding:NSUTF8StringEncoding]];
+	[fh closeFile];
+	struct timeval times[2];
+	TIMESPEC_TO_TIMEVAL(&times[0], &sb.st_atimespec);
+	TIMESPEC_TO_TIMEVAL(&times[1], &sb.st_mtimespec);
+	utimes(path, times);
+}
+
+- (void)testSignatureHit{
+	NSURL *url = [self writeText:@"original text" toFile:@"paper.txt"];
+	BDSKTextExtractionCache *cache = [self cacheWithMaximumSize:1024 * 1024];
+	NSData *signature = [cache signatureForFileURL:url];
+	
+	STAssertEqualObjects(signature, [NSData sha1SignatureForFile:[url path]], @"Check that the signature is the SHA-1 of the file");
+	STAssertEqualObjects([cache textForFileURL:url], @"original text", nil);
+	
+	[self overwriteText:@"modified text" atURL:url];
+	STAssertEqualObjects([cache signatureForFileURL:url], signature, @"Check that an unchanged device, inode, size and date are a signature hit without reading the file");
+	STAssertEqualObjects([cache textForFileURL:url], @"original text", @"Check that the text is found by the remembered signature");
+	
+	// a new cache instance, as after a relaunch, still finds the signature on disk
+	cache = [self cacheWithMaximumSize:1024 * 1024];
+	STAssertEqualObjects([cache signatureForFileURL:url], signature, @"Check that signatures are kept on disk");
+}
+
+- (void)testSignatureMiss{
+	NSURL *url = [self writeText:@"original text" toFile:@"paper.txt"];
+	BDSKTextExtractionCache *cache = [self cacheWithMaximumSize:1024 * 1024];
+	NSData *signature = [cache signatureForFileURL:url];
+	struct timeval times[2];
+	
+	[self overwriteText:@"modified text" atURL:url];
+	gettimeofday(&times[0], NULL);
+	times[1] = times[0];
+	times[1].tv_sec += 10;
+	utimes([[url path] fileSystemRepresentation], times);
+	
+	STAssertFalse([[cache signatureForFileURL:url] isEqual:signature], @"Check that a changed modification date is a signature miss");
+	STAssertEqualObjects([cache signatureForFileURL:url], [NSData sha1SignatureForFile:[url path]], nil);
+	STAssertEqualObjects([cache textForFileURL:url], @"modified text", @"Check that the text of the new version is extracted");
+	
+	url = [self writeText:@"longer modified text" toFile:@"paper.txt"];
+	STAssertEqualObjects([cache textForFileURL:url], @"longer modified text", @"Check that a changed size is a signature miss");
+}
+
+- (void)testEviction{
+	NSString *text = [@"" stringByPaddingToLength:1000 withString:@"0123456789" startingAtIndex:0];
+	// every file has an entry of about 1 kB for its text and a small one for its signature, so this has room for two files but not three, and eviction stops after removing one
+	BDSKTextExtractionCache *cache = [self cacheWithMaximumSize:CACHE_SIZE];
+	NSURL *oldURL = [self writeText:[@"old " stringByAppendingString:text] toFile:@"old.txt"];
+	NSURL *newURL = [self writeText:[@"new " stringByAppendingString:text] toFile:@"new.txt"];
+	
+	STAssertNotNil([cache textForFileURL:oldURL], nil);
+	[NSThread sleepForTimeInterval:ENTRY_DATE_RESOLUTION];
+	STAssertNotNil([cache textForFileURL:newURL], nil);
+	[NSThread sleepForTimeInterval:ENTRY_DATE_RESOLUTION];
+	STAssertNotNil([cache textForFileURL:[self writeText:[@"one " stringByAppendingString:text] toFile:@"one.txt"]], nil);
+	
+	unsigned long long size = 0;
+	NSString *cacheFolder = [rootPath stringByAppendingPathComponent:@"Cache"];
+	NSDirectoryEnumerator *dirEnum = [[NSFileManager defaultManager] enumeratorAtPath:cacheFolder];
+	while ([dirEnum nextObject]) {
+		if ([[[dirEnum fileAttributes] fileType] isEqualToString:NSFileTypeRegular])
+			size += [[dirEnum fileAttributes] fileSize];
+	}
+	STAssertTrue(size <= CACHE_SIZE, @"Check that the cache is kept below its maximum size");
+	
+	[self overwriteText:@"OLD " atURL:oldURL];
+	[self overwriteText:@"NEW " atURL:newURL];
+	STAssertTrue([[cache textForFileURL:oldURL] hasPrefix:@"OLD "], @"Check that the least recently used entry is evicted");
+	STAssertTrue([[cache textForFileURL:newURL] hasPrefix:@"new "], @"Check that a more recently used entry is kept");
+}
+
+@end
@@ -37,6 +37,7 @@
 
 #import "TestBDSKTypeManager.h"
 #import "BDSKTypeManager.h"
+#import "BDSKFieldDictionary.h"
 
 
 @implementation TestBDSKTypeManager
@@ -47,4 +48,47 @@
 	STAssertTrue([tid count]>0 ,@"Check that we are able to load (and parse) TypeInfo.plist");
 }
 
+- (void)testFieldIDs{
+	NSString *name = [NSMutableString stringWithString:@"Title"];
+	NSUInteger fieldID = [BDSKTypeManager fieldIDForFieldName:@"Title"];
+	
+	STAssertTrue(fieldID==[BDSKTypeManager fieldIDForFieldName:name] ,@"Check that equal field names get the same ID");
+	STAssertFalse(fieldID==[BDSKTypeManager fieldIDForFieldName:@"Journal"] ,@"Check that different field names get different IDs");
+	STAssertEqualObjects([BDSKTypeManager fieldNameForFieldID:fieldID], @"Title", @"Check the field name for an ID");
+	STAssertTrue([BDSKTypeManager internedFieldName:name]==[BDSKTypeManager internedFieldName:@"Title"] ,@"Check that interned field names are identical");
+}
+
+- (void)testLookupDoesNotAddFieldNames{
+	NSString *name = [NSString stringWithFormat:@"Unseen-%@", [[NSProcessInfo processInfo] globallyUniqueString]];
+	BDSKFieldDictionary *dict = [[[BDSKFieldDictionary alloc] init] autorelease];
+	
+	STAssertNil([dict objectForKey:name], @"Check the value for an unknown field");
+	[dict removeObjectForKey:name];
+	STAssertTrue([BDSKTypeManager existingFieldIDForFieldName:name]==NSNotFound ,@"Check that looking up a field does not add it");
+	[dict setObject:@"value" forKey:name];
+	STAssertTrue([BDSKTypeManager existingFieldIDForFieldName:name]==[BDSKTypeManager fieldIDForFieldName:name] ,@"Check that setting a field adds it");
+}
+
+- (void)testManyFieldIDs{
+	NSMutableArray *names = [NSMutableArray array];
+	NSUInteger i;
+	for (i = 0; i < 1000; i++)
+		[names addObject:[NSString stringWithFormat:@"Field-%lu", (unsigned long)i]];
+	for (NSString *name in names)
+		STAssertEqualObjects([BDSKTypeManager fieldNameForFieldID:[BDSKTypeManager fieldIDForFieldName:name]], name, @"Check the field name for an ID after the tables grow");
+}
+
+- (void)testFieldDictionary{
+	NSDictionary *fields = [NSDictionary dictionaryWithObjectsAndKeys:@"A Title", @"Title", @"1996", @"Year", @"Lee, Peter", @"Author", nil];
+	BDSKFieldDictionary *dict = [[[BDSKFieldDictionary alloc] initWithDictionary:fields] autorelease];
+	
+	STAssertEqualObjects(dict, fields, @"Check that the field dictionary has the same contents");
+	[dict setObject:@"PLDI" forKey:@"Booktitle"];
+	[dict setObject:@"1997" forKey:@"Year"];
+	[dict removeObjectForKey:@"Title"];
+	STAssertTrue([dict count]==3 ,@"Check the count after setting and removing fields");
+	STAssertEqualObjects([dict objectForKey:@"Year"], @"1997", @"Check a replaced field value");
+	STAssertNil([dict objectForKey:@"Title"], @"Check a removed field value");
+}
+
 @end
@@ -43,11 +43,55 @@
 #import "BDSKTypeManager.h"
 #import "BDSKStringParser.h"
 #import "NSString_BDSKExtensions.h"
+#import "BDSKOwnerProtocol.h"
+#import "NSError_BDSKExtensions.h"
 
 #define oneItem @"@inproceedings{Lee96RTOptML,\nYear = {1996},\nUrl = {http://citeseer.nj.nec.com/70627.html},\nTitle = {Optimizing ML with Run-Time Code Generation},\nBooktitle = {PLDI},\nAuthor = {Peter Lee and Mark Leone}}"
 #define twoItems @"@inproceedings{Lee96RTOptML,\nYear = {1996},\nUrl = {http://citeseer.nj.nec.com/70627.html},\nTitle = {Optimizing ML with Run-Time Code Generation},\nBooktitle = {PLDI},\nAuthor = {Peter Lee and Mark Leone}}\n\n@inproceedings{yang01LoopTransformPowerImpact,\nYear = {2001},\nTitle = {Power and Energy Impact by Loop Transformations},\nBooktitle = {COLP '01},\nAuthor = {Hongbo Yang and Guang R. Gao and Andres Marquez and George Cai and Ziang Hu}}"
 
 
+// stands in for the document, so publications have an undo manager
+@interface TestBibItemOwner : NSObject <BDSKOwner> {
+    NSUndoManager *undoManager;
+}
+@end
+
+@implementation TestBibItemOwner
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        undoManager = [[NSUndoManager alloc] init];
+        [undoManager setGroupsByEvent:NO];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [undoManager release];
+    [super dealloc];
+}
+
+- (BOOL)isDocument { return NO; }
+- (BDSKPublicationsArray *)publications { return nil; }
+- (BDSKMacroResolver *)macroResolver { return nil; }
+- (NSUndoManager *)undoManager { return undoManager; }
+- (NSURL *)fileURL { return nil; }
+- (NSString *)documentInfoForKey:(NSString *)key { return nil; }
+- (BDSKItemSearchIndexes *)searchIndexes { return nil; }
+
+@end
+
+static BibItem *migrationItem(id<BDSKOwner> owner, NSString *title, NSString *localURLString, NSString *urlString) {
+	NSMutableDictionary *pubFields = [NSMutableDictionary dictionaryWithObjectsAndKeys:title, BDSKTitleString, nil];
+	[pubFields setValue:localURLString forKey:BDSKLocalUrlString];
+	[pubFields setValue:urlString forKey:BDSKUrlString];
+	BibItem *pub = [[[BibItem alloc] initWithType:BDSKArticleString citeKey:nil pubFields:pubFields isNew:YES] autorelease];
+	[pub setOwner:owner];
+	return pub;
+}
+
+
 @implementation TestBibItem
 - (void)setUp {
     // create the object(s) that we want to test
@@ -69,6 +113,18 @@
     STAssertTrue(1==[b numberOfAuthors],@"Check that Less, von More, Jr. parses to single author");
 }
 
+- (void)testLazyPeopleWithBracedAnd{
+	NSDictionary *pubFields = [NSDictionary dictionaryWithObjectsAndKeys:@"Hello", BDSKTitleString,
+							   @"{Someone and Someone Else, Inc} AND Last, First and First von Last", BDSKAuthorString, nil];
+	BibItem *b = [[[BibItem alloc] initWithType:BDSKArticleString citeKey:nil pubFields:pubFields isNew:YES] autorelease];
+	
+	STAssertTrue(3==[b numberOfPeopleForField:BDSKAuthorString inherit:NO],@"Check that the names are counted without creating authors");
+	STAssertTrue(3==[[b pubAuthors] count],@"Check that braced and is not a separator");
+	STAssertEqualObjects([[b authorAtIndex:1] lastName], @"Last", @"last name of second author");
+	STAssertEqualObjects([[b authorAtIndex:2] vonPart], @"von", @"von part of third author");
+	STAssertNil([BDSKBibTeXParser nameRangesFromBibtexString:@"{Unbalanced and Name"], @"Check that unbalanced braces are an error");
+}
+
 - (void)testComplexAuthorNameNormalisation{
 	// Check for parsing of two variants
 	// "First von Last" "von Last, First"
@@ -156,6 +212,77 @@
 //				   @"File orders of two records should differ by 1");
 }
 
+- (void)testMigrateFilesUndoesInSingleGroup{
+	NSString *rootPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	NSString *path = [rootPath stringByAppendingPathComponent:@"paper.pdf"];
+	[[NSFileManager defaultManager] createDirectoryAtPath:rootPath withIntermediateDirectories:YES attributes:nil error:NULL];
+	[[NSData data] writeToFile:path atomically:NO];
+	
+	TestBibItemOwner *owner = [[[TestBibItemOwner alloc] init] autorelease];
+	BibItem *pub1 = migrationItem(owner, @"First", path, @"http://example.com/first");
+	BibItem *pub2 = migrationItem(owner, @"Second", nil, @"http://example.com/second");
+	NSInteger numberOfAddedFiles = 0, numberOfRemovedFields = 0;
+	
+	STAssertTrue([BibItem migrateFilesForPublications:[NSArray arrayWithObjects:pub1, pub2, nil] withRemoveOptions:BDSKRemoveLocalFileFieldsMask | BDSKRemoveRemoteURLFieldsMask numberOfAddedFiles:&numberOfAddedFiles numberOfRemovedFields:&numberOfRemovedFields error:NULL], nil);
+	STAssertEquals(numberOfAddedFiles, (NSInteger)3, nil);
+	STAssertEquals(numberOfRemovedFields, (NSInteger)3, nil);
+	STAssertEquals([pub1 countOfFiles], (NSUInteger)2, nil);
+	STAssertNil([pub1 valueOfField:BDSKLocalUrlString inherit:NO], @"Check that the converted field is removed");
+	
+	STAssertTrue([[owner undoManager] canUndo], nil);
+	[[owner undoManager] undo];
+	STAssertFalse([[owner undoManager] canUndo], @"Check that the whole migration is a single undo group");
+	
+	STAssertEquals([pub1 countOfFiles], (NSUInteger)0, @"Check that the files are removed by undo");
+	STAssertEquals([pub2 countOfFiles], (NSUInteger)0, @"Check that the files are removed by undo");
+	STAssertEqualObjects([pub1 valueOfField:BDSKLocalUrlString inherit:NO], path, @"Check that the fields are restored by undo");
+	STAssertEqualObjects([pub1 valueOfField:BDSKUrlString inherit:NO], @"http://example.com/first", nil);
+	STAssertEqualObjects([pub2 valueOfField:BDSKUrlString inherit:NO], @"http://example.com/second", nil);
+	
+	[[NSFileManager defaultManager] removeItemAtPath:rootPath error:NULL];
+}
+
+- (void)testMigrateFilesDoesNotAddDuplicates{
+	TestBibItemOwner *owner = [[[TestBibItemOwner alloc] init] autorelease];
+	NSDictionary *pubFields = [NSDictionary dictionaryWithObjectsAndKeys:@"Title", BDSKTitleString, @"http://example.com/paper", BDSKUrlString, @"http://example.com/paper", @"Bdsk-Url-1", nil];
+	BibItem *pub = [[[BibItem alloc] initWithType:BDSKArticleString citeKey:nil pubFields:pubFields isNew:YES] autorelease];
+	NSInteger numberOfAddedFiles = 0;
+	
+	// the linked URL is created from the Bdsk-Url-1 field when the owner is set
+	[pub setOwner:owner];
+	STAssertEquals([pub countOfFiles], (NSUInteger)1, nil);
+	STAssertTrue([BibItem migrateFilesForPublications:[NSArray arrayWithObject:pub] withRemoveOptions:BDSKRemoveRemoteURLFieldsMask numberOfAddedFiles:&numberOfAddedFiles numberOfRemovedFields:NULL error:NULL], nil);
+	STAssertEquals(numberOfAddedFiles, (NSInteger)0, @"Check that an existing URL is not added again");
+	STAssertEquals([pub countOfFiles], (NSUInteger)1, nil);
+	STAssertNil([pub valueOfField:BDSKUrlString inherit:NO], @"Check that a field that was converted before is removed");
+	
+	pub = migrationItem(owner, @"Title", nil, @"http://example.com/paper");
+	STAssertTrue([BibItem migrateFilesForPublications:[NSArray arrayWithObject:pub] withRemoveOptions:0 numberOfAddedFiles:&numberOfAddedFiles numberOfRemovedFields:NULL error:NULL], nil);
+	STAssertEquals(numberOfAddedFiles, (NSInteger)1, nil);
+	STAssertTrue([BibItem migrateFilesForPublications:[NSArray arrayWithObject:pub] withRemoveOptions:0 numberOfAddedFiles:&numberOfAddedFiles numberOfRemovedFields:NULL error:NULL], nil);
+	STAssertEquals(numberOfAddedFiles, (NSInteger)0, @"Check that migrating twice does not add the URL twice");
+	STAssertEquals([pub countOfFiles], (NSUInteger)1, nil);
+}
+
+- (void)testMigrateFilesReportsFailuresForPublications{
+	TestBibItemOwner *owner = [[[TestBibItemOwner alloc] init] autorelease];
+	NSString *missingPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+	BibItem *good = migrationItem(owner, @"Good", nil, @"http://example.com/paper");
+	BibItem *missing = migrationItem(owner, @"Missing", missingPath, nil);
+	BibItem *invalid = migrationItem(owner, @"Invalid", @"file://not a valid url", nil);
+	NSInteger numberOfAddedFiles = 0;
+	NSError *error = nil;
+	
+	STAssertFalse([BibItem migrateFilesForPublications:[NSArray arrayWithObjects:missing, good, invalid, nil] withRemoveOptions:BDSKRemoveLocalFileFieldsMask numberOfAddedFiles:&numberOfAddedFiles numberOfRemovedFields:NULL error:&error], nil);
+	STAssertEquals(numberOfAddedFiles, (NSInteger)1, @"Check that the other publications are still migrated");
+	STAssertTrue([error isLocalErrorWithCode:kBDSKFileNotFound], nil);
+	
+	NSArray *messages = [error valueForKey:@"messages"];
+	STAssertEquals([messages count], (NSUInteger)2, nil);
+	STAssertEqualObjects([messages valueForKey:@"publication"], ([NSArray arrayWithObjects:missing, invalid, nil]), @"Check that every message has its publication, in order");
+	STAssertEqualObjects([missing valueOfField:BDSKLocalUrlString inherit:NO], missingPath, @"Check that a field that was not converted is kept");
+}
+
 - (void)testMakeTypeBibTeX{
     BOOL isPartialData = NO;
 	NSError *parseError = nil;
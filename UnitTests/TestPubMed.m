@@ -40,10 +40,12 @@
 #import "BDSKBibTeXParser.h"
 #import "BDSKStringConstants.h"
 #import "BDSKPubMedParser.h"
+#import "BDSKPubMedXMLParser.h"
 #import "BibItem_PubMedLookup.h"
 
 #define watsonCrick @"PMID- 13054692\nOWN - NLM\nSTAT- MEDLINE\nDA  - 19531201\nDCOM- 20030501\nLR  - 20061115\nIS  - 0028-0836 (Print)\nVI  - 171\nIP  - 4356\nDP  - 1953 Apr 25\nTI  - Molecular structure of nucleic acids; a structure for deoxyribose nucleic acid.\nPG  - 737-8\nFAU - WATSON, J D\nAU  - WATSON JD\nFAU - CRICK, F H\nAU  - CRICK FH\nLA  - eng\nPT  - Journal Article\nPL  - Not Available\nTA  - Nature\nJT  - Nature\nJID - 0410462\nRN  - 0 (Nucleic Acids)\nSB  - OM\nMH  - *Nucleic Acids\nOID - CLML: 5324:25254:447\nOTO - NLM\nOT  - *NUCLEIC ACIDS\nEDAT- 1953/04/25\nMHDA- 1953/04/25 00:01\nCRDT- 1953/04/25 00:00\nPST - ppublish\nSO  - Nature. 1953 Apr 25;171(4356):737-8.\n"
 #define jefferisetal @"PMID- 17382886\nOWN - NLM\nSTAT- MEDLINE\nDA  - 20070326\nDCOM- 20070508\nLR  - 20081120\nIS  - 0092-8674 (Print)\nVI  - 128\nIP  - 6\nDP  - 2007 Mar 23\nTI  - Comprehensive maps of Drosophila higher olfactory centers: spatially segregated\n      fruit and pheromone representation.\nPG  - 1187-203\nAB  - In Drosophila, approximately 50 classes of olfactory receptor neurons (ORNs) send\n      axons to 50 corresponding glomeruli in the antennal lobe. Uniglomerular\n      projection neurons (PNs) relay olfactory information to the mushroom body (MB)\n      and lateral horn (LH). Here, we combine single-cell labeling and image\n      registration to create high-resolution, quantitative maps of the MB and LH for 35\n      input PN channels and several groups of LH neurons. We find (1) PN inputs to the \n      MB are stereotyped as previously shown for the LH; (2) PN partners of ORNs from\n      different sensillar groups are clustered in the LH; (3) fruit odors are\n      represented mostly in the posterior-dorsal LH, whereas candidate\n      pheromone-responsive PNs project to the anterior-ventral LH; (4) dendrites of\n      single LH neurons each overlap with specific subsets of PN axons. Our results\n      suggest that the LH is organized according to biological values of olfactory\n      input.\nAD  - Department of Biological Sciences, Stanford University, Stanford, CA 94305, USA. \n      gsxej2@cam.ac.uk\nFAU - Jefferis, Gregory S X E\nAU  - Jefferis GS\nFAU - Potter, Christopher J\nAU  - Potter CJ\nFAU - Chan, Alexander M\nAU  - Chan AM\nFAU - Marin, Elizabeth C\nAU  - Marin EC\nFAU - Rohlfing, Torsten\nAU  - Rohlfing T\nFAU - Maurer, Calvin R Jr\nAU  - Maurer CR Jr\nFAU - Luo, Liqun\nAU  - Luo L\nLA  - eng\nGR  - AA05965/AA/NIAAA NIH HHS/United States\nGR  - AA13521/AA/NIAAA NIH HHS/United States\nGR  - R01-DC005982/DC/NIDCD NIH HHS/United States\nPT  - Journal Article\nPT  - Research Support, N.I.H., Extramural\nPT  - Research Support, Non-U.S. Gov't\nPL  - United States\nTA  - Cell\nJT  - Cell\nJID - 0413066\nRN  - 0 (Pheromones)\nSB  - IM\nMH  - Animals\nMH  - Brain/anatomy & histology/physiology\nMH  - Brain Mapping\nMH  - Drosophila/*anatomy & histology/*physiology\nMH  - Female\nMH  - Fruit\nMH  - Male\nMH  - Mushroom Bodies/*physiology\nMH  - Odors\nMH  - Olfactory Pathways/physiology\nMH  - Olfactory Receptor Neurons/*physiology\nMH  - Pheromones\nMH  - Presynaptic Terminals/physiology\nMH  - Sex Characteristics\nMH  - Smell/physiology\nMH  - Synapses/physiology\nPMC - PMC1885945\nOID - NLM: PMC1885945\nEDAT- 2007/03/27 09:00\nMHDA- 2007/05/09 09:00\nCRDT- 2007/03/27 09:00\nPHST- 2006/08/21 [received]\nPHST- 2006/11/10 [revised]\nPHST- 2007/01/17 [accepted]\nAID - S0092-8674(07)00204-8 [pii]\nAID - 10.1016/j.cell.2007.01.040 [doi]\nPST - ppublish\nSO  - Cell. 2007 Mar 23;128(6):1187-203.\n"
+#define watsonCrickXMLArticle @"<PubmedArticle><MedlineCitation Owner=\"NLM\" Status=\"MEDLINE\"><PMID>13054692</PMID><Article PubModel=\"Print\"><Journal><JournalIssue CitedMedium=\"Print\"><Volume>171</Volume><Issue>4356</Issue><PubDate><Year>1953</Year><Month>Apr</Month></PubDate></JournalIssue><Title>Nature</Title></Journal><ArticleTitle>Molecular structure of nucleic acids; a structure for <i>deoxyribose</i> nucleic acid.</ArticleTitle><Pagination><MedlinePgn>737-8</MedlinePgn></Pagination><AuthorList CompleteYN=\"Y\"><Author ValidYN=\"Y\"><LastName>WATSON</LastName><ForeName>J D</ForeName></Author><Author ValidYN=\"Y\"><LastName>CRICK</LastName><ForeName>F H</ForeName></Author></AuthorList></Article><MedlineJournalInfo><MedlineTA>Nature</MedlineTA></MedlineJournalInfo><CommentsCorrectionsList><CommentsCorrections RefType=\"CommentIn\"><PMID>12345</PMID></CommentsCorrections></CommentsCorrectionsList></MedlineCitation><PubmedData><PublicationStatus>ppublish</PublicationStatus><ArticleIdList><ArticleId IdType=\"pubmed\">13054692</ArticleId><ArticleId IdType=\"doi\">10.1038/171737a0</ArticleId></ArticleIdList></PubmedData></PubmedArticle>"
 #define semCell @"PMID- 16439169\nOWN - NLM\nSTAT- MEDLINE\nDA  - 20060426\nDCOM- 20060810\nLR  - 20061115\nIS  - 1084-9521 (Print)\nVI  - 17\nIP  - 1\nDP  - 2006 Feb\nTI  - Wiring specificity in the olfactory system.\nPG  - 50-65\nAB  - The fruitfly brain learns about the olfactory world by reading the activity of\n      about 50 distinct channels of incoming information. The receptor neurons that\n      compose each channel have their own distinctive odour response profile governed\n      by a specific receptor molecule. These receptor neurons form highly specific\n      connections in the first olfactory relay of the fly brain, each synapsing with\n      specific second order partner neurons. We use this system to discuss the logic of\n      wiring specificity in the brain and to review the cellular and molecular\n      mechanisms that allow such precise wiring to develop.\nAD  - Department of Zoology, University of Cambridge, Downing Street, Cambridge CB2\n      3EJ, United Kingdom. gsxej2@cam.ac.uk\nFAU - Jefferis, Gregory S X E\nAU  - Jefferis GS\nFAU - Hummel, Thomas\nAU  - Hummel T\nLA  - eng\nPT  - Journal Article\nPT  - Research Support, Non-U.S. Gov't\nPT  - Review\nDEP - 20060124\nPL  - England\nTA  - Semin Cell Dev Biol\nJT  - Seminars in cell & developmental biology\nJID - 9607332\nRN  - 0 (Receptors, Odorant)\nSB  - IM\nMH  - Animals\nMH  - *Drosophila melanogaster/anatomy & histology/physiology\nMH  - Nerve Net\nMH  - *Neurons/cytology/physiology\nMH  - *Olfactory Pathways/anatomy & histology/physiology\nMH  - Olfactory Receptor Neurons/cytology/physiology\nMH  - Receptors, Odorant/metabolism\nMH  - Synapses/metabolism/ultrastructure\nRF  - 80\nEDAT- 2006/01/28 09:00\nMHDA- 2006/08/11 09:00\nCRDT- 2006/01/28 09:00\nPHST- 2006/01/24 [aheadofprint]\nAID - S1084-9521(05)00125-4 [pii]\nAID - 10.1016/j.semcdb.2005.12.002 [doi]\nPST - ppublish\nSO  - Semin Cell Dev Biol. 2006 Feb;17(1):50-65. Epub 2006 Jan 24.\n"
 
 // For Elsevier PIIs
@@ -260,6 +262,44 @@
 	STAssertNil([@"" stringByExtractingNormalisedPIIFromString],nil);	
 }
 
+- (void)testPubMedXMLParsing{
+	NSString *xmlString = [NSString stringWithFormat:@"<?xml version=\"1.0\"?>\n<!DOCTYPE PubmedArticleSet PUBLIC \"-//NLM//DTD PubMedArticle, 1st January 2011//EN\" \"http://www.ncbi.nlm.nih.gov/entrez/query/DTD/pubmed_110101.dtd\">\n<PubmedArticleSet>%@%@</PubmedArticleSet>", watsonCrickXMLArticle, watsonCrickXMLArticle];
+	NSArray *items = [BDSKPubMedXMLParser itemsFromString:xmlString error:NULL];
+	STAssertTrue(2 == [items count], @"There are 2 articles");
+	
+	BibItem *b = [items lastObject];
+	STAssertEqualObjects([b pubType], @"article", @"");
+	STAssertTrue(2 == [[b pubAuthors] count], @"There are 2 authors");
+	STAssertEqualObjects([[b lastAuthor] valueForKey:@"lastName"], @"CRICK", @"Crick's last name");
+	STAssertEqualObjects([b valueOfField:BDSKTitleString], @"Molecular structure of nucleic acids; a structure for deoxyribose nucleic acid", @"Check that nested markup and the trailing period are handled");
+	STAssertEqualObjects([b valueOfField:@"Pmid"], @"13054692", @"Check that the PMID of a comment is ignored");
+	STAssertEqualObjects([b valueOfField:BDSKDoiString], @"10.1038/171737a0", @"for DOI field");
+	STAssertEqualObjects([b valueOfField:@"Year"], @"1953", @"for Year field");
+	STAssertEqualObjects([b valueOfField:@"Pst"], @"ppublish", @"for Pst field");
+	
+	STAssertNil([BDSKPubMedXMLParser itemsFromString:@"<PubmedArticleSet><PubmedArticle>" error:NULL], @"Check that invalid XML fails");
+}
+
+- (void)testPubMedXMLPartialParsing{
+	NSString *xmlString = [NSString stringWithFormat:@"<?xml version=\"1.0\"?>\n<PubmedArticleSet>%@%@</PubmedArticleSet>", watsonCrickXMLArticle, watsonCrickXMLArticle];
+	NSData *data = [xmlString dataUsingEncoding:NSUTF8StringEncoding];
+	// cut the data in the middle of the second article, as if it is still downloading
+	NSData *partialData = [data subdataWithRange:NSMakeRange(0, [data length] - 100)];
+	NSUInteger location = 0;
+	
+	NSArray *items = [BDSKPubMedXMLParser itemsFromPartialData:partialData location:&location error:NULL];
+	STAssertTrue(1 == [items count], @"Check that only the complete article is parsed");
+	STAssertTrue(location > 0 && location < [partialData length], @"Check that the location is moved past the first article");
+	
+	NSUInteger previousLocation = location;
+	items = [BDSKPubMedXMLParser itemsFromPartialData:partialData location:&location error:NULL];
+	STAssertTrue(0 == [items count] && location == previousLocation, @"Check that an incomplete article is not parsed");
+	
+	items = [BDSKPubMedXMLParser itemsFromPartialData:data location:&location error:NULL];
+	STAssertTrue(1 == [items count], @"Check that the rest is parsed when the data is complete");
+	STAssertEqualObjects([[items lastObject] valueOfField:@"Pmid"], @"13054692", @"for Pmid field");
+}
+
 - (void)testStringByMakingPubmedSearchFromAnyBibliographicIDsInString{
 	// Check DOI identifiers
 	STAssertEqualObjects([textFromBenton2009 stringByMakingPubmedSearchFromAnyBibliographicIDsInString],